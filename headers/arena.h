@@ -0,0 +1,48 @@
+#ifndef ARENA_H
+    #define ARENA_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <stddef.h>
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    /* Allocations are aligned for any vector type used here. */
+    #define ARENA_ALIGNMENT 16
+
+    typedef struct Arena_Chunk Arena_Chunk;
+    struct Arena_Chunk {
+        Arena_Chunk * next;            //the chunk filled before this one
+        size_t        size;
+        size_t        used;
+    };
+
+    /* Bump allocator. Memory comes out of the newest chunk until it runs
+     * out, then a new chunk at least chunk_size large (larger for a large
+     * request) is put in front. Nothing is freed on its own, the whole
+     * arena is reset or freed at once.
+     *
+     * Not thread safe. An arena belongs to one thread at a time.
+     */
+    struct Arena {
+        Arena_Chunk * chunks;
+        size_t        chunk_size;
+        size_t        allocated;       //bytes handed out
+        size_t        reserved;        //bytes in chunks
+    };
+    typedef struct Arena Arena;
+
+
+    void arena_init(Arena * arena, size_t chunk_size);
+    /* NULL when out of memory. */
+    void * arena_alloc(Arena * arena, size_t size);
+    void * arena_calloc(Arena * arena, size_t count, size_t size);
+    char * arena_strdup(Arena * arena, const char * string);
+    /* Keeps the newest chunk for reuse and frees the rest. */
+    void arena_reset(Arena * arena);
+    void arena_free(Arena * arena);
+#endif
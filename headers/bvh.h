@@ -0,0 +1,90 @@
+#ifndef BVH_H
+    #define BVH_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <linmath.h>
+    #include <cull.h>
+
+
+    typedef enum {
+        BVH_SUCCESS =  0,
+        BVH_NO_MEM  = -1,
+    } bvh_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    /* Leaves are not split below this many items unless the surface area
+     * heuristic says splitting pays, and never split past BVH_MAX_DEPTH,
+     * which also bounds the traversal stacks.
+     */
+    #define BVH_LEAF_SIZE 4
+    #define BVH_MAX_DEPTH 48
+    #define BVH_BINS      12
+
+    struct Bvh_Box {
+        vec3 min;
+        vec3 max;
+    };
+    typedef struct Bvh_Box Bvh_Box;
+
+    /* Every node covers a contiguous run of items, first to first + count,
+     * so a subtree found wholly inside a query is taken as it is. Children
+     * are allocated in pairs after their parent, left at index left and
+     * right at left + 1, and leaves have left 0.
+     */
+    struct Bvh_Node {
+        vec3         min;
+        vec3         max;
+        unsigned int left;
+        unsigned int first;
+        unsigned int count;
+    };
+    typedef struct Bvh_Node Bvh_Node;
+
+    struct Bvh {
+        Bvh_Node *     nodes;
+        unsigned int   num_nodes;
+        unsigned int * items;          //caller's box indices, in leaf order
+        Bvh_Box *      item_boxes;     //their boxes, in the same order
+        unsigned int   num_items;
+    };
+    typedef struct Bvh Bvh;
+
+    /* Tests an item against a ray, in whatever detail the caller keeps.
+     * On a hit closer than *t it stores the distance in *t and returns 1.
+     */
+    typedef int (*bvh_ray_test)(void * user, unsigned int item,
+                                const vec3 origin, const vec3 direction,
+                                float * t);
+
+
+    /* Binned SAH build over count boxes. The tree keeps its own copy of
+     * the boxes, bvh_refit takes the caller's array, updated, again.
+     */
+    bvh_error_t bvh_build(Bvh * bvh, const Bvh_Box * boxes,
+                          unsigned int count);
+    void bvh_free(Bvh * bvh);
+    /* Recomputes node bounds bottom up after items moved. The topology is
+     * kept, so queries stay correct but slow down as it drifts from what
+     * a rebuild would give.
+     */
+    void bvh_refit(Bvh * bvh, const Bvh_Box * boxes);
+    /* Queries write the indices of matching items to out, which can be
+     * NULL, and return how many there were. out needs room for every item.
+     */
+    unsigned int bvh_query_frustum(const Bvh * bvh, const Frustum * frustum,
+                                   unsigned int * out);
+    unsigned int bvh_query_sphere(const Bvh * bvh, const vec3 center,
+                                  float radius, unsigned int * out);
+    /* Closest item along the ray within *t, or -1. Nodes are visited near
+     * to far and skipped once a closer hit is known. Without a test the
+     * items' boxes are what is hit.
+     */
+    int bvh_raycast(const Bvh * bvh, const vec3 origin, const vec3 direction,
+                    float * t, bvh_ray_test test, void * user);
+#endif
@@ -9,6 +9,7 @@
     #include <stdbool.h>
     #include <linmath.h>
     #include <shader.h>
+    #include <cull.h>
 
 
     #define toRadians(x) (M_PI*x/180)
@@ -50,14 +51,35 @@
                                                          __LINE__))
 
 
+    // Keys processKeyboard reacts to, as bits of a key state
+    #define CAM_KEY_FORWARD  0x01
+    #define CAM_KEY_BACKWARD 0x02
+    #define CAM_KEY_LEFT     0x04
+    #define CAM_KEY_RIGHT    0x08
+    #define CAM_KEY_UP       0x10
+    #define CAM_KEY_DOWN     0x20
+    #define CAM_KEY_ESCAPE   0x40
+
     // Default camera values
     const static float YAW              = -90.0f;
     const static float PITCH            =  0.0f;
     const static float SPEED            =  2.5f;
     const static float SENSITIVITY      =  0.1f;
     const static float ZOOM             =  45.0f;
-    // Module local variables
-    static struct Camera * _active_cam  = NULL;
+
+
+    /* Everything derived from a camera's position, orientation and lens,
+     * laid out as a std140 uniform block of the same members so it can be
+     * uploaded in one go.
+     */
+    struct CameraMatrices {
+        mat4x4 view;
+        mat4x4 projection;
+        mat4x4 viewProjection;
+        mat4x4 inverseView;
+        mat4x4 inverseViewProjection;
+        vec4 position;          // w is 1
+    };
 
 
     struct Camera {
@@ -70,8 +92,9 @@
         float lastUpdateTime;
         float lastMouseX;
         float lastMouseY;
-        // first mouse call flag
+        // first mouse and keyboard call flags
         bool firstMouse;
+        bool firstKeyboard;
         // euler Angles
         float yaw;
         float pitch;
@@ -80,8 +103,18 @@
         float mouseSensitivity;
         float zoom;
         float aspect;
+        // x, y, width and height within the window, in pixels
+        int viewport[4];
         float nearClipPlane;
         float farClipPlane;
+        // derived data, rebuilt by updateCameraMatrices only once the
+        // inputs it was built from have changed
+        struct CameraMatrices matrices;
+        Frustum frustum;        // world space, from viewProjection
+        unsigned int matricesVersion;
+        float viewInputs[9];
+        float projectionInputs[4];
+        bool matricesValid;
         // Funcs
         void (*setViewMatrix)(struct Camera * self,
                               struct Shader * shaders,
@@ -102,8 +135,22 @@
 
 
     // Module export functions
+    /* Input is routed through the GLFW window user pointer: the
+     * glfwCompat* callbacks move the camera attached to the window they
+     * are called for, or the active camera if it has none. Any number of
+     * other cameras can be driven directly, for split screen viewports or
+     * off-screen views. Detach a camera, by attaching NULL, before
+     * freeing it.
+     */
     void setActiveCamera(struct Camera * cam);
+    void attachCamera(GLFWwindow * window, struct Camera * cam);
+    struct Camera * windowCamera(GLFWwindow * window);
     void glfwCompatKeyboardCallback(GLFWwindow * window);
+    /* As glfwCompatKeyboardCallback, with the key state and time given
+     * rather than read, eg. when replaying recorded input.
+     */
+    void glfwCompatKeyState(GLFWwindow * window, unsigned int keys,
+                            double time);
     void glfwCompatMouseMovementCallback(GLFWwindow * window, double xPos,
                                          double yPos);
     void glfwCompatMouseScrollCallback(GLFWwindow * window, double xPos,
@@ -113,14 +160,32 @@
                                     float z);
     void setActiveCameraPosition(float x, float y, float z);
     struct Camera * cameraInit(int width, int height);
+    // Also sets the aspect ratio to match.
+    void setCameraViewport(struct Camera * cam, int x, int y, int width,
+                           int height);
+    void useCameraViewport(struct Camera * cam);
 
     // Camera struct functions
+    /* Returns whether anything changed, bumping matricesVersion if so.
+     * The getters below call it themselves, so it is only needed to
+     * find out whether a cached upload is stale.
+     */
+    bool updateCameraMatrices(struct Camera * self);
+    const struct CameraMatrices * getCameraMatrices(struct Camera * self);
+    const Frustum * getCameraFrustum(struct Camera * self);
+    void getViewMatrix(struct Camera * self, mat4x4 view);
+    void getProjectionMatrix(struct Camera * self, mat4x4 projection);
+    void getPickRay(struct Camera * self, double x, double y, int width,
+                    int height, vec3 origin, vec3 direction);
     void setViewMatrix(struct Camera * self, struct Shader * shaders,
                        const char * handle);
     void setProjectionMatrix(struct Camera * self,
                              struct Shader * shaders,
                              const char * handle);
     void processKeyboard(struct Camera * self, GLFWwindow * window);
+    unsigned int getCameraKeys(GLFWwindow * window);
+    void applyCameraKeys(struct Camera * self, GLFWwindow * window,
+                         unsigned int keys, double time);
     void processMouseMovement(struct Camera * self, GLFWwindow * window,
                               double xoffset, double yoffset);
     void processMouseScroll(struct Camera * self, GLFWwindow * window,
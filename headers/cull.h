@@ -0,0 +1,49 @@
+#ifndef CULL_H
+    #define CULL_H
+
+    #include <linmath.h>
+
+
+    /* Planes are left, right, bottom, top, near, far, with normals
+     * pointing inwards: a point p is inside plane i when
+     * dot(planes[i].xyz, p) + planes[i].w >= 0.
+     */
+    struct Frustum {
+        vec4  planes[6];
+        /* The same planes by component, padded with two that pass
+         * everything, for testing four planes at a time.
+         */
+        float plane_x[8];
+        float plane_y[8];
+        float plane_z[8];
+        float plane_w[8];
+    };
+    typedef struct Frustum Frustum;
+
+    typedef enum {
+        FRUSTUM_OUTSIDE    = 0,
+        FRUSTUM_INTERSECTS = 1,
+        FRUSTUM_INSIDE     = 2,
+    } frustum_overlap_t;
+
+    /* Gribb and Hartmann. For clip = projection * view * model the planes
+     * come out in model space, so bounds stored in model space can be
+     * tested without transforming them.
+     */
+    void frustum_from_matrix(Frustum * frustum, mat4x4 clip);
+    int frustum_test_sphere(const Frustum * frustum, const vec3 center,
+                            float radius);
+    int frustum_test_aabb(const Frustum * frustum, const vec3 min,
+                          const vec3 max);
+    /* As frustum_test_aabb, but also tells boxes wholly inside apart, so
+     * hierarchies can accept a whole subtree without testing it.
+     */
+    frustum_overlap_t frustum_classify_aabb(const Frustum * frustum,
+                                            const vec3 min, const vec3 max);
+    /* Tests one box against up to 32 views at once, eg. every camera in a
+     * split screen, returning a mask with bit i set when frusta[i] sees it.
+     */
+    unsigned int frustum_visible_views(const Frustum * const * frusta,
+                                       int count, const vec3 min,
+                                       const vec3 max);
+#endif
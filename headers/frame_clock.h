@@ -0,0 +1,63 @@
+#ifndef FRAME_CLOCK_H
+    #define FRAME_CLOCK_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+
+
+    /* Frames longer than this are counted as this long, so a stall, eg. a
+     * window drag, doesn't leave a backlog of simulation steps to run.
+     */
+    #define FRAME_CLOCK_MAX_FRAME .25
+
+    /* Fixed step simulation clock. Each frame adds its length to an
+     * accumulator and the simulation runs whole steps out of it,
+     *
+     *     frame_clock_begin(&clock);
+     *     while (frame_clock_tick(&clock))
+     *         simulate(clock.step);
+     *     render(frame_clock_alpha(&clock));
+     *
+     * rendering between the last two simulated states by alpha, so
+     * animation runs at the same speed under any frame rate and, given
+     * the same frame times, comes out the same.
+     *
+     * Frame times come from the monotonic clock, from the caller through
+     * frame_clock_begin_at, or, in virtual mode, advance by a fixed
+     * amount per frame for benchmarks that should not depend on how fast
+     * they run.
+     */
+    struct Frame_Clock {
+        double             step;           //simulated seconds per tick
+        double             virtual_frame;  //0 for real time
+        double             min_frame;      //limiter, 0 for none
+        double             now;            //time of the current frame
+        double             frame_time;     //of the current frame, clamped
+        double             accumulator;
+        double             simulation_time;
+        double             last_wall;      //when the last frame began
+        unsigned long long frames;
+        unsigned long long ticks;
+        int                started;
+    };
+    typedef struct Frame_Clock Frame_Clock;
+
+
+    void frame_clock_init(Frame_Clock * clock, double step);
+    /* Caps the frame rate by sleeping in frame_clock_begin. 0 lifts it. */
+    void frame_clock_set_limit(Frame_Clock * clock, double frames_per_second);
+    /* Every frame then lasts frame_seconds, 0 returns to real time. */
+    void frame_clock_set_virtual(Frame_Clock * clock, double frame_seconds);
+    /* Starts a frame and returns its length. */
+    double frame_clock_begin(Frame_Clock * clock);
+    /* As frame_clock_begin, with the time given by another clock, eg. a
+     * replayed recording. Still subject to the limiter.
+     */
+    double frame_clock_begin_at(Frame_Clock * clock, double now);
+    /* Consumes one step, returning 0 once less than a step is left. */
+    int frame_clock_tick(Frame_Clock * clock);
+    /* How far, from 0 to 1, the frame lies between the last tick and the
+     * next.
+     */
+    float frame_clock_alpha(const Frame_Clock * clock);
+#endif
@@ -0,0 +1,52 @@
+#ifndef HIZ_H
+    #define HIZ_H
+
+    #include <stdio.h>
+    #include <glad/glad.h>
+    #include <linmath.h>
+    #include <shader.h>
+    #include <memstat.h>
+
+    typedef enum {
+        HIZ_SUCCESS =  0,
+        HIZ_GL_ERR  = -1,
+    } hiz_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    /* local_size_x and _y of hiz_reduce.comp */
+    #define HIZ_GROUP_SIZE 8
+
+    /* Depth pyramid for occlusion culling on the GPU. Level 0 is a copy of
+     * a framebuffer's depth, every level above keeps the furthest depth of
+     * the texels it covers. view_projection is the view that depth was
+     * drawn from, culling projects bounds with it.
+     */
+    struct Hiz {
+        unsigned int texture;          //GL_R32F, full mip chain
+        unsigned int depth_texture;    //framebuffer depth is copied here
+        unsigned int FBO;
+        int          width;
+        int          height;
+        int          levels;
+        int          valid;            //0 until the first build
+        mat4x4       view_projection;
+        Shader *     reduce_shader;    //hiz_reduce.comp
+        Memstat_Asset memory;
+    };
+    typedef struct Hiz Hiz;
+
+    /* width and height must match the framebuffers later built from. */
+    hiz_error_t hiz_init(Hiz * hiz, int width, int height,
+                         Shader * reduce_shader);
+    /* Copies framebuffer's depth, 0 for the default one, and reduces it.
+     * Multisampled depth is resolved by the copy.
+     */
+    hiz_error_t hiz_build(Hiz * hiz, unsigned int framebuffer,
+                          mat4x4 view_projection);
+    void hiz_free(Hiz * hiz);
+#endif
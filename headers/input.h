@@ -0,0 +1,67 @@
+#ifndef INPUT_H
+    #define INPUT_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <GLFW/glfw3.h>
+    #include <camera.h>
+
+
+    typedef enum {
+        INPUT_SUCCESS    =  0,
+        INPUT_IO_ERR     = -1,
+        INPUT_FORMAT_ERR = -2,
+    } input_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    typedef enum {
+        INPUT_LIVE   = 0,
+        INPUT_RECORD = 1,   //live, and written to a file
+        INPUT_REPLAY = 2,   //read back from a file, live input ignored
+    } input_mode_t;
+
+    /* Camera input, passed live to the glfwCompat* callbacks, recorded
+     * on the way, or replayed from a recording.
+     *
+     * A recording is a short header followed by one record per frame,
+     * holding the frame's time and camera key state, with the cursor and
+     * scroll events that arrived between frames in between. Replays step
+     * through it one frame per input_frame, so a replay sees the same
+     * camera path however fast it renders. The clock runs from the start
+     * of the recording, or advances by a fixed step per frame when one is
+     * given. Live and recorded input take the same step if it is set
+     * after input_live or input_record. Files are in host byte order.
+     */
+    struct Input_Recorder {
+        input_mode_t mode;
+        FILE *       file;
+        double       start;     //glfwGetTime when recording began
+        double       step;      //seconds per frame, 0 for real time
+        double       time;      //of the current frame
+        unsigned int frames;
+    };
+    typedef struct Input_Recorder Input_Recorder;
+
+
+    void input_live(Input_Recorder * input);
+    input_error_t input_record(Input_Recorder * input, const char * path);
+    input_error_t input_replay(Input_Recorder * input, const char * path,
+                               double step);
+    void input_end(Input_Recorder * input);
+    /* Routes window's cursor and scroll callbacks through input, in place
+     * of glfwCompatMouseMovementCallback and glfwCompatMouseScrollCallback.
+     * One input is attached at a time.
+     */
+    void input_attach(Input_Recorder * input, GLFWwindow * window);
+    /* Once a frame, in place of glfwCompatKeyboardCallback. A replay
+     * closes window when the recording runs out.
+     */
+    void input_frame(Input_Recorder * input, GLFWwindow * window);
+    /* Time of the current frame, for animation that should replay too. */
+    double input_time(const Input_Recorder * input);
+#endif
@@ -0,0 +1,60 @@
+#ifndef JOBS_H
+    #define JOBS_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <pthread.h>
+
+
+    typedef enum {
+        JOBS_SUCCESS =  0,
+        JOBS_NO_MEM  = -1,
+        JOBS_ERR     = -2,
+    } jobs_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    typedef void (*job_fn)(void * arg);
+
+    /* Counts outstanding jobs so a caller can wait on just the work it
+     * submitted. Protected by the owning pool's lock.
+     */
+    struct Job_Group {
+        int pending;
+    };
+    typedef struct Job_Group Job_Group;
+
+    typedef struct Job Job;
+    struct Job {
+        job_fn      fn;
+        void *      arg;
+        Job_Group * group;
+        Job *       next;
+    };
+
+    struct Job_Pool {
+        pthread_t *     threads;
+        int             num_threads;
+        pthread_mutex_t lock;
+        pthread_cond_t  work_ready;
+        pthread_cond_t  work_done;
+        Job *           head;
+        Job *           tail;
+        int             shutdown;
+    };
+    typedef struct Job_Pool Job_Pool;
+
+    jobs_error_t job_pool_init(Job_Pool * pool, int num_threads);
+    void job_pool_destroy(Job_Pool * pool);
+    Job_Pool * job_pool_default(void);
+    void job_group_init(Job_Group * group);
+    jobs_error_t job_pool_submit(Job_Pool * pool, Job_Group * group,
+                                 job_fn fn, void * arg);
+    void job_group_wait(Job_Pool * pool, Job_Group * group);
+    int job_group_done(Job_Pool * pool, Job_Group * group);
+    int jobs_hardware_threads(void);
+#endif
@@ -4,7 +4,9 @@
     #include <stdio.h>
     #include <glad/glad.h>
     #include <linmath.h>
+    #include <linmath_simd.h>
     #include <shader.h>
+    #include <memstat.h>
 
     typedef enum {
         LIGHT_SUCCESS =  0,
@@ -36,6 +38,7 @@
         mat4x4 shadow_matrix;       //shadows
         mat4x4 * cube_mats;         //Cube matices.
                                     //in order: +x, -x, +y, -y, +z, -z
+        Memstat_Asset memory;       //registered with the shadow map
     };
     typedef struct Light Light;
 
@@ -48,4 +51,7 @@
                                                float far_plane,
                                                vec4 ortho_params);
     light_error_t light_shadow_cube_mat(Light * light, float near, float far);
+    void light_shadow_cube_bounds(Light * light, float far, mat4x4 out);
+    /* Releases the shadow map, if any. name is left to its owner. */
+    void light_free(Light * light);
 #endif
@@ -31,17 +31,23 @@ LINMATH_H_FUNC void mat4x4_normal_matrix(mat4x4 out, mat4x4 const in)
         return;
     }
     #endif
-    mat4x4 tmp1 = {{0.f, 0.f, 0.f, 0.f},
-                   {0.f, 0.f, 0.f, 0.f},
-                   {0.f, 0.f, 0.f, 0.f},
-                   {0.f, 0.f, 0.f, 1.f}};
-    mat4x4 tmp2;
+    /* Cofactors over the determinant, no 4x4 inverse needed. A singular
+     * matrix gives zeros, as mat4x4_normal_cofactor does.
+     */
+    vec3 c[3];
+    float det;
 
+    vec3_mul_cross(c[0], in[1], in[2]);
+    vec3_mul_cross(c[1], in[2], in[0]);
+    vec3_mul_cross(c[2], in[0], in[1]);
+    det = vec3_mul_inner(in[0], c[0]);
+    det = det != 0.f ? 1.f / det : 0.f;
     for (; i<3; i++){
         for (j=0; j<3; j++){
-            tmp1[i][j] = in[i][j];
+            out[i][j] = c[i][j] * det;
         }
+        out[i][3] = 0.f;
     }
-    mat4x4_invert(tmp2, tmp1);
-    mat4x4_transpose(out, tmp2);
+    out[3][0] = out[3][1] = out[3][2] = 0.f;
+    out[3][3] = 1.f;
 }
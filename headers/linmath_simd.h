@@ -0,0 +1,35 @@
+#ifndef LINMATH_SIMD_H
+    #define LINMATH_SIMD_H
+
+    #include <stddef.h>
+    #include <linmath.h>
+
+
+    /* Vectorised versions of the linmath.h matrix routines that sit on hot
+     * paths. They give the same results as their linmath counterparts, up
+     * to float rounding, and take the same column major mat4x4. SSE is
+     * used on x86, batched calls move to AVX2 when the CPU has it, and
+     * everything else falls back to plain loops.
+     *
+     * out may alias any input, as in linmath.
+     */
+    void mat4x4_mul_simd(mat4x4 out, mat4x4 const a, mat4x4 const b);
+    void mat4x4_mul_vec4_simd(vec4 out, mat4x4 const m, vec4 const v);
+    void mat4x4_invert_simd(mat4x4 out, mat4x4 const m);
+    /* Inverse transpose of the upper 3x3, from its cofactors, padded out
+     * to a mat4 for setMat4x4. Singular matrices give zeros.
+     */
+    void mat4x4_normal_cofactor(mat4x4 out, mat4x4 const m);
+
+    /* out[i] = m * in[i]. */
+    void mat4x4_mul_array(mat4x4 * out, mat4x4 const m, const mat4x4 * in,
+                          unsigned int count);
+    void mat4x4_mul_vec4_array(vec4 * out, mat4x4 const m, const vec4 * in,
+                               unsigned int count);
+    /* out[i] = m * (p, 1), for count positions stride bytes apart, as they
+     * sit in an interleaved vertex array.
+     */
+    void mat4x4_transform_points(vec4 * out, mat4x4 const m,
+                                 const float * positions, size_t stride,
+                                 unsigned int count);
+#endif
@@ -0,0 +1,63 @@
+#ifndef MEMSTAT_H
+    #define MEMSTAT_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+
+
+    typedef enum {
+        MEMSTAT_CPU     = 0,
+        MEMSTAT_GPU     = 1,
+        MEMSTAT_DOMAINS = 2,
+    } memstat_domain_t;
+
+    typedef enum {
+        MEMSTAT_GEOMETRY   = 0,    //vertices, indices and their buffers
+        MEMSTAT_TEXTURE    = 1,
+        MEMSTAT_SHADOW     = 2,    //shadow maps
+        MEMSTAT_CULLING    = 3,    //meshlets, depth pyramids, occlusion
+        MEMSTAT_OTHER      = 4,
+        MEMSTAT_CATEGORIES = 5,
+    } memstat_category_t;
+
+    #define MEMSTAT_NAME_LENGTH 64
+
+    /* Memory owned by one asset, a model, a light and so on, by domain
+     * and category. Everything added to an asset also counts towards the
+     * process wide totals, and is taken back out when the asset is
+     * unregistered.
+     */
+    typedef struct Memstat_Asset Memstat_Asset;
+    struct Memstat_Asset {
+        char            name[MEMSTAT_NAME_LENGTH];
+        long long       bytes[MEMSTAT_DOMAINS][MEMSTAT_CATEGORIES];
+        long long       peak[MEMSTAT_DOMAINS];
+        int             registered;
+        Memstat_Asset * previous;
+        Memstat_Asset * next;
+    };
+
+
+    /* asset must be zeroed, unregistered or registered already, in which
+     * case its counts start over.
+     */
+    void memstat_register(Memstat_Asset * asset, const char * name);
+    void memstat_unregister(Memstat_Asset * asset);
+    /* bytes may be negative. asset may be NULL, which counts towards the
+     * totals only. Assets not registered are ignored. Thread safe.
+     */
+    void memstat_add(Memstat_Asset * asset, memstat_domain_t domain,
+                     memstat_category_t category, long long bytes);
+    /* Sets a category to an absolute figure, for owners who measure
+     * rather than count.
+     */
+    void memstat_set(Memstat_Asset * asset, memstat_domain_t domain,
+                     memstat_category_t category, long long bytes);
+    /* MEMSTAT_CATEGORIES for all categories. */
+    long long memstat_total(memstat_domain_t domain,
+                            memstat_category_t category);
+    long long memstat_peak(memstat_domain_t domain,
+                           memstat_category_t category);
+    /* Totals, high-water marks and every registered asset. */
+    void memstat_report(FILE * fp);
+#endif
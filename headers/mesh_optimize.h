@@ -0,0 +1,65 @@
+#ifndef MESH_OPTIMIZE_H
+    #define MESH_OPTIMIZE_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <stddef.h>
+
+
+    typedef enum {
+        MESH_OPTIMIZE_SUCCESS =  0,
+        MESH_OPTIMIZE_NO_MEM  = -1,
+        MESH_OPTIMIZE_ERR     = -2,
+    } mesh_optimize_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    /* FIFO size used for reports. Close to what current GPUs reuse within
+     * a batch of vertices.
+     */
+    #define MESH_OPTIMIZE_REPORT_CACHE 16
+
+    /* acmr is vertex shader invocations per triangle (0.5 is the best a
+     * regular grid can do, 3 the worst), atvr invocations per vertex (1
+     * is ideal).
+     */
+    struct Vertex_Cache_Stats {
+        unsigned int vertices_transformed;
+        float        acmr;
+        float        atvr;
+    };
+    typedef struct Vertex_Cache_Stats Vertex_Cache_Stats;
+
+    /* All of these work on indexed triangle lists in place. Positions are
+     * read as three floats, stride bytes apart.
+     */
+    mesh_optimize_error_t mesh_optimize_vertex_cache(unsigned int * indices,
+                                                     size_t num_indices,
+                                                     size_t num_vertices);
+    mesh_optimize_error_t mesh_optimize_overdraw(unsigned int * indices,
+                                                 size_t num_indices,
+                                                 const float * positions,
+                                                 size_t stride,
+                                                 size_t num_vertices,
+                                                 float threshold);
+    mesh_optimize_error_t mesh_optimize_vertex_fetch(void * vertices,
+                                                     size_t vertex_size,
+                                                     size_t num_vertices,
+                                                     unsigned int * indices,
+                                                     size_t num_indices,
+                                                     size_t * used_vertices);
+    mesh_optimize_error_t mesh_weld_vertices(void * vertices,
+                                             size_t vertex_size,
+                                             size_t num_vertices,
+                                             unsigned int * indices,
+                                             size_t num_indices,
+                                             size_t * unique_vertices);
+    void mesh_analyze_vertex_cache(const unsigned int * indices,
+                                   size_t num_indices, size_t num_vertices,
+                                   unsigned int cache_size,
+                                   Vertex_Cache_Stats * out);
+#endif
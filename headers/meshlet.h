@@ -0,0 +1,72 @@
+#ifndef MESHLET_H
+    #define MESHLET_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <stddef.h>
+    #include <cull.h>
+
+
+    typedef enum {
+        MESHLET_SUCCESS =  0,
+        MESHLET_NO_MEM  = -1,
+    } meshlet_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    /* Sizes that map well onto a GPU wave, the same limits mesh shader
+     * pipelines use.
+     */
+    #define MESHLET_MAX_VERTICES  64
+    #define MESHLET_MAX_TRIANGLES 124
+
+    /* A run of consecutive triangles of the mesh's index buffer. Laid
+     * out as a uvec2 for shaders.
+     */
+    struct Meshlet {
+        unsigned int first_index;
+        unsigned int count;
+    };
+    typedef struct Meshlet Meshlet;
+
+    /* Bounds of four meshlets, one lane each, so culling tests four at a
+     * time. The normal cone has every triangle facing away from any eye
+     * for which dot(center - eye, axis) >= cutoff * |center - eye| +
+     * radius. cutoff is 1 when the triangles face too many ways for that
+     * to ever hold. Matches the std430 layout of a struct of eight vec4.
+     */
+    struct Meshlet_Bounds4 {
+        float center_x[4];
+        float center_y[4];
+        float center_z[4];
+        float radius[4];
+        float axis_x[4];
+        float axis_y[4];
+        float axis_z[4];
+        float cutoff[4];
+    };
+    typedef struct Meshlet_Bounds4 Meshlet_Bounds4;
+
+    /* Cuts the triangle list, in its current order, into meshlets. The
+     * order is left alone, so run the vertex cache optimization first:
+     * its output is already made of compact runs. bounds gets
+     * (count + 3) / 4 entries.
+     */
+    meshlet_error_t meshlet_build(Meshlet ** meshlets,
+                                  Meshlet_Bounds4 ** bounds,
+                                  unsigned int * count,
+                                  const unsigned int * indices,
+                                  size_t num_indices,
+                                  const float * positions, size_t stride,
+                                  size_t num_vertices);
+    /* Writes the numbers of the meshlets inside the frustum, and unless
+     * eye is NULL not facing away from it, to visible. Returns how many.
+     */
+    unsigned int meshlet_cull(const Meshlet_Bounds4 * bounds,
+                              unsigned int count, const Frustum * frustum,
+                              const float * eye, unsigned int * visible);
+#endif
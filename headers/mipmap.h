@@ -0,0 +1,59 @@
+#ifndef MIPMAP_H
+    #define MIPMAP_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <stddef.h>
+
+
+    typedef enum {
+        MIPMAP_SUCCESS =  0,
+        MIPMAP_NO_MEM  = -1,
+        MIPMAP_ERR     = -2,
+    } mipmap_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    typedef enum {
+        MIP_FILTER_BOX    = 0,  //2x2 average
+        MIP_FILTER_KAISER = 1,  //6 tap Kaiser windowed sinc, sharper
+    } mip_filter_t;
+
+    /* How the texel values are to be interpreted while filtering. */
+    typedef enum {
+        MIP_CONTENT_LINEAR = 0, //data maps, averaged as stored
+        MIP_CONTENT_SRGB   = 1, //colour, averaged in linear light
+        MIP_CONTENT_NORMAL = 2, //tangent space normals, renormalized
+    } mip_content_t;
+
+    #define MIPMAP_MAX_LEVELS 16
+
+    struct Mip_Level {
+        int             width;
+        int             height;
+        size_t          size;   //bytes
+        unsigned char * data;
+    };
+    typedef struct Mip_Level Mip_Level;
+
+    /* Level 0 points at the caller's pixels and is never freed here.
+     * Levels 1 and up share one allocation owned by the chain.
+     */
+    struct Mip_Chain {
+        int             channels;
+        int             num_levels;
+        Mip_Level       levels[MIPMAP_MAX_LEVELS];
+        unsigned char * storage;
+    };
+    typedef struct Mip_Chain Mip_Chain;
+
+    mipmap_error_t mip_chain_build(Mip_Chain * chain, unsigned char * pixels,
+                                   int width, int height, int channels,
+                                   mip_content_t content, mip_filter_t filter);
+    void mip_chain_free(Mip_Chain * chain);
+    int mip_level_count(int width, int height);
+#endif
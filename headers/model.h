@@ -4,6 +4,18 @@
     #include <linmath.h>
     #include <stdio.h>
     #include <shader.h>
+    #include <texture.h>
+    #include <mipmap.h>
+    #include <jobs.h>
+    #include <mesh_optimize.h>
+    #include <simplify.h>
+    #include <meshlet.h>
+    #include <scene.h>
+    #include <bvh.h>
+    #include <occlusion.h>
+    #include <hiz.h>
+    #include <arena.h>
+    #include <memstat.h>
     #include <GLFW/glfw3.h>
     #include <stddef.h>
     #include <assimp/cimport.h>
@@ -34,6 +46,133 @@
     };
     typedef struct Vertex Vertex;
 
+    /* Meshes with at most this many vertices get 16-bit index buffers.
+     * Larger ones are split at import when that is cheap.
+     */
+    #define MODEL_MAX_SHORT_INDEX_VERTICES 65536
+
+    /* Detail levels share the mesh's vertices, each is a range of its
+     * index buffer. error is the largest deviation from the full detail
+     * surface, in model units. Level 0 is the imported mesh.
+     */
+    #define MODEL_MAX_LODS 5
+
+    struct Mesh_Lod {
+        unsigned int offset;    //first index
+        unsigned int count;
+        float        error;
+    };
+    typedef struct Mesh_Lod Mesh_Lod;
+
+    /* Pixels of error allowed before a finer level is drawn. */
+    #define MODEL_LOD_THRESHOLD 1.f
+
+    /* Where the model is seen from this frame, for picking detail levels.
+     * Set with model_set_lod_view, until then meshes draw at full detail.
+     */
+    struct Lod_View {
+        int   enabled;
+        vec3  eye;              //world space
+        float pixel_scale;      //pixels per unit of error at distance 1
+        float threshold;        //pixels
+    };
+    typedef struct Lod_View Lod_View;
+
+    /* local_size_x of meshlet_cull.comp */
+    #define MESHLET_CULL_GROUP_SIZE 64
+
+    /* Layout glMultiDrawElementsIndirect reads. */
+    struct Draw_Elements_Command {
+        unsigned int count;
+        unsigned int instance_count;
+        unsigned int first_index;
+        int          base_vertex;
+        unsigned int base_instance;
+    };
+    typedef struct Draw_Elements_Command Draw_Elements_Command;
+
+    /* What draw_model culls against: whole meshes by their boxes, then
+     * full detail meshes meshlet by meshlet. Set with model_set_cull_view
+     * before each pass, clear enabled to turn it off. With a cull_shader
+     * (meshlet_cull.comp) the meshlet test runs on the GPU and writes the
+     * indirect draws itself. An occlusion buffer drawn from the same view,
+     * attached with model_set_occlusion, also drops meshes hidden behind
+     * its occluders. A GPU depth pyramid, attached with model_set_hiz,
+     * does the same for meshlets, see draw_model_disoccluded.
+     *
+     * When several passes cull the same model, eg. a shadow map and the
+     * camera, model_cull_views tests every mesh against all of them at
+     * once, and model_use_view has a pass read its meshes from that.
+     */
+    #define MODEL_MAX_VIEWS 32
+
+    struct Cull_View {
+        int      enabled;
+        int      view;             //of model_cull_views, -1 for none
+        mat4x4   view_projection;
+        int      backfaces;        //also drop meshlets facing away from eye
+        vec3     eye;              //world space
+        Shader * cull_shader;
+        Occlusion_Buffer * occlusion;
+        Hiz *    hiz;              //with cull_shader only
+    };
+    typedef struct Cull_View Cull_View;
+
+    typedef enum {
+        VERTEX_FORMAT_FULL   = 0,   //vec3 + Vertex_Attributes, 56 bytes
+        VERTEX_FORMAT_PACKED = 1,   //Packed_Position + Packed_Attributes, 20
+    } vertex_format_t;
+
+    /* What of a mesh stays in system memory once it is set up. */
+    typedef enum {
+        MODEL_KEEP_ALL       = 0,   //everything, eg. for editing
+        MODEL_KEEP_POSITIONS = 1,   //positions and indices, for picking
+                                    //and occlusion culling on the CPU
+        MODEL_KEEP_NONE      = 2,   //draw only
+    } model_residency_t;
+
+    /* Bytes a model holds, by where. Textures are left out, a streamer
+     * accounts for those.
+     */
+    struct Model_Memory {
+        size_t cpu_geometry;   //vertices, positions and indices
+        size_t cpu_other;      //meshlets, bounds, hierarchy, arena
+        size_t gpu_geometry;   //vertex and index buffers
+        size_t gpu_other;      //meshlet and indirect buffers
+    };
+    typedef struct Model_Memory Model_Memory;
+
+    /* On the GPU positions live in their own tightly packed buffer so
+     * depth only passes fetch nothing else. Everything else goes in a
+     * second, interleaved, buffer.
+     */
+    struct Vertex_Attributes {
+        vec3 normal;
+        vec2 texture_coordinates;
+        vec3 tangent;
+        vec3 bitangent;
+    };
+    typedef struct Vertex_Attributes Vertex_Attributes;
+
+    /* Compact layout. Positions are unorm16 within the mesh bounds
+     * (decoded with position_offset + position_scale * p), normals and
+     * tangents are octahedral snorm16 pairs and texture coordinates are
+     * half floats. The bitangent is rebuilt in the shader from
+     * cross(normal, tangent), with position[3] set when it is flipped.
+     * Shaders built with PACKED_VERTICES defined read this layout.
+     */
+    struct Packed_Position {
+        unsigned short position[4];
+    };
+    typedef struct Packed_Position Packed_Position;
+
+    struct Packed_Attributes {
+        short          normal[2];
+        unsigned short texture_coordinates[2];
+        short          tangent[2];
+    };
+    typedef struct Packed_Attributes Packed_Attributes;
+
     typedef enum {
         DIFFUSE  = 0,
         SPECULAR = 1,
@@ -47,22 +186,64 @@
     };
     typedef struct Texture Texture;
 
+    /* A texture file decoded, and mip mapped, off the GL thread. It waits
+     * in the model's texture list until load_model uploads it.
+     */
+    struct Texture_Image {
+        const char *     path;
+        texture_t        type;
+        unsigned int     id;
+        int              compressed;
+        Compressed_Image compressed_image;
+        unsigned char *  pixels;
+        int              width;
+        int              height;
+        int              channels;
+        Mip_Chain        chain;
+        model_error_t    result;
+    };
+    typedef struct Texture_Image Texture_Image;
+
     typedef struct Texture_Node Texture_Node;
     struct Texture_Node {
         Texture texture;
+        Texture_Image * image;      //NULL once uploaded
         Texture_Node * next;
     };
 
     struct Mesh {
         Vertex *       vertices;
         unsigned int   num_vertices;
-        unsigned int * indices;
+        vec3 *         positions;      //in place of vertices, see residency
+        unsigned int * indices;        //every detail level, back to back
         unsigned int   num_indices;
         Texture *      textures;
         unsigned int   num_textures;
         unsigned int   VAO;
-        unsigned int   VBO;
+        unsigned int   VBO;            //everything but positions
         unsigned int   EBO;
+        unsigned int   position_VBO;
+        unsigned int   depth_VAO;      //positions and indices only
+        unsigned int   index_type;     //GL_UNSIGNED_SHORT/INT, by setup_mesh
+        //GPU vertex layout, chosen before setup_mesh
+        vertex_format_t vertex_format;
+        vec3           position_offset;
+        vec3           position_scale;
+        Mesh_Lod       lods[MODEL_MAX_LODS];
+        unsigned int   num_lods;
+        unsigned int   node;           //in the model's scene graph
+        vec3           aabb_min;       //bounds, in the node's space
+        vec3           aabb_max;
+        vec3           center;         //bounding sphere
+        float          radius;
+        Meshlet *      meshlets;       //runs of lods[0]
+        Meshlet_Bounds4 * meshlet_bounds;
+        unsigned int   num_meshlets;
+        unsigned int   meshlet_SSBO;   //meshlets and bounds, for GPU culling
+        unsigned int   meshlet_bounds_SSBO;
+        unsigned int   indirect_buffer;
+        unsigned int   meshlet_occluded_SSBO;  //hidden by last frame's depth
+        int            occluder;       //drawn into occlusion buffers
     };
     typedef struct Mesh Mesh;
 
@@ -72,17 +253,95 @@
         unsigned int   num_meshes;
         char *         directory;
         Texture_Node * loaded_textures;
+        Lod_View       lod_view;
+        Cull_View      cull_view;
+        Scene_Graph    scene;          //node 0 is the model's transform
+        Bvh            bvh;            //over the meshes' world boxes
+        Bvh_Box *      mesh_boxes;     //by mesh, world space
+        unsigned int * view_masks;     //by mesh, bit v if in view v
+        int            num_views;      //of the last model_cull_views
+        unsigned int   pending_names;  //provisional texture ids handed out
+        //Import progress, safe to read from other threads atomically
+        unsigned int   meshes_processed;
+        unsigned int   meshes_in_file;
+        /* Texture lists, paths and mesh texture arrays live as long as
+         * the model. scratch only lasts through the import.
+         */
+        Arena          arena;
+        Arena          scratch;
+        model_residency_t residency;   //applied as meshes are set up
+        Memstat_Asset  memory;         //registered by import_model
     };
     typedef struct Model Model;
 
+    /* One mesh placement found by process_node, converted on the job pool
+     * by process_meshes. mesh arrives with its textures and node set.
+     */
+    struct Mesh_Task {
+        struct aiMesh * source;
+        Model *         model;
+        Mesh            mesh;
+        Mesh *          pieces;        //if split for 16-bit indices
+        unsigned int    num_pieces;
+        model_error_t   result;
+    };
+    typedef struct Mesh_Task Mesh_Task;
+
 
     model_error_t setup_model(Model * model);
     model_error_t setup_mesh(Mesh * mesh);
+    void model_set_vertex_format(Model * model, vertex_format_t format);
+    void pack_vertices(const Mesh * mesh, Packed_Position * positions,
+                       Packed_Attributes * attributes,
+                       vec3 position_offset, vec3 position_scale);
     model_error_t draw_mesh(Shader * shader, Mesh mesh);
-    model_error_t draw_model(Shader * shader, Model model);
+    model_error_t draw_mesh_lod(Shader * shader, Mesh mesh, unsigned int lod);
+    void model_set_transform(Model * model, mat4x4 model_matrix);
+    void model_set_lod_view(Model * model, vec3 eye, float fov_y,
+                            int viewport_height, float threshold);
+    unsigned int mesh_select_lod(const Mesh * mesh, const Lod_View * view);
+    void model_set_cull_view(Model * model, mat4x4 view_projection,
+                             vec3 eye, int backfaces, Shader * cull_shader);
+    /* Tests every mesh's world box against up to MODEL_MAX_VIEWS view
+     * projections in one pass. Call once the frame's transforms are set.
+     */
+    model_error_t model_cull_views(Model * model, mat4x4 * view_projections,
+                                   int count);
+    /* After model_set_cull_view, takes the pass's meshes from view of the
+     * last model_cull_views instead of searching the hierarchy.
+     */
+    void model_use_view(Model * model, int view);
+    /* Adds the model's occluder meshes in the buffer's view, at the detail
+     * the lod view picks, ahead of occlusion_rasterize.
+     */
+    model_error_t model_add_occluders(Model * model, Occlusion_Buffer * buffer);
+    void model_set_occlusion(Model * model, Occlusion_Buffer * buffer);
+    void model_set_hiz(Model * model, Hiz * hiz);
+    model_error_t draw_model(Shader * shader, Model * model);
+    /* With a depth pyramid attached, draw_model leaves out meshlets hidden
+     * in it. Rebuild the pyramid from what was drawn, then call this with
+     * the same cull view to draw those of them that are visible now.
+     */
+    model_error_t draw_model_disoccluded(Shader * shader, Model * model);
+    /* Meshes whose world bounds overlap the sphere, eg. a light's range.
+     * meshes, if not NULL, needs room for num_meshes entries.
+     */
+    unsigned int model_query_sphere(Model * model, vec3 center, float radius,
+                                    unsigned int * meshes);
+    /* Index of the first mesh a world space ray hits, or -1. Triangles are
+     * tested at full detail, distance is in units of direction.
+     */
+    int model_pick(Model * model, vec3 origin, vec3 direction,
+                   float * distance);
     model_error_t load_model(Model * model);
+    model_error_t load_model_deferred(Model * model);
+    model_error_t import_model(Model * model);
+    void name_pending_textures(Model * model);
     model_error_t process_node(Model * model, struct aiNode * node,
-                               const struct aiScene * scene, int * index);
+                               const struct aiScene * scene, Mesh_Task * tasks,
+                               int * index, int parent);
+    model_error_t process_meshes(Model * model, Mesh_Task * tasks,
+                                 unsigned int count);
     model_error_t process_mesh(struct aiMesh * mesh,
                                const struct aiScene * scene,
                                Mesh * out, Model * model);
@@ -91,8 +350,27 @@
                                          texture_t type_name, int * count,
                                          Model * model, Texture ** out);
     model_error_t texture_from_file(char * fname, unsigned int * texture_id);
+    void texture_image_decode(void * image);
+    model_error_t texture_image_upload(Texture_Image * image);
+    size_t texture_image_bytes(const Texture_Image * image);
+    void texture_image_drop_levels(Texture_Image * image, int count);
+    void texture_image_free(Texture_Image * image);
+    model_error_t upload_pending_textures(Model * model);
     void free_mesh(Mesh * mesh);
     void free_model(Model * model);
     void append_texture_node(Model * model, Texture_Node * new_node);
     int cached_texture_count(Model model);
+    void model_vertex_cache_report(const Model * model, FILE * fp);
+    /* Applies to meshes already set up at once, and to the rest as they
+     * are. Geometry dropped is gone for good, so the policy can only get
+     * stricter.
+     */
+    void model_set_residency(Model * model, model_residency_t residency);
+    void mesh_apply_residency(Mesh * mesh, model_residency_t residency);
+    void model_memory(const Model * model, Model_Memory * out);
+    void model_memory_report(const Model * model, FILE * fp);
+    /* Called by setup_model and model_set_residency. Anything else that
+     * changes a model's geometry calls it too.
+     */
+    void model_account_memory(Model * model);
 #endif
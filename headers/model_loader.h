@@ -0,0 +1,65 @@
+#ifndef MODEL_LOADER_H
+    #define MODEL_LOADER_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <model.h>
+    #include <jobs.h>
+
+
+    typedef enum {
+        MODEL_LOAD_IMPORTING = 0,   //reading and processing, on the pool
+        MODEL_LOAD_UPLOADING = 1,   //a slice per poll, on the GL thread
+        MODEL_LOAD_DONE      = 2,
+        MODEL_LOAD_FAILED    = 3,
+    } model_load_state_t;
+
+    /* Called from model_load_poll, on the GL thread. progress runs from 0
+     * to 1 over the whole load.
+     */
+    typedef void (*model_load_progress_fn)(void * user,
+                                           model_load_state_t state,
+                                           float progress);
+
+    /* A model loading in the background, polled once a frame by the
+     * render loop. Import, mesh processing and, optionally, texture
+     * decoding run as a job on the pool. GL work is staged back through
+     * model_load_poll, which uploads meshes and textures one at a time
+     * until its time budget runs out.
+     */
+    struct Model_Load {
+        Model *                model;
+        Job_Pool *             pool;
+        Job_Group              group;
+        vertex_format_t        vertex_format;
+        int                    decode_textures; //else left to a streamer
+        model_error_t          result;          //import job, then uploads
+        model_load_state_t     state;
+        unsigned int           meshes_uploaded;
+        unsigned int           num_textures;
+        unsigned int           textures_uploaded;
+        Texture_Node *         next_texture;
+        model_load_progress_fn on_progress;
+        void *                 user;
+    };
+    typedef struct Model_Load Model_Load;
+
+
+    /* model is set up as for load_model, with a file_path. Leave it, and
+     * load, alone until the load is done or failed. pool may be NULL,
+     * which imports right here. A load failing during upload leaves what
+     * was uploaded for free_model.
+     */
+    model_error_t model_load_begin(Model_Load * load, Model * model,
+                                   Job_Pool * pool, vertex_format_t format,
+                                   int decode_textures);
+    void model_load_on_progress(Model_Load * load, model_load_progress_fn fn,
+                                void * user);
+    /* Moves the load along, spending up to budget seconds on GL uploads,
+     * but always at least one, and returns where it stands.
+     */
+    model_load_state_t model_load_poll(Model_Load * load, double budget);
+    float model_load_progress(const Model_Load * load);
+    /* Blocks until the load is done or failed. */
+    model_load_state_t model_load_finish(Model_Load * load);
+#endif
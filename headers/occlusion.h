@@ -0,0 +1,108 @@
+#ifndef OCCLUSION_H
+    #define OCCLUSION_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <linmath.h>
+    #include <linmath_simd.h>
+    #include <jobs.h>
+    #include <memstat.h>
+
+
+    typedef enum {
+        OCCLUSION_SUCCESS =  0,
+        OCCLUSION_NO_MEM  = -1,
+    } occlusion_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    /* Buffers are cut into tiles, each rasterized by one job. Sizes are
+     * rounded up to whole tiles. Every tile also reduces itself into the
+     * coarser levels, OCCLUSION_LEVELS - 1 halvings, which must divide the
+     * tile evenly.
+     */
+    #define OCCLUSION_TILE_WIDTH  32
+    #define OCCLUSION_TILE_HEIGHT 16
+    #define OCCLUSION_LEVELS      5
+
+    /* A front facing occluder triangle in buffer pixels, set up for
+     * rasterizing. Depth is 0 at the near plane and 1 at the far one.
+     */
+    struct Occlusion_Triangle {
+        float edge[3][3];      //inside where x * a + y * b + c >= 0
+        float depth[3];        //x * a + y * b + c
+        int   min_x;           //pixels whose centres it may cover
+        int   min_y;
+        int   max_x;
+        int   max_y;
+    };
+    typedef struct Occlusion_Triangle Occlusion_Triangle;
+
+    typedef struct Occlusion_Buffer Occlusion_Buffer;
+
+    struct Occlusion_Tile {
+        Occlusion_Buffer * buffer;
+        int                x;              //in tiles
+        int                y;
+        unsigned int       first;          //in the buffer's bins
+        unsigned int       count;
+    };
+    typedef struct Occlusion_Tile Occlusion_Tile;
+
+    /* A coarse depth buffer drawn on the CPU from a few large meshes,
+     * then used to reject bounding boxes hidden behind them. levels[0]
+     * is the depth itself, rows from the bottom, and each further level
+     * keeps the furthest depth of 2x2 texels of the one below.
+     */
+    struct Occlusion_Buffer {
+        int                  width;
+        int                  height;
+        int                  tiles_x;
+        int                  tiles_y;
+        float *              levels[OCCLUSION_LEVELS];
+        mat4x4               view_projection;
+        Occlusion_Triangle * triangles;
+        unsigned int         num_triangles;
+        unsigned int         triangle_capacity;
+        unsigned int *       bins;          //triangle indices, by tile
+        unsigned int         bin_capacity;
+        Occlusion_Tile *     tiles;
+        vec4 *               clip;          //scratch, transformed vertices
+        unsigned int         clip_capacity;
+        Memstat_Asset        memory;
+    };
+
+
+    occlusion_error_t occlusion_init(Occlusion_Buffer * buffer, int width,
+                                     int height);
+    void occlusion_free(Occlusion_Buffer * buffer);
+    /* Drops the previous frame's occluders. view_projection is the view
+     * everything is drawn and tested from.
+     */
+    void occlusion_begin(Occlusion_Buffer * buffer, mat4x4 view_projection);
+    /* Transforms and sets up an occluder's triangles, nothing is drawn
+     * yet. positions are stride bytes apart. Triangles crossing the near
+     * plane are left out, which only ever lets more through.
+     */
+    occlusion_error_t occlusion_add_occluder(Occlusion_Buffer * buffer,
+                                             mat4x4 world,
+                                             const float * positions,
+                                             size_t stride,
+                                             unsigned int num_vertices,
+                                             const unsigned int * indices,
+                                             unsigned int count);
+    /* Draws every added triangle, one job per tile, and waits for them.
+     * pool may be NULL to draw on the calling thread.
+     */
+    occlusion_error_t occlusion_rasterize(Occlusion_Buffer * buffer,
+                                          Job_Pool * pool);
+    /* 0 when the box, in the space world takes to world space, is hidden
+     * behind the occluders, 1 otherwise.
+     */
+    int occlusion_test_aabb(const Occlusion_Buffer * buffer, mat4x4 world,
+                            const vec3 min, const vec3 max);
+#endif
@@ -0,0 +1,53 @@
+#ifndef SCENE_H
+    #define SCENE_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <linmath.h>
+    #include <linmath_simd.h>
+
+
+    typedef enum {
+        SCENE_SUCCESS =  0,
+        SCENE_NO_MEM  = -1,
+        SCENE_ERR     = -2,
+    } scene_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    /* Transform hierarchy, one array per field. A node's parent always
+     * has a smaller index, so walking the arrays front to back visits
+     * parents before children and one pass updates everything.
+     *
+     * Changing a local transform only flags the node. scene_graph_update
+     * then recomputes the world transforms of flagged nodes and their
+     * descendants, and leaves their indices in updated until the next
+     * update.
+     */
+    struct Scene_Graph {
+        unsigned int    num_nodes;
+        unsigned int    capacity;
+        int *           parent;        //-1 for roots
+        mat4x4 *        local;
+        mat4x4 *        world;
+        unsigned char * dirty;
+        unsigned int *  updated;
+        unsigned int    num_updated;
+    };
+    typedef struct Scene_Graph Scene_Graph;
+
+
+    scene_error_t scene_graph_init(Scene_Graph * graph, unsigned int capacity);
+    void scene_graph_free(Scene_Graph * graph);
+    /* Returns the new node's index, or -1 when out of memory or parent is
+     * not an existing node.
+     */
+    int scene_graph_add(Scene_Graph * graph, int parent, mat4x4 local);
+    void scene_graph_set_local(Scene_Graph * graph, unsigned int node,
+                               mat4x4 local);
+    unsigned int scene_graph_update(Scene_Graph * graph);
+#endif
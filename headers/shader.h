@@ -4,6 +4,7 @@
     #include <glad/glad.h>
     #include <stdio.h>
     #include <stdlib.h>
+    #include <string.h>
     #include <linmath.h>
 
     typedef enum {
@@ -22,6 +23,7 @@
 
     struct Shader{
         unsigned int ID;
+        int positionsOnly;  //only vertex input is location 0
         struct Shader * self;
         shader_err_t (*load)(struct Shader * self, char * vertexPath,
                              char * fragmentPath);
@@ -42,6 +44,11 @@
                       char * fragmentPath);
     shader_err_t shaderLoad(struct Shader * self, char * vertexPath,
                             char * fragmentPath, char * geomPath);
+    shader_err_t shaderLoadDefines(struct Shader * self, char * vertexPath,
+                                   char * fragmentPath, char * geomPath,
+                                   const char * defines);
+    shader_err_t shaderLoadCompute(struct Shader * self, char * computePath,
+                                   const char * defines);
     shader_err_t use(struct Shader * self);
     shader_err_t setBool(struct Shader * self, const char * name, int value);
     shader_err_t setInt(struct Shader * self, const char * name, int value);
@@ -0,0 +1,35 @@
+#ifndef SIMPLIFY_H
+    #define SIMPLIFY_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <stddef.h>
+
+
+    typedef enum {
+        SIMPLIFY_SUCCESS =  0,
+        SIMPLIFY_NO_MEM  = -1,
+    } simplify_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    /* Quadric error metric edge collapse (Garland and Heckbert). Vertices
+     * only ever collapse onto other existing vertices, so the result is a
+     * new index list over the same vertex buffer. Open borders and
+     * attribute seams (several vertices at one position) are kept as is.
+     *
+     * out needs room for num_indices entries. target_error is the largest
+     * allowed deviation in model units, result_error the one reached.
+     */
+    simplify_error_t simplify_mesh(unsigned int * out, size_t * out_count,
+                                   const unsigned int * indices,
+                                   size_t num_indices,
+                                   const float * positions, size_t stride,
+                                   size_t num_vertices,
+                                   size_t target_index_count,
+                                   float target_error, float * result_error);
+#endif
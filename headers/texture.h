@@ -0,0 +1,171 @@
+#ifndef TEXTURE_H
+    #define TEXTURE_H
+
+    #include <glad/glad.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <stdint.h>
+    #include <string.h>
+
+
+    typedef enum {
+        TEXTURE_SUCCESS    =  0,
+        TEXTURE_FS_ERR     = -1,
+        TEXTURE_NO_MEM     = -2,
+        TEXTURE_FORMAT_ERR = -3,
+        TEXTURE_GL_ERR     = -4,
+        TEXTURE_ERR        = -5,
+    } texture_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    /* The S3TC formats are an extension and glad only exports the enums
+     * if the extension was ticked when the loader was generated.
+     */
+    #ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+        #define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT       0x83F1
+    #endif
+    #ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+        #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT       0x83F3
+    #endif
+    #ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+        #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+    #endif
+    #ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+        #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+    #endif
+    #ifndef GL_COMPRESSED_RED_RGTC1
+        #define GL_COMPRESSED_RED_RGTC1                0x8DBB
+    #endif
+    #ifndef GL_COMPRESSED_RG_RGTC2
+        #define GL_COMPRESSED_RG_RGTC2                 0x8DBD
+    #endif
+    #ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+        #define GL_COMPRESSED_RGBA_BPTC_UNORM          0x8E8C
+    #endif
+    #ifndef GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+        #define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM    0x8E8D
+    #endif
+    #ifndef GL_COMPRESSED_RGB8_ETC2
+        #define GL_COMPRESSED_RGB8_ETC2                0x9274
+    #endif
+    #ifndef GL_COMPRESSED_SRGB8_ETC2
+        #define GL_COMPRESSED_SRGB8_ETC2               0x9275
+    #endif
+    #ifndef GL_COMPRESSED_RGBA8_ETC2_EAC
+        #define GL_COMPRESSED_RGBA8_ETC2_EAC           0x9278
+    #endif
+    #ifndef GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC
+        #define GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC    0x9279
+    #endif
+
+    /* DXGI_FORMAT values used in the DX10 extension of the DDS header.
+     * Only the block compressed formats we know how to upload are listed.
+     */
+    typedef enum {
+        DXGI_BC1_UNORM      = 71,
+        DXGI_BC1_UNORM_SRGB = 72,
+        DXGI_BC3_UNORM      = 77,
+        DXGI_BC3_UNORM_SRGB = 78,
+        DXGI_BC4_UNORM      = 80,
+        DXGI_BC5_UNORM      = 83,
+        DXGI_BC7_UNORM      = 98,
+        DXGI_BC7_UNORM_SRGB = 99,
+    } dxgi_format_t;
+
+    #define DDS_MAGIC                 0x20534444 // "DDS "
+    #define DDS_FOURCC(a, b, c, d)    ((uint32_t)(a) | ((uint32_t)(b) << 8) \
+                                       | ((uint32_t)(c) << 16) \
+                                       | ((uint32_t)(d) << 24))
+    #define DDSD_CAPS                 0x1
+    #define DDSD_HEIGHT               0x2
+    #define DDSD_WIDTH                0x4
+    #define DDSD_PIXELFORMAT          0x1000
+    #define DDSD_MIPMAPCOUNT          0x20000
+    #define DDSD_LINEARSIZE           0x80000
+    #define DDPF_FOURCC               0x4
+    #define DDSCAPS_COMPLEX           0x8
+    #define DDSCAPS_TEXTURE           0x1000
+    #define DDSCAPS_MIPMAP            0x400000
+    #define DDS_DIMENSION_TEXTURE2D   3
+
+    /* On disk layout of a DDS file is
+     * magic, Dds_Header, [Dds_Header_DX10], level 0, level 1, ...
+     */
+    struct Dds_Pixel_Format {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t four_cc;
+        uint32_t rgb_bit_count;
+        uint32_t r_mask;
+        uint32_t g_mask;
+        uint32_t b_mask;
+        uint32_t a_mask;
+    };
+
+    struct Dds_Header {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t height;
+        uint32_t width;
+        uint32_t pitch_or_linear_size;
+        uint32_t depth;
+        uint32_t mip_map_count;
+        uint32_t reserved1[11];
+        struct Dds_Pixel_Format pixel_format;
+        uint32_t caps;
+        uint32_t caps2;
+        uint32_t caps3;
+        uint32_t caps4;
+        uint32_t reserved2;
+    };
+    typedef struct Dds_Header Dds_Header;
+
+    struct Dds_Header_DX10 {
+        uint32_t dxgi_format;
+        uint32_t resource_dimension;
+        uint32_t misc_flag;
+        uint32_t array_size;
+        uint32_t misc_flags2;
+    };
+    typedef struct Dds_Header_DX10 Dds_Header_DX10;
+
+    #define TEXTURE_MAX_LEVELS 16
+
+    struct Texture_Level {
+        unsigned int    width;
+        unsigned int    height;
+        size_t          size;       //bytes
+        unsigned char * data;       //points into Compressed_Image.blob
+    };
+    typedef struct Texture_Level Texture_Level;
+
+    struct Compressed_Image {
+        GLenum          internal_format;
+        unsigned int    block_size; //bytes per 4x4 block
+        unsigned int    width;
+        unsigned int    height;
+        unsigned int    num_levels;
+        Texture_Level   levels[TEXTURE_MAX_LEVELS];
+        unsigned char * blob;       //entire file, owned by the image
+        size_t          blob_size;
+    };
+    typedef struct Compressed_Image Compressed_Image;
+
+    texture_error_t compressed_image_load(const char * file_name,
+                                          Compressed_Image * out);
+    texture_error_t compressed_image_upload(Compressed_Image * image,
+                                            unsigned int * texture_id);
+    void compressed_image_free(Compressed_Image * image);
+    texture_error_t compressed_texture_from_file(const char * file_name,
+                                                 unsigned int * texture_id);
+    int compressed_texture_path(const char * file_name, char * out,
+                                int max_length);
+    int texture_is_compressed_file(const char * file_name);
+    size_t compressed_level_size(unsigned int block_size, unsigned int width,
+                                 unsigned int height);
+#endif
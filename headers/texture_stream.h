@@ -0,0 +1,107 @@
+#ifndef TEXTURE_STREAM_H
+    #define TEXTURE_STREAM_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <stddef.h>
+    #include <model.h>
+    #include <jobs.h>
+
+
+    typedef enum {
+        TEXTURE_STREAM_SUCCESS =  0,
+        TEXTURE_STREAM_NO_MEM  = -1,
+        TEXTURE_STREAM_ERR     = -2,
+    } texture_stream_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    /* Largest dimension of the mip level every texture keeps resident,
+     * whatever the budget.
+     */
+    #define TEXTURE_STREAM_TAIL_SIZE 64
+
+    /* A decode running on the job pool. base is the finest level wanted,
+     * or -1 for the tail, and is only read once the request is queued.
+     * image is a view into the texture's source holding the levels to
+     * upload, it owns no memory.
+     */
+    struct Stream_Request {
+        Job_Group     group;
+        Texture_Image image;
+        int           base;
+        int           active;
+        int           decode;       //source has to be decoded first
+        //Filled in by the worker
+        int           level;        //base, resolved and clamped
+        int           width;
+        int           height;
+        int           num_levels;
+        unsigned int  block_size;   //0 when uncompressed
+        int           texel_bytes;
+    };
+    typedef struct Stream_Request Stream_Request;
+
+    /* Levels resident_base .. num_levels - 1 of the source are on the GPU,
+     * uploaded as levels 0 .. of the GL texture. When the resident range
+     * changes a new GL texture is built off to the side and its name
+     * written through slots, so meshes never sample a half built texture.
+     *
+     * The decoded source is kept while any level finer than the tail is
+     * resident, so moving between levels doesn't decode the file again.
+     * It goes once the texture is back down to its tail.
+     */
+    struct Stream_Texture {
+        const char *    path;
+        texture_t       type;
+        Model *         model;
+        unsigned int    id;
+        unsigned int ** slots;
+        int             num_slots;
+        int             width;
+        int             height;
+        int             num_levels;     //0 until the tail has loaded
+        unsigned int    block_size;
+        int             texel_bytes;
+        int             resident_base;
+        int             wanted;         //finest level asked for this frame
+        unsigned int    last_used;      //frame of the last request
+        Texture_Image   source;         //full chain, if source_ready
+        int             source_ready;
+        Stream_Request  request;
+    };
+    typedef struct Stream_Texture Stream_Texture;
+
+    struct Texture_Streamer {
+        Job_Pool *        pool;
+        Stream_Texture ** textures;
+        Stream_Texture ** scratch;          //sorting space for update
+        int               num_textures;
+        int               capacity;
+        size_t            budget;           //bytes of texture memory
+        size_t            resident;         //bytes currently uploaded
+        size_t            upload_limit;     //bytes uploaded per update
+        int               max_in_flight;    //decodes queued at once
+        int               in_flight;
+        int               lod_bias;
+        unsigned int      frame;
+    };
+    typedef struct Texture_Streamer Texture_Streamer;
+
+
+    texture_stream_error_t texture_stream_init(Texture_Streamer * streamer,
+                                               size_t budget);
+    void texture_stream_destroy(Texture_Streamer * streamer);
+    texture_stream_error_t texture_stream_add_model(Texture_Streamer * streamer,
+                                                    Model * model);
+    void texture_stream_request_model(Texture_Streamer * streamer,
+                                      const Model * model,
+                                      float screen_size);
+    void texture_stream_update(Texture_Streamer * streamer);
+    float texture_stream_screen_size(float radius, float distance,
+                                     float fov_y, int viewport_height);
+#endif
@@ -0,0 +1,89 @@
+#ifndef TRANSFORM_H
+    #define TRANSFORM_H
+
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <glad/glad.h>
+    #include <linmath.h>
+    #include <jobs.h>
+    #include <memstat.h>
+
+
+    typedef enum {
+        TRANSFORM_SUCCESS =  0,
+        TRANSFORM_NO_MEM  = -1,
+        TRANSFORM_GL_ERR  = -2,
+    } transform_error_t;
+
+    #ifndef err_print
+        #define err_print(msg){\
+            fprintf(stderr, "%s %d: "msg"\n", __FILE__, __LINE__);\
+        }
+    #endif
+
+    /* Objects per job in transform_set_update. Big enough that a job
+     * outlasts the cost of queueing it.
+     */
+    #define TRANSFORM_JOB_SIZE 4096
+
+    /* What transform_set_update writes per object, laid out to be read
+     * straight from an instance buffer: eight vec4 attributes, the model
+     * matrix's columns then the normal matrix's.
+     */
+    struct Transform_Instance {
+        mat4x4 model;
+        mat4x4 normal_matrix;
+    };
+    typedef struct Transform_Instance Transform_Instance;
+
+    /* Positions, rotations and scales of many objects, one array per
+     * component so eight objects load into a register at a time. Rotations
+     * are unit quaternions, x, y, z then w as in linmath, and scales must
+     * not be zero. Model matrices come out as translate * rotate * scale.
+     */
+    struct Transform_Set {
+        unsigned int  count;
+        unsigned int  capacity;
+        float *       position[3];
+        float *       rotation[4];
+        float *       scale[3];
+        Memstat_Asset memory;
+    };
+    typedef struct Transform_Set Transform_Set;
+
+
+    transform_error_t transform_set_init(Transform_Set * set,
+                                         unsigned int capacity);
+    void transform_set_free(Transform_Set * set);
+    /* Returns the new object's index, or -1 when out of memory. */
+    int transform_set_add(Transform_Set * set, const vec3 position,
+                          const quat rotation, const vec3 scale);
+    void transform_set_position(Transform_Set * set, unsigned int index,
+                                const vec3 position);
+    void transform_set_rotation(Transform_Set * set, unsigned int index,
+                                const quat rotation);
+    /* Rotation of angle radians about axis, which needn't be unit length. */
+    void transform_set_axis_angle(Transform_Set * set, unsigned int index,
+                                  const vec3 axis, float angle);
+    void transform_set_scale(Transform_Set * set, unsigned int index,
+                             const vec3 scale);
+
+    /* Model and normal matrices of objects first to first + count - 1,
+     * into out[0] onwards.
+     */
+    void transform_set_compute(const Transform_Set * set,
+                               Transform_Instance * out, unsigned int first,
+                               unsigned int count);
+    /* Every object, split into jobs on pool, which may be NULL. */
+    void transform_set_update(const Transform_Set * set,
+                              Transform_Instance * out, Job_Pool * pool);
+    /* Updates straight into buffer, which must hold count instances, by
+     * mapping it with its old contents invalidated.
+     */
+    transform_error_t transform_set_upload(const Transform_Set * set,
+                                           GLuint buffer, Job_Pool * pool);
+    /* Points attributes location to location + 7 of the bound vertex
+     * array at buffer, one Transform_Instance per instance.
+     */
+    void transform_instance_attributes(GLuint buffer, GLuint location);
+#endif
@@ -165,7 +165,7 @@ int main(){
         setFloat(model_shader, "point_light.quadratic", 0.017f);
         setFloat(model_shader, "material.shininess", 4.f);
 
-        draw_model(model_shader, backpack);
+        draw_model(model_shader, &backpack);
 
         glfwSwapBuffers(window);
         glfwPollEvents();
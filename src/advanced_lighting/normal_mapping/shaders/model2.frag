@@ -61,7 +61,11 @@ vec3 calc_point_light(Light light, vec3 fragment_position)
                                     texture_coordinates).rgb;
     vec3 normal_texture = texture(material.texture_normal1,
                                   texture_coordinates).rgb;
-    normal_texture = normalize(2.0 * normal_texture - vec3(1.0));
+    //BC5 maps only hold x and y
+    normal_texture.xy = 2.0 * normal_texture.xy - vec2(1.0);
+    normal_texture.z = sqrt(max(1.0 - dot(normal_texture.xy,
+                                          normal_texture.xy), 0.0));
+    normal_texture = normalize(normal_texture);
     /* R(i, n) - R is reflection, i is incident vector, n is normal vector.
      * R(i, n) by definition is i - 2(i * n)n. One can check that
      * R(i, Mn) = M R(M^Ti, n) when M is an orthogonal matrix.
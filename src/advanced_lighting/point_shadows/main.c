@@ -9,7 +9,11 @@
 #include <camera.h>
 #include <shader.h>
 #include <model.h>
+#include <texture_stream.h>
+#include <model_loader.h>
 #include <light.h>
+#include <input.h>
+#include <frame_clock.h>
 
 
 #define SUCCESS 0;
@@ -35,8 +39,44 @@ static char depth_geom_source[] = "shaders/point_shadow.geom";
 static char depth_vert_source[] = "shaders/point_shadow.vert";
 static char texture_frag_source[] = "shaders/texture_render.frag";
 static char texture_vert_source[] = "shaders/texture_render.vert";
+static char cull_comp_source[] = "shaders/meshlet_cull.comp";
+static char hiz_comp_source[] = "shaders/hiz_reduce.comp";
+/* Build with -DFULL_VERTICES to draw from the float vertex layout. */
+#ifdef FULL_VERTICES
+static const char * vertex_defines = NULL;
+static const vertex_format_t vertex_format = VERTEX_FORMAT_FULL;
+#else
+static const char * vertex_defines = "#define PACKED_VERTICES\n";
+static const vertex_format_t vertex_format = VERTEX_FORMAT_PACKED;
+#endif
+/* Build with -DGPU_CULLING to cull meshlets in a compute shader, against
+ * the frustum and a depth pyramid of the previous frame.
+ */
+#ifdef GPU_CULLING
+static const int gpu_culling = 1;
+#else
+static const int gpu_culling = 0;
+#endif
+/* Build with -DOCCLUSION_CULLING to also skip meshes hidden behind the
+ * backpack's large parts, found on the CPU.
+ */
+#ifdef OCCLUSION_CULLING
+static const int occlusion_culling = 1;
+#else
+static const int occlusion_culling = 0;
+#endif
 static int WIDTH = 1920;
 static int HEIGHT = 1080;
+/* Texture memory the backpack may use once streamed in. */
+static size_t TEXTURE_BUDGET = 64 << 20;
+static float BACKPACK_RADIUS = 1.5f;
+/* Meshes at least this large relative to the backpack occlude others. */
+static float OCCLUDER_FRACTION = .25f;
+/* Animation runs in fixed steps of this many seconds. */
+static double SIMULATION_STEP = 1. / 120.;
+static float LIGHT_SPEED = 50.f * M_PI / 180.f;
+/* Seconds per frame spent uploading while the model loads. */
+static double LOAD_SLICE = .004;
 
 
 static const float quad_data[] = {
@@ -62,6 +102,11 @@ void print_array(float * array, int rows, int cols){
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
+    struct Camera * cam = windowCamera(window);
+
+    if (cam){
+        setCameraViewport(cam, 0, 0, width, height);
+    }
     glViewport(0, 0, width, height);
 }
 
@@ -74,34 +119,64 @@ void basic_loading_screen(GLFWwindow * window)
 }
 
 
-void draw_loading_screen(GLFWwindow * window, unsigned int plane_vao,
-                         struct Shader * texture_shader)
+unsigned int load_loading_screen(void)
 {
-    /* Be sure texture shader is available */
-    glClearColor(0.f, 0.f, 0.f, 1.f);
-    glClear(GL_COLOR_BUFFER_BIT);
+    unsigned int loading_screen_id = 0;
 
-    unsigned int loading_screen_id;
     // This handy function comes from model.c. Hooray abstraction :)
     if (texture_from_file("../../model_loading/model/models/"
                           "loading_screen.jpg", &loading_screen_id)){
         err_print("error loading loading screen texture (l0l)");
     }
+    return loading_screen_id;
+}
+
+
+void draw_loading_screen(GLFWwindow * window, unsigned int plane_vao,
+                         struct Shader * texture_shader,
+                         unsigned int loading_screen_id, float progress)
+{
+    /* Be sure texture shader is available. Drawn every frame while the
+     * model loads, with a pulsing progress bar along the bottom.
+     */
+    float pulse = .6f + .4f * sinf(6.f * (float)glfwGetTime());
+    int bar_height = HEIGHT / 60;
+
+    glClearColor(0.f, 0.f, 0.f, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-    shader_err_t result;
     GL_ERR_CHECK;
-    result = use(texture_shader);
+    use(texture_shader);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, loading_screen_id);
     setInt(texture_shader, "texture_to_render", 0);
     glBindVertexArray(plane_vao);
     glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(0, 0, WIDTH, bar_height);
+    glClearColor(.1f, .1f, .1f, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glScissor(0, 0, (int)(progress * WIDTH), bar_height);
+    glClearColor(.2f * pulse, .6f * pulse, pulse, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
     glfwSwapBuffers(window);
 }
 
 
-int main(){
+int main(int argc, char ** argv){
+    /* ./main --record FILE saves the camera input of a run, and
+     * ./main --replay FILE plays it back frame for frame, so timings of
+     * different builds can be compared over the same camera path.
+     * --step SECONDS makes every frame last that long, on a virtual
+     * clock, and --fps N caps the frame rate.
+     */
     int status = SUCCESS;
+    Input_Recorder input;
+    Frame_Clock frame_clock;
+    const char * record_path = NULL, * replay_path = NULL;
+    double virtual_step = 0., frame_limit = 0.;
     int numFrames = 0;
     mat4x4 model_matrix;
     mat4x4 normal_matrix;
@@ -111,6 +186,27 @@ int main(){
     const int AA_RATE = 4;
     clock_t clock_start, diff;
 
+    input_live(&input);
+    frame_clock_init(&frame_clock, SIMULATION_STEP);
+    for (int i = 1; i + 1 < argc; i += 2){
+        if (!strcmp(argv[i], "--record")){
+            record_path = argv[i + 1];
+        } else if (!strcmp(argv[i], "--replay")){
+            replay_path = argv[i + 1];
+        } else if (!strcmp(argv[i], "--step")){
+            virtual_step = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--fps")){
+            frame_limit = atof(argv[i + 1]);
+        } else{
+            fprintf(stderr, "Unknown option %s.\n", argv[i]);
+        }
+    }
+    if (argc % 2 == 0){
+        fprintf(stderr, "Option %s needs a value, ignored.\n", argv[argc - 1]);
+    }
+    frame_clock_set_limit(&frame_clock, frame_limit);
+    frame_clock_set_virtual(&frame_clock, virtual_step);
+
     /* glfw init and context creation */
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -128,9 +224,17 @@ int main(){
     }
     glfwMakeContextCurrent(window);
     /* user input callbacks */
+    if (replay_path){
+        if (input_replay(&input, replay_path, virtual_step)){
+            status = FAILURE;
+            goto cleanup_glfw;
+        }
+    } else if (record_path && input_record(&input, record_path)){
+        err_print("Not recording, running on live input only.");
+    }
+    input.step = virtual_step;
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, glfwCompatMouseMovementCallback);
-    glfwSetScrollCallback(window, glfwCompatMouseScrollCallback);
+    input_attach(&input, window);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     //initialize GLAD loader
@@ -160,15 +264,23 @@ int main(){
                           (void *)(3 * sizeof(float)));
     glBindVertexArray(0);
 
+    Texture_Streamer streamer;
+    texture_stream_init(&streamer, TEXTURE_BUDGET);
+    /* Zeroed here so cleanup is safe from any point below. */
+    Occlusion_Buffer occlusion;
+    memset(&occlusion, 0, sizeof(Occlusion_Buffer));
+    Hiz hiz;
+    memset(&hiz, 0, sizeof(Hiz));
+
     struct Shader * model_shader = shaderInit();
-    if (load(model_shader, model_vert_source,
-             model_frag_source) != SHADER_NO_ERR){
+    if (shaderLoadDefines(model_shader, model_vert_source, model_frag_source,
+                          NULL, vertex_defines) != SHADER_NO_ERR){
         err_print("model shader compile error");
         goto cleanup_gl;
     }
     struct Shader * depth_shader = shaderInit();
-    if (shaderLoad(depth_shader, depth_vert_source,
-                   depth_frag_source, depth_geom_source) != SHADER_NO_ERR){
+    if (shaderLoadDefines(depth_shader, depth_vert_source, depth_frag_source,
+                          depth_geom_source, vertex_defines) != SHADER_NO_ERR){
         err_print("point shadow shader compile error");
         goto cleanup_gl;
     }
@@ -178,9 +290,32 @@ int main(){
         err_print("texture render shader compile error");
         goto cleanup_gl;
     }
+    struct Shader * cull_shader = NULL;
+    struct Shader * hiz_shader = NULL;
+    if (gpu_culling){
+        cull_shader = shaderInit();
+        if (shaderLoadCompute(cull_shader, cull_comp_source,
+                              NULL) != SHADER_NO_ERR){
+            err_print("meshlet cull shader compile error");
+            goto cleanup_gl;
+        }
+        hiz_shader = shaderInit();
+        if (shaderLoadCompute(hiz_shader, hiz_comp_source,
+                              NULL) != SHADER_NO_ERR){
+            err_print("depth pyramid shader compile error");
+            goto cleanup_gl;
+        }
+        if (hiz_init(&hiz, WIDTH, HEIGHT, hiz_shader)){
+            goto cleanup_gl;
+        }
+    }
 
-    // Loading screen
-    draw_loading_screen(window, plane_vao, texture_render);
+    /* Before loading, whose event polling reaches the camera callbacks. */
+    struct Camera * cam;
+    cam = cameraInit(WIDTH, HEIGHT);
+    cam->movementSpeed = 5.f;
+    attachCamera(window, cam);
+    camErrorHandler(setCameraPosition(cam, 0, 0, 3));
 
     Model backpack;
     backpack.file_path = model_path;
@@ -188,12 +323,50 @@ int main(){
     backpack.directory = NULL;
     backpack.num_meshes = 0;
     backpack.loaded_textures = NULL;
-    if (load_model(&backpack)){
+    /* The backpack imports on the job pool while the loading screen
+     * animates. Meshes upload a few per frame, textures are left to the
+     * streamer.
+     */
+    unsigned int loading_screen_id = load_loading_screen();
+    Model_Load backpack_load;
+    model_load_state_t load_state;
+    model_load_begin(&backpack_load, &backpack, job_pool_default(),
+                     vertex_format, 0);
+    do {
+        load_state = model_load_poll(&backpack_load, LOAD_SLICE);
+        draw_loading_screen(window, plane_vao, texture_render,
+                            loading_screen_id,
+                            model_load_progress(&backpack_load));
+        glfwPollEvents();
+        if (glfwWindowShouldClose(window)){
+            load_state = model_load_finish(&backpack_load);
+            break;
+        }
+    } while (load_state != MODEL_LOAD_DONE && \
+             load_state != MODEL_LOAD_FAILED);
+    glDeleteTextures(1, &loading_screen_id);
+    if (load_state == MODEL_LOAD_FAILED){
         fprintf(stderr, "%s %d: Failed to load backpack model.\n", __FILE__,
                 __LINE__);
-        goto end;
+        status = FAILURE;
+        goto cleanup_gl;
+    }
+    model_vertex_cache_report(&backpack, stdout);
+    /* Picking and occlusion culling only need positions and indices. */
+    model_set_residency(&backpack, MODEL_KEEP_POSITIONS);
+    /* Only the smallest mips are loaded here, the rest stream in. */
+    if (texture_stream_add_model(&streamer, &backpack)){
+        err_print("Failed to stream backpack textures");
+    }
+
+    if (occlusion_init(&occlusion, 256, 128)){
+        status = FAILURE;
+        goto cleanup_gl;
+    }
+    for (int i = 0; i < backpack.num_meshes; i++){
+        backpack.meshes[i].occluder = backpack.meshes[i].radius >= \
+                                      OCCLUDER_FRACTION * BACKPACK_RADIUS;
     }
-    setup_model(&backpack);
 
     Texture_Node * node;
     int num_textures = 0;
@@ -201,12 +374,6 @@ int main(){
         num_textures += 1;
     }
 
-    struct Camera * cam;
-    cam = cameraInit(WIDTH, HEIGHT);
-    cam->movementSpeed = 5.f;
-    setActiveCamera(cam);
-    setActiveCameraPosition(0, 0, 3);
-
     Light light;
     light_init(&light);
     /* Set the shadow texture resolution before the gl init call. 
@@ -214,10 +381,10 @@ int main(){
      */
     light.shadow_width = 2048;
     light.shadow_height = 2048;
-    /* This allocates a framebuffer, texture, etc. */
-    light_shadow_cube_map_init(&light);
     light.name = malloc(12 * sizeof(char));
     snprintf(light.name, 12, "point_light");
+    /* This allocates a framebuffer, texture, etc. */
+    light_shadow_cube_map_init(&light);
     vec3 point_ambient = {0.4f, 0.4f, 0.4f};
     vec3 point_diffuse = {1.f, 1.f, 1.f};
     vec3 point_specular = {3.f, 3.f, 3.f};
@@ -228,15 +395,32 @@ int main(){
     glEnable(GL_MULTISAMPLE);
     glEnable(GL_DEPTH_TEST);
     float glfw_loop_start_time = (float)glfwGetTime();
+    #ifdef DEBUG
+    int clicked = 0;
+    #endif
+    float light_angle = 0.f, previous_light_angle = 0.f;
 
     while (!glfwWindowShouldClose(window)){
         numFrames += 1;
-        time = (float)glfwGetTime();
-
         glClearColor(0.2f, 0.2f, 0.2f, 1.f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glfwCompatKeyboardCallback(window);
+        input_frame(&input, window);
+        /* A replay's frames take the recorded times, or its fixed step. */
+        if (input.mode == INPUT_REPLAY){
+            frame_clock_begin_at(&frame_clock, input_time(&input));
+        } else{
+            frame_clock_begin(&frame_clock);
+        }
+        while (frame_clock_tick(&frame_clock)){
+            previous_light_angle = light_angle;
+            light_angle += LIGHT_SPEED * frame_clock.step;
+            /* Kept small so long runs don't lose precision. */
+            if (light_angle >= 2.f * M_PI){
+                light_angle -= 2.f * M_PI;
+                previous_light_angle -= 2.f * M_PI;
+            }
+        }
 
         /* Parameters shared by all shaders */
         vec4 light_position_4;
@@ -244,12 +428,17 @@ int main(){
         vec4 light_initial_position = {4.f, 0.f, 0.f, 0.f};
         mat4x4 R;
         mat4x4_identity(R);
-        float angle = time*50*M_PI/180;
+        float angle = previous_light_angle + frame_clock_alpha(&frame_clock) * \
+                      (light_angle - previous_light_angle);
         mat4x4_rotate(R, R, 0.f, 1.f, 0.f, angle);
         mat4x4_mul_vec4(light_position_4, R, light_initial_position);
         vec3_dup(light.position, light_position_4);
         mat4x4_identity(model_matrix);
         mat4x4_identity(normal_matrix);
+        model_set_transform(&backpack, model_matrix);
+        /* Detail levels follow the camera, the shadow pass included. */
+        model_set_lod_view(&backpack, *cam->position, toRadians(cam->zoom),
+                           HEIGHT, MODEL_LOD_THRESHOLD);
 
         /* depth mapping */
         float far_plane = 10.f;
@@ -263,17 +452,30 @@ int main(){
         setMat4x4(depth_shader, "model_matrix", model_matrix);
         glViewport(0, 0, light.shadow_width, light.shadow_height);
         GL_ERR_CHECK;
+        /* Every face at once, so cull to the box they cover together. The
+         * shadow and camera passes are culled together, as views 0 and 1.
+         */
+        mat4x4 cull_views[2];
+        light_shadow_cube_bounds(&light, far_plane, cull_views[0]);
+        mat4x4_dup(cull_views[1], getCameraMatrices(cam)->viewProjection);
+        model_cull_views(&backpack, cull_views, 2);
+        model_set_cull_view(&backpack, cull_views[0], light.position, 0,
+                            cull_shader);
+        model_use_view(&backpack, 0);
+        /* Only meshes within the light's range can cast into its map. */
         model_error_t draw_result;
-        if (draw_result = draw_model(depth_shader, backpack)){
+        if (model_query_sphere(&backpack, light.position, far_plane, NULL) && \
+            (draw_result = draw_model(depth_shader, &backpack)))
+        {
             err_print("failure drawing with depth shader");
             fprintf(stderr, "Error code: %x\n", draw_result);
-            goto cleanup_gl;
+            goto cleanup_light;
         }
 
         /* Undo shadow configuration */
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         glClear(GL_DEPTH_BUFFER_BIT);
-        glViewport(0, 0, WIDTH, HEIGHT);
+        useCameraViewport(cam);
         glCullFace(GL_BACK);
 
         /* Draw model */
@@ -312,7 +514,55 @@ int main(){
         setFloat(model_shader, "material.shininess", 4.f);
         setFloat(model_shader, "far_plane", far_plane);
         light_to_shader(&light, model_shader);
-        draw_model(model_shader, backpack);
+        mat4x4 view_projection;
+        mat4x4_dup(view_projection, cull_views[1]);
+        model_set_cull_view(&backpack, view_projection, *cam->position, 1,
+                            cull_shader);
+        model_use_view(&backpack, 1);
+        if (occlusion_culling){
+            occlusion_begin(&occlusion, view_projection);
+            model_add_occluders(&backpack, &occlusion);
+            occlusion_rasterize(&occlusion, job_pool_default());
+            model_set_occlusion(&backpack, &occlusion);
+        }
+        if (gpu_culling){
+            model_set_hiz(&backpack, &hiz);
+        }
+        draw_model(model_shader, &backpack);
+        if (gpu_culling){
+            /* Next frame culls against this one, and whatever last
+             * frame's pyramid hid wrongly is drawn now.
+             */
+            hiz_build(&hiz, 0, view_projection);
+            draw_model_disoccluded(model_shader, &backpack);
+        }
+
+        #ifdef DEBUG
+        /* A left click picks whatever is under the crosshair. */
+        int click = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT);
+        if (click == GLFW_PRESS && !clicked){
+            vec3 ray_origin, ray_direction;
+            float distance;
+            getPickRay(cam, WIDTH / 2., HEIGHT / 2., WIDTH, HEIGHT,
+                       ray_origin, ray_direction);
+            int picked = model_pick(&backpack, ray_origin, ray_direction,
+                                    &distance);
+            if (picked >= 0){
+                printf("Picked mesh %d at distance %f\n", picked, distance);
+            }
+        }
+        clicked = click == GLFW_PRESS;
+        #endif
+
+        /* Texture residency for the next frame */
+        vec3 to_model;
+        vec3_sub(to_model, *cam->position, model_matrix[3]);
+        texture_stream_request_model(&streamer, &backpack,
+                                     texture_stream_screen_size(
+                                         BACKPACK_RADIUS,
+                                         vec3_len(to_model),
+                                         toRadians(cam->zoom), HEIGHT));
+        texture_stream_update(&streamer);
 
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -324,11 +574,17 @@ int main(){
     time = (float)glfwGetTime() - glfw_loop_start_time;
     printf("Rendered %i frames in %1.10f seconds amounting to %f FPS.\n",
            numFrames, time, numFrames / time);
+    memstat_report(stdout);
 
+    cleanup_light:
+        light_free(&light);
     cleanup_gl:
+        texture_stream_destroy(&streamer);
+        occlusion_free(&occlusion);
+        hiz_free(&hiz);
         free_model(&backpack);
     cleanup_glfw:
+        input_end(&input);
         glfwTerminate();
-    end:
         return status;
 }
@@ -1,10 +1,31 @@
 #version 400 core
 
+#ifdef PACKED_VERTICES
+/* See struct Packed_Vertex in model.h */
+layout (location=0) in vec4 in_position;
+layout (location=1) in vec2 in_normal;
+layout (location=2) in vec2 in_texture_coordinates;
+layout (location=3) in vec2 in_tangent;
+
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
+vec3 octahedral_decode(vec2 e)
+{
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0){
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0,
+                                        v.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(v);
+}
+#else
 layout (location=0) in vec3 in_position;
 layout (location=1) in vec3 in_normal;
 layout (location=2) in vec2 in_texture_coordinates;
 layout (location=3) in vec3 in_tangent;
 layout (location=4) in vec3 in_bitangent;
+#endif
 
 out vec3 fragment_position;
 out vec3 normal;
@@ -39,12 +60,25 @@ uniform Light point_light;
 
 
 void main(){
-    fragment_position = vec3(model_matrix * vec4(in_position, 1.0));
+#ifdef PACKED_VERTICES
+    vec3 position = position_offset + position_scale * in_position.xyz;
+    vec3 vertex_normal = octahedral_decode(in_normal);
+    vec3 vertex_tangent = octahedral_decode(in_tangent);
+    vec3 vertex_bitangent = (in_position.w > 0.5 ? -1.0 : 1.0) * \
+                            cross(vertex_normal, vertex_tangent);
+#else
+    vec3 position = in_position;
+    vec3 vertex_normal = in_normal;
+    vec3 vertex_tangent = in_tangent;
+    vec3 vertex_bitangent = in_bitangent;
+#endif
+    fragment_position = vec3(model_matrix * vec4(position, 1.0));
 	texture_coordinates = in_texture_coordinates;
-	gl_Position = projection * view * model_matrix * vec4(in_position, 1.0);
-    vec3 tangent = normalize(vec3(normal_matrix * vec4(in_tangent, 0.0)));
-    vec3 bitangent = normalize(vec3(normal_matrix * vec4(in_bitangent, 0.0)));
-    normal = normalize(vec3(normal_matrix * vec4(in_normal, 0.0)));
+	gl_Position = projection * view * model_matrix * vec4(position, 1.0);
+    vec3 tangent = normalize(vec3(normal_matrix * vec4(vertex_tangent, 0.0)));
+    vec3 bitangent = normalize(vec3(normal_matrix * \
+                                    vec4(vertex_bitangent, 0.0)));
+    normal = normalize(vec3(normal_matrix * vec4(vertex_normal, 0.0)));
     tbn_matrix = mat3(tangent, bitangent, normal);
     mat3 tbn_transpose = transpose(tbn_matrix);
     light_direction = tbn_transpose * normalize(point_light.position \
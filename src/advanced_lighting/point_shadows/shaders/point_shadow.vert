@@ -1,14 +1,26 @@
 #version 450 core
 
+#ifdef PACKED_VERTICES
+layout (location = 0) in vec4 in_position;
+
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+#else
 layout (location = 0) in vec3 in_position;
 layout (location = 1) in vec3 in_normal;
 layout (location = 2) in vec2 in_texture_coordinates;
 layout (location = 3) in vec3 in_tangent;
 layout (location = 4) in vec3 in_bitangent;
+#endif
 
 uniform mat4 model_matrix;
 
 void main()
 {
-    gl_Position = model_matrix * vec4(in_position, 1.0);
+#ifdef PACKED_VERTICES
+    vec3 position = position_offset + position_scale * in_position.xyz;
+#else
+    vec3 position = in_position;
+#endif
+    gl_Position = model_matrix * vec4(position, 1.0);
 }
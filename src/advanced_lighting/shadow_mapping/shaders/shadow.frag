@@ -140,7 +140,11 @@ vec3 calc_point_light(Light light, vec3 fragment_position)
      */
     vec3 normal_texture = texture(material.texture_normal1,
                                   texture_coordinates).rgb;
-    normal_texture = normalize(2.0 * normal_texture - vec3(1.0));
+    //BC5 maps only hold x and y
+    normal_texture.xy = 2.0 * normal_texture.xy - vec2(1.0);
+    normal_texture.z = sqrt(max(1.0 - dot(normal_texture.xy,
+                                          normal_texture.xy), 0.0));
+    normal_texture = normalize(normal_texture);
 
     vec3 ambient = light.ambient * material_texture;
     float diff = max(dot(normal_texture, light_direction), 0.0);
@@ -219,9 +219,9 @@ int main(){
     light.shadow_width = 2048;
     light.shadow_height = 2048;
     /* This allocates a framebuffer, texture, etc. */
-    light_shadow_gl_init(&light);
     light.name = malloc(12 * sizeof(char));
     snprintf(light.name, 12, "point_light");
+    light_shadow_gl_init(&light);
     vec3 point_ambient = {0.4f, 0.4f, 0.4f};
     vec3 point_diffuse = {1.f, 1.f, 1.f};
     vec3 point_specular = {3.f, 3.f, 3.f};
@@ -284,10 +284,10 @@ int main(){
         glViewport(0, 0, light.shadow_width, light.shadow_height);
         GL_ERR_CHECK;
         model_error_t draw_result;
-        if (draw_result = draw_model(depth_shader, backpack)){
+        if (draw_result = draw_model(depth_shader, &backpack)){
             err_print("failure drawing with depth shader");
             fprintf(stderr, "Error code: %x\n", draw_result);
-            goto cleanup_gl;
+            goto cleanup_light;
         }
 
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -304,7 +304,7 @@ int main(){
         result = use(texture_render);
         if (result != SHADER_NO_ERR){
             err_print("Error using texture_render");
-            goto cleanup_gl;
+            goto cleanup_light;
         }
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, light.depth_texture);
@@ -332,7 +332,7 @@ int main(){
 
         setFloat(model_shader, "material.shininess", 4.f);
         light_to_shader(&light, model_shader);
-        draw_model(model_shader, backpack);
+        draw_model(model_shader, &backpack);
         #endif
 
         glfwSwapBuffers(window);
@@ -359,6 +359,8 @@ int main(){
     printf("Rendered %i frames in %1.10f seconds amounting to %f FPS.\n",
            numFrames, time, numFrames/time);
 
+    cleanup_light:
+        light_free(&light);
     cleanup_gl:
         free_model(&backpack);
     cleanup_glfw:
@@ -334,9 +334,9 @@ int main(){
      */
     light.shadow_width = 2048;
     light.shadow_height = 2048;
-    light_shadow_cube_map_init(&light);
     light.name = malloc(12 * sizeof(char));
     snprintf(light.name, 12, "point_light");
+    light_shadow_cube_map_init(&light);
     vec3 point_ambient = {0.4f, 0.4f, 0.4f};
     vec3 point_diffuse = {1.f, 1.f, 1.f};
     vec3 point_specular = {3.f, 3.f, 3.f};
@@ -391,10 +391,10 @@ int main(){
         glViewport(0, 0, light.shadow_width, light.shadow_height);
         GL_ERR_CHECK;
         model_error_t draw_result;
-        if (draw_result = draw_model(depth_shader, backpack)){
+        if (draw_result = draw_model(depth_shader, &backpack)){
             err_print("failure drawing with depth shader");
             fprintf(stderr, "Error code: %x\n", draw_result);
-            goto cleanup_gl;
+            goto cleanup_light;
         }
 
         /* Undo shadow configuration */
@@ -447,7 +447,7 @@ int main(){
         setFloat(model_shader, "material.shininess", 4.f);
         setFloat(model_shader, "far_plane", far_plane);
         light_to_shader(&light, model_shader);
-        draw_model(model_shader, backpack);
+        draw_model(model_shader, &backpack);
 
         /* skybox */
         glDepthFunc(GL_LEQUAL);
@@ -474,6 +474,8 @@ int main(){
     printf("Rendered %i frames in %1.10f seconds amounting to %f FPS.\n",
            numFrames, time, numFrames / time);
 
+    cleanup_light:
+        light_free(&light);
     cleanup_gl:
         free_model(&backpack);
     cleanup_glfw:
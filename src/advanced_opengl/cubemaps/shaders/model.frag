@@ -156,7 +156,11 @@ vec3 calc_point_light(Light light, vec3 fragment_position, vec3 normal)
      */
     vec3 material_normal = texture(material.texture_normal1,
                                   texture_coordinates).rgb;
-    material_normal = normalize(2.0 * material_normal - vec3(1.0));
+    //BC5 maps only hold x and y
+    material_normal.xy = 2.0 * material_normal.xy - vec2(1.0);
+    material_normal.z = sqrt(max(1.0 - dot(material_normal.xy,
+                                           material_normal.xy), 0.0));
+    material_normal = normalize(material_normal);
 
     vec3 ambient = light.ambient * material_diffuse;
     float diff = max(dot(material_normal, light_direction), 0.0);
@@ -239,7 +243,11 @@ void main(){
     vec3 light_effects;
     vec3 material_normal = texture(material.texture_normal1,
                                   texture_coordinates).rgb;
-    material_normal = normalize(2.0 * material_normal - vec3(1.0));
+    //BC5 maps only hold x and y
+    material_normal.xy = 2.0 * material_normal.xy - vec2(1.0);
+    material_normal.z = sqrt(max(1.0 - dot(material_normal.xy,
+                                           material_normal.xy), 0.0));
+    material_normal = normalize(material_normal);
     float refractive_index = 1.52;
 
     light_effects = calc_point_light(point_light, fragment_position,
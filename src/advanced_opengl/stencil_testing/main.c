@@ -152,7 +152,7 @@ int main(){
         setProjectionMatrix(cam, model_shader, "projection");
         mat4x4_identity(model_matrix);
         mat4x4_identity(normal_matrix);
-        sendMatrixToShader(model_matrix, "model_matrix", model_shader);
+        model_set_transform(&backpack, model_matrix);
         sendMatrixToShader(normal_matrix, "normal_matrix", model_shader);
         vec3 point_ambient = {0.4f, 0.4f, 0.4f};
         vec3 point_diffuse = {2.f, 2.f, 2.f};
@@ -176,7 +176,7 @@ int main(){
         setFloat(model_shader, "point_light.linear", 0.07f);
         setFloat(model_shader, "point_light.quadratic", 0.017f);
         setFloat(model_shader, "material.shininess", 32.f);
-        draw_model(model_shader, backpack);
+        draw_model(model_shader, &backpack);
 
         /* Draw upscaled monotone container */
         glStencilFunc(GL_NOTEQUAL, 1, 0xff);
@@ -187,9 +187,9 @@ int main(){
         setProjectionMatrix(cam, model_shader, "projection");
         mat4x4_scale(model_matrix, model_matrix, 1.05);
         model_matrix[3][3] = 1.0;
-        sendMatrixToShader(model_matrix, "model_matrix", monotone_shader);
+        model_set_transform(&backpack, model_matrix);
         sendMatrixToShader(normal_matrix, "normal_matrix", monotone_shader);
-        draw_model(monotone_shader, backpack);
+        draw_model(monotone_shader, &backpack);
         glStencilMask(0xff);
         glStencilFunc(GL_ALWAYS, 1, 0xff);
         glEnable(GL_DEPTH_TEST);
@@ -0,0 +1,112 @@
+#include <arena.h>
+#include <string.h>
+
+
+/* Chunk headers are padded so the first allocation in a chunk is
+ * aligned too.
+ */
+#define HEADER_SIZE ((sizeof(Arena_Chunk) + ARENA_ALIGNMENT - 1) & \
+                     ~(size_t)(ARENA_ALIGNMENT - 1))
+
+
+void arena_init(Arena * arena, size_t chunk_size)
+{
+    memset(arena, 0, sizeof(Arena));
+    arena->chunk_size = chunk_size ? chunk_size : 64 << 10;
+}
+
+
+static Arena_Chunk * add_chunk(Arena * arena, size_t size)
+{
+    Arena_Chunk * chunk;
+
+    if (size < arena->chunk_size){
+        size = arena->chunk_size;
+    }
+    chunk = malloc(HEADER_SIZE + size);
+    if (!chunk){
+        err_print("Out of memory");
+        return NULL;
+    }
+    chunk->next = arena->chunks;
+    chunk->size = size;
+    chunk->used = 0;
+    arena->chunks = chunk;
+    arena->reserved += size;
+    return chunk;
+}
+
+
+void * arena_alloc(Arena * arena, size_t size)
+{
+    Arena_Chunk * chunk = arena->chunks;
+    size_t offset;
+
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (!chunk || chunk->size - chunk->used < size){
+        chunk = add_chunk(arena, size);
+        if (!chunk)
+            return NULL;
+    }
+    offset = chunk->used;
+    chunk->used += size;
+    arena->allocated += size;
+    return (unsigned char *)chunk + HEADER_SIZE + offset;
+}
+
+
+void * arena_calloc(Arena * arena, size_t count, size_t size)
+{
+    void * memory;
+
+    if (size && count > (size_t)-1 / size)
+        return NULL;
+    memory = arena_alloc(arena, count * size);
+    if (memory){
+        memset(memory, 0, count * size);
+    }
+    return memory;
+}
+
+
+char * arena_strdup(Arena * arena, const char * string)
+{
+    size_t length = strlen(string) + 1;
+    char * copy = arena_alloc(arena, length);
+
+    if (copy){
+        memcpy(copy, string, length);
+    }
+    return copy;
+}
+
+
+void arena_reset(Arena * arena)
+{
+    Arena_Chunk * chunk, * next;
+
+    if (!arena->chunks)
+        return;
+    for (chunk = arena->chunks->next; chunk; chunk = next){
+        next = chunk->next;
+        free(chunk);
+    }
+    arena->chunks->next = NULL;
+    arena->chunks->used = 0;
+    arena->reserved = arena->chunks->size;
+    arena->allocated = 0;
+}
+
+
+void arena_free(Arena * arena)
+{
+    Arena_Chunk * chunk, * next;
+
+    for (chunk = arena->chunks; chunk; chunk = next){
+        next = chunk->next;
+        free(chunk);
+    }
+    arena->chunks = NULL;
+    arena->allocated = 0;
+    arena->reserved = 0;
+}
@@ -0,0 +1,442 @@
+#include <bvh.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+
+struct Build {
+    Bvh *           bvh;
+    const Bvh_Box * boxes;
+    vec3 *          centroids;
+};
+typedef struct Build Build;
+
+
+static void box_empty(vec3 min, vec3 max)
+{
+    for (int k = 0; k < 3; k++){
+        min[k] = FLT_MAX;
+        max[k] = -FLT_MAX;
+    }
+}
+
+
+static void box_grow(vec3 min, vec3 max, const vec3 other_min,
+                     const vec3 other_max)
+{
+    for (int k = 0; k < 3; k++){
+        min[k] = fminf(min[k], other_min[k]);
+        max[k] = fmaxf(max[k], other_max[k]);
+    }
+}
+
+
+static float box_area(const vec3 min, const vec3 max)
+{
+    /* Half the surface area, which is all the heuristic compares. */
+    float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+
+    if (dx < 0.f)
+        return 0.f;
+    return dx * dy + dy * dz + dz * dx;
+}
+
+
+static void node_fit(Bvh_Node * node, const Bvh_Box * boxes,
+                     const unsigned int * items)
+{
+    const Bvh_Box * box;
+
+    box_empty(node->min, node->max);
+    for (unsigned int i = node->first; i < node->first + node->count; i++){
+        box = boxes + items[i];
+        box_grow(node->min, node->max, box->min, box->max);
+    }
+}
+
+
+static void subdivide(Build * build, unsigned int index, unsigned int depth)
+{
+    /* Centroids are dropped into BVH_BINS slots along each axis and the
+     * cheapest boundary between slots, by surface area, is the split.
+     */
+    Bvh * bvh = build->bvh;
+    Bvh_Node * node = bvh->nodes + index, * left;
+    unsigned int * items = bvh->items;
+    unsigned int bin_count[BVH_BINS], left_count[BVH_BINS];
+    Bvh_Box bins[BVH_BINS];
+    float left_area[BVH_BINS];
+    vec3 centroid_min, centroid_max, min, max;
+    float scale, cost, best_cost = FLT_MAX, leaf_cost;
+    int best_axis = -1, best_split = 0, bin;
+    unsigned int count, i, j, swap;
+    const float * centroid;
+
+    if (node->count <= 1 || depth >= BVH_MAX_DEPTH)
+        return;
+    box_empty(centroid_min, centroid_max);
+    for (i = node->first; i < node->first + node->count; i++){
+        centroid = build->centroids[items[i]];
+        box_grow(centroid_min, centroid_max, centroid, centroid);
+    }
+    for (int axis = 0; axis < 3; axis++){
+        if (centroid_max[axis] <= centroid_min[axis])
+            continue;
+        scale = BVH_BINS / (centroid_max[axis] - centroid_min[axis]);
+        for (bin = 0; bin < BVH_BINS; bin++){
+            bin_count[bin] = 0;
+            box_empty(bins[bin].min, bins[bin].max);
+        }
+        for (i = node->first; i < node->first + node->count; i++){
+            bin = (build->centroids[items[i]][axis] - centroid_min[axis]) * \
+                  scale;
+            bin = bin < BVH_BINS ? bin : BVH_BINS - 1;
+            bin_count[bin]++;
+            box_grow(bins[bin].min, bins[bin].max,
+                     build->boxes[items[i]].min, build->boxes[items[i]].max);
+        }
+        /* Left sides sweeping up, then right sides sweeping down. */
+        box_empty(min, max);
+        count = 0;
+        for (bin = 0; bin < BVH_BINS - 1; bin++){
+            count += bin_count[bin];
+            box_grow(min, max, bins[bin].min, bins[bin].max);
+            left_count[bin] = count;
+            left_area[bin] = box_area(min, max);
+        }
+        box_empty(min, max);
+        count = 0;
+        for (bin = BVH_BINS - 1; bin > 0; bin--){
+            count += bin_count[bin];
+            box_grow(min, max, bins[bin].min, bins[bin].max);
+            if (!count || !left_count[bin - 1])
+                continue;
+            cost = left_count[bin - 1] * left_area[bin - 1] + \
+                   count * box_area(min, max);
+            if (cost < best_cost){
+                best_cost = cost;
+                best_axis = axis;
+                best_split = bin;
+            }
+        }
+    }
+    if (best_axis < 0)
+        return;
+    /* Visiting a node costs about as much as testing an item. */
+    leaf_cost = node->count * box_area(node->min, node->max);
+    if (node->count <= BVH_LEAF_SIZE && \
+        best_cost + box_area(node->min, node->max) >= leaf_cost)
+        return;
+    scale = BVH_BINS / (centroid_max[best_axis] - centroid_min[best_axis]);
+    i = node->first;
+    j = node->first + node->count;
+    while (i < j){
+        bin = (build->centroids[items[i]][best_axis] - \
+               centroid_min[best_axis]) * scale;
+        bin = bin < BVH_BINS ? bin : BVH_BINS - 1;
+        if (bin < best_split){
+            i++;
+        } else{
+            swap = items[i];
+            items[i] = items[--j];
+            items[j] = swap;
+        }
+    }
+    node->left = bvh->num_nodes;
+    bvh->num_nodes += 2;
+    left = bvh->nodes + node->left;
+    left[0].left = left[1].left = 0;
+    left[0].first = node->first;
+    left[0].count = i - node->first;
+    left[1].first = i;
+    left[1].count = node->count - left[0].count;
+    node_fit(left, build->boxes, items);
+    node_fit(left + 1, build->boxes, items);
+    subdivide(build, node->left, depth + 1);
+    subdivide(build, node->left + 1, depth + 1);
+}
+
+
+bvh_error_t bvh_build(Bvh * bvh, const Bvh_Box * boxes, unsigned int count)
+{
+    Build build;
+
+    memset(bvh, 0, sizeof(Bvh));
+    if (!count)
+        return BVH_SUCCESS;
+    /* Every split leaves both sides non empty, so there are at most
+     * count leaves and count - 1 inner nodes.
+     */
+    bvh->nodes = malloc((2 * count - 1) * sizeof(Bvh_Node));
+    bvh->items = malloc(count * sizeof(unsigned int));
+    bvh->item_boxes = malloc(count * sizeof(Bvh_Box));
+    build.centroids = malloc(count * sizeof(vec3));
+    if (!bvh->nodes || !bvh->items || !bvh->item_boxes || !build.centroids){
+        free(build.centroids);
+        bvh_free(bvh);
+        err_print("Out of memory");
+        return BVH_NO_MEM;
+    }
+    for (unsigned int i = 0; i < count; i++){
+        bvh->items[i] = i;
+        vec3_add(build.centroids[i], boxes[i].min, boxes[i].max);
+        vec3_scale(build.centroids[i], build.centroids[i], .5f);
+    }
+    bvh->num_items = count;
+    bvh->num_nodes = 1;
+    bvh->nodes[0].left = 0;
+    bvh->nodes[0].first = 0;
+    bvh->nodes[0].count = count;
+    node_fit(bvh->nodes, boxes, bvh->items);
+    build.bvh = bvh;
+    build.boxes = boxes;
+    subdivide(&build, 0, 0);
+    free(build.centroids);
+    for (unsigned int i = 0; i < count; i++){
+        bvh->item_boxes[i] = boxes[bvh->items[i]];
+    }
+    return BVH_SUCCESS;
+}
+
+
+void bvh_free(Bvh * bvh)
+{
+    free(bvh->nodes);
+    free(bvh->items);
+    free(bvh->item_boxes);
+    memset(bvh, 0, sizeof(Bvh));
+}
+
+
+void bvh_refit(Bvh * bvh, const Bvh_Box * boxes)
+{
+    /* Children always come after their parent, so walking back to front
+     * finishes both children before the parent is reached.
+     */
+    Bvh_Node * node;
+
+    for (unsigned int i = 0; i < bvh->num_items; i++){
+        bvh->item_boxes[i] = boxes[bvh->items[i]];
+    }
+    for (unsigned int i = bvh->num_nodes; i-- > 0;){
+        node = bvh->nodes + i;
+        if (!node->left){
+            box_empty(node->min, node->max);
+            for (unsigned int k = node->first; \
+                 k < node->first + node->count; k++)
+            {
+                box_grow(node->min, node->max, bvh->item_boxes[k].min,
+                         bvh->item_boxes[k].max);
+            }
+        } else{
+            vec3_dup(node->min, bvh->nodes[node->left].min);
+            vec3_dup(node->max, bvh->nodes[node->left].max);
+            box_grow(node->min, node->max, bvh->nodes[node->left + 1].min,
+                     bvh->nodes[node->left + 1].max);
+        }
+    }
+}
+
+
+static unsigned int emit(const Bvh * bvh, const Bvh_Node * node,
+                         unsigned int * out, unsigned int count)
+{
+    if (out){
+        memcpy(out + count, bvh->items + node->first,
+               node->count * sizeof(unsigned int));
+    }
+    return count + node->count;
+}
+
+
+unsigned int bvh_query_frustum(const Bvh * bvh, const Frustum * frustum,
+                               unsigned int * out)
+{
+    unsigned int stack[BVH_MAX_DEPTH + 2], top = 0, count = 0;
+    frustum_overlap_t overlap;
+    const Bvh_Node * node;
+    const Bvh_Box * box;
+
+    if (bvh->num_nodes){
+        stack[top++] = 0;
+    }
+    while (top){
+        node = bvh->nodes + stack[--top];
+        overlap = frustum_classify_aabb(frustum, node->min, node->max);
+        if (overlap == FRUSTUM_OUTSIDE)
+            continue;
+        if (overlap == FRUSTUM_INSIDE){
+            count = emit(bvh, node, out, count);
+        } else if (!node->left){
+            for (unsigned int i = node->first; \
+                 i < node->first + node->count; i++)
+            {
+                box = bvh->item_boxes + i;
+                if (!frustum_test_aabb(frustum, box->min, box->max))
+                    continue;
+                if (out){
+                    out[count] = bvh->items[i];
+                }
+                count++;
+            }
+        } else{
+            stack[top++] = node->left + 1;
+            stack[top++] = node->left;
+        }
+    }
+    return count;
+}
+
+
+static int sphere_overlap(const vec3 center, float radius, const vec3 min,
+                          const vec3 max, int * inside)
+{
+    /* Distance to the box's nearest point, and to its furthest corner. */
+    float near = 0.f, far = 0.f, d, d_min, d_max;
+
+    for (int k = 0; k < 3; k++){
+        d_min = center[k] - min[k];
+        d_max = max[k] - center[k];
+        d = d_min < 0.f ? d_min : (d_max < 0.f ? d_max : 0.f);
+        near += d * d;
+        d = fmaxf(fabsf(d_min), fabsf(d_max));
+        far += d * d;
+    }
+    *inside = far <= radius * radius;
+    return near <= radius * radius;
+}
+
+
+unsigned int bvh_query_sphere(const Bvh * bvh, const vec3 center,
+                              float radius, unsigned int * out)
+{
+    unsigned int stack[BVH_MAX_DEPTH + 2], top = 0, count = 0;
+    const Bvh_Node * node;
+    const Bvh_Box * box;
+    int inside;
+
+    if (bvh->num_nodes){
+        stack[top++] = 0;
+    }
+    while (top){
+        node = bvh->nodes + stack[--top];
+        if (!sphere_overlap(center, radius, node->min, node->max, &inside))
+            continue;
+        if (inside){
+            count = emit(bvh, node, out, count);
+        } else if (!node->left){
+            for (unsigned int i = node->first; \
+                 i < node->first + node->count; i++)
+            {
+                box = bvh->item_boxes + i;
+                if (!sphere_overlap(center, radius, box->min, box->max,
+                                    &inside))
+                    continue;
+                if (out){
+                    out[count] = bvh->items[i];
+                }
+                count++;
+            }
+        } else{
+            stack[top++] = node->left + 1;
+            stack[top++] = node->left;
+        }
+    }
+    return count;
+}
+
+
+static float ray_box(const vec3 origin, const vec3 inverse, const vec3 min,
+                     const vec3 max, float t_max)
+{
+    /* Slabs. Entry distance, clamped to the origin, or INFINITY on a miss.
+     * Axis parallel rays get infinite inverses and still come out right.
+     */
+    float t0 = 0.f, t1 = t_max, near, far;
+
+    for (int k = 0; k < 3; k++){
+        near = (min[k] - origin[k]) * inverse[k];
+        far = (max[k] - origin[k]) * inverse[k];
+        if (near > far){
+            float swap = near;
+            near = far;
+            far = swap;
+        }
+        t0 = near > t0 ? near : t0;
+        t1 = far < t1 ? far : t1;
+    }
+    return t0 <= t1 ? t0 : INFINITY;
+}
+
+
+int bvh_raycast(const Bvh * bvh, const vec3 origin, const vec3 direction,
+                float * t, bvh_ray_test test, void * user)
+{
+    unsigned int stack[BVH_MAX_DEPTH + 2], top = 0, index;
+    float entry[BVH_MAX_DEPTH + 2], best = *t, t_left, t_right, t_item;
+    const Bvh_Node * node, * left;
+    const Bvh_Box * box;
+    vec3 inverse;
+    int hit = -1;
+
+    for (int k = 0; k < 3; k++){
+        inverse[k] = 1.f / direction[k];
+    }
+    if (bvh->num_nodes){
+        entry[top] = ray_box(origin, inverse, bvh->nodes[0].min,
+                             bvh->nodes[0].max, best);
+        stack[top++] = 0;
+    }
+    while (top){
+        index = stack[--top];
+        if (entry[top] >= best)
+            continue;
+        node = bvh->nodes + index;
+        if (!node->left){
+            for (unsigned int i = node->first; \
+                 i < node->first + node->count; i++)
+            {
+                box = bvh->item_boxes + i;
+                t_item = ray_box(origin, inverse, box->min, box->max, best);
+                if (t_item >= best)
+                    continue;
+                if (!test){
+                    best = t_item;
+                    hit = bvh->items[i];
+                } else if (test(user, bvh->items[i], origin, direction,
+                                &best))
+                {
+                    hit = bvh->items[i];
+                }
+            }
+            continue;
+        }
+        /* Nearer child on top of the stack. */
+        left = bvh->nodes + node->left;
+        t_left = ray_box(origin, inverse, left[0].min, left[0].max, best);
+        t_right = ray_box(origin, inverse, left[1].min, left[1].max, best);
+        if (t_left <= t_right){
+            if (t_right < best){
+                entry[top] = t_right;
+                stack[top++] = node->left + 1;
+            }
+            if (t_left < best){
+                entry[top] = t_left;
+                stack[top++] = node->left;
+            }
+        } else{
+            if (t_left < best){
+                entry[top] = t_left;
+                stack[top++] = node->left;
+            }
+            if (t_right < best){
+                entry[top] = t_right;
+                stack[top++] = node->left + 1;
+            }
+        }
+    }
+    if (hit >= 0){
+        *t = best;
+    }
+    return hit;
+}
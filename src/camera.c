@@ -1,62 +1,211 @@
 #include <camera.h>
+#include <linmath_simd.h>
 
 
 static const size_t vecSize = 3*sizeof(float);
+// Fallback for windows without a camera of their own
+static struct Camera * activeCamera = NULL;
 
 
 // `exported` functions.
 void setActiveCamera(struct Camera * cam){
-    _active_cam = cam;
+    activeCamera = cam;
 }
 
 
+void attachCamera(GLFWwindow * window, struct Camera * cam){
+    glfwSetWindowUserPointer(window, cam);
+}
+
+
+struct Camera * windowCamera(GLFWwindow * window){
+    struct Camera * cam = glfwGetWindowUserPointer(window);
+    return cam ? cam : activeCamera;
+}
+
+
+// Events arriving before any camera exists, eg. while loading, are dropped.
 void glfwCompatKeyboardCallback(GLFWwindow * window){
-    _active_cam->processKeyboard(_active_cam, window);
+    struct Camera * cam = windowCamera(window);
+    if (cam){
+        cam->processKeyboard(cam, window);
+    }
+}
+
+
+void glfwCompatKeyState(GLFWwindow * window, unsigned int keys,
+                        double time){
+    struct Camera * cam = windowCamera(window);
+    if (cam){
+        applyCameraKeys(cam, window, keys, time);
+    }
 }
 
 
 void glfwCompatMouseMovementCallback(GLFWwindow * window, double xPos,
                                      double yPos){
-    _active_cam->processMouseMovement(_active_cam, window, xPos, yPos);
+    struct Camera * cam = windowCamera(window);
+    if (cam){
+        cam->processMouseMovement(cam, window, xPos, yPos);
+    }
 }
 
 
 void glfwCompatMouseScrollCallback(GLFWwindow * window, double xPos,
                                    double yPos){
-    _active_cam->processMouseScroll(_active_cam, window, yPos);
+    struct Camera * cam = windowCamera(window);
+    if (cam){
+        cam->processMouseScroll(cam, window, yPos);
+    }
 }
 
 
-void setViewMatrix(struct Camera * self, struct Shader * shaders,
-                          const char * handle){
-    vec3 temp;
-    mat4x4 view;
-    if (!(self->position) || !(self->front)){
+static bool cacheInputs(float * cached, const float * current, int count){
+    bool changed = false;
+    for (int i = 0; i < count; i++){
+        if (cached[i] != current[i]){
+            cached[i] = current[i];
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+
+bool updateCameraMatrices(struct Camera * self){
+    /* The inputs are compared against copies rather than flagged, since
+     * callers are free to write position, zoom and the rest directly.
+     */
+    struct CameraMatrices * m = &(self->matrices);
+    float view[9], projection[4];
+    bool viewChanged, projectionChanged;
+    vec3 target;
+
+    if (!(self->position) || !(self->front) || !(self->up)){
         printf("NULL ptr in %s", __func__);
-        // Really need a cleanup / bail-out function here...
+        return false;
+    }
+    memcpy(view, *(self->position), vecSize);
+    memcpy(view + 3, *(self->front), vecSize);
+    memcpy(view + 6, *(self->up), vecSize);
+    projection[0] = self->zoom;
+    projection[1] = self->aspect;
+    projection[2] = self->nearClipPlane;
+    projection[3] = self->farClipPlane;
+    viewChanged = cacheInputs(self->viewInputs, view, 9);
+    projectionChanged = cacheInputs(self->projectionInputs, projection, 4);
+    if (!self->matricesValid){
+        viewChanged = projectionChanged = true;
+    }
+    if (!viewChanged && !projectionChanged){
+        return false;
+    }
+
+    if (viewChanged){
+        vec3_add(target, *(self->position), *(self->front));
+        mat4x4_look_at(m->view, *(self->position), target, *(self->up));
+        mat4x4_invert_simd(m->inverseView, m->view);
+        memcpy(m->position, *(self->position), vecSize);
+        m->position[3] = 1.f;
     }
-    vec3_add(temp, *(self->position), *(self->front));
-    mat4x4_look_at(view, *(self->position), temp, *(self->up));
-    setMat4x4(shaders, handle, view);
+    if (projectionChanged){
+        mat4x4_perspective(m->projection, self->zoom*M_PI/180, self->aspect,
+                           self->nearClipPlane, self->farClipPlane);
+    }
+    mat4x4_mul_simd(m->viewProjection, m->projection, m->view);
+    mat4x4_invert_simd(m->inverseViewProjection, m->viewProjection);
+    frustum_from_matrix(&(self->frustum), m->viewProjection);
+    self->matricesValid = true;
+    self->matricesVersion++;
+    return true;
+}
+
+
+const struct CameraMatrices * getCameraMatrices(struct Camera * self){
+    updateCameraMatrices(self);
+    return &(self->matrices);
+}
+
+
+const Frustum * getCameraFrustum(struct Camera * self){
+    updateCameraMatrices(self);
+    return &(self->frustum);
+}
+
+
+void getViewMatrix(struct Camera * self, mat4x4 view){
+    mat4x4_dup(view, getCameraMatrices(self)->view);
+}
+
+
+void getProjectionMatrix(struct Camera * self, mat4x4 projection){
+    mat4x4_dup(projection, getCameraMatrices(self)->projection);
+}
+
+
+void getPickRay(struct Camera * self, double x, double y, int width,
+                int height, vec3 origin, vec3 direction){
+    /* World space ray from the eye through a point of the window, in
+     * pixels from its top left corner, eg. the cursor or the centre.
+     */
+    const struct CameraMatrices * m = getCameraMatrices(self);
+    vec4 far_point = {2.f * x / width - 1.f, 1.f - 2.f * y / height, 1.f, 1.f};
+    vec4 world;
+
+    mat4x4_mul_vec4_simd(world, m->inverseViewProjection, far_point);
+    memcpy(origin, *(self->position), vecSize);
+    for (int i = 0; i < 3; i++){
+        direction[i] = world[i] / world[3] - origin[i];
+    }
+    vec3_norm(direction, direction);
+}
+
+
+void setViewMatrix(struct Camera * self, struct Shader * shaders,
+                          const char * handle){
+    setMat4x4(shaders, handle, (vec4 *)getCameraMatrices(self)->view);
 }
 
 
 void setProjectionMatrix(struct Camera * self, struct Shader * shaders,
                                 const char * handle){
-    mat4x4 projection;
-    mat4x4_perspective(projection,
-                       self->zoom*M_PI/180,
-                       self->aspect,
-                       self->nearClipPlane,
-                       self->farClipPlane);
-    setMat4x4(shaders, handle, projection);
+    setMat4x4(shaders, handle, (vec4 *)getCameraMatrices(self)->projection);
 }
 
 
 void processKeyboard(struct Camera * self, GLFWwindow * window){
+    applyCameraKeys(self, window, getCameraKeys(window), glfwGetTime());
+}
+
+
+unsigned int getCameraKeys(GLFWwindow * window){
+    // In the order of the CAM_KEY_* bits
+    static const int keys[] = {
+        GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_SPACE,
+        GLFW_KEY_LEFT_SHIFT, GLFW_KEY_ESCAPE
+    };
+    unsigned int state = 0;
+
+    for (int i = 0; i < (int)(sizeof(keys) / sizeof(keys[0])); i++){
+        if (glfwGetKey(window, keys[i]) == GLFW_PRESS){
+            state |= 1u << i;
+        }
+    }
+    return state;
+}
+
+
+void applyCameraKeys(struct Camera * self, GLFWwindow * window,
+                     unsigned int keys, double time){
     float deltaTime, currentTime;
 
-    currentTime = glfwGetTime();
+    // The first call only starts the clock, so time spent between
+    // cameraInit and the first frame doesn't become one long step.
+    currentTime = time;
+    if (self->firstKeyboard){
+        self->lastUpdateTime = currentTime;
+        self->firstKeyboard = false;
+    }
     deltaTime = currentTime-(self->lastUpdateTime);
     self->lastUpdateTime = currentTime;
 
@@ -70,25 +219,25 @@ void processKeyboard(struct Camera * self, GLFWwindow * window){
     vec3_scale(right, right, velocity);
     vec3_scale(up, up, velocity);
 
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS){
+    if (keys & CAM_KEY_ESCAPE){
         glfwSetWindowShouldClose(window, 1);
     }
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS){
+    if (keys & CAM_KEY_FORWARD){
         vec3_add(position, position, front);
     }
-    else if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS){
+    else if (keys & CAM_KEY_BACKWARD){
         vec3_sub(position, position, front);
     }
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS){
+    if (keys & CAM_KEY_LEFT){
         vec3_sub(position, position, right);
     }
-    else if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS){
+    else if (keys & CAM_KEY_RIGHT){
         vec3_add(position, position, right);
     }
-    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS){
+    if (keys & CAM_KEY_UP){
         vec3_add(position, position, up);
     }
-    else if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS){
+    else if (keys & CAM_KEY_DOWN){
         vec3_sub(position, position, up);
     }
 
@@ -203,10 +352,11 @@ struct Camera * cameraInit(int width, int height){
     out->lastUpdateTime = glfwGetTime();
     out->lastMouseX = width/2;
     out->lastMouseY = height/2;
-    out->aspect = width/height;
+    setCameraViewport(out, 0, 0, width, height);
     out->nearClipPlane = 0.1;
     out->farClipPlane = 100.0;
     out->firstMouse = true;
+    out->firstKeyboard = true;
 
     out->yaw = YAW;
     out->pitch = PITCH;
@@ -224,7 +374,26 @@ struct Camera * cameraInit(int width, int height){
 }
 
 
+void setCameraViewport(struct Camera * cam, int x, int y, int width,
+                       int height){
+    cam->viewport[0] = x;
+    cam->viewport[1] = y;
+    cam->viewport[2] = width;
+    cam->viewport[3] = height;
+    cam->aspect = height > 0 ? (float)width/height : 1.f;
+}
+
+
+void useCameraViewport(struct Camera * cam){
+    glViewport(cam->viewport[0], cam->viewport[1], cam->viewport[2],
+               cam->viewport[3]);
+}
+
+
 void cameraFree(struct Camera * cam){
+    if (activeCamera == cam){
+        activeCamera = NULL;
+    }
     free(cam->position);
     free(cam->front);
     free(cam->up);
@@ -250,5 +419,5 @@ cameraError_t setCameraPosition(struct Camera * cam, float x, float y,
 
 
 void setActiveCameraPosition(float x, float y, float z){
-    camErrorHandler(setCameraPosition(_active_cam, x, y, z));
+    camErrorHandler(setCameraPosition(activeCamera, x, y, z));
 }
@@ -0,0 +1,212 @@
+#include <cull.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <xmmintrin.h>
+    #define CULL_X86
+#endif
+
+
+void frustum_from_matrix(Frustum * frustum, mat4x4 clip)
+{
+    /* linmath matrices are column major, clip[column][row]. Each plane is
+     * the last row of the matrix plus or minus one of the others.
+     */
+    float length;
+
+    for (int i = 0; i < 3; i++){
+        for (int k = 0; k < 4; k++){
+            frustum->planes[2 * i][k] = clip[k][3] + clip[k][i];
+            frustum->planes[2 * i + 1][k] = clip[k][3] - clip[k][i];
+        }
+    }
+    for (int i = 0; i < 6; i++){
+        length = sqrtf(frustum->planes[i][0] * frustum->planes[i][0] + \
+                       frustum->planes[i][1] * frustum->planes[i][1] + \
+                       frustum->planes[i][2] * frustum->planes[i][2]);
+        if (length > 0.f){
+            vec4_scale(frustum->planes[i], frustum->planes[i], 1.f / length);
+        }
+        frustum->plane_x[i] = frustum->planes[i][0];
+        frustum->plane_y[i] = frustum->planes[i][1];
+        frustum->plane_z[i] = frustum->planes[i][2];
+        frustum->plane_w[i] = frustum->planes[i][3];
+    }
+    for (int i = 6; i < 8; i++){
+        frustum->plane_x[i] = 0.f;
+        frustum->plane_y[i] = 0.f;
+        frustum->plane_z[i] = 0.f;
+        frustum->plane_w[i] = 1.f;
+    }
+}
+
+
+int frustum_test_sphere(const Frustum * frustum, const vec3 center,
+                        float radius)
+{
+    /* Conservative, spheres just outside a corner still pass. */
+    for (int i = 0; i < 6; i++){
+        if (frustum->planes[i][0] * center[0] + \
+            frustum->planes[i][1] * center[1] + \
+            frustum->planes[i][2] * center[2] + \
+            frustum->planes[i][3] < -radius)
+            return 0;
+    }
+    return 1;
+}
+
+
+#ifdef CULL_X86
+int frustum_test_aabb(const Frustum * frustum, const vec3 min,
+                      const vec3 max)
+{
+    /* Four planes at a time. For each plane the box corner furthest along
+     * its normal is max(n * min, n * max) per axis, and the box is out if
+     * that corner is behind any plane.
+     */
+    __m128 x, y, z, d;
+
+    for (int i = 0; i < 8; i += 4){
+        x = _mm_loadu_ps(frustum->plane_x + i);
+        y = _mm_loadu_ps(frustum->plane_y + i);
+        z = _mm_loadu_ps(frustum->plane_z + i);
+        d = _mm_add_ps(
+                _mm_add_ps(_mm_max_ps(_mm_mul_ps(x, _mm_set1_ps(min[0])),
+                                      _mm_mul_ps(x, _mm_set1_ps(max[0]))),
+                           _mm_max_ps(_mm_mul_ps(y, _mm_set1_ps(min[1])),
+                                      _mm_mul_ps(y, _mm_set1_ps(max[1])))),
+                _mm_add_ps(_mm_max_ps(_mm_mul_ps(z, _mm_set1_ps(min[2])),
+                                      _mm_mul_ps(z, _mm_set1_ps(max[2]))),
+                           _mm_loadu_ps(frustum->plane_w + i)));
+        if (_mm_movemask_ps(_mm_cmplt_ps(d, _mm_setzero_ps())))
+            return 0;
+    }
+    return 1;
+}
+#else
+int frustum_test_aabb(const Frustum * frustum, const vec3 min,
+                      const vec3 max)
+{
+    const float * p;
+
+    for (int i = 0; i < 6; i++){
+        p = frustum->planes[i];
+        if (fmaxf(p[0] * min[0], p[0] * max[0]) + \
+            fmaxf(p[1] * min[1], p[1] * max[1]) + \
+            fmaxf(p[2] * min[2], p[2] * max[2]) + p[3] < 0.f)
+            return 0;
+    }
+    return 1;
+}
+#endif
+
+
+#ifdef CULL_X86
+frustum_overlap_t frustum_classify_aabb(const Frustum * frustum,
+                                        const vec3 min, const vec3 max)
+{
+    /* The nearest corner along each normal is min(n * min, n * max). The
+     * box is inside when that corner is in front of every plane.
+     */
+    __m128 x, y, z, w, far, near;
+    int inside = 1;
+
+    for (int i = 0; i < 8; i += 4){
+        x = _mm_loadu_ps(frustum->plane_x + i);
+        y = _mm_loadu_ps(frustum->plane_y + i);
+        z = _mm_loadu_ps(frustum->plane_z + i);
+        w = _mm_loadu_ps(frustum->plane_w + i);
+        __m128 x0 = _mm_mul_ps(x, _mm_set1_ps(min[0]));
+        __m128 x1 = _mm_mul_ps(x, _mm_set1_ps(max[0]));
+        __m128 y0 = _mm_mul_ps(y, _mm_set1_ps(min[1]));
+        __m128 y1 = _mm_mul_ps(y, _mm_set1_ps(max[1]));
+        __m128 z0 = _mm_mul_ps(z, _mm_set1_ps(min[2]));
+        __m128 z1 = _mm_mul_ps(z, _mm_set1_ps(max[2]));
+        far = _mm_add_ps(_mm_add_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)),
+                         _mm_add_ps(_mm_max_ps(z0, z1), w));
+        if (_mm_movemask_ps(_mm_cmplt_ps(far, _mm_setzero_ps())))
+            return FRUSTUM_OUTSIDE;
+        near = _mm_add_ps(_mm_add_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)),
+                          _mm_add_ps(_mm_min_ps(z0, z1), w));
+        if (_mm_movemask_ps(_mm_cmplt_ps(near, _mm_setzero_ps())))
+            inside = 0;
+    }
+    return inside ? FRUSTUM_INSIDE : FRUSTUM_INTERSECTS;
+}
+#else
+frustum_overlap_t frustum_classify_aabb(const Frustum * frustum,
+                                        const vec3 min, const vec3 max)
+{
+    const float * p;
+    float far, near;
+    int inside = 1;
+
+    for (int i = 0; i < 6; i++){
+        p = frustum->planes[i];
+        far = near = p[3];
+        for (int k = 0; k < 3; k++){
+            far += fmaxf(p[k] * min[k], p[k] * max[k]);
+            near += fminf(p[k] * min[k], p[k] * max[k]);
+        }
+        if (far < 0.f)
+            return FRUSTUM_OUTSIDE;
+        if (near < 0.f)
+            inside = 0;
+    }
+    return inside ? FRUSTUM_INSIDE : FRUSTUM_INTERSECTS;
+}
+#endif
+
+
+#ifdef CULL_X86
+unsigned int frustum_visible_views(const Frustum * const * frusta,
+                                   int count, const vec3 min,
+                                   const vec3 max)
+{
+    /* As frustum_test_aabb, with the box broadcast once for every view. */
+    const __m128 min_x = _mm_set1_ps(min[0]), max_x = _mm_set1_ps(max[0]);
+    const __m128 min_y = _mm_set1_ps(min[1]), max_y = _mm_set1_ps(max[1]);
+    const __m128 min_z = _mm_set1_ps(min[2]), max_z = _mm_set1_ps(max[2]);
+    const Frustum * f;
+    unsigned int visible = 0;
+    __m128 x, y, z, d, out;
+
+    if (count > 32)
+        count = 32;
+    for (int v = 0; v < count; v++){
+        f = frusta[v];
+        out = _mm_setzero_ps();
+        for (int i = 0; i < 8; i += 4){
+            x = _mm_loadu_ps(f->plane_x + i);
+            y = _mm_loadu_ps(f->plane_y + i);
+            z = _mm_loadu_ps(f->plane_z + i);
+            d = _mm_add_ps(
+                    _mm_add_ps(_mm_max_ps(_mm_mul_ps(x, min_x),
+                                          _mm_mul_ps(x, max_x)),
+                               _mm_max_ps(_mm_mul_ps(y, min_y),
+                                          _mm_mul_ps(y, max_y))),
+                    _mm_add_ps(_mm_max_ps(_mm_mul_ps(z, min_z),
+                                          _mm_mul_ps(z, max_z)),
+                               _mm_loadu_ps(f->plane_w + i)));
+            out = _mm_or_ps(out, _mm_cmplt_ps(d, _mm_setzero_ps()));
+        }
+        if (!_mm_movemask_ps(out))
+            visible |= 1u << v;
+    }
+    return visible;
+}
+#else
+unsigned int frustum_visible_views(const Frustum * const * frusta,
+                                   int count, const vec3 min,
+                                   const vec3 max)
+{
+    unsigned int visible = 0;
+
+    if (count > 32)
+        count = 32;
+    for (int v = 0; v < count; v++){
+        if (frustum_test_aabb(frusta[v], min, max))
+            visible |= 1u << v;
+    }
+    return visible;
+}
+#endif
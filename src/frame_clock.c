@@ -0,0 +1,107 @@
+#include <frame_clock.h>
+#include <string.h>
+#include <time.h>
+
+
+static double seconds_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+
+static void limit(Frame_Clock * clock)
+{
+    /* Sleeps most of the way, then spins, as sleeps tend to overshoot by
+     * more than a frame can spare.
+     */
+    double wall = seconds_now(), until = clock->last_wall + clock->min_frame;
+    double remaining;
+    struct timespec nap;
+
+    if (clock->min_frame > 0. && clock->frames){
+        while ((remaining = until - wall) > 0.){
+            if (remaining > .002){
+                remaining -= .001;
+                nap.tv_sec = (time_t)remaining;
+                nap.tv_nsec = (long)((remaining - nap.tv_sec) * 1e9);
+                nanosleep(&nap, NULL);
+            }
+            wall = seconds_now();
+        }
+    }
+    clock->last_wall = wall;
+}
+
+
+void frame_clock_init(Frame_Clock * clock, double step)
+{
+    memset(clock, 0, sizeof(Frame_Clock));
+    clock->step = step;
+}
+
+
+void frame_clock_set_limit(Frame_Clock * clock, double frames_per_second)
+{
+    clock->min_frame = frames_per_second > 0. ? 1. / frames_per_second : 0.;
+}
+
+
+void frame_clock_set_virtual(Frame_Clock * clock, double frame_seconds)
+{
+    clock->virtual_frame = frame_seconds;
+}
+
+
+static double start_frame(Frame_Clock * clock, double now)
+{
+    double frame_time = clock->started ? now - clock->now : 0.;
+
+    if (frame_time < 0.){
+        frame_time = 0.;
+    } else if (frame_time > FRAME_CLOCK_MAX_FRAME){
+        frame_time = FRAME_CLOCK_MAX_FRAME;
+    }
+    clock->now = now;
+    clock->started = 1;
+    clock->frame_time = frame_time;
+    clock->accumulator += frame_time;
+    clock->frames++;
+    return frame_time;
+}
+
+
+double frame_clock_begin_at(Frame_Clock * clock, double now)
+{
+    limit(clock);
+    return start_frame(clock, now);
+}
+
+
+double frame_clock_begin(Frame_Clock * clock)
+{
+    limit(clock);
+    if (clock->virtual_frame > 0.){
+        return start_frame(clock, clock->frames * clock->virtual_frame);
+    }
+    return start_frame(clock, clock->last_wall);
+}
+
+
+int frame_clock_tick(Frame_Clock * clock)
+{
+    if (clock->step <= 0. || clock->accumulator < clock->step)
+        return 0;
+    clock->accumulator -= clock->step;
+    clock->simulation_time += clock->step;
+    clock->ticks++;
+    return 1;
+}
+
+
+float frame_clock_alpha(const Frame_Clock * clock)
+{
+    return clock->step > 0. ? (float)(clock->accumulator / clock->step) : 1.f;
+}
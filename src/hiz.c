@@ -0,0 +1,127 @@
+#include <hiz.h>
+#include <string.h>
+
+
+static long long hiz_pyramid_bytes(const Hiz * hiz)
+{
+    long long total = 0;
+    int width = hiz->width, height = hiz->height;
+
+    for (int level = 0; level < hiz->levels; level++){
+        total += 4LL * width * height;
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+    return total;
+}
+
+
+hiz_error_t hiz_init(Hiz * hiz, int width, int height,
+                     Shader * reduce_shader)
+{
+    int size = width > height ? width : height;
+    hiz_error_t result = HIZ_SUCCESS;
+
+    memset(hiz, 0, sizeof(Hiz));
+    hiz->width = width;
+    hiz->height = height;
+    hiz->reduce_shader = reduce_shader;
+    hiz->levels = 1;
+    while (size >>= 1){
+        hiz->levels++;
+    }
+    glGenTextures(1, &hiz->texture);
+    glBindTexture(GL_TEXTURE_2D, hiz->texture);
+    glTexStorage2D(GL_TEXTURE_2D, hiz->levels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    /* Blits need matching depth formats, and default framebuffers are
+     * nearly always 24 bit depth with stencil.
+     */
+    glGenTextures(1, &hiz->depth_texture);
+    glBindTexture(GL_TEXTURE_2D, hiz->depth_texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &hiz->FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, hiz->FBO);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                         hiz->depth_texture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+        err_print("Depth pyramid framebuffer incomplete");
+        result = HIZ_GL_ERR;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    memstat_register(&hiz->memory, "depth pyramid");
+    memstat_add(&hiz->memory, MEMSTAT_GPU, MEMSTAT_CULLING,
+                hiz_pyramid_bytes(hiz) + 4LL * width * height);
+    return result;
+}
+
+
+hiz_error_t hiz_build(Hiz * hiz, unsigned int framebuffer,
+                      mat4x4 view_projection)
+{
+    /* Level 0 is a straight copy, since depth textures can't be bound as
+     * images, then each level is reduced from the one below behind an
+     * image barrier.
+     */
+    int width = hiz->width, height = hiz->height, source[2];
+    Shader * shader = hiz->reduce_shader;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, hiz->FBO);
+    glBlitFramebuffer(0, 0, hiz->width, hiz->height, 0, 0, hiz->width,
+                      hiz->height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    use(shader);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, hiz->depth_texture);
+    for (int level = 0; level < hiz->levels; level++){
+        source[0] = width;
+        source[1] = height;
+        if (level){
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+            glBindImageTexture(0, hiz->texture, level - 1, GL_FALSE, 0,
+                               GL_READ_ONLY, GL_R32F);
+        }
+        glBindImageTexture(1, hiz->texture, level, GL_FALSE, 0,
+                           GL_WRITE_ONLY, GL_R32F);
+        setInt(shader, "level", level);
+        glUniform2i(glGetUniformLocation(shader->ID, "source_size"),
+                    source[0], source[1]);
+        glUniform2i(glGetUniformLocation(shader->ID, "size"), width, height);
+        glDispatchCompute((width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE,
+                          (height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    mat4x4_dup(hiz->view_projection, view_projection);
+    hiz->valid = 1;
+    #ifdef HIZ_DEBUG
+    if (glGetError() != GL_NO_ERROR){
+        err_print("GL error building depth pyramid");
+        return HIZ_GL_ERR;
+    }
+    #endif
+    return HIZ_SUCCESS;
+}
+
+
+void hiz_free(Hiz * hiz)
+{
+    glDeleteTextures(1, &hiz->texture);
+    glDeleteTextures(1, &hiz->depth_texture);
+    glDeleteFramebuffers(1, &hiz->FBO);
+    hiz->texture = hiz->depth_texture = hiz->FBO = 0;
+    hiz->valid = 0;
+    memstat_unregister(&hiz->memory);
+}
@@ -0,0 +1,211 @@
+#include <input.h>
+#include <stdint.h>
+#include <string.h>
+
+
+#define INPUT_MAGIC   "GLIN"
+#define INPUT_VERSION 1
+
+typedef enum {
+    INPUT_EVENT_FRAME  = 0,   //double time, uint8_t keys
+    INPUT_EVENT_CURSOR = 1,   //double x, double y
+    INPUT_EVENT_SCROLL = 2,   //double x, double y
+} input_event_t;
+
+static Input_Recorder * attached = NULL;
+
+
+static void stop_recording(Input_Recorder * input)
+{
+    err_print("Could not write input recording, carrying on live");
+    fclose(input->file);
+    input->file = NULL;
+    input->mode = INPUT_LIVE;
+}
+
+
+static void write_pair(Input_Recorder * input, input_event_t event,
+                       double x, double y)
+{
+    uint8_t type = event;
+
+    if (fwrite(&type, 1, 1, input->file) != 1 || \
+        fwrite(&x, sizeof(double), 1, input->file) != 1 || \
+        fwrite(&y, sizeof(double), 1, input->file) != 1)
+    {
+        stop_recording(input);
+    }
+}
+
+
+static void cursor_callback(GLFWwindow * window, double x, double y)
+{
+    if (attached && attached->mode == INPUT_REPLAY)
+        return;
+    if (attached && attached->mode == INPUT_RECORD){
+        write_pair(attached, INPUT_EVENT_CURSOR, x, y);
+    }
+    glfwCompatMouseMovementCallback(window, x, y);
+}
+
+
+static void scroll_callback(GLFWwindow * window, double x, double y)
+{
+    if (attached && attached->mode == INPUT_REPLAY)
+        return;
+    if (attached && attached->mode == INPUT_RECORD){
+        write_pair(attached, INPUT_EVENT_SCROLL, x, y);
+    }
+    glfwCompatMouseScrollCallback(window, x, y);
+}
+
+
+void input_live(Input_Recorder * input)
+{
+    memset(input, 0, sizeof(Input_Recorder));
+    input->mode = INPUT_LIVE;
+}
+
+
+input_error_t input_record(Input_Recorder * input, const char * path)
+{
+    uint32_t version = INPUT_VERSION;
+
+    input_live(input);
+    input->file = fopen(path, "wb");
+    if (!input->file){
+        fprintf(stderr, "%s %d: Could not open %s for writing.\n", __FILE__,
+                __LINE__, path);
+        return INPUT_IO_ERR;
+    }
+    if (fwrite(INPUT_MAGIC, 4, 1, input->file) != 1 || \
+        fwrite(&version, sizeof(uint32_t), 1, input->file) != 1)
+    {
+        err_print("Could not write input recording header");
+        fclose(input->file);
+        input->file = NULL;
+        return INPUT_IO_ERR;
+    }
+    input->mode = INPUT_RECORD;
+    input->start = glfwGetTime();
+    return INPUT_SUCCESS;
+}
+
+
+input_error_t input_replay(Input_Recorder * input, const char * path,
+                           double step)
+{
+    char magic[4];
+    uint32_t version;
+
+    input_live(input);
+    input->file = fopen(path, "rb");
+    if (!input->file){
+        fprintf(stderr, "%s %d: Could not open %s.\n", __FILE__, __LINE__,
+                path);
+        return INPUT_IO_ERR;
+    }
+    if (fread(magic, 4, 1, input->file) != 1 || \
+        fread(&version, sizeof(uint32_t), 1, input->file) != 1 || \
+        memcmp(magic, INPUT_MAGIC, 4) || version != INPUT_VERSION)
+    {
+        fprintf(stderr, "%s %d: %s is not an input recording.\n", __FILE__,
+                __LINE__, path);
+        fclose(input->file);
+        input->file = NULL;
+        return INPUT_FORMAT_ERR;
+    }
+    input->mode = INPUT_REPLAY;
+    input->step = step;
+    return INPUT_SUCCESS;
+}
+
+
+void input_end(Input_Recorder * input)
+{
+    if (input->file){
+        fclose(input->file);
+        input->file = NULL;
+    }
+    input->mode = INPUT_LIVE;
+    if (attached == input){
+        attached = NULL;
+    }
+}
+
+
+void input_attach(Input_Recorder * input, GLFWwindow * window)
+{
+    attached = input;
+    glfwSetCursorPosCallback(window, cursor_callback);
+    glfwSetScrollCallback(window, scroll_callback);
+}
+
+
+static void replay_frame(Input_Recorder * input, GLFWwindow * window)
+{
+    /* Events recorded since the last frame are delivered first, as they
+     * were live, then the frame's keys.
+     */
+    uint8_t type, keys;
+    double x, y;
+
+    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS){
+        glfwSetWindowShouldClose(window, 1);
+    }
+    while (fread(&type, 1, 1, input->file) == 1){
+        if (type == INPUT_EVENT_FRAME){
+            if (fread(&x, sizeof(double), 1, input->file) != 1 || \
+                fread(&keys, 1, 1, input->file) != 1)
+            {
+                break;
+            }
+            input->time = input->step > 0. ? input->frames * input->step : x;
+            input->frames++;
+            glfwCompatKeyState(window, keys, input->time);
+            return;
+        }
+        if (fread(&x, sizeof(double), 1, input->file) != 1 || \
+            fread(&y, sizeof(double), 1, input->file) != 1)
+        {
+            break;
+        }
+        if (type == INPUT_EVENT_CURSOR){
+            glfwCompatMouseMovementCallback(window, x, y);
+        } else if (type == INPUT_EVENT_SCROLL){
+            glfwCompatMouseScrollCallback(window, x, y);
+        }
+    }
+    /* Out of frames, or a truncated last one. */
+    glfwSetWindowShouldClose(window, 1);
+}
+
+
+void input_frame(Input_Recorder * input, GLFWwindow * window)
+{
+    uint8_t type = INPUT_EVENT_FRAME, keys;
+
+    if (input->mode == INPUT_REPLAY){
+        replay_frame(input, window);
+        return;
+    }
+    keys = getCameraKeys(window);
+    input->time = input->step > 0. ? input->frames * input->step
+                                   : glfwGetTime() - input->start;
+    input->frames++;
+    if (input->mode == INPUT_RECORD){
+        if (fwrite(&type, 1, 1, input->file) != 1 || \
+            fwrite(&input->time, sizeof(double), 1, input->file) != 1 || \
+            fwrite(&keys, 1, 1, input->file) != 1)
+        {
+            stop_recording(input);
+        }
+    }
+    glfwCompatKeyState(window, keys, input->time);
+}
+
+
+double input_time(const Input_Recorder * input)
+{
+    return input->time;
+}
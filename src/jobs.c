@@ -0,0 +1,209 @@
+#include <jobs.h>
+#include <unistd.h>
+
+
+static Job_Pool default_pool;
+static pthread_once_t default_pool_once = PTHREAD_ONCE_INIT;
+static int default_pool_ok = 0;
+
+
+int jobs_hardware_threads(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+
+static Job * pop_job(Job_Pool * pool)
+{
+    /* Caller holds pool->lock. */
+    Job * job = pool->head;
+
+    if (job){
+        pool->head = job->next;
+        if (!pool->head)
+            pool->tail = NULL;
+    }
+    return job;
+}
+
+
+static void run_job(Job_Pool * pool, Job * job)
+{
+    /* Called without the lock held, returns without it too. */
+    job->fn(job->arg);
+    pthread_mutex_lock(&pool->lock);
+    if (job->group){
+        job->group->pending--;
+    }
+    pthread_cond_broadcast(&pool->work_done);
+    pthread_mutex_unlock(&pool->lock);
+    free(job);
+}
+
+
+static void * worker_main(void * arg)
+{
+    Job_Pool * pool = arg;
+    Job * job;
+
+    for (;;){
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->head && !pool->shutdown){
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutdown && !pool->head){
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        job = pop_job(pool);
+        pthread_mutex_unlock(&pool->lock);
+        run_job(pool, job);
+    }
+}
+
+
+jobs_error_t job_pool_init(Job_Pool * pool, int num_threads)
+{
+    /* num_threads <= 0 picks one worker per core, less the calling thread
+     * which helps out from job_group_wait.
+     */
+    if (num_threads <= 0){
+        num_threads = jobs_hardware_threads() - 1;
+        if (num_threads < 1)
+            num_threads = 1;
+    }
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->shutdown = 0;
+    pool->num_threads = 0;
+    pool->threads = malloc(num_threads * sizeof(pthread_t));
+    if (!pool->threads){
+        err_print("Out of memory");
+        return JOBS_NO_MEM;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    for (int i = 0; i < num_threads; i++){
+        if (pthread_create(pool->threads + i, NULL, worker_main, pool)){
+            err_print("pthread_create failure");
+            job_pool_destroy(pool);
+            return JOBS_ERR;
+        }
+        pool->num_threads++;
+    }
+    return JOBS_SUCCESS;
+}
+
+
+void job_pool_destroy(Job_Pool * pool)
+{
+    /* Outstanding jobs are drained before the workers exit. */
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->num_threads; i++){
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->num_threads = 0;
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+}
+
+
+static void default_pool_init(void)
+{
+    default_pool_ok = job_pool_init(&default_pool, 0) == JOBS_SUCCESS;
+}
+
+
+Job_Pool * job_pool_default(void)
+{
+    /* Shared pool for library internals (texture decode etc.). It lives
+     * until the process exits.
+     */
+    pthread_once(&default_pool_once, default_pool_init);
+    return default_pool_ok ? &default_pool : NULL;
+}
+
+
+void job_group_init(Job_Group * group)
+{
+    group->pending = 0;
+}
+
+
+jobs_error_t job_pool_submit(Job_Pool * pool, Job_Group * group, job_fn fn,
+                             void * arg)
+{
+    Job * job;
+
+    if (!pool){
+        /* No pool, run inline. Keeps callers simple when threads fail. */
+        fn(arg);
+        return JOBS_SUCCESS;
+    }
+    job = malloc(sizeof(Job));
+    if (!job){
+        err_print("Out of memory");
+        return JOBS_NO_MEM;
+    }
+    job->fn = fn;
+    job->arg = arg;
+    job->group = group;
+    job->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (group)
+        group->pending++;
+    if (pool->tail){
+        pool->tail->next = job;
+    } else{
+        pool->head = job;
+    }
+    pool->tail = job;
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    return JOBS_SUCCESS;
+}
+
+
+void job_group_wait(Job_Pool * pool, Job_Group * group)
+{
+    /* Rather than sleep, the waiting thread runs queued jobs (anyone's)
+     * until its own group has drained.
+     */
+    Job * job;
+
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    while (group->pending > 0){
+        job = pop_job(pool);
+        if (job){
+            pthread_mutex_unlock(&pool->lock);
+            run_job(pool, job);
+            pthread_mutex_lock(&pool->lock);
+        } else{
+            pthread_cond_wait(&pool->work_done, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+int job_group_done(Job_Pool * pool, Job_Group * group)
+{
+    int done;
+
+    if (!pool)
+        return 1;
+    pthread_mutex_lock(&pool->lock);
+    done = group->pending == 0;
+    pthread_mutex_unlock(&pool->lock);
+    return done;
+}
@@ -31,6 +31,7 @@ light_error_t light_init(Light * light)
     light->shadow_height     = 1024;
     mat4x4_dup(light->shadow_matrix, zeros);
     light->cube_mats         = NULL;
+    memset(&light->memory, 0, sizeof(Memstat_Asset));
     return LIGHT_SUCCESS;
 }
 
@@ -178,6 +179,10 @@ light_error_t light_shadow_gl_init(Light * light)
     const vec3 border_color = {1.f, 1.f, 1.f};
     glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border_color);
     glBindTexture(GL_TEXTURE_2D, 0);
+    /* Unsized depth is 24 bit, stored in 32. */
+    memstat_register(&light->memory, light->name ? light->name : "light");
+    memstat_add(&light->memory, MEMSTAT_GPU, MEMSTAT_SHADOW,
+                4LL * light->shadow_width * light->shadow_height);
 
     if (light->depth_FBO){
         err_print("depth FBO is not 0");
@@ -225,6 +230,10 @@ light_error_t light_shadow_cube_map_init(Light * light)
                         GL_CLAMP_TO_EDGE);
     }
 
+    memstat_register(&light->memory, light->name ? light->name : "light");
+    memstat_add(&light->memory, MEMSTAT_GPU, MEMSTAT_SHADOW,
+                6 * 4LL * light->shadow_width * light->shadow_height);
+
     if (light->depth_FBO){
         err_print("depth FBO is not 0");
         result = LIGHT_ERR;
@@ -245,6 +254,9 @@ light_error_t light_shadow_cube_map_init(Light * light)
     if (!light->cube_mats){
         err_print("Out of memory");
         result = LIGHT_ERR;
+    } else{
+        memstat_add(&light->memory, MEMSTAT_CPU, MEMSTAT_SHADOW,
+                    6 * sizeof(mat4x4));
     }
 
     return result;
@@ -268,7 +280,7 @@ light_error_t light_shadow_mat_directional(Light * light, vec3 center, vec3 up,
     mat4x4_look_at(look_at, light->position, center, up);
     mat4x4_ortho(ortho, ortho_params[0], ortho_params[1], ortho_params[2],
                  ortho_params[3], near_plane, far_plane);
-    mat4x4_mul(light->shadow_matrix, ortho, look_at);
+    mat4x4_mul_simd(light->shadow_matrix, ortho, look_at);
     return LIGHT_SUCCESS;
 }
 
@@ -279,7 +291,7 @@ light_error_t light_shadow_cube_mat(Light * light, float near, float far)
     mat4x4 shadow_proj;
     mat4x4_perspective(shadow_proj, (float)(90.f * M_PI / 180.f),
                        aspect, near, far);
-    mat4x4 look_at;
+    mat4x4 look_at[6];
     vec3 x_dir     = {1.f, 0.f, 0.f};
     vec3 y_dir     = {0.f, 1.f, 0.f};
     vec3 neg_y_dir = {0.f, -1.f, 0.f};
@@ -298,22 +310,45 @@ light_error_t light_shadow_cube_mat(Light * light, float near, float far)
     #endif
 
     vec3_add(forward, light->position, x_dir);
-    mat4x4_look_at(look_at, light->position, forward, neg_y_dir);
-    mat4x4_mul(light->cube_mats[0], shadow_proj, look_at);
+    mat4x4_look_at(look_at[0], light->position, forward, neg_y_dir);
     vec3_sub(forward, light->position, x_dir);
-    mat4x4_look_at(look_at, light->position, forward, neg_y_dir);
-    mat4x4_mul(light->cube_mats[1], shadow_proj, look_at);
+    mat4x4_look_at(look_at[1], light->position, forward, neg_y_dir);
     vec3_add(forward, light->position, y_dir);
-    mat4x4_look_at(look_at, light->position, forward, z_dir);
-    mat4x4_mul(light->cube_mats[2], shadow_proj, look_at);
+    mat4x4_look_at(look_at[2], light->position, forward, z_dir);
     vec3_sub(forward, light->position, y_dir);
-    mat4x4_look_at(look_at, light->position, forward, z_dir);
-    mat4x4_mul(light->cube_mats[3], shadow_proj, look_at);
+    mat4x4_look_at(look_at[3], light->position, forward, z_dir);
     vec3_add(forward, light->position, z_dir);
-    mat4x4_look_at(look_at, light->position, forward, neg_y_dir);
-    mat4x4_mul(light->cube_mats[4], shadow_proj, look_at);
+    mat4x4_look_at(look_at[4], light->position, forward, neg_y_dir);
     vec3_sub(forward, light->position, z_dir);
-    mat4x4_look_at(look_at, light->position, forward, neg_y_dir);
-    mat4x4_mul(light->cube_mats[5], shadow_proj, look_at);
+    mat4x4_look_at(look_at[5], light->position, forward, neg_y_dir);
+    mat4x4_mul_array(light->cube_mats, shadow_proj, (const mat4x4 *)look_at,
+                     6);
     return LIGHT_SUCCESS;
 }
+
+
+void light_shadow_cube_bounds(Light * light, float far, mat4x4 out)
+{
+    /* The six faces of a cube shadow map together see the box reaching
+     * far in every direction from the light. This maps that box to clip
+     * space, for culling what the whole cube map pass draws at once.
+     */
+    mat4x4 ortho, translate;
+
+    mat4x4_ortho(ortho, -far, far, -far, far, -far, far);
+    mat4x4_translate(translate, -light->position[0], -light->position[1],
+                     -light->position[2]);
+    mat4x4_mul(out, ortho, translate);
+}
+
+
+void light_free(Light * light)
+{
+    glDeleteTextures(1, &light->depth_texture);
+    glDeleteFramebuffers(1, &light->depth_FBO);
+    light->depth_texture = 0;
+    light->depth_FBO = 0;
+    free(light->cube_mats);
+    light->cube_mats = NULL;
+    memstat_unregister(&light->memory);
+}
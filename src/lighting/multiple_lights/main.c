@@ -9,6 +9,7 @@
 #include "../../../headers/linmath.h"
 #include "../../../headers/linmath_extension.h"
 #include <camera.h>
+#include <transform.h>
 #include "models/combined_cube_vertices.h"
 #include "models/light_vertices.h"
 #include "../../../headers/shader.h"
@@ -185,6 +186,29 @@ int main(){
                           (void*)(6*sizeof(float)));
     glEnableVertexAttribArray(2);
 
+    /* Each cube's model and normal matrices come from a per instance
+     * buffer, rewritten once a frame from the transform set, so all ten
+     * are drawn with one call.
+     */
+    Transform_Set cube_transforms;
+    vec3 rotation_axis = {0.5f, 1.f, 0.f};
+    vec3 unit_scale = {1.f, 1.f, 1.f};
+    quat no_rotation = {0.f, 0.f, 0.f, 1.f};
+    if (transform_set_init(&cube_transforms, 10)){
+        status = FAILURE;
+        goto cleanup_gl;
+    }
+    for (int i=0; i<10; i++){
+        transform_set_add(&cube_transforms, cubePositions + 3*i,
+                          no_rotation, unit_scale);
+    }
+    unsigned int instance_VBO;
+    glGenBuffers(1, &instance_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_VBO);
+    glBufferData(GL_ARRAY_BUFFER, 10*sizeof(Transform_Instance), NULL,
+                 GL_STREAM_DRAW);
+    transform_instance_attributes(instance_VBO, 3);
+
     if (glGetError() != GL_NO_ERROR){
         fprintf(stderr, "Error during VAO / VBO assignments\n");
         goto cleanup_gl;
@@ -315,10 +339,6 @@ int main(){
     int numFrames = 0;
     float past = (float)glfwGetTime();
     mat4x4 model;
-    /* This is the one that transforms the normals correctly,
-     * even if there is a scaling present in the model matrix.
-     */
-    mat4x4 normal_matrix;
 
     while (!glfwWindowShouldClose(window)){
         numFrames += 1;
@@ -361,25 +381,17 @@ int main(){
         cam->setViewMatrix(cam, cube_shaders, "view");
         cam->setProjectionMatrix(cam, cube_shaders, "projection");
         
-        for (int i=0; i<10; i++){
-            float x, y, z;
-            x = cubePositions[3*i];
-            y = cubePositions[3*i+1];
-            z = cubePositions[3*i+2];
-            mat4x4_translate(model, x, y, z);
-            if (i%3 == 0){
-                float angle = time*50*M_PI/180;
-                float offset = 20*i;
-                mat4x4_rotate(model, model, 0.5, 1, 0, angle+offset);
-            }
-            else{
-                mat4x4_rotate(model, model, 0.5, 1, 0, 0);
-            }
-            sendMatrixToShader(model, "model", cube_shaders);
-            mat4x4_normal_matrix(normal_matrix, model);
-            sendMatrixToShader(normal_matrix, "normal_matrix", cube_shaders);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+        for (int i=0; i<10; i+=3){
+            float angle = time*50*M_PI/180;
+            float offset = 20*i;
+            transform_set_axis_angle(&cube_transforms, i, rotation_axis,
+                                     angle+offset);
+        }
+        if (transform_set_upload(&cube_transforms, instance_VBO, NULL)){
+            status = FAILURE;
+            break;
         }
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 36, cube_transforms.count);
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
@@ -388,6 +400,9 @@ int main(){
     printf("Rendered %i frames in %1.10f seconds amounting to %f FPS.\n",
            numFrames, time, numFrames/time);
 
+    transform_set_free(&cube_transforms);
+    glDeleteBuffers(1, &instance_VBO);
+
     cleanup_gl:
         glDeleteVertexArrays(1, &light_VAO);
         glDeleteBuffers(1, &light_VBO);
@@ -0,0 +1,304 @@
+#include <linmath_simd.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define LINMATH_SIMD_X86
+#endif
+
+
+void mat4x4_normal_cofactor(mat4x4 out, mat4x4 const m)
+{
+    /* For A = [a0 a1 a2], the inverse transpose has columns a1 x a2,
+     * a2 x a0 and a0 x a1 over the determinant, which is far cheaper than
+     * a general 4x4 inverse and a transpose. A singular matrix gives
+     * zeros rather than infinities, matching mat4x4_normal_matrix.
+     */
+    vec3 a[3], c[3];
+    float det;
+
+    for (int i = 0; i < 3; i++){
+        a[i][0] = m[i][0];
+        a[i][1] = m[i][1];
+        a[i][2] = m[i][2];
+    }
+    vec3_mul_cross(c[0], a[1], a[2]);
+    vec3_mul_cross(c[1], a[2], a[0]);
+    vec3_mul_cross(c[2], a[0], a[1]);
+    det = vec3_mul_inner(a[0], c[0]);
+    det = det != 0.f ? 1.f / det : 0.f;
+    for (int i = 0; i < 3; i++){
+        out[i][0] = c[i][0] * det;
+        out[i][1] = c[i][1] * det;
+        out[i][2] = c[i][2] * det;
+        out[i][3] = 0.f;
+    }
+    out[3][0] = out[3][1] = out[3][2] = 0.f;
+    out[3][3] = 1.f;
+}
+
+
+#ifdef LINMATH_SIMD_X86
+static int use_avx2 = 0;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+
+
+static void detect_cpu(void)
+{
+    __builtin_cpu_init();
+    use_avx2 = __builtin_cpu_supports("avx2");
+}
+
+
+static inline __m128 transform(__m128 c0, __m128 c1, __m128 c2, __m128 c3,
+                               __m128 v)
+{
+    /* m * v is m's columns weighted by v's components. */
+    return _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(c0, _mm_shuffle_ps(v, v, 0x00)),
+                   _mm_mul_ps(c1, _mm_shuffle_ps(v, v, 0x55))),
+        _mm_add_ps(_mm_mul_ps(c2, _mm_shuffle_ps(v, v, 0xaa)),
+                   _mm_mul_ps(c3, _mm_shuffle_ps(v, v, 0xff))));
+}
+
+
+static inline __m128 cross(__m128 a, __m128 b)
+{
+    /* The w lanes cancel to zero. */
+    __m128 yzx = _mm_sub_ps(
+        _mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1))),
+        _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)), b));
+
+    return _mm_shuffle_ps(yzx, yzx, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+
+static inline __m128 dot(__m128 a, __m128 b)
+{
+    /* The sum ends up in every lane. */
+    __m128 m = _mm_mul_ps(a, b);
+
+    m = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+
+void mat4x4_mul_simd(mat4x4 out, mat4x4 const a, mat4x4 const b)
+{
+    /* a is held in registers, and column j of b is read before column j
+     * of out is written, so out may be either input.
+     */
+    __m128 c0 = _mm_loadu_ps(a[0]);
+    __m128 c1 = _mm_loadu_ps(a[1]);
+    __m128 c2 = _mm_loadu_ps(a[2]);
+    __m128 c3 = _mm_loadu_ps(a[3]);
+
+    for (int j = 0; j < 4; j++){
+        _mm_storeu_ps(out[j], transform(c0, c1, c2, c3, _mm_loadu_ps(b[j])));
+    }
+}
+
+
+void mat4x4_mul_vec4_simd(vec4 out, mat4x4 const m, vec4 const v)
+{
+    _mm_storeu_ps(out, transform(_mm_loadu_ps(m[0]), _mm_loadu_ps(m[1]),
+                                 _mm_loadu_ps(m[2]), _mm_loadu_ps(m[3]),
+                                 _mm_loadu_ps(v)));
+}
+
+
+void mat4x4_invert_simd(mat4x4 out, mat4x4 const m)
+{
+    /* Cramer's rule written with cross products over the columns a, b, c
+     * and d, whose bottom row is x, y, z and w. Rows of the inverse come
+     * out, so they are transposed on the way to the column major out.
+     */
+    const __m128 xyz = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    __m128 a = _mm_loadu_ps(m[0]), b = _mm_loadu_ps(m[1]);
+    __m128 c = _mm_loadu_ps(m[2]), d = _mm_loadu_ps(m[3]);
+    __m128 x = _mm_shuffle_ps(a, a, 0xff), y = _mm_shuffle_ps(b, b, 0xff);
+    __m128 z = _mm_shuffle_ps(c, c, 0xff), w = _mm_shuffle_ps(d, d, 0xff);
+    __m128 s, t, u, v, inverse_det, r0, r1, r2, r3, low, high;
+
+    a = _mm_and_ps(a, xyz);
+    b = _mm_and_ps(b, xyz);
+    c = _mm_and_ps(c, xyz);
+    d = _mm_and_ps(d, xyz);
+    s = cross(a, b);
+    t = cross(c, d);
+    u = _mm_sub_ps(_mm_mul_ps(a, y), _mm_mul_ps(b, x));
+    v = _mm_sub_ps(_mm_mul_ps(c, w), _mm_mul_ps(d, z));
+    inverse_det = _mm_div_ps(_mm_set1_ps(1.f),
+                             _mm_add_ps(dot(s, v), dot(t, u)));
+    s = _mm_mul_ps(s, inverse_det);
+    t = _mm_mul_ps(t, inverse_det);
+    u = _mm_mul_ps(u, inverse_det);
+    v = _mm_mul_ps(v, inverse_det);
+    r0 = _mm_add_ps(cross(b, v), _mm_mul_ps(t, y));
+    r1 = _mm_sub_ps(cross(v, a), _mm_mul_ps(t, x));
+    r2 = _mm_add_ps(cross(d, u), _mm_mul_ps(s, w));
+    r3 = _mm_sub_ps(cross(u, c), _mm_mul_ps(s, z));
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    /* The w lanes were zero, leaving the last column to fill in. */
+    low = _mm_unpacklo_ps(_mm_sub_ps(_mm_setzero_ps(), dot(b, t)), dot(a, t));
+    high = _mm_unpacklo_ps(_mm_sub_ps(_mm_setzero_ps(), dot(d, s)),
+                           dot(c, s));
+    _mm_storeu_ps(out[0], r0);
+    _mm_storeu_ps(out[1], r1);
+    _mm_storeu_ps(out[2], r2);
+    _mm_storeu_ps(out[3], _mm_movelh_ps(low, high));
+}
+
+
+__attribute__((target("avx2")))
+static unsigned int mul_vec4_avx2(vec4 * out, mat4x4 const m, const vec4 * in,
+                                  unsigned int count)
+{
+    /* Two vectors per register, each lane pair against its own copy of
+     * the matrix. Returns how many were done.
+     */
+    __m256 c0 = _mm256_broadcast_ps((const __m128 *)m[0]);
+    __m256 c1 = _mm256_broadcast_ps((const __m128 *)m[1]);
+    __m256 c2 = _mm256_broadcast_ps((const __m128 *)m[2]);
+    __m256 c3 = _mm256_broadcast_ps((const __m128 *)m[3]);
+    __m256 v;
+    unsigned int i;
+
+    for (i = 0; i + 2 <= count; i += 2){
+        v = _mm256_loadu_ps(in[i]);
+        _mm256_storeu_ps(out[i], _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(c0, _mm256_permute_ps(v, 0x00)),
+                          _mm256_mul_ps(c1, _mm256_permute_ps(v, 0x55))),
+            _mm256_add_ps(_mm256_mul_ps(c2, _mm256_permute_ps(v, 0xaa)),
+                          _mm256_mul_ps(c3, _mm256_permute_ps(v, 0xff)))));
+    }
+    return i;
+}
+
+
+__attribute__((target("avx2")))
+static unsigned int transform_points_avx2(vec4 * out, mat4x4 const m,
+                                          const float * positions,
+                                          size_t stride, unsigned int count)
+{
+    __m256 c0 = _mm256_broadcast_ps((const __m128 *)m[0]);
+    __m256 c1 = _mm256_broadcast_ps((const __m128 *)m[1]);
+    __m256 c2 = _mm256_broadcast_ps((const __m128 *)m[2]);
+    __m256 c3 = _mm256_broadcast_ps((const __m128 *)m[3]);
+    const float * p, * q;
+    unsigned int i;
+
+    for (i = 0; i + 2 <= count; i += 2){
+        p = (const float *)((const char *)positions + i * stride);
+        q = (const float *)((const char *)p + stride);
+        _mm256_storeu_ps(out[i], _mm256_add_ps(
+            _mm256_add_ps(
+                _mm256_mul_ps(c0, _mm256_setr_m128(_mm_set1_ps(p[0]),
+                                                   _mm_set1_ps(q[0]))),
+                _mm256_mul_ps(c1, _mm256_setr_m128(_mm_set1_ps(p[1]),
+                                                   _mm_set1_ps(q[1])))),
+            _mm256_add_ps(
+                _mm256_mul_ps(c2, _mm256_setr_m128(_mm_set1_ps(p[2]),
+                                                   _mm_set1_ps(q[2]))),
+                c3)));
+    }
+    return i;
+}
+
+
+void mat4x4_mul_vec4_array(vec4 * out, mat4x4 const m, const vec4 * in,
+                           unsigned int count)
+{
+    __m128 c0 = _mm_loadu_ps(m[0]), c1 = _mm_loadu_ps(m[1]);
+    __m128 c2 = _mm_loadu_ps(m[2]), c3 = _mm_loadu_ps(m[3]);
+    unsigned int i = 0;
+
+    pthread_once(&cpu_once, detect_cpu);
+    if (use_avx2){
+        i = mul_vec4_avx2(out, m, in, count);
+    }
+    for (; i < count; i++){
+        _mm_storeu_ps(out[i], transform(c0, c1, c2, c3, _mm_loadu_ps(in[i])));
+    }
+}
+
+
+void mat4x4_transform_points(vec4 * out, mat4x4 const m,
+                             const float * positions, size_t stride,
+                             unsigned int count)
+{
+    __m128 c0 = _mm_loadu_ps(m[0]), c1 = _mm_loadu_ps(m[1]);
+    __m128 c2 = _mm_loadu_ps(m[2]), c3 = _mm_loadu_ps(m[3]);
+    const float * p;
+    unsigned int i = 0;
+
+    pthread_once(&cpu_once, detect_cpu);
+    if (use_avx2){
+        i = transform_points_avx2(out, m, positions, stride, count);
+    }
+    for (; i < count; i++){
+        p = (const float *)((const char *)positions + i * stride);
+        _mm_storeu_ps(out[i], _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])),
+                       _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+            _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])), c3)));
+    }
+}
+#else
+void mat4x4_mul_simd(mat4x4 out, mat4x4 const a, mat4x4 const b)
+{
+    mat4x4_mul(out, a, b);
+}
+
+
+void mat4x4_mul_vec4_simd(vec4 out, mat4x4 const m, vec4 const v)
+{
+    vec4 result;
+
+    mat4x4_mul_vec4(result, m, v);
+    vec4_dup(out, result);
+}
+
+
+void mat4x4_invert_simd(mat4x4 out, mat4x4 const m)
+{
+    mat4x4_invert(out, m);
+}
+
+
+void mat4x4_mul_vec4_array(vec4 * out, mat4x4 const m, const vec4 * in,
+                           unsigned int count)
+{
+    vec4 result;
+
+    for (unsigned int i = 0; i < count; i++){
+        mat4x4_mul_vec4(result, m, in[i]);
+        vec4_dup(out[i], result);
+    }
+}
+
+
+void mat4x4_transform_points(vec4 * out, mat4x4 const m,
+                             const float * positions, size_t stride,
+                             unsigned int count)
+{
+    const float * p;
+
+    for (unsigned int i = 0; i < count; i++){
+        p = (const float *)((const char *)positions + i * stride);
+        for (int j = 0; j < 4; j++){
+            out[i][j] = m[0][j] * p[0] + m[1][j] * p[1] + m[2][j] * p[2] + \
+                        m[3][j];
+        }
+    }
+}
+#endif
+
+
+void mat4x4_mul_array(mat4x4 * out, mat4x4 const m, const mat4x4 * in,
+                      unsigned int count)
+{
+    /* Column j of m * in[i] is m * in[i][j], so the matrices are just a
+     * run of 4 * count vectors.
+     */
+    mat4x4_mul_vec4_array((vec4 *)out, m, (const vec4 *)in, 4 * count);
+}
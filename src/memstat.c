@@ -0,0 +1,195 @@
+#include <memstat.h>
+#include <string.h>
+#include <pthread.h>
+
+
+/* Live totals and high-water marks. Index MEMSTAT_CATEGORIES holds the
+ * sum over categories.
+ */
+static long long totals[MEMSTAT_DOMAINS][MEMSTAT_CATEGORIES + 1];
+static long long peaks[MEMSTAT_DOMAINS][MEMSTAT_CATEGORIES + 1];
+static Memstat_Asset * assets = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char * domain_names[MEMSTAT_DOMAINS] = {"CPU", "GPU"};
+static const char * category_names[MEMSTAT_CATEGORIES + 1] = {
+    "geometry", "texture", "shadow", "culling", "other", "total"
+};
+
+
+static void count(memstat_domain_t domain, memstat_category_t category,
+                  long long bytes)
+{
+    /* Called with the lock held. */
+    totals[domain][category] += bytes;
+    totals[domain][MEMSTAT_CATEGORIES] += bytes;
+    if (totals[domain][category] > peaks[domain][category]){
+        peaks[domain][category] = totals[domain][category];
+    }
+    if (totals[domain][MEMSTAT_CATEGORIES] > \
+        peaks[domain][MEMSTAT_CATEGORIES])
+    {
+        peaks[domain][MEMSTAT_CATEGORIES] = \
+            totals[domain][MEMSTAT_CATEGORIES];
+    }
+}
+
+
+static long long asset_total(const Memstat_Asset * asset,
+                             memstat_domain_t domain)
+{
+    long long total = 0;
+
+    for (int c = 0; c < MEMSTAT_CATEGORIES; c++){
+        total += asset->bytes[domain][c];
+    }
+    return total;
+}
+
+
+static void unlink_locked(Memstat_Asset * asset)
+{
+    /* Takes the asset and its bytes out of the totals. */
+    for (int d = 0; d < MEMSTAT_DOMAINS; d++){
+        for (int c = 0; c < MEMSTAT_CATEGORIES; c++){
+            count(d, c, -asset->bytes[d][c]);
+        }
+    }
+    if (asset->previous){
+        asset->previous->next = asset->next;
+    } else{
+        assets = asset->next;
+    }
+    if (asset->next){
+        asset->next->previous = asset->previous;
+    }
+}
+
+
+void memstat_register(Memstat_Asset * asset, const char * name)
+{
+    /* An asset registered again, eg. by a second init without a free in
+     * between, starts over rather than being linked in twice.
+     */
+    Memstat_Asset * a;
+
+    pthread_mutex_lock(&lock);
+    if (asset->registered){
+        for (a = assets; a && a != asset; a = a->next);
+        if (a){
+            unlink_locked(asset);
+        }
+    }
+    memset(asset, 0, sizeof(Memstat_Asset));
+    snprintf(asset->name, MEMSTAT_NAME_LENGTH, "%s", name ? name : "?");
+    asset->registered = 1;
+    asset->next = assets;
+    if (assets){
+        assets->previous = asset;
+    }
+    assets = asset;
+    pthread_mutex_unlock(&lock);
+}
+
+
+void memstat_unregister(Memstat_Asset * asset)
+{
+    if (!asset->registered)
+        return;
+    pthread_mutex_lock(&lock);
+    unlink_locked(asset);
+    pthread_mutex_unlock(&lock);
+    memset(asset, 0, sizeof(Memstat_Asset));
+}
+
+
+static void add_locked(Memstat_Asset * asset, memstat_domain_t domain,
+                       memstat_category_t category, long long bytes)
+{
+    long long total;
+
+    count(domain, category, bytes);
+    if (!asset)
+        return;
+    asset->bytes[domain][category] += bytes;
+    total = asset_total(asset, domain);
+    if (total > asset->peak[domain]){
+        asset->peak[domain] = total;
+    }
+}
+
+
+void memstat_add(Memstat_Asset * asset, memstat_domain_t domain,
+                 memstat_category_t category, long long bytes)
+{
+    if (asset && !asset->registered)
+        return;
+    pthread_mutex_lock(&lock);
+    add_locked(asset, domain, category, bytes);
+    pthread_mutex_unlock(&lock);
+}
+
+
+void memstat_set(Memstat_Asset * asset, memstat_domain_t domain,
+                 memstat_category_t category, long long bytes)
+{
+    if (!asset->registered)
+        return;
+    pthread_mutex_lock(&lock);
+    add_locked(asset, domain, category,
+               bytes - asset->bytes[domain][category]);
+    pthread_mutex_unlock(&lock);
+}
+
+
+long long memstat_total(memstat_domain_t domain, memstat_category_t category)
+{
+    long long total;
+
+    pthread_mutex_lock(&lock);
+    total = totals[domain][category];
+    pthread_mutex_unlock(&lock);
+    return total;
+}
+
+
+long long memstat_peak(memstat_domain_t domain, memstat_category_t category)
+{
+    long long peak;
+
+    pthread_mutex_lock(&lock);
+    peak = peaks[domain][category];
+    pthread_mutex_unlock(&lock);
+    return peak;
+}
+
+
+void memstat_report(FILE * fp)
+{
+    const double MiB = 1048576.;
+    Memstat_Asset * asset;
+
+    pthread_mutex_lock(&lock);
+    fprintf(fp, "%-4s %-9s %12s %12s\n", "", "", "live MiB", "peak MiB");
+    for (int d = 0; d < MEMSTAT_DOMAINS; d++){
+        for (int c = 0; c <= MEMSTAT_CATEGORIES; c++){
+            fprintf(fp, "%-4s %-9s %12.2f %12.2f\n", domain_names[d],
+                    category_names[c], totals[d][c] / MiB, peaks[d][c] / MiB);
+        }
+    }
+    for (asset = assets; asset; asset = asset->next){
+        fprintf(fp, "%s\n", asset->name);
+        for (int d = 0; d < MEMSTAT_DOMAINS; d++){
+            fprintf(fp, "    %s %.2f MiB, peak %.2f MiB:", domain_names[d],
+                    asset_total(asset, d) / MiB, asset->peak[d] / MiB);
+            for (int c = 0; c < MEMSTAT_CATEGORIES; c++){
+                if (asset->bytes[d][c]){
+                    fprintf(fp, " %s %.2f", category_names[c],
+                            asset->bytes[d][c] / MiB);
+                }
+            }
+            fprintf(fp, "\n");
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,580 @@
+#include <mesh_optimize.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+
+/* Import time reordering of triangle lists, in the order they should be
+ * applied:
+ *
+ * mesh_weld_vertices first merges duplicate vertices, which importers
+ * emit freely (OBJ in particular), so the rest sees the real sharing.
+ *
+ * mesh_optimize_vertex_cache reorders triangles for post-transform cache
+ * reuse (Forsyth, "Linear-Speed Vertex Cache Optimisation").
+ *
+ * mesh_optimize_overdraw then cuts that order into clusters wherever the
+ * cache state restarts anyway, and sorts the clusters so outward facing
+ * ones are drawn first (Sander et al., "Fast Triangle Reordering for
+ * Vertex Locality and Reduced Overdraw"). Cache efficiency within a
+ * cluster is untouched.
+ *
+ * mesh_optimize_vertex_fetch finally renumbers vertices in order of first
+ * use, so fetches walk the vertex buffer front to back.
+ */
+
+#define FORSYTH_CACHE_SIZE 32
+#define OVERDRAW_CACHE_SIZE 16
+
+
+static float forsyth_vertex_score(int cache_position, unsigned int remaining)
+{
+    float score = 0.f;
+
+    if (!remaining){
+        return -1.f;
+    }
+    if (cache_position >= 0){
+        if (cache_position < 3){
+            /* The triangle just drawn, a fixed score so it isn't simply
+             * repeated.
+             */
+            score = 0.75f;
+        } else{
+            score = powf(1.f - (cache_position - 3) / \
+                         (float)(FORSYTH_CACHE_SIZE - 3), 1.5f);
+        }
+    }
+    /* Favour vertices with few triangles left, so they get finished. */
+    return score + 2.f / sqrtf((float)remaining);
+}
+
+
+mesh_optimize_error_t mesh_optimize_vertex_cache(unsigned int * indices,
+                                                 size_t num_indices,
+                                                 size_t num_vertices)
+{
+    size_t num_triangles = num_indices / 3;
+    unsigned int * offsets, * remaining, * adjacency, * out;
+    float * vertex_score, * triangle_score, best_score;
+    int * cache_position;
+    unsigned char * emitted;
+    unsigned int cache[FORSYTH_CACHE_SIZE + 3];
+    unsigned int new_cache[FORSYTH_CACHE_SIZE + 3];
+    int cache_count = 0, new_count, found;
+    unsigned int v, t, * list;
+    size_t scan = 0, written = 0;
+    long best;
+
+    if (num_triangles == 0){
+        return MESH_OPTIMIZE_SUCCESS;
+    }
+    offsets = calloc(num_vertices + 1, sizeof(unsigned int));
+    remaining = calloc(num_vertices, sizeof(unsigned int));
+    adjacency = malloc(num_triangles * 3 * sizeof(unsigned int));
+    out = malloc(num_triangles * 3 * sizeof(unsigned int));
+    vertex_score = malloc(num_vertices * sizeof(float));
+    triangle_score = malloc(num_triangles * sizeof(float));
+    cache_position = malloc(num_vertices * sizeof(int));
+    emitted = calloc(num_triangles, 1);
+    if (!offsets || !remaining || !adjacency || !out || !vertex_score || \
+        !triangle_score || !cache_position || !emitted)
+    {
+        err_print("Out of memory");
+        free(offsets);
+        free(remaining);
+        free(adjacency);
+        free(out);
+        free(vertex_score);
+        free(triangle_score);
+        free(cache_position);
+        free(emitted);
+        return MESH_OPTIMIZE_NO_MEM;
+    }
+
+    /* Triangles using each vertex. remaining[v] counts the ones not yet
+     * emitted, which are kept at the front of the vertex's list.
+     */
+    for (size_t i = 0; i < num_triangles * 3; i++){
+        remaining[indices[i]]++;
+    }
+    for (size_t i = 0; i < num_vertices; i++){
+        offsets[i + 1] = offsets[i] + remaining[i];
+        remaining[i] = 0;
+    }
+    for (size_t i = 0; i < num_triangles * 3; i++){
+        v = indices[i];
+        adjacency[offsets[v] + remaining[v]++] = i / 3;
+    }
+    for (size_t i = 0; i < num_vertices; i++){
+        cache_position[i] = -1;
+        vertex_score[i] = forsyth_vertex_score(-1, remaining[i]);
+    }
+    best = 0;
+    best_score = -1.f;
+    for (size_t i = 0; i < num_triangles; i++){
+        triangle_score[i] = vertex_score[indices[3 * i]] + \
+                            vertex_score[indices[3 * i + 1]] + \
+                            vertex_score[indices[3 * i + 2]];
+        if (triangle_score[i] > best_score){
+            best_score = triangle_score[i];
+            best = i;
+        }
+    }
+
+    while (best >= 0){
+        t = (unsigned int)best;
+        memcpy(out + written, indices + 3 * t, 3 * sizeof(unsigned int));
+        written += 3;
+        emitted[t] = 1;
+
+        /* Drop t from its vertices' lists, and put them at the front of
+         * the cache.
+         */
+        new_count = 0;
+        for (int k = 0; k < 3; k++){
+            v = indices[3 * t + k];
+            list = adjacency + offsets[v];
+            for (unsigned int j = 0; j < remaining[v]; j++){
+                if (list[j] == t){
+                    list[j] = list[remaining[v] - 1];
+                    remaining[v]--;
+                    break;
+                }
+            }
+            found = 0;
+            for (int j = 0; j < new_count; j++){
+                found |= new_cache[j] == v;
+            }
+            if (!found){
+                new_cache[new_count++] = v;
+            }
+        }
+        for (int i = 0; i < cache_count; i++){
+            v = cache[i];
+            if (v != indices[3 * t] && v != indices[3 * t + 1] && \
+                v != indices[3 * t + 2])
+            {
+                new_cache[new_count++] = v;
+            }
+        }
+
+        /* Rescore everything that was or is in the cache, and pick the
+         * next triangle from among their neighbours.
+         */
+        for (int i = 0; i < new_count; i++){
+            v = new_cache[i];
+            cache_position[v] = i < FORSYTH_CACHE_SIZE ? i : -1;
+            vertex_score[v] = forsyth_vertex_score(cache_position[v],
+                                                   remaining[v]);
+        }
+        best = -1;
+        best_score = -1.f;
+        for (int i = 0; i < new_count; i++){
+            v = new_cache[i];
+            list = adjacency + offsets[v];
+            for (unsigned int j = 0; j < remaining[v]; j++){
+                t = list[j];
+                triangle_score[t] = vertex_score[indices[3 * t]] + \
+                                    vertex_score[indices[3 * t + 1]] + \
+                                    vertex_score[indices[3 * t + 2]];
+                if (triangle_score[t] > best_score){
+                    best_score = triangle_score[t];
+                    best = t;
+                }
+            }
+        }
+        cache_count = new_count < FORSYTH_CACHE_SIZE ? new_count \
+                                                     : FORSYTH_CACHE_SIZE;
+        memcpy(cache, new_cache, cache_count * sizeof(unsigned int));
+
+        if (best < 0){
+            /* Nothing left around the cache, restart from the next
+             * triangle in the original order.
+             */
+            while (scan < num_triangles && emitted[scan]){
+                scan++;
+            }
+            best = scan < num_triangles ? (long)scan : -1;
+        }
+    }
+    memcpy(indices, out, num_triangles * 3 * sizeof(unsigned int));
+
+    free(offsets);
+    free(remaining);
+    free(adjacency);
+    free(out);
+    free(vertex_score);
+    free(triangle_score);
+    free(cache_position);
+    free(emitted);
+    return MESH_OPTIMIZE_SUCCESS;
+}
+
+
+struct Fifo_Cache {
+    unsigned int * stamps;
+    unsigned int   time;
+    unsigned int   size;
+};
+typedef struct Fifo_Cache Fifo_Cache;
+
+
+static int fifo_cache_init(Fifo_Cache * cache, size_t num_vertices,
+                           unsigned int size)
+{
+    /* A vertex is cached while fewer than size misses happened since its
+     * own, which is exactly a FIFO of that size.
+     */
+    cache->stamps = calloc(num_vertices, sizeof(unsigned int));
+    cache->size = size;
+    cache->time = size + 1;
+    return cache->stamps != NULL;
+}
+
+
+static void fifo_cache_reset(Fifo_Cache * cache)
+{
+    cache->time += cache->size + 1;
+}
+
+
+static unsigned int fifo_cache_triangle(Fifo_Cache * cache,
+                                        const unsigned int * triangle)
+{
+    /* Returns the number of misses. */
+    unsigned int misses = 0;
+
+    for (int k = 0; k < 3; k++){
+        if (cache->time - cache->stamps[triangle[k]] > cache->size){
+            cache->stamps[triangle[k]] = cache->time++;
+            misses++;
+        }
+    }
+    return misses;
+}
+
+
+void mesh_analyze_vertex_cache(const unsigned int * indices,
+                               size_t num_indices, size_t num_vertices,
+                               unsigned int cache_size,
+                               Vertex_Cache_Stats * out)
+{
+    Fifo_Cache cache;
+    size_t num_triangles = num_indices / 3;
+
+    memset(out, 0, sizeof(Vertex_Cache_Stats));
+    if (!num_triangles || !fifo_cache_init(&cache, num_vertices, cache_size)){
+        return;
+    }
+    for (size_t i = 0; i < num_triangles; i++){
+        out->vertices_transformed += fifo_cache_triangle(&cache,
+                                                         indices + 3 * i);
+    }
+    out->acmr = out->vertices_transformed / (float)num_triangles;
+    out->atvr = num_vertices ? out->vertices_transformed / (float)num_vertices
+                             : 0.f;
+    free(cache.stamps);
+}
+
+
+struct Cluster {
+    size_t start;
+    size_t count;
+    float  sort_key;
+};
+typedef struct Cluster Cluster;
+
+
+static int compare_cluster(const void * a, const void * b)
+{
+    const Cluster * x = a;
+    const Cluster * y = b;
+
+    if (x->sort_key != y->sort_key)
+        return x->sort_key > y->sort_key ? -1 : 1;
+    return x->start < y->start ? -1 : 1;
+}
+
+
+static const float * vertex_position(const float * positions, size_t stride,
+                                     unsigned int index)
+{
+    return (const float *)((const char *)positions + index * stride);
+}
+
+
+mesh_optimize_error_t mesh_optimize_overdraw(unsigned int * indices,
+                                             size_t num_indices,
+                                             const float * positions,
+                                             size_t stride,
+                                             size_t num_vertices,
+                                             float threshold)
+{
+    /* threshold is how much worse than its cluster's ACMR a piece may be
+     * before it is split off, 1.05 gives up about 5% of cache efficiency.
+     */
+    size_t num_triangles = num_indices / 3;
+    unsigned int * out;
+    size_t * hard, num_hard = 0, num_clusters = 0, cursor;
+    unsigned int misses, cluster_misses;
+    Cluster * clusters;
+    Fifo_Cache cache;
+    const float * p[3];
+    float e1[3], e2[3], n[3], centroid[3], mesh_centroid[3] = {0.f, 0.f, 0.f};
+    float mesh_area = 0.f, area, cluster_area, cluster_acmr, length;
+    float cluster_centroid[3], cluster_normal[3];
+
+    if (num_triangles < 2){
+        return MESH_OPTIMIZE_SUCCESS;
+    }
+    out = malloc(num_indices * sizeof(unsigned int));
+    hard = malloc((num_triangles + 1) * sizeof(size_t));
+    clusters = malloc(num_triangles * sizeof(Cluster));
+    if (!out || !hard || !clusters || \
+        !fifo_cache_init(&cache, num_vertices, OVERDRAW_CACHE_SIZE))
+    {
+        err_print("Out of memory");
+        free(out);
+        free(hard);
+        free(clusters);
+        return MESH_OPTIMIZE_NO_MEM;
+    }
+
+    /* Hard boundaries: triangles missing on all three vertices, where the
+     * cache has effectively restarted.
+     */
+    for (size_t i = 0; i < num_triangles; i++){
+        if (fifo_cache_triangle(&cache, indices + 3 * i) == 3){
+            hard[num_hard++] = i;
+        }
+    }
+    if (!num_hard || hard[0] != 0){
+        /* Can't happen for the first triangle unless it is degenerate. */
+        memmove(hard + 1, hard, num_hard * sizeof(size_t));
+        hard[0] = 0;
+        num_hard++;
+    }
+    hard[num_hard] = num_triangles;
+
+    /* Soft boundaries: split each hard cluster as soon as its prefix is
+     * close enough to the whole cluster's ACMR.
+     */
+    for (size_t h = 0; h < num_hard; h++){
+        fifo_cache_reset(&cache);
+        cluster_misses = 0;
+        for (size_t i = hard[h]; i < hard[h + 1]; i++){
+            cluster_misses += fifo_cache_triangle(&cache, indices + 3 * i);
+        }
+        cluster_acmr = cluster_misses / (float)(hard[h + 1] - hard[h]);
+        fifo_cache_reset(&cache);
+        misses = 0;
+        cursor = hard[h];
+        for (size_t i = hard[h]; i < hard[h + 1]; i++){
+            misses += fifo_cache_triangle(&cache, indices + 3 * i);
+            if (i + 1 < hard[h + 1] && \
+                misses <= cluster_acmr * threshold * (i + 1 - cursor))
+            {
+                clusters[num_clusters].start = cursor;
+                clusters[num_clusters++].count = i + 1 - cursor;
+                cursor = i + 1;
+                misses = 0;
+                fifo_cache_reset(&cache);
+            }
+        }
+        clusters[num_clusters].start = cursor;
+        clusters[num_clusters++].count = hard[h + 1] - cursor;
+    }
+    free(cache.stamps);
+
+    /* Area weighted mesh centroid. */
+    for (size_t i = 0; i < num_triangles; i++){
+        for (int k = 0; k < 3; k++){
+            p[k] = vertex_position(positions, stride, indices[3 * i + k]);
+        }
+        for (int k = 0; k < 3; k++){
+            e1[k] = p[1][k] - p[0][k];
+            e2[k] = p[2][k] - p[0][k];
+        }
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (int k = 0; k < 3; k++){
+            mesh_centroid[k] += area * (p[0][k] + p[1][k] + p[2][k]) / 3.f;
+        }
+        mesh_area += area;
+    }
+    for (int k = 0; k < 3 && mesh_area > 0.f; k++){
+        mesh_centroid[k] /= mesh_area;
+    }
+
+    /* Clusters facing away from the centre are likely to be in front of
+     * the rest of the mesh from any viewpoint, so they are drawn first.
+     */
+    for (size_t c = 0; c < num_clusters; c++){
+        memset(cluster_centroid, 0, sizeof(cluster_centroid));
+        memset(cluster_normal, 0, sizeof(cluster_normal));
+        cluster_area = 0.f;
+        for (size_t i = clusters[c].start;
+             i < clusters[c].start + clusters[c].count; i++)
+        {
+            for (int k = 0; k < 3; k++){
+                p[k] = vertex_position(positions, stride, indices[3 * i + k]);
+            }
+            for (int k = 0; k < 3; k++){
+                e1[k] = p[1][k] - p[0][k];
+                e2[k] = p[2][k] - p[0][k];
+            }
+            n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+            n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+            n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+            area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int k = 0; k < 3; k++){
+                cluster_centroid[k] += area * (p[0][k] + p[1][k] + p[2][k]) \
+                                       / 3.f;
+                cluster_normal[k] += n[k];
+            }
+            cluster_area += area;
+        }
+        length = sqrtf(cluster_normal[0] * cluster_normal[0] + \
+                       cluster_normal[1] * cluster_normal[1] + \
+                       cluster_normal[2] * cluster_normal[2]);
+        clusters[c].sort_key = 0.f;
+        if (cluster_area > 0.f && length > 0.f){
+            for (int k = 0; k < 3; k++){
+                centroid[k] = cluster_centroid[k] / cluster_area - \
+                              mesh_centroid[k];
+                clusters[c].sort_key += centroid[k] * cluster_normal[k] / \
+                                        length;
+            }
+        }
+    }
+    qsort(clusters, num_clusters, sizeof(Cluster), compare_cluster);
+
+    cursor = 0;
+    for (size_t c = 0; c < num_clusters; c++){
+        memcpy(out + cursor, indices + 3 * clusters[c].start,
+               3 * clusters[c].count * sizeof(unsigned int));
+        cursor += 3 * clusters[c].count;
+    }
+    memcpy(indices, out, num_triangles * 3 * sizeof(unsigned int));
+    free(out);
+    free(hard);
+    free(clusters);
+    return MESH_OPTIMIZE_SUCCESS;
+}
+
+
+mesh_optimize_error_t mesh_optimize_vertex_fetch(void * vertices,
+                                                 size_t vertex_size,
+                                                 size_t num_vertices,
+                                                 unsigned int * indices,
+                                                 size_t num_indices,
+                                                 size_t * used_vertices)
+{
+    /* Vertices are renumbered in order of first use. Ones no triangle
+     * references are dropped, *used_vertices is the new count.
+     */
+    const unsigned int unused = ~0u;
+    unsigned int * remap;
+    unsigned char * reordered;
+    unsigned int next = 0;
+
+    *used_vertices = num_vertices;
+    remap = malloc(num_vertices * sizeof(unsigned int));
+    reordered = malloc(num_vertices * vertex_size);
+    if (!remap || !reordered){
+        err_print("Out of memory");
+        free(remap);
+        free(reordered);
+        return MESH_OPTIMIZE_NO_MEM;
+    }
+    memset(remap, 0xff, num_vertices * sizeof(unsigned int));
+    for (size_t i = 0; i < num_indices; i++){
+        if (remap[indices[i]] == unused){
+            memcpy(reordered + next * vertex_size,
+                   (unsigned char *)vertices + indices[i] * vertex_size,
+                   vertex_size);
+            remap[indices[i]] = next++;
+        }
+        indices[i] = remap[indices[i]];
+    }
+    memcpy(vertices, reordered, next * vertex_size);
+    *used_vertices = next;
+    free(remap);
+    free(reordered);
+    return MESH_OPTIMIZE_SUCCESS;
+}
+
+
+static uint32_t hash_bytes(const unsigned char * data, size_t size)
+{
+    /* FNV-1a. */
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < size; i++){
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+mesh_optimize_error_t mesh_weld_vertices(void * vertices, size_t vertex_size,
+                                         size_t num_vertices,
+                                         unsigned int * indices,
+                                         size_t num_indices,
+                                         size_t * unique_vertices)
+{
+    /* Merges bit-identical vertices, keeping the first copy, and compacts
+     * the vertex array. *unique_vertices is the new count.
+     */
+    const unsigned int empty = ~0u;
+    unsigned char * data = vertices;
+    unsigned int * table, * remap;
+    size_t table_size = 1, slot;
+    unsigned int next = 0;
+
+    *unique_vertices = num_vertices;
+    while (table_size < 2 * num_vertices){
+        table_size *= 2;
+    }
+    table = malloc(table_size * sizeof(unsigned int));
+    remap = malloc(num_vertices * sizeof(unsigned int));
+    if (!table || !remap){
+        err_print("Out of memory");
+        free(table);
+        free(remap);
+        return MESH_OPTIMIZE_NO_MEM;
+    }
+    memset(table, 0xff, table_size * sizeof(unsigned int));
+    for (size_t i = 0; i < num_vertices; i++){
+        slot = hash_bytes(data + i * vertex_size, vertex_size) & \
+               (table_size - 1);
+        /* Linear probing. Entries are indices into the compacted array,
+         * which is filled in place as we go.
+         */
+        while (table[slot] != empty && \
+               memcmp(data + table[slot] * vertex_size,
+                      data + i * vertex_size, vertex_size))
+        {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot] == empty){
+            if (next != i){
+                memcpy(data + next * vertex_size, data + i * vertex_size,
+                       vertex_size);
+            }
+            table[slot] = next++;
+        }
+        remap[i] = table[slot];
+    }
+    for (size_t i = 0; i < num_indices; i++){
+        indices[i] = remap[indices[i]];
+    }
+    *unique_vertices = next;
+    free(table);
+    free(remap);
+    return MESH_OPTIMIZE_SUCCESS;
+}
@@ -0,0 +1,275 @@
+#include <meshlet.h>
+#include <math.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <xmmintrin.h>
+    #define MESHLET_X86
+#endif
+
+
+/* Below this the triangles of a meshlet spread too far for the normal
+ * cone to ever reject it.
+ */
+#define CONE_MIN_DOT 0.1f
+
+
+static const float * position_of(const float * positions, size_t stride,
+                                 unsigned int index)
+{
+    return (const float *)((const char *)positions + index * stride);
+}
+
+
+static void meshlet_bounds(Meshlet_Bounds4 * bounds, int lane,
+                           const Meshlet * meshlet,
+                           const unsigned int * indices,
+                           const float * positions, size_t stride)
+{
+    const unsigned int * triangle;
+    const float * p, * a, * b, * c;
+    float low[3], high[3], center[3], axis[3] = {0.f, 0.f, 0.f};
+    float e1[3], e2[3], n[3], length, radius = 0.f, distance, dot;
+    float min_dot = 1.f;
+
+    p = position_of(positions, stride, indices[meshlet->first_index]);
+    for (int k = 0; k < 3; k++){
+        low[k] = high[k] = p[k];
+    }
+    for (unsigned int i = 0; i < meshlet->count; i++){
+        p = position_of(positions, stride, indices[meshlet->first_index + i]);
+        for (int k = 0; k < 3; k++){
+            low[k] = fminf(low[k], p[k]);
+            high[k] = fmaxf(high[k], p[k]);
+        }
+    }
+    for (int k = 0; k < 3; k++){
+        center[k] = 0.5f * (low[k] + high[k]);
+    }
+    for (unsigned int i = 0; i < meshlet->count; i++){
+        p = position_of(positions, stride, indices[meshlet->first_index + i]);
+        distance = sqrtf((p[0] - center[0]) * (p[0] - center[0]) + \
+                         (p[1] - center[1]) * (p[1] - center[1]) + \
+                         (p[2] - center[2]) * (p[2] - center[2]));
+        radius = fmaxf(radius, distance);
+    }
+
+    /* Unit face normals, twice: once for their mean direction, once for
+     * the widest angle from it.
+     */
+    for (int pass = 0; pass < 2; pass++){
+        for (unsigned int i = 0; i < meshlet->count; i += 3){
+            triangle = indices + meshlet->first_index + i;
+            a = position_of(positions, stride, triangle[0]);
+            b = position_of(positions, stride, triangle[1]);
+            c = position_of(positions, stride, triangle[2]);
+            for (int k = 0; k < 3; k++){
+                e1[k] = b[k] - a[k];
+                e2[k] = c[k] - a[k];
+            }
+            n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+            n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+            n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+            length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (length == 0.f)
+                continue;
+            if (!pass){
+                for (int k = 0; k < 3; k++){
+                    axis[k] += n[k] / length;
+                }
+            } else{
+                dot = (n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2]) / \
+                      length;
+                min_dot = fminf(min_dot, dot);
+            }
+        }
+        if (!pass){
+            length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + \
+                           axis[2] * axis[2]);
+            if (length == 0.f){
+                min_dot = -1.f;
+                break;
+            }
+            for (int k = 0; k < 3; k++){
+                axis[k] /= length;
+            }
+        }
+    }
+
+    bounds->center_x[lane] = center[0];
+    bounds->center_y[lane] = center[1];
+    bounds->center_z[lane] = center[2];
+    bounds->radius[lane] = radius;
+    bounds->axis_x[lane] = axis[0];
+    bounds->axis_y[lane] = axis[1];
+    bounds->axis_z[lane] = axis[2];
+    /* The sine of the cone's half angle, as seen from the other side. */
+    bounds->cutoff[lane] = min_dot < CONE_MIN_DOT ? 1.f : \
+                           sqrtf(1.f - min_dot * min_dot);
+}
+
+
+meshlet_error_t meshlet_build(Meshlet ** meshlets, Meshlet_Bounds4 ** bounds,
+                              unsigned int * count,
+                              const unsigned int * indices,
+                              size_t num_indices,
+                              const float * positions, size_t stride,
+                              size_t num_vertices)
+{
+    unsigned int * owner, capacity = 64, num_meshlets = 0, vertices = 0;
+    unsigned int fresh, v;
+    Meshlet * out, * grown, * current = NULL;
+    Meshlet_Bounds4 * out_bounds;
+
+    *meshlets = NULL;
+    *bounds = NULL;
+    *count = 0;
+    owner = calloc(num_vertices, sizeof(unsigned int));
+    out = malloc(capacity * sizeof(Meshlet));
+    if (!owner || !out){
+        free(owner);
+        free(out);
+        err_print("Out of memory");
+        return MESHLET_NO_MEM;
+    }
+
+    /* owner holds the meshlet number + 1 of the last meshlet using a
+     * vertex.
+     */
+    for (size_t i = 0; i < num_indices; i += 3){
+        fresh = 0;
+        for (int k = 0; k < 3; k++){
+            v = indices[i + k];
+            fresh += owner[v] != num_meshlets && \
+                     (k == 0 || v != indices[i]) && \
+                     (k < 2 || v != indices[i + 1]);
+        }
+        if (!current || vertices + fresh > MESHLET_MAX_VERTICES || \
+            current->count == 3 * MESHLET_MAX_TRIANGLES)
+        {
+            if (num_meshlets == capacity){
+                capacity *= 2;
+                grown = realloc(out, capacity * sizeof(Meshlet));
+                if (!grown){
+                    free(owner);
+                    free(out);
+                    err_print("Out of memory");
+                    return MESHLET_NO_MEM;
+                }
+                out = grown;
+            }
+            current = out + num_meshlets++;
+            current->first_index = i;
+            current->count = 0;
+            vertices = 0;
+        }
+        for (int k = 0; k < 3; k++){
+            v = indices[i + k];
+            if (owner[v] != num_meshlets){
+                owner[v] = num_meshlets;
+                vertices++;
+            }
+        }
+        current->count += 3;
+    }
+    free(owner);
+
+    out_bounds = calloc((num_meshlets + 3) / 4, sizeof(Meshlet_Bounds4));
+    if (!out_bounds){
+        free(out);
+        err_print("Out of memory");
+        return MESHLET_NO_MEM;
+    }
+    for (unsigned int i = 0; i < num_meshlets; i++){
+        meshlet_bounds(out_bounds + i / 4, i % 4, out + i, indices,
+                       positions, stride);
+    }
+    *meshlets = out;
+    *bounds = out_bounds;
+    *count = num_meshlets;
+    return MESHLET_SUCCESS;
+}
+
+
+#ifdef MESHLET_X86
+unsigned int meshlet_cull(const Meshlet_Bounds4 * bounds, unsigned int count,
+                          const Frustum * frustum, const float * eye,
+                          unsigned int * visible)
+{
+    const __m128 zero = _mm_setzero_ps();
+    __m128 x, y, z, r, d, mask, dx, dy, dz, dot, length, away;
+    unsigned int num_visible = 0, first;
+    int bits;
+
+    for (unsigned int g = 0; g < (count + 3) / 4; g++){
+        x = _mm_loadu_ps(bounds[g].center_x);
+        y = _mm_loadu_ps(bounds[g].center_y);
+        z = _mm_loadu_ps(bounds[g].center_z);
+        r = _mm_loadu_ps(bounds[g].radius);
+        mask = _mm_cmpeq_ps(zero, zero);
+        for (int i = 0; i < 6; i++){
+            d = _mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(x, _mm_set1_ps(frustum->planes[i][0])),
+                    _mm_mul_ps(y, _mm_set1_ps(frustum->planes[i][1]))),
+                _mm_add_ps(
+                    _mm_mul_ps(z, _mm_set1_ps(frustum->planes[i][2])),
+                    _mm_set1_ps(frustum->planes[i][3])));
+            mask = _mm_and_ps(mask, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+        }
+        if (eye){
+            dx = _mm_sub_ps(x, _mm_set1_ps(eye[0]));
+            dy = _mm_sub_ps(y, _mm_set1_ps(eye[1]));
+            dz = _mm_sub_ps(z, _mm_set1_ps(eye[2]));
+            dot = _mm_add_ps(_mm_add_ps(
+                      _mm_mul_ps(dx, _mm_loadu_ps(bounds[g].axis_x)),
+                      _mm_mul_ps(dy, _mm_loadu_ps(bounds[g].axis_y))),
+                  _mm_mul_ps(dz, _mm_loadu_ps(bounds[g].axis_z)));
+            length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+                         _mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                     _mm_mul_ps(dz, dz)));
+            away = _mm_cmpge_ps(dot, _mm_add_ps(
+                       _mm_mul_ps(_mm_loadu_ps(bounds[g].cutoff), length), r));
+            mask = _mm_andnot_ps(away, mask);
+        }
+        bits = _mm_movemask_ps(mask);
+        first = 4 * g;
+        for (int lane = 0; lane < 4 && first + lane < count; lane++){
+            if (bits & (1 << lane)){
+                visible[num_visible++] = first + lane;
+            }
+        }
+    }
+    return num_visible;
+}
+#else
+unsigned int meshlet_cull(const Meshlet_Bounds4 * bounds, unsigned int count,
+                          const Frustum * frustum, const float * eye,
+                          unsigned int * visible)
+{
+    const Meshlet_Bounds4 * b;
+    unsigned int num_visible = 0;
+    int lane;
+    float center[3], d[3], dot, length;
+
+    for (unsigned int i = 0; i < count; i++){
+        b = bounds + i / 4;
+        lane = i % 4;
+        center[0] = b->center_x[lane];
+        center[1] = b->center_y[lane];
+        center[2] = b->center_z[lane];
+        if (!frustum_test_sphere(frustum, center, b->radius[lane]))
+            continue;
+        if (eye){
+            for (int k = 0; k < 3; k++){
+                d[k] = center[k] - eye[k];
+            }
+            dot = d[0] * b->axis_x[lane] + d[1] * b->axis_y[lane] + \
+                  d[2] * b->axis_z[lane];
+            length = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+            if (dot >= b->cutoff[lane] * length + b->radius[lane])
+                continue;
+        }
+        visible[num_visible++] = i;
+    }
+    return num_visible;
+}
+#endif
@@ -0,0 +1,493 @@
+#include <mipmap.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define MIPMAP_X86
+#endif
+
+
+/* Every level is filtered in float, four channels per texel regardless of
+ * the source channel count, so the SIMD kernels only ever see rows of
+ * 4-float texels. Conversion to and from bytes is where sRGB decoding and
+ * normal renormalization happen.
+ */
+
+#define LINEAR_LUT_SIZE 4096
+#define KAISER_TAPS     6
+
+static float srgb_to_linear_lut[256];
+static unsigned char linear_to_srgb_lut[LINEAR_LUT_SIZE];
+static float kaiser_weights[KAISER_TAPS];
+static int use_avx2 = 0;
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++){
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+
+static void init_tables(void)
+{
+    const double alpha = 4.0, half_width = 3.0;
+    double c, offset, t, sinc, window, sum = 0.0;
+
+    for (int i = 0; i < 256; i++){
+        c = i / 255.0;
+        srgb_to_linear_lut[i] = c <= 0.04045 ? c / 12.92 : \
+                                pow((c + 0.055) / 1.055, 2.4);
+    }
+    for (int i = 0; i < LINEAR_LUT_SIZE; i++){
+        c = i / (double)(LINEAR_LUT_SIZE - 1);
+        c = c <= 0.0031308 ? c * 12.92 : 1.055 * pow(c, 1.0 / 2.4) - 0.055;
+        linear_to_srgb_lut[i] = (unsigned char)(c * 255.0 + 0.5);
+    }
+    /* Taps sit at source texels 2x-2 .. 2x+3, ie. -2.5 .. 2.5 source
+     * texels from the centre of output texel x.
+     */
+    for (int k = 0; k < KAISER_TAPS; k++){
+        offset = k - 2.5;
+        t = offset / 2.0;
+        sinc = sin(M_PI * t) / (M_PI * t);
+        t = offset / half_width;
+        window = bessel_i0(alpha * sqrt(fmax(1.0 - t * t, 0.0))) / \
+                 bessel_i0(alpha);
+        kaiser_weights[k] = sinc * window;
+        sum += kaiser_weights[k];
+    }
+    for (int k = 0; k < KAISER_TAPS; k++){
+        kaiser_weights[k] /= sum;
+    }
+    #ifdef MIPMAP_X86
+    __builtin_cpu_init();
+    use_avx2 = __builtin_cpu_supports("avx2");
+    #endif
+}
+
+
+int mip_level_count(int width, int height)
+{
+    int levels = 1;
+    int size = width > height ? width : height;
+
+    while (size > 1 && levels < MIPMAP_MAX_LEVELS){
+        size /= 2;
+        levels++;
+    }
+    return levels;
+}
+
+
+static int alpha_channel(int channels)
+{
+    /* stb hands back grey+alpha for 2 channels and RGBA for 4. */
+    return (channels == 2 || channels == 4) ? channels - 1 : -1;
+}
+
+
+static void row_to_float(const unsigned char * src, int width, int channels,
+                         mip_content_t content, float * out)
+{
+    int alpha = alpha_channel(channels);
+    int color_channels = alpha >= 0 ? channels - 1 : channels;
+    unsigned char byte;
+
+    for (int x = 0; x < width; x++){
+        for (int c = 0; c < 4; c++){
+            out[4 * x + c] = c == 3 ? 1.f : 0.f;
+        }
+        for (int c = 0; c < channels; c++){
+            byte = src[x * channels + c];
+            if (c == alpha){
+                out[4 * x + 3] = byte / 255.f;
+            } else if (content == MIP_CONTENT_SRGB){
+                out[4 * x + c] = srgb_to_linear_lut[byte];
+            } else if (content == MIP_CONTENT_NORMAL && c < color_channels){
+                out[4 * x + c] = byte / 127.5f - 1.f;
+            } else{
+                out[4 * x + c] = byte / 255.f;
+            }
+        }
+    }
+}
+
+
+static unsigned char to_byte(float value)
+{
+    value = value * 255.f + 0.5f;
+    if (value < 0.f)
+        return 0;
+    if (value > 255.f)
+        return 255;
+    return (unsigned char)value;
+}
+
+
+static void float_to_row(float * in, int width, int channels,
+                         mip_content_t content, unsigned char * dst)
+{
+    int alpha = alpha_channel(channels);
+    float * texel;
+    float length, value;
+
+    for (int x = 0; x < width; x++){
+        texel = in + 4 * x;
+        if (content == MIP_CONTENT_NORMAL){
+            length = sqrtf(texel[0] * texel[0] + texel[1] * texel[1] + \
+                           texel[2] * texel[2]);
+            if (length > 1e-6f){
+                texel[0] /= length;
+                texel[1] /= length;
+                texel[2] /= length;
+            }
+        }
+        for (int c = 0; c < channels; c++){
+            if (c == alpha){
+                dst[x * channels + c] = to_byte(texel[3]);
+            } else if (content == MIP_CONTENT_SRGB){
+                value = texel[c] < 0.f ? 0.f : (texel[c] > 1.f ? 1.f : texel[c]);
+                dst[x * channels + c] = \
+                    linear_to_srgb_lut[(int)(value * (LINEAR_LUT_SIZE - 1) \
+                                             + 0.5f)];
+            } else if (content == MIP_CONTENT_NORMAL){
+                dst[x * channels + c] = to_byte(texel[c] * 0.5f + 0.5f);
+            } else{
+                dst[x * channels + c] = to_byte(texel[c]);
+            }
+        }
+    }
+}
+
+
+/* Vertical kernels: whole rows of floats, n is a multiple of 4. */
+
+#ifdef MIPMAP_X86
+__attribute__((target("avx2")))
+static void row_scale_avx2(float * acc, const float * row, float weight,
+                           int n)
+{
+    __m256 w = _mm256_set1_ps(weight);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8){
+        _mm256_storeu_ps(acc + i, _mm256_mul_ps(_mm256_loadu_ps(row + i), w));
+    }
+    for (; i < n; i += 4){
+        _mm_storeu_ps(acc + i, _mm_mul_ps(_mm_loadu_ps(row + i),
+                                          _mm_set1_ps(weight)));
+    }
+}
+
+
+__attribute__((target("avx2")))
+static void row_accumulate_avx2(float * acc, const float * row, float weight,
+                                int n)
+{
+    __m256 w = _mm256_set1_ps(weight);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8){
+        _mm256_storeu_ps(acc + i,
+                         _mm256_add_ps(_mm256_loadu_ps(acc + i),
+                                       _mm256_mul_ps(_mm256_loadu_ps(row + i),
+                                                     w)));
+    }
+    for (; i < n; i += 4){
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                          _mm_mul_ps(_mm_loadu_ps(row + i),
+                                                     _mm_set1_ps(weight))));
+    }
+}
+#endif
+
+
+static void row_scale(float * acc, const float * row, float weight, int n)
+{
+    #ifdef MIPMAP_X86
+    if (use_avx2){
+        row_scale_avx2(acc, row, weight, n);
+        return;
+    }
+    __m128 w = _mm_set1_ps(weight);
+    for (int i = 0; i < n; i += 4){
+        _mm_storeu_ps(acc + i, _mm_mul_ps(_mm_loadu_ps(row + i), w));
+    }
+    #else
+    for (int i = 0; i < n; i++){
+        acc[i] = row[i] * weight;
+    }
+    #endif
+}
+
+
+static void row_accumulate(float * acc, const float * row, float weight,
+                           int n)
+{
+    #ifdef MIPMAP_X86
+    if (use_avx2){
+        row_accumulate_avx2(acc, row, weight, n);
+        return;
+    }
+    __m128 w = _mm_set1_ps(weight);
+    for (int i = 0; i < n; i += 4){
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                          _mm_mul_ps(_mm_loadu_ps(row + i),
+                                                     w)));
+    }
+    #else
+    for (int i = 0; i < n; i++){
+        acc[i] += row[i] * weight;
+    }
+    #endif
+}
+
+
+/* Horizontal kernels: one 4-float texel per SSE register. */
+
+#ifdef MIPMAP_X86
+__attribute__((target("avx2")))
+static int box_horizontal_avx2(const float * row, int in_width, float * out,
+                               int out_width)
+{
+    /* Two output texels per iteration. Returns how many were written so
+     * the caller can finish the clamped edge.
+     */
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256 a, b;
+    int x = 0;
+
+    for (; x + 2 <= out_width && 2 * x + 3 < in_width; x += 2){
+        a = _mm256_loadu_ps(row + 8 * x);       //texels 2x, 2x+1
+        b = _mm256_loadu_ps(row + 8 * x + 8);   //texels 2x+2, 2x+3
+        _mm256_storeu_ps(out + 4 * x,
+                         _mm256_mul_ps(_mm256_add_ps(
+                             _mm256_permute2f128_ps(a, b, 0x20),
+                             _mm256_permute2f128_ps(a, b, 0x31)), half));
+    }
+    return x;
+}
+#endif
+
+
+static void box_horizontal(const float * row, int in_width, float * out,
+                           int out_width)
+{
+    int x = 0, x0, x1;
+
+    #ifdef MIPMAP_X86
+    __m128 half = _mm_set1_ps(0.5f);
+    if (use_avx2){
+        x = box_horizontal_avx2(row, in_width, out, out_width);
+    }
+    #endif
+    for (; x < out_width; x++){
+        x0 = 2 * x < in_width ? 2 * x : in_width - 1;
+        x1 = 2 * x + 1 < in_width ? 2 * x + 1 : in_width - 1;
+        #ifdef MIPMAP_X86
+        _mm_storeu_ps(out + 4 * x,
+                      _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(row + 4 * x0),
+                                            _mm_loadu_ps(row + 4 * x1)),
+                                 half));
+        #else
+        for (int c = 0; c < 4; c++){
+            out[4 * x + c] = 0.5f * (row[4 * x0 + c] + row[4 * x1 + c]);
+        }
+        #endif
+    }
+}
+
+
+static void kaiser_horizontal(const float * row, int in_width, float * out,
+                              int out_width)
+{
+    int source;
+
+    for (int x = 0; x < out_width; x++){
+        #ifdef MIPMAP_X86
+        __m128 acc = _mm_setzero_ps();
+        for (int k = 0; k < KAISER_TAPS; k++){
+            source = 2 * x - 2 + k;
+            source = source < 0 ? 0 : \
+                     (source >= in_width ? in_width - 1 : source);
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(row + 4 * source),
+                                             _mm_set1_ps(kaiser_weights[k])));
+        }
+        _mm_storeu_ps(out + 4 * x, acc);
+        #else
+        for (int c = 0; c < 4; c++)
+            out[4 * x + c] = 0.f;
+        for (int k = 0; k < KAISER_TAPS; k++){
+            source = 2 * x - 2 + k;
+            source = source < 0 ? 0 : \
+                     (source >= in_width ? in_width - 1 : source);
+            for (int c = 0; c < 4; c++)
+                out[4 * x + c] += kaiser_weights[k] * row[4 * source + c];
+        }
+        #endif
+    }
+}
+
+
+static mipmap_error_t downsample_box(const Mip_Level * in, Mip_Level * out,
+                                     int channels, mip_content_t content)
+{
+    size_t in_row = (size_t)in->width * channels;
+    size_t out_row = (size_t)out->width * channels;
+    float * scratch;
+    float * r0, * r1, * vertical, * result;
+    int y0, y1;
+
+    scratch = malloc((3 * 4 * (size_t)in->width + 4 * (size_t)out->width) * \
+                     sizeof(float));
+    if (!scratch){
+        err_print("Out of memory");
+        return MIPMAP_NO_MEM;
+    }
+    r0 = scratch;
+    r1 = r0 + 4 * in->width;
+    vertical = r1 + 4 * in->width;
+    result = vertical + 4 * in->width;
+    for (int y = 0; y < out->height; y++){
+        y0 = 2 * y < in->height ? 2 * y : in->height - 1;
+        y1 = 2 * y + 1 < in->height ? 2 * y + 1 : in->height - 1;
+        row_to_float(in->data + y0 * in_row, in->width, channels, content, r0);
+        row_to_float(in->data + y1 * in_row, in->width, channels, content, r1);
+        row_scale(vertical, r0, 0.5f, 4 * in->width);
+        row_accumulate(vertical, r1, 0.5f, 4 * in->width);
+        box_horizontal(vertical, in->width, result, out->width);
+        float_to_row(result, out->width, channels, content,
+                     out->data + y * out_row);
+    }
+    free(scratch);
+    return MIPMAP_SUCCESS;
+}
+
+
+static mipmap_error_t downsample_kaiser(const Mip_Level * in, Mip_Level * out,
+                                        int channels, mip_content_t content)
+{
+    /* Separable: source rows are filtered horizontally into a ring of
+     * KAISER_TAPS rows, each output row is then a weighted sum of the ring.
+     */
+    size_t in_row = (size_t)in->width * channels;
+    size_t out_row = (size_t)out->width * channels;
+    size_t ring_row = 4 * (size_t)out->width;
+    int ring_tags[KAISER_TAPS];
+    float * scratch, * ring, * source_row, * result;
+    int source, slot;
+
+    scratch = malloc(((KAISER_TAPS + 1) * ring_row + 4 * (size_t)in->width) * \
+                     sizeof(float));
+    if (!scratch){
+        err_print("Out of memory");
+        return MIPMAP_NO_MEM;
+    }
+    ring = scratch;
+    result = ring + KAISER_TAPS * ring_row;
+    source_row = result + ring_row;
+    for (int k = 0; k < KAISER_TAPS; k++){
+        ring_tags[k] = -1;
+    }
+    for (int y = 0; y < out->height; y++){
+        for (int k = 0; k < KAISER_TAPS; k++){
+            source = 2 * y - 2 + k;
+            source = source < 0 ? 0 : \
+                     (source >= in->height ? in->height - 1 : source);
+            slot = source % KAISER_TAPS;
+            if (ring_tags[slot] != source){
+                row_to_float(in->data + source * in_row, in->width, channels,
+                             content, source_row);
+                kaiser_horizontal(source_row, in->width,
+                                  ring + slot * ring_row, out->width);
+                ring_tags[slot] = source;
+            }
+            if (k == 0){
+                row_scale(result, ring + slot * ring_row, kaiser_weights[k],
+                          ring_row);
+            } else{
+                row_accumulate(result, ring + slot * ring_row,
+                               kaiser_weights[k], ring_row);
+            }
+        }
+        float_to_row(result, out->width, channels, content,
+                     out->data + y * out_row);
+    }
+    free(scratch);
+    return MIPMAP_SUCCESS;
+}
+
+
+mipmap_error_t mip_chain_build(Mip_Chain * chain, unsigned char * pixels,
+                               int width, int height, int channels,
+                               mip_content_t content, mip_filter_t filter)
+{
+    /* Safe to call from worker threads, nothing here touches GL. */
+    mipmap_error_t result = MIPMAP_SUCCESS;
+    size_t total = 0;
+    int level_width = width, level_height = height;
+    unsigned char * cursor;
+
+    pthread_once(&tables_once, init_tables);
+    memset(chain, 0, sizeof(Mip_Chain));
+    if (!pixels || width < 1 || height < 1 || channels < 1 || channels > 4){
+        err_print("Bad image passed to mip_chain_build");
+        return MIPMAP_ERR;
+    }
+    chain->channels = channels;
+    chain->num_levels = mip_level_count(width, height);
+    for (int i = 0; i < chain->num_levels; i++){
+        chain->levels[i].width = level_width;
+        chain->levels[i].height = level_height;
+        chain->levels[i].size = (size_t)level_width * level_height * channels;
+        if (i > 0)
+            total += chain->levels[i].size;
+        level_width = level_width > 1 ? level_width / 2 : 1;
+        level_height = level_height > 1 ? level_height / 2 : 1;
+    }
+    chain->levels[0].data = pixels;
+    if (chain->num_levels == 1){
+        return MIPMAP_SUCCESS;
+    }
+    chain->storage = malloc(total);
+    if (!chain->storage){
+        err_print("Out of memory");
+        chain->num_levels = 1;
+        return MIPMAP_NO_MEM;
+    }
+    cursor = chain->storage;
+    for (int i = 1; i < chain->num_levels; i++){
+        chain->levels[i].data = cursor;
+        cursor += chain->levels[i].size;
+        if (filter == MIP_FILTER_KAISER){
+            result = downsample_kaiser(chain->levels + i - 1, chain->levels + i,
+                                       channels, content);
+        } else{
+            result = downsample_box(chain->levels + i - 1, chain->levels + i,
+                                    channels, content);
+        }
+        if (result){
+            /* Keep what we have, it is still a valid (short) chain. */
+            chain->num_levels = i;
+            break;
+        }
+    }
+    return result;
+}
+
+
+void mip_chain_free(Mip_Chain * chain)
+{
+    if (chain->storage){
+        free(chain->storage);
+        chain->storage = NULL;
+    }
+    chain->num_levels = 0;
+}
@@ -1,4 +1,270 @@
 #include <model.h>
+#include <math.h>
+#include <stdint.h>
+#include <float.h>
+
+
+static unsigned short float_to_half(float value)
+{
+    /* Round to nearest even. Out of range values become infinity. */
+    union {
+        float    f;
+        uint32_t u;
+    } bits;
+    uint32_t sign, magnitude, half, remainder;
+
+    bits.f = value;
+    sign = (bits.u >> 16) & 0x8000;
+    magnitude = bits.u & 0x7fffffff;
+    if (magnitude >= 0x47800000){
+        return sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+    if (magnitude < 0x38800000){
+        /* Subnormal half, in units of 2^-24. */
+        return sign | (unsigned short)lrintf(fabsf(value) * 16777216.f);
+    }
+    half = (magnitude - 0x38000000) >> 13;
+    remainder = magnitude & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        half++;
+    return sign | half;
+}
+
+
+static short float_to_snorm16(float value)
+{
+    value = value < -1.f ? -1.f : (value > 1.f ? 1.f : value);
+    return (short)lrintf(value * 32767.f);
+}
+
+
+static void octahedral_encode(const vec3 v, short out[2])
+{
+    /* Project onto the octahedron |x|+|y|+|z| = 1 and fold the lower half
+     * over the diagonals, so a unit vector fits in two components.
+     */
+    float l1 = fabsf(v[0]) + fabsf(v[1]) + fabsf(v[2]);
+    float x, y, folded_x;
+
+    if (l1 == 0.f){
+        out[0] = 0;
+        out[1] = 0;
+        return;
+    }
+    x = v[0] / l1;
+    y = v[1] / l1;
+    if (v[2] < 0.f){
+        folded_x = (1.f - fabsf(y)) * (x >= 0.f ? 1.f : -1.f);
+        y = (1.f - fabsf(x)) * (y >= 0.f ? 1.f : -1.f);
+        x = folded_x;
+    }
+    out[0] = float_to_snorm16(x);
+    out[1] = float_to_snorm16(y);
+}
+
+
+void pack_vertices(const Mesh * mesh, Packed_Position * positions,
+                   Packed_Attributes * attributes,
+                   vec3 position_offset, vec3 position_scale)
+{
+    /* Fills both streams with mesh->num_vertices entries, and the affine
+     * map taking unorm16 positions back to model space.
+     */
+    const Vertex * vertex;
+    vec3 min, max, cross_nt;
+    float value;
+
+    if (!mesh->num_vertices){
+        vec3_scale(position_offset, position_offset, 0.f);
+        position_scale[0] = position_scale[1] = position_scale[2] = 1.f;
+        return;
+    }
+    vec3_dup(min, mesh->vertices[0].position);
+    vec3_dup(max, mesh->vertices[0].position);
+    for (unsigned int i = 1; i < mesh->num_vertices; i++){
+        for (int k = 0; k < 3; k++){
+            value = mesh->vertices[i].position[k];
+            min[k] = value < min[k] ? value : min[k];
+            max[k] = value > max[k] ? value : max[k];
+        }
+    }
+    for (int k = 0; k < 3; k++){
+        position_offset[k] = min[k];
+        position_scale[k] = max[k] > min[k] ? max[k] - min[k] : 1.f;
+    }
+    for (unsigned int i = 0; i < mesh->num_vertices; i++){
+        vertex = mesh->vertices + i;
+        for (int k = 0; k < 3; k++){
+            value = (vertex->position[k] - position_offset[k]) / \
+                    position_scale[k];
+            value = value < 0.f ? 0.f : (value > 1.f ? 1.f : value);
+            positions[i].position[k] = (unsigned short)lrintf(value * 65535.f);
+        }
+        vec3_mul_cross(cross_nt, vertex->normal, vertex->tangent);
+        positions[i].position[3] = vec3_mul_inner(cross_nt,
+                                                  vertex->bitangent) \
+                                   < 0.f ? 65535 : 0;
+        octahedral_encode(vertex->normal, attributes[i].normal);
+        octahedral_encode(vertex->tangent, attributes[i].tangent);
+        attributes[i].texture_coordinates[0] = \
+            float_to_half(vertex->texture_coordinates[0]);
+        attributes[i].texture_coordinates[1] = \
+            float_to_half(vertex->texture_coordinates[1]);
+    }
+}
+
+
+static model_error_t upload_packed_streams(Mesh * mesh)
+{
+    Packed_Position * positions;
+    Packed_Attributes * attributes;
+
+    positions = malloc(mesh->num_vertices * sizeof(Packed_Position));
+    attributes = malloc(mesh->num_vertices * sizeof(Packed_Attributes));
+    if (!positions || !attributes){
+        fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
+        free(positions);
+        free(attributes);
+        return MODEL_NO_MEM;
+    }
+    pack_vertices(mesh, positions, attributes, mesh->position_offset,
+                  mesh->position_scale);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->position_VBO);
+    glBufferData(GL_ARRAY_BUFFER, mesh->num_vertices * sizeof(Packed_Position),
+                 positions, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+    glBufferData(GL_ARRAY_BUFFER,
+                 mesh->num_vertices * sizeof(Packed_Attributes),
+                 attributes, GL_STATIC_DRAW);
+    free(positions);
+    free(attributes);
+    return MODEL_SUCCESS;
+}
+
+
+static model_error_t upload_full_streams(Mesh * mesh)
+{
+    vec3 * positions;
+    Vertex_Attributes * attributes;
+    Vertex * vertex;
+
+    positions = malloc(mesh->num_vertices * sizeof(vec3));
+    attributes = malloc(mesh->num_vertices * sizeof(Vertex_Attributes));
+    if (!positions || !attributes){
+        fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
+        free(positions);
+        free(attributes);
+        return MODEL_NO_MEM;
+    }
+    for (unsigned int i = 0; i < mesh->num_vertices; i++){
+        vertex = mesh->vertices + i;
+        vec3_dup(positions[i], vertex->position);
+        vec3_dup(attributes[i].normal, vertex->normal);
+        attributes[i].texture_coordinates[0] = vertex->texture_coordinates[0];
+        attributes[i].texture_coordinates[1] = vertex->texture_coordinates[1];
+        vec3_dup(attributes[i].tangent, vertex->tangent);
+        vec3_dup(attributes[i].bitangent, vertex->bitangent);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->position_VBO);
+    glBufferData(GL_ARRAY_BUFFER, mesh->num_vertices * sizeof(vec3),
+                 positions, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+    glBufferData(GL_ARRAY_BUFFER,
+                 mesh->num_vertices * sizeof(Vertex_Attributes),
+                 attributes, GL_STATIC_DRAW);
+    free(positions);
+    free(attributes);
+    return MODEL_SUCCESS;
+}
+
+
+static model_error_t upload_indices(Mesh * mesh)
+{
+    /* Expects the mesh's EBO to be bound. Indices stay 32-bit on the CPU
+     * and are narrowed here when every vertex is reachable with 16 bits.
+     */
+    unsigned short * short_indices;
+
+    if (mesh->num_vertices > MODEL_MAX_SHORT_INDEX_VERTICES){
+        mesh->index_type = GL_UNSIGNED_INT;
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                     mesh->num_indices * sizeof(unsigned int),
+                     mesh->indices, GL_STATIC_DRAW);
+        return MODEL_SUCCESS;
+    }
+    short_indices = malloc(mesh->num_indices * sizeof(unsigned short));
+    if (!short_indices){
+        fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
+        return MODEL_NO_MEM;
+    }
+    for (unsigned int i = 0; i < mesh->num_indices; i++){
+        short_indices[i] = (unsigned short)mesh->indices[i];
+    }
+    mesh->index_type = GL_UNSIGNED_SHORT;
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 mesh->num_indices * sizeof(unsigned short),
+                 short_indices, GL_STATIC_DRAW);
+    free(short_indices);
+    return MODEL_SUCCESS;
+}
+
+
+static void position_pointer(const Mesh * mesh)
+{
+    /* Location 0, from mesh->position_VBO which must be bound. */
+    glEnableVertexAttribArray(0);
+    if (mesh->vertex_format == VERTEX_FORMAT_PACKED){
+        glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE,
+                              sizeof(Packed_Position), (void*)0);
+    } else{
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3),
+                              (void*)0);
+    }
+}
+
+
+static void attribute_pointers(const Mesh * mesh)
+{
+    /* Locations 1 and up, from mesh->VBO which must be bound. */
+    if (mesh->vertex_format == VERTEX_FORMAT_PACKED){
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE,
+                              sizeof(Packed_Attributes),
+                              (void*)offsetof(Packed_Attributes, normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE,
+                              sizeof(Packed_Attributes),
+                              (void*)offsetof(Packed_Attributes,
+                                              texture_coordinates));
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE,
+                              sizeof(Packed_Attributes),
+                              (void*)offsetof(Packed_Attributes, tangent));
+        return;
+    }
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex_Attributes),
+                          (void*)offsetof(Vertex_Attributes, normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex_Attributes),
+                          (void*)offsetof(Vertex_Attributes,
+                                          texture_coordinates));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex_Attributes),
+                          (void*)offsetof(Vertex_Attributes, tangent));
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex_Attributes),
+                          (void*)offsetof(Vertex_Attributes, bitangent));
+}
+
+
+void model_set_vertex_format(Model * model, vertex_format_t format)
+{
+    /* Takes effect at the next setup_model. */
+    for (int i = 0; i < model->num_meshes; i++){
+        model->meshes[i].vertex_format = format;
+    }
+}
 
 
 model_error_t setup_model(Model * model)
@@ -7,11 +273,45 @@ model_error_t setup_model(Model * model)
 
     for (int i = 0; i < model->num_meshes; i++){
         result = setup_mesh(model->meshes+i);
+        mesh_apply_residency(model->meshes + i, model->residency);
     }
+    model_account_memory(model);
     return result;
 }
 
 
+static void upload_meshlets(Mesh * mesh)
+{
+    /* Meshlet ranges and bounds as shader storage for GPU culling, and
+     * room for one indirect draw per meshlet.
+     */
+    glGenBuffers(1, &mesh->meshlet_SSBO);
+    glGenBuffers(1, &mesh->meshlet_bounds_SSBO);
+    glGenBuffers(1, &mesh->indirect_buffer);
+    glGenBuffers(1, &mesh->meshlet_occluded_SSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mesh->meshlet_occluded_SSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 mesh->num_meshlets * sizeof(unsigned int), NULL,
+                 GL_DYNAMIC_COPY);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                      GL_UNSIGNED_INT, NULL);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mesh->meshlet_SSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 mesh->num_meshlets * sizeof(Meshlet), mesh->meshlets,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mesh->meshlet_bounds_SSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 (mesh->num_meshlets + 3) / 4 * sizeof(Meshlet_Bounds4),
+                 mesh->meshlet_bounds, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mesh->indirect_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                 mesh->num_meshlets * sizeof(Draw_Elements_Command), NULL,
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+
 model_error_t setup_mesh(Mesh * mesh)
 {
     /* Currently there is no cleanup for the buffers and arrays
@@ -26,35 +326,46 @@ model_error_t setup_mesh(Mesh * mesh)
     model_error_t result = MODEL_SUCCESS;
 
     glGenVertexArrays(1, &mesh->VAO);
+    glGenVertexArrays(1, &mesh->depth_VAO);
     glGenBuffers(1, &mesh->VBO);
+    glGenBuffers(1, &mesh->position_VBO);
     glGenBuffers(1, &mesh->EBO);
 
+    if (mesh->vertex_format == VERTEX_FORMAT_PACKED){
+        result = upload_packed_streams(mesh);
+    } else{
+        result = upload_full_streams(mesh);
+    }
+    if (result){
+        return result;
+    }
+
     glBindVertexArray(mesh->VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
-    glBufferData(GL_ARRAY_BUFFER, mesh->num_vertices * sizeof(Vertex),
-                 mesh->vertices, GL_STATIC_DRAW);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->num_indices * \
-                 sizeof(unsigned int),
-                 mesh->indices, GL_STATIC_DRAW);
+    result = upload_indices(mesh);
+    if (result){
+        glBindVertexArray(0);
+        return result;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->position_VBO);
+    position_pointer(mesh);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+    attribute_pointers(mesh);
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void*)offsetof(Vertex, normal));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void*)offsetof(Vertex, texture_coordinates));
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void*)offsetof(Vertex, tangent));
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void*)offsetof(Vertex, bitangent));
+    /* Same indices and positions, nothing else. Used by draw_mesh for
+     * shaders that only read positions (shadow maps, depth prepasses).
+     */
+    glBindVertexArray(mesh->depth_VAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->position_VBO);
+    position_pointer(mesh);
     // This breaks the existing vertex array binding
     glBindVertexArray(0);
 
+    if (mesh->num_meshlets){
+        upload_meshlets(mesh);
+    }
+
     #ifdef MODEL_DEBUG
     if (glGetError() != GL_NO_ERROR){
         result = MODEL_GL_ERR;
@@ -66,7 +377,13 @@ model_error_t setup_mesh(Mesh * mesh)
 
 model_error_t draw_mesh(Shader * shader, Mesh mesh)
 {
-    model_error_t result = MODEL_SUCCESS;
+    return draw_mesh_lod(shader, mesh, 0);
+}
+
+
+static model_error_t bind_material(Shader * shader, const Mesh * mesh)
+{
+    /* Textures, and the packed position transform, for drawing mesh. */
     unsigned int diffuse_count = 1;
     unsigned int specular_count = 1;
     unsigned int normal_count = 1;
@@ -79,10 +396,14 @@ model_error_t draw_mesh(Shader * shader, Mesh mesh)
     const int max_unif_name = 128;
     char name[max_unif_name];
     int string_length;
+    /* Shaders reading nothing but positions get no textures and draw
+     * from the position only VAO.
+     */
+    unsigned int num_textures = shader->positionsOnly ? 0 : mesh->num_textures;
 
-    for (unsigned int i=0; i < mesh.num_textures; i++){
+    for (unsigned int i=0; i < num_textures; i++){
         glActiveTexture(GL_TEXTURE0 + i);
-        switch(mesh.textures[i].type){
+        switch(mesh->textures[i].type){
             case DIFFUSE:
                 string_length = snprintf(name, max_unif_name,
                                          "material.texture_diffuse%i",
@@ -115,7 +436,7 @@ model_error_t draw_mesh(Shader * shader, Mesh mesh)
                 break;
             default:
                 fprintf(stderr, "%s %d: Texture type unrecognized: %i\n",
-                        __FILE__, __LINE__, mesh.textures[i].type);
+                        __FILE__, __LINE__, mesh->textures[i].type);
                 return MODEL_ERR;
         }
         setInt(shader, name, i);
@@ -128,117 +449,1313 @@ model_error_t draw_mesh(Shader * shader, Mesh mesh)
          * is to be drawn from texture unit i (and presumably sampler2D
          * is used to inform the shader to read from the 2D target).
          */
-        glBindTexture(GL_TEXTURE_2D, mesh.textures[i].id);
+        glBindTexture(GL_TEXTURE_2D, mesh->textures[i].id);
     }
     glActiveTexture(GL_TEXTURE0);
-    glBindVertexArray(mesh.VAO);
-    glDrawElements(GL_TRIANGLES, mesh.num_indices, GL_UNSIGNED_INT, 0);
+    if (mesh->vertex_format == VERTEX_FORMAT_PACKED){
+        setVec3(shader, "position_offset", (float *)mesh->position_offset);
+        setVec3(shader, "position_scale", (float *)mesh->position_scale);
+    }
+    return MODEL_SUCCESS;
+}
+
+
+model_error_t draw_mesh_lod(Shader * shader, Mesh mesh, unsigned int lod)
+{
+    model_error_t result;
+    size_t index_size = mesh.index_type == GL_UNSIGNED_SHORT ? \
+                        sizeof(unsigned short) : sizeof(unsigned int);
+    /* Without LODs the index list is the full detail level alone. */
+    unsigned int count = mesh.num_indices, offset = 0;
+
+    if (mesh.num_lods){
+        if (lod >= mesh.num_lods){
+            lod = mesh.num_lods - 1;
+        }
+        count = mesh.lods[lod].count;
+        offset = mesh.lods[lod].offset;
+    }
+    result = bind_material(shader, &mesh);
+    if (result){
+        return result;
+    }
+    glBindVertexArray(shader->positionsOnly ? mesh.depth_VAO : mesh.VAO);
+    glDrawElements(GL_TRIANGLES, count, mesh.index_type,
+                   (void *)(uintptr_t)(offset * index_size));
     glBindVertexArray(0);
 
     #ifdef MODEL_DEBUG
     if (glGetError() != GL_NO_ERROR){
         result = MODEL_GL_ERR;
     }
-    #endif
-    return result;
+    #endif
+    return result;
+}
+
+
+static model_error_t draw_meshlets(Shader * shader, const Mesh * mesh,
+                                   unsigned int num_commands)
+{
+    /* The full detail level, one indirect draw per meshlet command in
+     * mesh->indirect_buffer.
+     */
+    model_error_t result;
+
+    result = bind_material(shader, mesh);
+    if (result){
+        return result;
+    }
+    glBindVertexArray(shader->positionsOnly ? mesh->depth_VAO : mesh->VAO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mesh->indirect_buffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, mesh->index_type, 0,
+                                num_commands, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+
+    #ifdef MODEL_DEBUG
+    if (glGetError() != GL_NO_ERROR){
+        result = MODEL_GL_ERR;
+    }
+    #endif
+    return result;
+}
+
+
+static model_error_t cull_meshlets(const Mesh * mesh,
+                                   const Frustum * frustum,
+                                   const float * eye, unsigned int * count)
+{
+    /* CPU culling. Survivors are written to the indirect buffer, and
+     * their count to count. Fails without touching the buffer if the
+     * scratch arrays can't grow.
+     */
+    static unsigned int * visible = NULL;
+    static Draw_Elements_Command * commands = NULL;
+    static unsigned int capacity = 0;
+    unsigned int * grown_visible;
+    Draw_Elements_Command * grown_commands;
+
+    if (mesh->num_meshlets > capacity){
+        grown_visible = realloc(visible,
+                                mesh->num_meshlets * sizeof(unsigned int));
+        if (grown_visible){
+            visible = grown_visible;
+        }
+        grown_commands = realloc(commands, mesh->num_meshlets * \
+                                 sizeof(Draw_Elements_Command));
+        if (grown_commands){
+            commands = grown_commands;
+        }
+        if (!grown_visible || !grown_commands){
+            fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
+            return MODEL_NO_MEM;
+        }
+        capacity = mesh->num_meshlets;
+    }
+    *count = meshlet_cull(mesh->meshlet_bounds, mesh->num_meshlets, frustum,
+                          eye, visible);
+    for (unsigned int i = 0; i < *count; i++){
+        commands[i].count = mesh->meshlets[visible[i]].count;
+        commands[i].instance_count = 1;
+        commands[i].first_index = mesh->meshlets[visible[i]].first_index;
+        commands[i].base_vertex = 0;
+        commands[i].base_instance = 0;
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mesh->indirect_buffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0,
+                    *count * sizeof(Draw_Elements_Command), commands);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return MODEL_SUCCESS;
+}
+
+
+static void dispatch_meshlet_culling(const Mesh * mesh,
+                                     const Frustum * frustum,
+                                     const float * eye, Shader * shader,
+                                     const Hiz * hiz, mat4x4 world, int phase)
+{
+    /* GPU culling. Every meshlet gets a command, culled ones with no
+     * instances, so the draw count is known without reading back. Phases
+     * 1 and 2 also test against hiz, see meshlet_cull.comp.
+     */
+    mat4x4 hiz_clip;
+
+    setInt(shader, "phase", phase);
+    if (phase){
+        mat4x4_mul_simd(hiz_clip, (vec4 *)hiz->view_projection, world);
+        setMat4x4(shader, "hiz_clip", hiz_clip);
+        glUniform2i(glGetUniformLocation(shader->ID, "hiz_size"), hiz->width,
+                    hiz->height);
+        setInt(shader, "hiz_levels", hiz->levels);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, hiz->texture);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mesh->meshlet_occluded_SSBO);
+    glUniform4fv(glGetUniformLocation(shader->ID, "planes"), 6,
+                 (const float *)frustum->planes);
+    if (eye){
+        setVec3(shader, "eye", (float *)eye);
+    }
+    setBool(shader, "cull_backfaces", eye != NULL);
+    glUniform1ui(glGetUniformLocation(shader->ID, "meshlet_count"),
+                 mesh->num_meshlets);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mesh->meshlet_bounds_SSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh->meshlet_SSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mesh->indirect_buffer);
+    glDispatchCompute((mesh->num_meshlets + MESHLET_CULL_GROUP_SIZE - 1) / \
+                      MESHLET_CULL_GROUP_SIZE, 1, 1);
+}
+
+
+/* One mesh as the model's views see it this pass. */
+struct Mesh_View {
+    int          visible;
+    unsigned int lod;
+    Frustum      frustum;      //mesh space
+    vec3         eye;          //cull eye, mesh space
+};
+typedef struct Mesh_View Mesh_View;
+
+
+static void transform_point(vec3 out, mat4x4 matrix, const vec3 point)
+{
+    vec4 in = {point[0], point[1], point[2], 1.f};
+    vec4 result;
+
+    mat4x4_mul_vec4(result, matrix, in);
+    out[0] = result[0];
+    out[1] = result[1];
+    out[2] = result[2];
+}
+
+
+static void mesh_view(const Model * model, const Mesh * mesh, Mesh_View * out)
+{
+    /* Views are kept in world space. Each mesh is tested in its own space,
+     * through its node's world transform, so bounds are never transformed.
+     */
+    mat4x4 * world = model->scene.world + mesh->node;
+    mat4x4 inverse, clip;
+    Lod_View lod_view = model->lod_view;
+
+    out->visible = 1;
+    out->lod = 0;
+    if (!model->lod_view.enabled && !model->cull_view.enabled)
+        return;
+    mat4x4_invert_simd(inverse, *world);
+    if (lod_view.enabled){
+        transform_point(lod_view.eye, inverse, model->lod_view.eye);
+        out->lod = mesh_select_lod(mesh, &lod_view);
+    }
+    if (model->cull_view.enabled){
+        mat4x4_mul_simd(clip, (vec4 *)model->cull_view.view_projection, *world);
+        frustum_from_matrix(&out->frustum, clip);
+        out->visible = frustum_test_aabb(&out->frustum, mesh->aabb_min,
+                                         mesh->aabb_max);
+        if (out->visible && model->cull_view.occlusion){
+            out->visible = occlusion_test_aabb(model->cull_view.occlusion,
+                                               *world, mesh->aabb_min,
+                                               mesh->aabb_max);
+        }
+        transform_point(out->eye, inverse, model->cull_view.eye);
+    }
+}
+
+
+static void mesh_world_box(const Model * model, const Mesh * mesh,
+                           Bvh_Box * out)
+{
+    /* Arvo's method: along each world axis, every column of the node's
+     * transform moves the box by the smaller or larger of its two ends.
+     */
+    vec4 * world = model->scene.world[mesh->node];
+    float a, b;
+
+    for (int i = 0; i < 3; i++){
+        out->min[i] = out->max[i] = world[3][i];
+        for (int j = 0; j < 3; j++){
+            a = world[j][i] * mesh->aabb_min[j];
+            b = world[j][i] * mesh->aabb_max[j];
+            out->min[i] += fminf(a, b);
+            out->max[i] += fmaxf(a, b);
+        }
+    }
+}
+
+
+static void update_hierarchy(Model * model)
+{
+    /* Node transforms, then mesh boxes, then the tree over them. Nothing
+     * moved is the common case and costs one pass over the node flags.
+     */
+    if (!scene_graph_update(&model->scene) || !model->mesh_boxes)
+        return;
+    for (unsigned int i = 0; i < model->num_meshes; i++){
+        mesh_world_box(model, model->meshes + i, model->mesh_boxes + i);
+    }
+    bvh_refit(&model->bvh, model->mesh_boxes);
+}
+
+
+static unsigned int visible_meshes(const Model * model, unsigned int ** out)
+{
+    /* Meshes in the cull view, found through the hierarchy, or all of
+     * them without one. The list is scratch, good until the next call.
+     */
+    static unsigned int * visible = NULL;
+    static unsigned int capacity = 0;
+    unsigned int * grown, mask, count = 0;
+    Frustum frustum;
+
+    if (model->num_meshes > capacity){
+        grown = realloc(visible, model->num_meshes * sizeof(unsigned int));
+        if (!grown){
+            fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
+            return 0;
+        }
+        visible = grown;
+        capacity = model->num_meshes;
+    }
+    *out = visible;
+    if (!model->cull_view.enabled || !model->mesh_boxes){
+        for (unsigned int i = 0; i < model->num_meshes; i++){
+            visible[i] = i;
+        }
+        return model->num_meshes;
+    }
+    if (model->cull_view.view >= 0 && \
+        model->cull_view.view < model->num_views)
+    {
+        mask = 1u << model->cull_view.view;
+        for (unsigned int i = 0; i < model->num_meshes; i++){
+            if (model->view_masks[i] & mask){
+                visible[count++] = i;
+            }
+        }
+        return count;
+    }
+    frustum_from_matrix(&frustum, (vec4 *)model->cull_view.view_projection);
+    return bvh_query_frustum(&model->bvh, &frustum, visible);
+}
+
+
+static void cull_on_gpu(const Model * model, const unsigned int * visible,
+                        unsigned int num_visible, int phase)
+{
+    /* Every visible full detail mesh's meshlets, behind one barrier. */
+    const Cull_View * cull = &model->cull_view;
+    Mesh_View view;
+    const Mesh * mesh;
+    int culled = 0;
+
+    use(cull->cull_shader);
+    for (unsigned int i = 0; i < num_visible; i++){
+        mesh = model->meshes + visible[i];
+        if (!mesh->num_meshlets)
+            continue;
+        mesh_view(model, mesh, &view);
+        if (view.visible && !view.lod){
+            dispatch_meshlet_culling(mesh, &view.frustum,
+                                     cull->backfaces ? view.eye : NULL,
+                                     cull->cull_shader, cull->hiz,
+                                     model->scene.world[mesh->node], phase);
+            culled = 1;
+        }
+    }
+    if (culled){
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    }
+}
+
+
+static void set_mesh_matrices(Shader * shader, const Model * model,
+                              const Mesh * mesh)
+{
+    mat4x4 normal;
+
+    setMat4x4(shader, "model_matrix", model->scene.world[mesh->node]);
+    if (!shader->positionsOnly){
+        mat4x4_normal_cofactor(normal, model->scene.world[mesh->node]);
+        setMat4x4(shader, "normal_matrix", normal);
+    }
+}
+
+
+model_error_t draw_model(Shader * shader, Model * model)
+{
+    /* Sets model_matrix, and normal_matrix unless the shader only reads
+     * positions, from each mesh's node. With a cull view set, meshes
+     * outside it are skipped, first through the model's hierarchy and
+     * then by their own boxes, and those drawn at full detail go through
+     * meshlet culling. On the GPU every mesh's meshlets are culled first,
+     * behind a single barrier, and the drawing shader is bound again
+     * afterwards.
+     */
+    model_error_t result = MODEL_SUCCESS;
+    const Cull_View * cull = &model->cull_view;
+    Mesh_View view;
+    Mesh * mesh;
+    unsigned int count, num_visible, * visible;
+
+    update_hierarchy(model);
+    num_visible = visible_meshes(model, &visible);
+    if (cull->enabled && cull->cull_shader){
+        cull_on_gpu(model, visible, num_visible,
+                    cull->hiz && cull->hiz->valid ? 1 : 0);
+        use(shader);
+    }
+    for (unsigned int i = 0; i < num_visible; i++){
+        mesh = model->meshes + visible[i];
+        mesh_view(model, mesh, &view);
+        if (!view.visible)
+            continue;
+        set_mesh_matrices(shader, model, mesh);
+        if (!cull->enabled || !mesh->num_meshlets || view.lod){
+            result = draw_mesh_lod(shader, *mesh, view.lod);
+        } else if (cull->cull_shader){
+            result = draw_meshlets(shader, mesh, mesh->num_meshlets);
+        } else if (cull_meshlets(mesh, &view.frustum,
+                                 cull->backfaces ? view.eye : NULL, &count))
+        {
+            //No room to cull in, so draw the whole mesh rather than none
+            result = draw_mesh_lod(shader, *mesh, 0);
+        } else if (count){
+            result = draw_meshlets(shader, mesh, count);
+        }
+    }
+    return result;
+}
+
+
+model_error_t draw_model_disoccluded(Shader * shader, Model * model)
+{
+    /* Phase 2 of depth pyramid culling, see model.h. The visible meshes
+     * come out the same as in draw_model, since nothing has changed in
+     * between, so the same meshlet buffers are retested.
+     */
+    model_error_t result = MODEL_SUCCESS;
+    const Cull_View * cull = &model->cull_view;
+    Mesh_View view;
+    Mesh * mesh;
+    unsigned int num_visible, * visible;
+
+    if (!cull->enabled || !cull->cull_shader || !cull->hiz || \
+        !cull->hiz->valid)
+        return MODEL_SUCCESS;
+    update_hierarchy(model);
+    num_visible = visible_meshes(model, &visible);
+    cull_on_gpu(model, visible, num_visible, 2);
+    use(shader);
+    for (unsigned int i = 0; i < num_visible; i++){
+        mesh = model->meshes + visible[i];
+        if (!mesh->num_meshlets)
+            continue;
+        mesh_view(model, mesh, &view);
+        if (!view.visible || view.lod)
+            continue;
+        set_mesh_matrices(shader, model, mesh);
+        result = draw_meshlets(shader, mesh, mesh->num_meshlets);
+    }
+    return result;
+}
+
+
+unsigned int model_query_sphere(Model * model, vec3 center, float radius,
+                                unsigned int * meshes)
+{
+    update_hierarchy(model);
+    return bvh_query_sphere(&model->bvh, center, radius, meshes);
+}
+
+
+static int ray_triangle(const vec3 origin, const vec3 direction,
+                        const float * a, const float * b, const float * c,
+                        float * t)
+{
+    /* Moller and Trumbore, both faces. */
+    vec3 edge1, edge2, p, q, s;
+    float determinant, inverse, u, v, distance;
+
+    vec3_sub(edge1, b, a);
+    vec3_sub(edge2, c, a);
+    vec3_mul_cross(p, direction, edge2);
+    determinant = vec3_mul_inner(edge1, p);
+    if (fabsf(determinant) < 1e-12f)
+        return 0;
+    inverse = 1.f / determinant;
+    vec3_sub(s, origin, a);
+    u = vec3_mul_inner(s, p) * inverse;
+    if (u < 0.f || u > 1.f)
+        return 0;
+    vec3_mul_cross(q, s, edge1);
+    v = vec3_mul_inner(direction, q) * inverse;
+    if (v < 0.f || u + v > 1.f)
+        return 0;
+    distance = vec3_mul_inner(edge2, q) * inverse;
+    if (distance < 0.f || distance >= *t)
+        return 0;
+    *t = distance;
+    return 1;
+}
+
+
+static const float * mesh_positions(const Mesh * mesh, size_t * stride)
+{
+    /* Wherever the residency policy left them, or NULL. */
+    if (mesh->vertices){
+        *stride = sizeof(Vertex);
+        return mesh->vertices[0].position;
+    }
+    *stride = sizeof(vec3);
+    return mesh->positions ? mesh->positions[0] : NULL;
+}
+
+
+static int pick_mesh(void * user, unsigned int item, const vec3 origin,
+                     const vec3 direction, float * t)
+{
+    /* The ray is moved into the mesh's space. Affine maps keep a ray's
+     * parameter, so distances found there hold in world space.
+     */
+    const Model * model = user;
+    const Mesh * mesh = model->meshes + item;
+    const unsigned int * indices = mesh->indices + mesh->lods[0].offset;
+    const unsigned char * positions;
+    vec4 world_direction = {direction[0], direction[1], direction[2], 0.f};
+    vec4 local_direction;
+    vec3 local_origin;
+    mat4x4 inverse;
+    size_t stride;
+    int hit = 0;
+
+    positions = (const unsigned char *)mesh_positions(mesh, &stride);
+    if (!positions || !mesh->indices)
+        return 0;
+    mat4x4_invert_simd(inverse, model->scene.world[mesh->node]);
+    transform_point(local_origin, inverse, origin);
+    mat4x4_mul_vec4(local_direction, inverse, world_direction);
+    for (unsigned int i = 0; i + 2 < mesh->lods[0].count; i += 3){
+        hit |= ray_triangle(local_origin, local_direction,
+                            (const float *)(positions + indices[i] * stride),
+                            (const float *)(positions + \
+                                            indices[i + 1] * stride),
+                            (const float *)(positions + \
+                                            indices[i + 2] * stride), t);
+    }
+    return hit;
+}
+
+
+int model_pick(Model * model, vec3 origin, vec3 direction, float * distance)
+{
+    float t = FLT_MAX;
+    int mesh;
+
+    update_hierarchy(model);
+    mesh = bvh_raycast(&model->bvh, origin, direction, &t, pick_mesh, model);
+    if (mesh >= 0){
+        *distance = t;
+    }
+    return mesh;
+}
+
+
+void model_set_transform(Model * model, mat4x4 model_matrix)
+{
+    /* Node 0 of the scene graph, the parent of the file's root node. */
+    scene_graph_set_local(&model->scene, 0, model_matrix);
+}
+
+
+void model_set_cull_view(Model * model, mat4x4 view_projection, vec3 eye,
+                         int backfaces, Shader * cull_shader)
+{
+    /* view_projection is any matrix whose clip volume is to be kept, a
+     * camera's or a shadow map's. backfaces should be off for passes
+     * drawing back faces, eg. shadow maps rendered with front face culling.
+     */
+    mat4x4_dup(model->cull_view.view_projection, view_projection);
+    vec3_dup(model->cull_view.eye, eye);
+    model->cull_view.backfaces = backfaces;
+    model->cull_view.cull_shader = cull_shader;
+    model->cull_view.occlusion = NULL;
+    model->cull_view.hiz = NULL;
+    model->cull_view.view = -1;
+    model->cull_view.enabled = 1;
+}
+
+
+model_error_t model_cull_views(Model * model, mat4x4 * view_projections,
+                               int count)
+{
+    /* One walk over the meshes for every view, rather than a hierarchy
+     * search per pass. The views share each box's loads, see
+     * frustum_visible_views.
+     */
+    Frustum frusta[MODEL_MAX_VIEWS];
+    const Frustum * views[MODEL_MAX_VIEWS];
+    const Bvh_Box * box;
+
+    model->num_views = 0;
+    if (!model->mesh_boxes || !model->view_masks)
+        return MODEL_ERR;
+    if (count > MODEL_MAX_VIEWS){
+        count = MODEL_MAX_VIEWS;
+    }
+    update_hierarchy(model);
+    for (int v = 0; v < count; v++){
+        frustum_from_matrix(frusta + v, view_projections[v]);
+        views[v] = frusta + v;
+    }
+    for (unsigned int i = 0; i < model->num_meshes; i++){
+        box = model->mesh_boxes + i;
+        model->view_masks[i] = frustum_visible_views(views, count, box->min,
+                                                     box->max);
+    }
+    model->num_views = count;
+    return MODEL_SUCCESS;
+}
+
+
+void model_use_view(Model * model, int view)
+{
+    model->cull_view.view = view;
+}
+
+
+model_error_t model_add_occluders(Model * model, Occlusion_Buffer * buffer)
+{
+    /* Coarser levels only trade a pixel or so of silhouette here, well
+     * under the buffer's own resolution.
+     */
+    Lod_View lod_view = model->lod_view;
+    const Mesh * mesh;
+    const float * positions;
+    mat4x4 inverse;
+    unsigned int lod;
+    size_t stride;
+
+    update_hierarchy(model);
+    for (unsigned int i = 0; i < model->num_meshes; i++){
+        mesh = model->meshes + i;
+        positions = mesh_positions(mesh, &stride);
+        if (!mesh->occluder || !positions || !mesh->indices)
+            continue;
+        lod = 0;
+        if (lod_view.enabled){
+            mat4x4_invert_simd(inverse, model->scene.world[mesh->node]);
+            transform_point(lod_view.eye, inverse, model->lod_view.eye);
+            lod = mesh_select_lod(mesh, &lod_view);
+        }
+        if (occlusion_add_occluder(buffer, model->scene.world[mesh->node],
+                                   positions, stride, mesh->num_vertices,
+                                   mesh->indices + mesh->lods[lod].offset,
+                                   mesh->lods[lod].count))
+            return MODEL_NO_MEM;
+    }
+    return MODEL_SUCCESS;
+}
+
+
+void model_set_hiz(Model * model, Hiz * hiz)
+{
+    /* As model_set_occlusion. hiz may come from last frame, phase 2 makes
+     * up for anything that has come into view since.
+     */
+    model->cull_view.hiz = hiz;
+}
+
+
+void model_set_occlusion(Model * model, Occlusion_Buffer * buffer)
+{
+    /* The buffer must have been drawn from the current cull view. Setting
+     * a new cull view detaches it.
+     */
+    model->cull_view.occlusion = buffer;
+}
+
+
+void model_set_lod_view(Model * model, vec3 eye, float fov_y,
+                        int viewport_height, float threshold)
+{
+    vec3_dup(model->lod_view.eye, eye);
+    model->lod_view.pixel_scale = viewport_height / (2.f * tanf(fov_y / 2.f));
+    model->lod_view.threshold = threshold;
+    model->lod_view.enabled = 1;
+}
+
+
+unsigned int mesh_select_lod(const Mesh * mesh, const Lod_View * view)
+{
+    /* Coarsest level whose error, projected at the nearest point of the
+     * mesh's bounding sphere, stays under the threshold. view->eye is in
+     * the mesh's own space here. Any uniform scale in between divides out
+     * of error / distance.
+     */
+    vec3 offset;
+    float distance;
+
+    if (!view->enabled || mesh->num_lods < 2)
+        return 0;
+    vec3_sub(offset, mesh->center, view->eye);
+    distance = vec3_len(offset) - mesh->radius;
+    if (distance <= 0.f)
+        return 0;
+    for (unsigned int lod = mesh->num_lods - 1; lod > 0; lod--){
+        if (mesh->lods[lod].error * view->pixel_scale <= \
+            view->threshold * distance)
+            return lod;
+    }
+    return 0;
+}
+
+
+model_error_t load_model(Model * model)
+{
+    /* model is expected to come with a valid file_path value */
+    model_error_t result;
+
+    result = load_model_deferred(model);
+    if (upload_pending_textures(model) && !result){
+        result = MODEL_ERR;
+    }
+    return result;
+}
+
+
+model_error_t load_model_deferred(Model * model)
+{
+    /* As load_model, but texture files are left unread. Every entry in
+     * model->loaded_textures keeps its Texture_Image until somebody calls
+     * upload_pending_textures, or hands the model to a texture streamer.
+     */
+    model_error_t result;
+
+    result = import_model(model);
+    if (!result){
+        name_pending_textures(model);
+    }
+    return result;
+}
+
+
+void name_pending_textures(Model * model)
+{
+    /* Swaps the provisional ids import_model hands out, places in
+     * loaded_textures counting from 1, for GL names. Every mesh texture
+     * is rewritten exactly once, straight from the table, so a new name
+     * equal to some other provisional id can't be mistaken for it.
+     */
+    unsigned int * names, count = model->pending_names;
+    Texture_Node * node;
+    Mesh * mesh;
+    unsigned int i;
+
+    if (!count)
+        return;
+    names = malloc(count * sizeof(unsigned int));
+    if (!names){
+        fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
+        return;
+    }
+    glGenTextures(count, names);
+    for (node = model->loaded_textures, i = 0; node && i < count; \
+         node = node->next, i++)
+    {
+        node->texture.id = names[i];
+        if (node->image){
+            node->image->id = names[i];
+        }
+    }
+    for (unsigned int m = 0; m < model->num_meshes; m++){
+        mesh = model->meshes + m;
+        for (unsigned int t = 0; t < mesh->num_textures; t++){
+            if (mesh->textures[t].id >= 1 && mesh->textures[t].id <= count){
+                mesh->textures[t].id = names[mesh->textures[t].id - 1];
+            }
+        }
+    }
+    free(names);
+    model->pending_names = 0;
+}
+
+
+static void free_mesh_data(Mesh * mesh)
+{
+    /* The CPU side of a mesh which never reached setup_mesh. Textures
+     * belong to the model's arena.
+     */
+    free(mesh->vertices);
+    free(mesh->indices);
+    free(mesh->meshlets);
+    free(mesh->meshlet_bounds);
+}
+
+
+static void discard_import(Model * model)
+{
+    /* Undoes a failed import_model, leaving the model as it was handed
+     * in. Nothing has reached the GL yet, so this is safe off the GL
+     * thread.
+     */
+    Texture_Node * node;
+
+    for (unsigned int i = 0; i < model->num_meshes; i++){
+        free_mesh_data(model->meshes + i);
+    }
+    free(model->meshes);
+    model->meshes = NULL;
+    model->num_meshes = 0;
+    for (node = model->loaded_textures; node; node = node->next){
+        if (node->image){
+            texture_image_free(node->image);
+            free(node->image);
+        }
+    }
+    model->loaded_textures = NULL;
+    arena_free(&model->arena);
+    scene_graph_free(&model->scene);
+    bvh_free(&model->bvh);
+    free(model->mesh_boxes);
+    model->mesh_boxes = NULL;
+    free(model->view_masks);
+    model->view_masks = NULL;
+    memstat_unregister(&model->memory);
+}
+
+
+static unsigned int count_mesh_references(const struct aiNode * node)
+{
+    unsigned int count = node->mNumMeshes;
+
+    for (unsigned int i = 0; i < node->mNumChildren; i++){
+        count += count_mesh_references(node->mChildren[i]);
+    }
+    return count;
+}
+
+
+model_error_t import_model(Model * model)
+{
+    /* Everything load_model_deferred does short of GL calls, so it may
+     * run off the GL thread. Texture ids stay provisional until
+     * name_pending_textures. meshes_processed counts up as it goes, for
+     * anyone watching from another thread.
+     */
+    model_error_t result = MODEL_SUCCESS;
+    int count = 0;
+    const struct aiScene * scene;
+    mat4x4 identity;
+    Mesh_Task * tasks;
+    unsigned int num_tasks;
+
+    if (model->meshes || model->loaded_textures){
+        /* This guarantees model.meshes == NULL and 
+         * model.loaded_textures == NULL
+         */
+        fprintf(stderr, "Ensure that model->meshes is NULL and \
+                model->loaded_textures is NULL.\n");
+        return MODEL_UNEXP_ALLOC;
+    }
+    scene = aiImportFile(model->file_path, aiProcess_Triangulate \
+                         | aiProcess_GenNormals \
+                         | aiProcess_CalcTangentSpace);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || \
+        !scene->mRootNode)
+    {
+        fprintf(stderr, "Some kind of assimp error.\n");
+        return MODEL_ASSIMP_ERR;
+    }
+    /* dirname may alter the passed file path...and it can segfault
+     * if you try to alter a string literal (aka, something defined
+     * by "this syyntax"). To avoid this always initialized model path
+     * like so:
+     * char file[] = "some/path";
+     * model.file_path = file;
+     */
+    mat4x4_identity(identity);
+    memstat_register(&model->memory, model->file_path);
+    model->directory = dirname(model->file_path);
+    model->num_meshes = 0;
+    model->pending_names = 0;
+    model->loaded_textures = NULL;
+    model->lod_view.enabled = 0;
+    model->cull_view.enabled = 0;
+    model->cull_view.occlusion = NULL;
+    model->cull_view.hiz = NULL;
+    model->cull_view.view = -1;
+    model->mesh_boxes = NULL;
+    model->view_masks = NULL;
+    model->num_views = 0;
+    model->residency = MODEL_KEEP_ALL;
+    memset(&model->bvh, 0, sizeof(Bvh));
+    memset(&model->scene, 0, sizeof(Scene_Graph));
+    arena_init(&model->arena, 0);
+    arena_init(&model->scratch, 4 << 10);
+    /* A mesh placed by several nodes is converted once for each. */
+    num_tasks = count_mesh_references(scene->mRootNode);
+    __atomic_store_n(&model->meshes_processed, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&model->meshes_in_file, num_tasks, __ATOMIC_RELAXED);
+    tasks = calloc(num_tasks ? num_tasks : 1, sizeof(Mesh_Task));
+    /* Node 0 is the model's own transform, identity until
+     * model_set_transform.
+     */
+    if (!tasks || scene_graph_init(&model->scene, 16) || \
+        scene_graph_add(&model->scene, -1, identity) < 0)
+    {
+        result = MODEL_NO_MEM;
+        goto cleanup;
+    }
+    result = process_node(model, scene->mRootNode, scene, tasks, &count, 0);
+    if (result)
+        goto cleanup;
+    result = process_meshes(model, tasks, count);
+    if (result)
+        goto cleanup;
+    /* Mesh bounds in world space, and the hierarchy culling and picking
+     * search. Later transforms only refit it.
+     */
+    scene_graph_update(&model->scene);
+    model->mesh_boxes = malloc(model->num_meshes * sizeof(Bvh_Box));
+    model->view_masks = calloc(model->num_meshes ? model->num_meshes : 1,
+                               sizeof(unsigned int));
+    if (!model->mesh_boxes || !model->view_masks){
+        err_print("Out of memory");
+        result = MODEL_NO_MEM;
+        goto cleanup;
+    }
+    for (unsigned int i = 0; i < model->num_meshes; i++){
+        mesh_world_box(model, model->meshes + i, model->mesh_boxes + i);
+    }
+    if (bvh_build(&model->bvh, model->mesh_boxes, model->num_meshes)){
+        result = MODEL_NO_MEM;
+    }
+
+    cleanup:
+        /* Converted meshes own copies of everything, and the texture
+         * list's paths are in the arena, so the scene can go.
+         */
+        free(tasks);
+        arena_free(&model->scratch);
+        aiReleaseImport(scene);
+        if (result){
+            discard_import(model);
+        } else{
+            model_account_memory(model);
+        }
+    return result;
+}
+
+
+static model_error_t split_mesh(const Mesh * mesh, Mesh ** out,
+                                unsigned int * num_out)
+{
+    /* Cuts a mesh too large for 16-bit indices into pieces which fit,
+     * following the optimized triangle order so each piece stays compact.
+     * Vertices on a cut are duplicated. If that would add more than an
+     * eighth to the vertex count the mesh is left alone (*num_out = 0)
+     * and keeps 32-bit indices.
+     */
+    const unsigned int max_vertices = MODEL_MAX_SHORT_INDEX_VERTICES;
+    unsigned int num_triangles = mesh->num_indices / 3;
+    unsigned int max_pieces = num_triangles / ((max_vertices - 2) / 3) + 2;
+    unsigned int * owner, * local, * piece_vertices, * piece_triangles;
+    unsigned int num_pieces = 0, count = 0, fresh, total = 0, v, t = 0;
+    Mesh * pieces = NULL, * piece;
+    model_error_t result = MODEL_SUCCESS;
+
+    *num_out = 0;
+    owner = calloc(mesh->num_vertices, sizeof(unsigned int));
+    local = malloc(mesh->num_vertices * sizeof(unsigned int));
+    piece_vertices = calloc(max_pieces, sizeof(unsigned int));
+    piece_triangles = calloc(max_pieces, sizeof(unsigned int));
+    if (!owner || !local || !piece_vertices || !piece_triangles){
+        result = MODEL_NO_MEM;
+        goto cleanup;
+    }
+
+    /* Pass 1, sizes only. owner holds the piece number + 1. */
+    for (unsigned int i = 0; i < num_triangles; i++){
+        fresh = 0;
+        for (int k = 0; k < 3; k++){
+            v = mesh->indices[3 * i + k];
+            fresh += owner[v] != num_pieces + 1 && \
+                     (k == 0 || v != mesh->indices[3 * i]) && \
+                     (k < 2 || v != mesh->indices[3 * i + 1]);
+        }
+        if (count + fresh > max_vertices){
+            piece_vertices[num_pieces++] = count;
+            total += count;
+            count = 0;
+        }
+        for (int k = 0; k < 3; k++){
+            v = mesh->indices[3 * i + k];
+            if (owner[v] != num_pieces + 1){
+                owner[v] = num_pieces + 1;
+                count++;
+            }
+        }
+        piece_triangles[num_pieces]++;
+    }
+    piece_vertices[num_pieces++] = count;
+    total += count;
+    if (num_pieces < 2 || total > mesh->num_vertices + mesh->num_vertices / 8){
+        goto cleanup;
+    }
+
+    /* Pass 2, build the pieces. */
+    pieces = calloc(num_pieces, sizeof(Mesh));
+    if (!pieces){
+        result = MODEL_NO_MEM;
+        goto cleanup;
+    }
+    memset(owner, 0, mesh->num_vertices * sizeof(unsigned int));
+    for (unsigned int p = 0; p < num_pieces; p++){
+        piece = pieces + p;
+        *piece = *mesh;
+        piece->num_vertices = 0;
+        piece->num_indices = 3 * piece_triangles[p];
+        piece->vertices = malloc(piece_vertices[p] * sizeof(Vertex));
+        piece->indices = malloc(piece->num_indices * sizeof(unsigned int));
+        /* Textures are shared, the array lives in the model's arena. */
+        if (!piece->vertices || !piece->indices){
+            for (unsigned int q = 0; q <= p; q++){
+                free(pieces[q].vertices);
+                free(pieces[q].indices);
+            }
+            free(pieces);
+            pieces = NULL;
+            result = MODEL_NO_MEM;
+            goto cleanup;
+        }
+        for (unsigned int i = 0; i < piece->num_indices; i++, t++){
+            v = mesh->indices[t];
+            if (owner[v] != p + 1){
+                owner[v] = p + 1;
+                local[v] = piece->num_vertices;
+                piece->vertices[piece->num_vertices++] = mesh->vertices[v];
+            }
+            piece->indices[i] = local[v];
+        }
+    }
+    *out = pieces;
+    *num_out = num_pieces;
+
+    cleanup:
+        if (result){
+            fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
+        }
+        free(owner);
+        free(local);
+        free(piece_vertices);
+        free(piece_triangles);
+    return result;
+}
+
+
+static void mesh_bounds(Mesh * mesh)
+{
+    /* Box and sphere around the vertices, in model space. The sphere is
+     * centred on the box, close enough to the minimal one for culling.
+     */
+    vec3 offset;
+    float distance;
+
+    if (!mesh->num_vertices){
+        memset(mesh->aabb_min, 0, sizeof(vec3));
+        memset(mesh->aabb_max, 0, sizeof(vec3));
+        memset(mesh->center, 0, sizeof(vec3));
+        mesh->radius = 0.f;
+        return;
+    }
+    vec3_dup(mesh->aabb_min, mesh->vertices[0].position);
+    vec3_dup(mesh->aabb_max, mesh->vertices[0].position);
+    for (unsigned int i = 1; i < mesh->num_vertices; i++){
+        for (int k = 0; k < 3; k++){
+            mesh->aabb_min[k] = fminf(mesh->aabb_min[k],
+                                      mesh->vertices[i].position[k]);
+            mesh->aabb_max[k] = fmaxf(mesh->aabb_max[k],
+                                      mesh->vertices[i].position[k]);
+        }
+    }
+    for (int k = 0; k < 3; k++){
+        mesh->center[k] = 0.5f * (mesh->aabb_min[k] + mesh->aabb_max[k]);
+    }
+    mesh->radius = 0.f;
+    for (unsigned int i = 0; i < mesh->num_vertices; i++){
+        vec3_sub(offset, mesh->vertices[i].position, mesh->center);
+        distance = vec3_len(offset);
+        mesh->radius = distance > mesh->radius ? distance : mesh->radius;
+    }
+}
+
+
+static void build_meshlets(Mesh * mesh)
+{
+    /* Meshlets cover the full detail level only. Without them the mesh is
+     * simply drawn whole.
+     */
+    meshlet_build(&mesh->meshlets, &mesh->meshlet_bounds,
+                  &mesh->num_meshlets, mesh->indices, mesh->lods[0].count,
+                  mesh->vertices[0].position, sizeof(Vertex),
+                  mesh->num_vertices);
+}
+
+
+static void generate_lods(Mesh * mesh)
+{
+    /* Each level aims at half the triangles of the one before, simplified
+     * from it, and gets the post-transform cache treatment of its own.
+     * Levels stop once simplification stalls or strays more than a tenth
+     * of the mesh's radius. Running out of memory just means fewer
+     * levels.
+     */
+    const unsigned int min_indices = 3 * 64;
+    unsigned int * lod_indices, * indices;
+    unsigned int previous = 0;
+    size_t count;
+    float error, max_error;
+
+    mesh->num_lods = 1;
+    mesh->lods[0].offset = 0;
+    mesh->lods[0].count = mesh->num_indices;
+    mesh->lods[0].error = 0.f;
+    if (!mesh->num_vertices)
+        return;
+    max_error = 0.1f * mesh->radius;
+    lod_indices = malloc(mesh->num_indices * sizeof(unsigned int));
+    if (!lod_indices)
+        return;
+    while (mesh->num_lods < MODEL_MAX_LODS && \
+           mesh->lods[previous].count > min_indices)
+    {
+        if (simplify_mesh(lod_indices, &count,
+                          mesh->indices + mesh->lods[previous].offset,
+                          mesh->lods[previous].count,
+                          mesh->vertices[0].position, sizeof(Vertex),
+                          mesh->num_vertices,
+                          mesh->lods[previous].count / 6 * 3,
+                          max_error - mesh->lods[previous].error, &error))
+            break;
+        if (count > mesh->lods[previous].count / 5 * 4)
+            break;
+        mesh_optimize_vertex_cache(lod_indices, count, mesh->num_vertices);
+        indices = realloc(mesh->indices,
+                          (mesh->num_indices + count) * sizeof(unsigned int));
+        if (!indices)
+            break;
+        mesh->indices = indices;
+        memcpy(mesh->indices + mesh->num_indices, lod_indices,
+               count * sizeof(unsigned int));
+        previous = mesh->num_lods++;
+        mesh->lods[previous].offset = mesh->num_indices;
+        mesh->lods[previous].count = count;
+        /* Errors are measured against the level simplified from. */
+        mesh->lods[previous].error = mesh->lods[previous - 1].error + error;
+        mesh->num_indices += count;
+    }
+    free(lod_indices);
+    #ifdef DEBUG
+    for (unsigned int i = 0; i < mesh->num_lods; i++){
+        printf("LOD %u: %u triangles, error %f\n", i, mesh->lods[i].count / 3,
+               mesh->lods[i].error);
+    }
+    #endif
+}
+
+
+static void optimize_mesh(Mesh * mesh)
+{
+    /* Reorders triangles for the post-transform cache and overdraw, then
+     * vertices for fetch locality. Nothing visible changes, and a failure
+     * just leaves the mesh in assimp's order.
+     */
+    size_t used_vertices;
+    #ifdef DEBUG
+    Vertex_Cache_Stats before, after;
+    unsigned int imported_vertices = mesh->num_vertices;
+
+    mesh_analyze_vertex_cache(mesh->indices, mesh->num_indices,
+                              mesh->num_vertices, MESH_OPTIMIZE_REPORT_CACHE,
+                              &before);
+    #endif
+    if (mesh_weld_vertices(mesh->vertices, sizeof(Vertex), mesh->num_vertices,
+                           mesh->indices, mesh->num_indices, &used_vertices))
+        return;
+    mesh->num_vertices = used_vertices;
+    if (mesh_optimize_vertex_cache(mesh->indices, mesh->num_indices,
+                                   mesh->num_vertices))
+        return;
+    if (mesh_optimize_overdraw(mesh->indices, mesh->num_indices,
+                               mesh->vertices[0].position, sizeof(Vertex),
+                               mesh->num_vertices, 1.05f))
+        return;
+    if (mesh_optimize_vertex_fetch(mesh->vertices, sizeof(Vertex),
+                                   mesh->num_vertices, mesh->indices,
+                                   mesh->num_indices, &used_vertices))
+        return;
+    mesh->num_vertices = used_vertices;
+    #ifdef DEBUG
+    mesh_analyze_vertex_cache(mesh->indices, mesh->num_indices,
+                              mesh->num_vertices, MESH_OPTIMIZE_REPORT_CACHE,
+                              &after);
+    printf("Mesh optimized: %u -> %u vertices, ACMR %.3f -> %.3f, "
+           "ATVR %.3f -> %.3f\n", imported_vertices, mesh->num_vertices,
+           before.acmr, after.acmr, before.atvr, after.atvr);
+    #endif
+}
+
+
+void model_vertex_cache_report(const Model * model, FILE * fp)
+{
+    Vertex_Cache_Stats stats;
+    Mesh * mesh;
+
+    fprintf(fp, "%-6s %10s %10s %8s %8s %5s\n", "mesh", "triangles",
+            "vertices", "ACMR", "ATVR", "LODs");
+    for (int i = 0; i < model->num_meshes; i++){
+        mesh = model->meshes + i;
+        if (!mesh->indices)
+            continue;
+        mesh_analyze_vertex_cache(mesh->indices, mesh->lods[0].count,
+                                  mesh->num_vertices,
+                                  MESH_OPTIMIZE_REPORT_CACHE, &stats);
+        fprintf(fp, "%-6d %10u %10u %8.3f %8.3f %5u\n", i,
+                mesh->lods[0].count / 3, mesh->num_vertices, stats.acmr,
+                stats.atvr, mesh->num_lods);
+    }
 }
 
 
-model_error_t draw_model(Shader * shader, Model model)
+void mesh_apply_residency(Mesh * mesh, model_residency_t residency)
 {
-    model_error_t result = MODEL_SUCCESS;
-    for (int i=0; i < model.num_meshes; i++){
-        result = draw_mesh(shader, model.meshes[i]);
+    /* Only for meshes set up already, the buffers hold the rest. */
+    if (!mesh->VAO || residency == MODEL_KEEP_ALL)
+        return;
+    if (residency == MODEL_KEEP_POSITIONS && mesh->vertices){
+        mesh->positions = malloc(mesh->num_vertices * sizeof(vec3));
+        if (!mesh->positions){
+            /* Keeping everything is the safe way to fail. */
+            fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
+            return;
+        }
+        for (unsigned int i = 0; i < mesh->num_vertices; i++){
+            vec3_dup(mesh->positions[i], mesh->vertices[i].position);
+        }
+    }
+    free(mesh->vertices);
+    mesh->vertices = NULL;
+    if (residency == MODEL_KEEP_NONE){
+        free(mesh->positions);
+        mesh->positions = NULL;
+        free(mesh->indices);
+        mesh->indices = NULL;
     }
-    return result;
 }
 
 
-model_error_t load_model(Model * model)
+void model_set_residency(Model * model, model_residency_t residency)
 {
-    /* model is expected to come with a valid file_path value */
-    model_error_t result = MODEL_SUCCESS;
-    int count = 0;
-    const struct aiScene * scene;
-
-    if (model->meshes || model->loaded_textures){
-        /* This guarantees model.meshes == NULL and 
-         * model.loaded_textures == NULL
-         */
-        fprintf(stderr, "Ensure that model->meshes is NULL and \
-                model->loaded_textures is NULL.\n");
-        return MODEL_UNEXP_ALLOC;
-    }
-    scene = aiImportFile(model->file_path, aiProcess_Triangulate \
-                         | aiProcess_GenNormals \
-                         | aiProcess_CalcTangentSpace);
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || \
-        !scene->mRootNode)
-    {
-        fprintf(stderr, "Some kind of assimp error.\n");
-        return MODEL_ASSIMP_ERR;
+    if (residency < model->residency)
+        return;
+    model->residency = residency;
+    for (unsigned int i = 0; i < model->num_meshes; i++){
+        mesh_apply_residency(model->meshes + i, residency);
     }
-    /* dirname may alter the passed file path...and it can segfault
-     * if you try to alter a string literal (aka, something defined
-     * by "this syyntax"). To avoid this always initialized model path
-     * like so:
-     * char file[] = "some/path";
-     * model.file_path = file;
-     */
-    model->directory = dirname(model->file_path);
-    model->meshes = malloc(scene->mNumMeshes * sizeof(Mesh));
-    model->num_meshes = scene->mNumMeshes;
-    model->loaded_textures = NULL;
-    result = process_node(model, scene->mRootNode, scene, &count);
-    return result;
+    model_account_memory(model);
 }
 
 
-model_error_t process_node(Model * model, struct aiNode * node,
-                           const struct aiScene * scene, int * index)
+void model_memory(const Model * model, Model_Memory * out)
 {
-    model_error_t result = MODEL_SUCCESS;
-    Mesh mesh;
-    struct aiMesh * ai_mesh = NULL;
+    /* GPU sizes follow what setup_mesh asks for, the driver may pad. */
+    const Mesh * mesh;
+    size_t vertex_size;
 
-    for (int i = 0; i < node->mNumMeshes; i++){
-        /* If loading succeeded this pointer should be valid. */
-        ai_mesh = scene->mMeshes[node->mMeshes[i]];
-        result = process_mesh(ai_mesh, scene, &mesh, model);
-        if (result){
-            /* Note: If an error occurred the contents of mesh are garbage. */
-            fprintf(stderr, "%s %d: Process_mesh failure during %s. \
-                    Model data incomplete.\n", __FILE__, __LINE__, __func__);
-            return result;
+    memset(out, 0, sizeof(Model_Memory));
+    for (unsigned int i = 0; i < model->num_meshes; i++){
+        mesh = model->meshes + i;
+        if (mesh->vertices){
+            out->cpu_geometry += mesh->num_vertices * sizeof(Vertex);
         }
-        model->meshes[(*index)++] = mesh;
-    }
-    for (int i = 0; i < node->mNumChildren; i++){
-        result = process_node(model, node->mChildren[i], scene, index);
-        if (result){
-            return result;
+        if (mesh->positions){
+            out->cpu_geometry += mesh->num_vertices * sizeof(vec3);
+        }
+        if (mesh->indices){
+            out->cpu_geometry += mesh->num_indices * sizeof(unsigned int);
+        }
+        out->cpu_other += mesh->num_meshlets * sizeof(Meshlet) + \
+                          (mesh->num_meshlets + 3) / 4 * \
+                          sizeof(Meshlet_Bounds4);
+        if (!mesh->VAO)
+            continue;
+        vertex_size = mesh->vertex_format == VERTEX_FORMAT_PACKED ? \
+                      sizeof(Packed_Position) + sizeof(Packed_Attributes) : \
+                      sizeof(vec3) + sizeof(Vertex_Attributes);
+        out->gpu_geometry += mesh->num_vertices * vertex_size + \
+                             mesh->num_indices * \
+                             (mesh->index_type == GL_UNSIGNED_SHORT ? \
+                              sizeof(unsigned short) : sizeof(unsigned int));
+        if (mesh->meshlet_SSBO){
+            out->gpu_other += mesh->num_meshlets * \
+                              (sizeof(Meshlet) + sizeof(unsigned int) + \
+                               sizeof(Draw_Elements_Command)) + \
+                              (mesh->num_meshlets + 3) / 4 * \
+                              sizeof(Meshlet_Bounds4);
         }
     }
-    return result;
+    out->cpu_other += model->num_meshes * (sizeof(Mesh) + sizeof(Bvh_Box));
+    out->cpu_other += model->bvh.num_nodes * sizeof(Bvh_Node) + \
+                      model->bvh.num_items * (sizeof(unsigned int) + \
+                                              sizeof(Bvh_Box));
+    out->cpu_other += model->scene.capacity * (sizeof(int) + \
+                      2 * sizeof(mat4x4) + 1 + sizeof(unsigned int));
+    out->cpu_other += model->arena.reserved;
 }
 
 
-model_error_t process_mesh(struct aiMesh * mesh, const struct aiScene * scene,
-                           Mesh * out, Model * model)
+void model_account_memory(Model * model)
+{
+    /* Brings the model's memstat figures up to date with model_memory.
+     * Textures are counted as they are uploaded instead.
+     */
+    Model_Memory memory;
+
+    model_memory(model, &memory);
+    memstat_set(&model->memory, MEMSTAT_CPU, MEMSTAT_GEOMETRY,
+                memory.cpu_geometry);
+    memstat_set(&model->memory, MEMSTAT_CPU, MEMSTAT_OTHER,
+                memory.cpu_other);
+    memstat_set(&model->memory, MEMSTAT_GPU, MEMSTAT_GEOMETRY,
+                memory.gpu_geometry);
+    memstat_set(&model->memory, MEMSTAT_GPU, MEMSTAT_CULLING,
+                memory.gpu_other);
+}
+
+
+void model_memory_report(const Model * model, FILE * fp)
+{
+    Model_Memory memory;
+
+    model_memory(model, &memory);
+    fprintf(fp, "Model memory: CPU %.2f MiB geometry, %.2f MiB other; "
+            "GPU %.2f MiB geometry, %.2f MiB other\n",
+            memory.cpu_geometry / 1048576., memory.cpu_other / 1048576.,
+            memory.gpu_geometry / 1048576., memory.gpu_other / 1048576.);
+}
+
+
+static model_error_t convert_mesh(struct aiMesh * mesh, Mesh * out)
 {
+    /* Vertices and indices out of assimp, optimized and bounded. Touches
+     * nothing but out, so meshes convert in parallel.
+     */
     Vertex vertex;
     int num_indices = 0;
     struct aiFace face;
     int count = 0;
-    struct aiMaterial * material;
-    Texture * diffuse_maps = NULL;
-    Texture * specular_maps = NULL;
-    Texture * normal_maps = NULL;
-    int num_diffuse_textures = 0;
-    int num_specular_textures = 0;
-    int num_normal_textures = 0;
-    model_error_t result;
 
+    out->vertex_format = VERTEX_FORMAT_FULL;
     /* Vertex processing. */
     out->vertices = malloc(mesh->mNumVertices * sizeof(Vertex));
     if (!out->vertices){
@@ -246,6 +1763,7 @@ model_error_t process_mesh(struct aiMesh * mesh, const struct aiScene * scene,
         return MODEL_NO_MEM;
     }
     out->num_vertices = mesh->mNumVertices;
+    out->positions = NULL;
     for (int i = 0; i < mesh->mNumVertices; i++){
         vertex.position[0] = mesh->mVertices[i].x;
         vertex.position[1] = mesh->mVertices[i].y;
@@ -294,6 +1812,18 @@ model_error_t process_mesh(struct aiMesh * mesh, const struct aiScene * scene,
         return MODEL_NO_MEM;
     }
     out->num_indices = num_indices;
+    out->num_lods = 1;
+    out->lods[0].offset = 0;
+    out->lods[0].count = num_indices;
+    out->lods[0].error = 0.f;
+    out->meshlets = NULL;
+    out->meshlet_bounds = NULL;
+    out->num_meshlets = 0;
+    out->meshlet_SSBO = 0;
+    out->meshlet_bounds_SSBO = 0;
+    out->indirect_buffer = 0;
+    out->meshlet_occluded_SSBO = 0;
+    out->occluder = 0;
     for (int i = 0; i < mesh->mNumFaces; i++){
         face = mesh->mFaces[i];
         for (int j = 0; j < face.mNumIndices; j++){
@@ -301,7 +1831,30 @@ model_error_t process_mesh(struct aiMesh * mesh, const struct aiScene * scene,
         }
     }
 
-    /* Texture processing */
+    optimize_mesh(out);
+    mesh_bounds(out);
+    return MODEL_SUCCESS;
+}
+
+
+static model_error_t mesh_materials(struct aiMesh * mesh,
+                                    const struct aiScene * scene, Mesh * out,
+                                    Model * model)
+{
+    /* Fills out's textures, from the model's arena. Shares the model's
+     * texture list, so it runs on one thread only.
+     */
+    struct aiMaterial * material;
+    Texture * diffuse_maps = NULL;
+    Texture * specular_maps = NULL;
+    Texture * normal_maps = NULL;
+    int num_diffuse_textures = 0;
+    int num_specular_textures = 0;
+    int num_normal_textures = 0;
+    model_error_t result;
+
+    out->textures = NULL;
+    out->num_textures = 0;
     if (mesh->mMaterialIndex >= 0){
         material = scene->mMaterials[mesh->mMaterialIndex];
         result = load_material_textures(material,
@@ -322,26 +1875,14 @@ model_error_t process_mesh(struct aiMesh * mesh, const struct aiScene * scene,
                                          &num_normal_textures,
                                          model,
                                          &normal_maps);
-        out->textures = malloc((num_diffuse_textures + \
-                                num_specular_textures + \
-                                num_normal_textures) * sizeof(Texture));
+        out->textures = arena_alloc(&model->arena, (num_diffuse_textures + \
+                                    num_specular_textures + \
+                                    num_normal_textures) * sizeof(Texture));
         if (!out->textures || result){
             fprintf(stderr, "%s %d: Error loading textures.\n", __FILE__,
                     __LINE__);
-            free(out->vertices);
-            out->vertices = NULL;
-            free(out->indices);
-            out->vertices = NULL;
-            if (out->textures){
-                free(out->textures);
-                out->textures = NULL;
-            }
-            if (diffuse_maps)
-                free(diffuse_maps);
-            if (specular_maps)
-                free(specular_maps);
-            if (normal_maps)
-                free(normal_maps);
+            out->textures = NULL;
+            arena_reset(&model->scratch);
             return MODEL_ERR;
         }
         out->num_textures = num_diffuse_textures + num_specular_textures \
@@ -362,17 +1903,172 @@ model_error_t process_mesh(struct aiMesh * mesh, const struct aiScene * scene,
                 = normal_maps[i];
             }
         }
-        if (diffuse_maps)
-            free(diffuse_maps);
-        if (specular_maps);
-            free(specular_maps);
-        if (normal_maps)
-            free(normal_maps);
+        /* The per type arrays were only scratch. */
+        arena_reset(&model->scratch);
     }
     return MODEL_SUCCESS;
 }
 
 
+model_error_t process_mesh(struct aiMesh * mesh, const struct aiScene * scene,
+                           Mesh * out, Model * model)
+{
+    model_error_t result;
+
+    result = convert_mesh(mesh, out);
+    if (result)
+        return result;
+    result = mesh_materials(mesh, scene, out, model);
+    if (result){
+        free(out->vertices);
+        out->vertices = NULL;
+        free(out->indices);
+        out->indices = NULL;
+    }
+    return result;
+}
+
+
+static void process_mesh_job(void * arg)
+{
+    /* Everything for one mesh short of its materials. */
+    Mesh_Task * task = arg;
+    Mesh * mesh = &task->mesh;
+
+    task->pieces = NULL;
+    task->num_pieces = 0;
+    task->result = convert_mesh(task->source, mesh);
+    if (task->result)
+        return;
+    __atomic_add_fetch(&task->model->meshes_processed, 1, __ATOMIC_RELAXED);
+    if (mesh->num_vertices > MODEL_MAX_SHORT_INDEX_VERTICES){
+        /* Not fatal, the mesh is just drawn with 32-bit indices. */
+        split_mesh(mesh, &task->pieces, &task->num_pieces);
+    }
+    if (task->num_pieces > 1){
+        for (unsigned int j = 0; j < task->num_pieces; j++){
+            mesh_bounds(task->pieces + j);
+            generate_lods(task->pieces + j);
+            build_meshlets(task->pieces + j);
+        }
+        free(mesh->vertices);
+        free(mesh->indices);
+        return;
+    }
+    generate_lods(mesh);
+    build_meshlets(mesh);
+}
+
+
+model_error_t process_meshes(Model * model, Mesh_Task * tasks,
+                             unsigned int count)
+{
+    /* Converts the meshes process_node recorded on the job pool, then
+     * lays them out in the model in walk order, split meshes in place of
+     * the mesh they came from. On failure every mesh is released and the
+     * model is left with none.
+     */
+    model_error_t result = MODEL_SUCCESS;
+    Job_Pool * pool = job_pool_default();
+    Job_Group group;
+    unsigned int total = 0, index = 0;
+    Mesh_Task * task;
+
+    job_group_init(&group);
+    for (unsigned int i = 0; i < count; i++){
+        tasks[i].model = model;
+        if (job_pool_submit(pool, &group, process_mesh_job, tasks + i)){
+            process_mesh_job(tasks + i);
+        }
+    }
+    job_group_wait(pool, &group);
+    for (unsigned int i = 0; i < count; i++){
+        if (tasks[i].result && !result){
+            fprintf(stderr, "%s %d: Process_mesh failure during %s. "
+                    "Model data incomplete.\n", __FILE__, __LINE__,
+                    __func__);
+            result = tasks[i].result;
+        }
+        total += tasks[i].num_pieces > 1 ? tasks[i].num_pieces : 1;
+    }
+    model->meshes = result ? NULL : malloc(total * sizeof(Mesh));
+    if (!result && total && !model->meshes){
+        fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
+        result = MODEL_NO_MEM;
+    }
+    for (unsigned int i = 0; i < count; i++){
+        task = tasks + i;
+        if (result){
+            if (task->result){
+                /* convert_mesh cleaned up after itself. */
+            } else if (task->num_pieces > 1){
+                for (unsigned int j = 0; j < task->num_pieces; j++){
+                    free_mesh_data(task->pieces + j);
+                }
+            } else{
+                free_mesh_data(&task->mesh);
+            }
+            free(task->pieces);
+            continue;
+        }
+        if (task->num_pieces > 1){
+            for (unsigned int j = 0; j < task->num_pieces; j++){
+                model->meshes[index++] = task->pieces[j];
+            }
+            free(task->pieces);
+            continue;
+        }
+        model->meshes[index++] = task->mesh;
+    }
+    model->num_meshes = result ? 0 : total;
+    return result;
+}
+
+
+model_error_t process_node(Model * model, struct aiNode * node,
+                           const struct aiScene * scene, Mesh_Task * tasks,
+                           int * index, int parent)
+{
+    /* node becomes a child of scene graph node parent, and its meshes
+     * are placed by it. Meshes are only recorded in tasks, with their
+     * materials, for process_meshes to convert.
+     */
+    model_error_t result = MODEL_SUCCESS;
+    Mesh_Task * task;
+    struct aiMatrix4x4 * t = &node->mTransformation;
+    int graph_node;
+    /* assimp matrices are row major, linmath's column major. */
+    mat4x4 local = {{t->a1, t->b1, t->c1, t->d1},
+                    {t->a2, t->b2, t->c2, t->d2},
+                    {t->a3, t->b3, t->c3, t->d3},
+                    {t->a4, t->b4, t->c4, t->d4}};
+
+    graph_node = scene_graph_add(&model->scene, parent, local);
+    if (graph_node < 0){
+        return MODEL_NO_MEM;
+    }
+    for (int i = 0; i < node->mNumMeshes; i++){
+        task = tasks + (*index);
+        /* If loading succeeded this pointer should be valid. */
+        task->source = scene->mMeshes[node->mMeshes[i]];
+        result = mesh_materials(task->source, scene, &task->mesh, model);
+        if (result){
+            return result;
+        }
+        task->mesh.node = graph_node;
+        (*index)++;
+    }
+    for (int i = 0; i < node->mNumChildren; i++){
+        result = process_node(model, node->mChildren[i], scene, tasks, index,
+                              graph_node);
+        if (result){
+            return result;
+        }
+    }
+    return result;
+}
+
+
 model_error_t load_material_textures(struct aiMaterial * mat,
                                      enum aiTextureType type,
                                      texture_t type_name, int * count,
@@ -380,7 +2076,7 @@ model_error_t load_material_textures(struct aiMaterial * mat,
 {
     /* Store the number of textures in count. */
     struct aiString string;
-    unsigned int texture_id;
+    unsigned int texture_id, known_textures;
     Texture texture;
     Texture_Node * node;
     const int max_file_name = 256;
@@ -398,7 +2094,7 @@ model_error_t load_material_textures(struct aiMaterial * mat,
     if (!aiGetMaterialTextureCount(mat, type)){
         return MODEL_SUCCESS;
     }
-    *out = malloc(texture_count * sizeof(Texture));
+    *out = arena_alloc(&model->scratch, texture_count * sizeof(Texture));
     if (!*out){
         fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
         return MODEL_NO_MEM;
@@ -411,41 +2107,55 @@ model_error_t load_material_textures(struct aiMaterial * mat,
         string_length = snprintf(file_name, max_file_name, "%s/%s",
                                  model->directory, string.data);
         if (string_length >= max_file_name || string_length < 0){
-            free(*out);
             fprintf(stderr, "%s %d: snprintf error.\n", __FILE__, __LINE__);
             return MODEL_ERR;
         }
+        known_textures = 0;
         for (node = model->loaded_textures; node; node = node->next){
             if (strcmp(file_name, (node->texture).path) == 0){
-                texture_id = (node->texture).id;
+                texture = node->texture;
                 load_texture = 0;
                 break;
             }
+            known_textures++;
         }
         if (load_texture){
             #ifdef DEBUG
             printf("Loading texture %s\n", file_name);
             #endif
-            if (texture_from_file(file_name, &texture_id)){
-                free(*out);
-                fprintf(stderr, "%s %d: Texture from file error.\n", __FILE__,
-                        __LINE__);
-                return MODEL_ERR;
+            /* No GL here, so importing can run on any thread. The id is
+             * provisional, the texture's place in the list counting from
+             * 1, until name_pending_textures. Decoding happens on the job
+             * pool once every mesh is processed, see
+             * upload_pending_textures.
+             */
+            texture_id = known_textures + 1;
+            model->pending_names = texture_id;
+            /* Paths are stored once, meshes share the node's. */
+            texture.id = texture_id;
+            texture.type = type_name;
+            texture.path = arena_strdup(&model->arena, file_name);
+            new_node = arena_alloc(&model->arena, sizeof(Texture_Node));
+            if (!texture.path || !new_node){
+                fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
+                return MODEL_NO_MEM;
+            }
+            /* Images go as soon as they are uploaded, so they stay on the
+             * heap.
+             */
+            new_node->image = calloc(1, sizeof(Texture_Image));
+            if (!new_node->image){
+                fprintf(stderr, "%s %d: Out of memory.\n", __FILE__, __LINE__);
+                return MODEL_NO_MEM;
             }
-        }
-        texture.id = texture_id;
-        texture.type = type_name;
-        string_length = strlen(file_name);
-        texture.path = malloc((string_length+1) * sizeof(char));
-        strncpy(texture.path, file_name, string_length);
-        texture.path[string_length] = '\0';
-        *out[i] = texture;
-        if (load_texture){
-            new_node = malloc(sizeof(Texture_Node));
             new_node->texture = texture;
+            new_node->image->path = new_node->texture.path;
+            new_node->image->type = type_name;
+            new_node->image->id = texture_id;
             new_node->next = NULL;
             append_texture_node(model, new_node);
         }
+        (*out)[i] = texture;
     }
     *count = texture_count;
     return MODEL_SUCCESS;
@@ -454,54 +2164,252 @@ model_error_t load_material_textures(struct aiMaterial * mat,
 
 model_error_t texture_from_file(char * file_name, unsigned int * texture_id)
 {
-    int width, height, nrChannels;
+    /* Synchronous decode + upload, treating the file as colour data. */
+    Texture_Image image;
+    model_error_t result;
+
+    memset(&image, 0, sizeof(Texture_Image));
+    image.path = file_name;
+    image.type = DIFFUSE;
+    texture_image_decode(&image);
+    result = texture_image_upload(&image);
+    *texture_id = image.id;
+    texture_image_free(&image);
+    return result;
+}
+
+
+void texture_image_decode(void * arg)
+{
+    /* Job pool entry point, so no GL calls in here. Prefers a
+     * pre-compressed sibling (see src/tools/texture_compress), which
+     * carries its own mip chain. Otherwise the image is decoded and its
+     * mip chain built on the CPU.
+     */
+    Texture_Image * image = arg;
+    const int max_file_name = 256;
+    char compressed_name[max_file_name];
+    mip_content_t content;
+
+    image->result = MODEL_SUCCESS;
+    if (texture_is_compressed_file(image->path)){
+        if (compressed_image_load(image->path, &image->compressed_image)){
+            image->result = MODEL_ERR;
+        } else{
+            image->compressed = 1;
+        }
+        return;
+    }
+    if (compressed_texture_path(image->path, compressed_name, max_file_name)){
+        #ifdef DEBUG
+        printf("Using compressed texture %s\n", compressed_name);
+        #endif
+        if (!compressed_image_load(compressed_name,
+                                   &image->compressed_image))
+        {
+            image->compressed = 1;
+            return;
+        }
+        fprintf(stderr, "%s %d: Falling back to %s\n", __FILE__, __LINE__,
+                image->path);
+    }
+
+    image->pixels = stbi_load(image->path, &image->width, &image->height,
+                              &image->channels, 0);
+    if (!image->pixels){
+        fprintf(stderr, "%s %d: Failed to load texture %s\n", __FILE__,
+                __LINE__, image->path);
+        image->result = MODEL_STB_ERR;
+        return;
+    }
+    switch(image->type){
+        case DIFFUSE:
+            content = MIP_CONTENT_SRGB;
+            break;
+        case NORMAL:
+            content = MIP_CONTENT_NORMAL;
+            break;
+        default:
+            content = MIP_CONTENT_LINEAR;
+            break;
+    }
+    /* A failure here leaves a shorter, still valid, chain. */
+    mip_chain_build(&image->chain, image->pixels, image->width,
+                    image->height, image->channels, content,
+                    MIP_FILTER_KAISER);
+}
+
+
+model_error_t texture_image_upload(Texture_Image * image)
+{
     GLenum format;
+    Mip_Level * level;
 
-    unsigned char * data = stbi_load(file_name, &width, &height,
-                                     &nrChannels, 0);
-    if (data){
-        switch(nrChannels){
-            case 1:
-                format = GL_RED;
-                #ifdef DEBUG
-                printf("Format is GL_RED\n");
-                #endif
-                break;
-            case 3:
-                format = GL_RGB;
-                #ifdef DEBUG
-                printf("Format is GL_RGB\n");
-                #endif
-                break;
-            case 4:
-                format = GL_RGBA;
-                #ifdef DEBUG
-                printf("Format is GL_RGBA\n");
-                #endif
-                break;
-            default:
-                fprintf(stderr, "%s %d: Unrecognized number of channels: %i\n",
-                        __FILE__, __LINE__, nrChannels);
-                stbi_image_free(data);
-                return MODEL_STB_ERR;
-        }
-        glGenTextures(1, texture_id);
-        glBindTexture(GL_TEXTURE_2D, *texture_id);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0,
-                     format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        stbi_image_free(data);
+    if (image->result){
+        return image->result;
+    }
+    if (image->compressed){
+        if (compressed_image_upload(&image->compressed_image, &image->id)){
+            return MODEL_GL_ERR;
+        }
         return MODEL_SUCCESS;
     }
-    else{
-        fprintf(stderr, "%f %d: Failed to load texture\n", __FILE__,
-                __LINE__);
-        return MODEL_STB_ERR;
+    switch(image->channels){
+        case 1:
+            format = GL_RED;
+            #ifdef DEBUG
+            printf("Format is GL_RED\n");
+            #endif
+            break;
+        case 3:
+            format = GL_RGB;
+            #ifdef DEBUG
+            printf("Format is GL_RGB\n");
+            #endif
+            break;
+        case 4:
+            format = GL_RGBA;
+            #ifdef DEBUG
+            printf("Format is GL_RGBA\n");
+            #endif
+            break;
+        default:
+            fprintf(stderr, "%s %d: Unrecognized number of channels: %i\n",
+                    __FILE__, __LINE__, image->channels);
+            return MODEL_STB_ERR;
+    }
+    if (!image->id){
+        glGenTextures(1, &image->id);
+    }
+    glBindTexture(GL_TEXTURE_2D, image->id);
+    /* Small levels of RGB images have rows which are not 4 byte aligned. */
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < image->chain.num_levels; i++){
+        level = image->chain.levels + i;
+        glTexImage2D(GL_TEXTURE_2D, i, format, level->width, level->height, 0,
+                     format, GL_UNSIGNED_BYTE, level->data);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    image->chain.num_levels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    #ifdef MODEL_DEBUG
+    if (glGetError() != GL_NO_ERROR){
+        return MODEL_GL_ERR;
+    }
+    #endif
+    return MODEL_SUCCESS;
+}
+
+
+size_t texture_image_bytes(const Texture_Image * image)
+{
+    /* As uploaded by texture_image_upload, ignoring driver padding. */
+    size_t total = 0;
+
+    if (image->compressed){
+        for (int i = 0; i < image->compressed_image.num_levels; i++){
+            total += image->compressed_image.levels[i].size;
+        }
+        return total;
+    }
+    for (int i = 0; i < image->chain.num_levels; i++){
+        total += (size_t)image->chain.levels[i].width * \
+                 image->chain.levels[i].height * image->channels;
+    }
+    return total;
+}
+
+
+void texture_image_drop_levels(Texture_Image * image, int count)
+{
+    /* Discards the count finest levels so that the next upload starts at
+     * a coarser resolution. The coarsest level is always kept.
+     */
+    int num_levels;
+
+    if (image->compressed){
+        num_levels = image->compressed_image.num_levels;
+        if (count > num_levels - 1)
+            count = num_levels - 1;
+        if (count <= 0)
+            return;
+        memmove(image->compressed_image.levels,
+                image->compressed_image.levels + count,
+                (num_levels - count) * sizeof(Texture_Level));
+        image->compressed_image.num_levels -= count;
+        image->compressed_image.width = image->compressed_image.levels[0].width;
+        image->compressed_image.height = \
+            image->compressed_image.levels[0].height;
+        return;
+    }
+    num_levels = image->chain.num_levels;
+    if (count > num_levels - 1)
+        count = num_levels - 1;
+    if (count <= 0)
+        return;
+    /* Level data stays where it is, owned by pixels and chain.storage. */
+    memmove(image->chain.levels, image->chain.levels + count,
+            (num_levels - count) * sizeof(Mip_Level));
+    image->chain.num_levels -= count;
+}
+
+
+void texture_image_free(Texture_Image * image)
+{
+    mip_chain_free(&image->chain);
+    if (image->pixels){
+        stbi_image_free(image->pixels);
+        image->pixels = NULL;
+    }
+    if (image->compressed){
+        compressed_image_free(&image->compressed_image);
+        image->compressed = 0;
+    }
+}
+
+
+model_error_t upload_pending_textures(Model * model)
+{
+    /* Decodes every texture still waiting in the model's list on the job
+     * pool, then uploads them here on the GL thread. The images are
+     * released either way.
+     */
+    model_error_t result = MODEL_SUCCESS;
+    Job_Pool * pool = job_pool_default();
+    Job_Group group;
+    Texture_Node * node;
+
+    job_group_init(&group);
+    for (node = model->loaded_textures; node; node = node->next){
+        if (node->image && \
+            job_pool_submit(pool, &group, texture_image_decode, node->image))
+        {
+            texture_image_decode(node->image);
+        }
+    }
+    job_group_wait(pool, &group);
+    for (node = model->loaded_textures; node; node = node->next){
+        if (!node->image)
+            continue;
+        if (texture_image_upload(node->image)){
+            fprintf(stderr, "%s %d: Texture upload error for %s.\n", __FILE__,
+                    __LINE__, node->texture.path);
+            result = MODEL_ERR;
+        } else{
+            memstat_add(&model->memory, MEMSTAT_GPU, MEMSTAT_TEXTURE,
+                        texture_image_bytes(node->image));
+        }
+        texture_image_free(node->image);
+        free(node->image);
+        node->image = NULL;
     }
+    return result;
 }
 
 
@@ -515,19 +2423,27 @@ void free_mesh(Mesh * mesh)
         free(mesh->indices);
         mesh->indices = NULL;
     }
-    for (int i = 0; i < mesh->num_textures; i++){
-        glDeleteTextures(1, &(mesh->textures[i]).id);
-    }
-    if (mesh->textures){
-        free(mesh->textures);
-        mesh->textures = NULL;
-    }
+    free(mesh->positions);
+    mesh->positions = NULL;
+    /* Textures are shared between meshes, free_model deletes them. */
+    mesh->textures = NULL;
+    mesh->num_textures = 0;
+    free(mesh->meshlets);
+    mesh->meshlets = NULL;
+    free(mesh->meshlet_bounds);
+    mesh->meshlet_bounds = NULL;
     /* Because of these calls, it is only safe to use mesh_free on a mesh
      * that has successfully passed through both process_mesh and setup_mesh.
      */
     glDeleteBuffers(1, &mesh->VBO);
+    glDeleteBuffers(1, &mesh->position_VBO);
     glDeleteBuffers(1, &mesh->EBO);
     glDeleteVertexArrays(1, &mesh->VAO);
+    glDeleteVertexArrays(1, &mesh->depth_VAO);
+    glDeleteBuffers(1, &mesh->meshlet_SSBO);
+    glDeleteBuffers(1, &mesh->meshlet_bounds_SSBO);
+    glDeleteBuffers(1, &mesh->indirect_buffer);
+    glDeleteBuffers(1, &mesh->meshlet_occluded_SSBO);
     if (glGetError() != GL_NO_ERROR){
         fprintf(stderr, "%s %d: GL resource cleanup error, \
                 if not before.\n", __FILE__, __LINE__);
@@ -540,11 +2456,38 @@ void free_model(Model * model)
     /* As with free_mesh, this is only safe to use on models which
      * have survived load_model in its entirety.
      */
+    Texture_Node * node;
+
     for (int i = 0; i < model->num_meshes; i++){
         free_mesh(&(model->meshes[i]));
     }
     free(model->meshes);
     model->meshes = NULL;
+    model->num_meshes = 0;
+    /* Each texture once. A streamer zeroes the ids it owns when it is
+     * destroyed, and zero is ignored. Provisional ids were never GL
+     * names.
+     */
+    for (node = model->loaded_textures; node; node = node->next){
+        if (!model->pending_names){
+            glDeleteTextures(1, &node->texture.id);
+        }
+        if (node->image){
+            texture_image_free(node->image);
+            free(node->image);
+        }
+    }
+    model->loaded_textures = NULL;
+    /* Nodes, paths and mesh texture arrays in one go. */
+    arena_free(&model->arena);
+    memstat_unregister(&model->memory);
+    scene_graph_free(&model->scene);
+    bvh_free(&model->bvh);
+    free(model->mesh_boxes);
+    model->mesh_boxes = NULL;
+    free(model->view_masks);
+    model->view_masks = NULL;
+    model->num_views = 0;
 }
 
 
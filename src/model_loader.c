@@ -0,0 +1,212 @@
+#include <model_loader.h>
+#include <string.h>
+#include <time.h>
+
+
+/* Background model loading.
+ *
+ * import_model needs no GL, so the whole import runs as one job. Texture
+ * decodes, if wanted, go out as jobs of their own in the same group the
+ * moment the import finishes, so the group only drains once everything
+ * off the GL thread is done. model_load_poll, on the GL thread, then
+ * names the textures and works through setup_mesh and texture uploads a
+ * few at a time, keeping each frame inside its budget.
+ */
+
+
+static void import_job(void * arg)
+{
+    Model_Load * load = arg;
+    Texture_Node * node;
+
+    load->result = import_model(load->model);
+    if (load->result || !load->decode_textures)
+        return;
+    for (node = load->model->loaded_textures; node; node = node->next){
+        if (node->image && \
+            job_pool_submit(load->pool, &load->group, texture_image_decode,
+                            node->image))
+        {
+            texture_image_decode(node->image);
+        }
+    }
+}
+
+
+static double seconds_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+
+static void report(Model_Load * load)
+{
+    if (load->on_progress){
+        load->on_progress(load->user, load->state,
+                          model_load_progress(load));
+    }
+}
+
+
+model_error_t model_load_begin(Model_Load * load, Model * model,
+                               Job_Pool * pool, vertex_format_t format,
+                               int decode_textures)
+{
+    memset(load, 0, sizeof(Model_Load));
+    load->model = model;
+    load->pool = pool;
+    load->vertex_format = format;
+    load->decode_textures = decode_textures;
+    load->state = MODEL_LOAD_IMPORTING;
+    model->meshes_processed = 0;
+    model->meshes_in_file = 0;
+    job_group_init(&load->group);
+    if (job_pool_submit(pool, &load->group, import_job, load)){
+        load->state = MODEL_LOAD_FAILED;
+        return MODEL_NO_MEM;
+    }
+    return MODEL_SUCCESS;
+}
+
+
+void model_load_on_progress(Model_Load * load, model_load_progress_fn fn,
+                            void * user)
+{
+    load->on_progress = fn;
+    load->user = user;
+}
+
+
+static void start_uploading(Model_Load * load)
+{
+    Model * model = load->model;
+    Texture_Node * node;
+
+    name_pending_textures(model);
+    model_set_vertex_format(model, load->vertex_format);
+    load->num_textures = 0;
+    if (load->decode_textures){
+        for (node = model->loaded_textures; node; node = node->next){
+            load->num_textures += node->image != NULL;
+        }
+    }
+    load->next_texture = model->loaded_textures;
+    load->state = MODEL_LOAD_UPLOADING;
+}
+
+
+static int upload_one(Model_Load * load)
+{
+    /* One mesh or texture to the GPU. Returns 0 once nothing is left, or
+     * on failure with load->result set.
+     */
+    Model * model = load->model;
+    Texture_Node * node;
+
+    if (load->meshes_uploaded < model->num_meshes){
+        load->result = setup_mesh(model->meshes + load->meshes_uploaded);
+        if (load->result){
+            fprintf(stderr, "%s %d: Mesh setup error in %s.\n", __FILE__,
+                    __LINE__, model->file_path);
+            return 0;
+        }
+        mesh_apply_residency(model->meshes + load->meshes_uploaded++,
+                             model->residency);
+        return 1;
+    }
+    if (!load->decode_textures)
+        return 0;
+    for (node = load->next_texture; node && !node->image; node = node->next);
+    if (!node)
+        return 0;
+    load->result = texture_image_upload(node->image);
+    if (load->result){
+        fprintf(stderr, "%s %d: Texture upload error for %s.\n", __FILE__,
+                __LINE__, node->texture.path);
+    } else{
+        memstat_add(&model->memory, MEMSTAT_GPU, MEMSTAT_TEXTURE,
+                    texture_image_bytes(node->image));
+    }
+    texture_image_free(node->image);
+    free(node->image);
+    node->image = NULL;
+    load->next_texture = node->next;
+    load->textures_uploaded++;
+    return !load->result;
+}
+
+
+model_load_state_t model_load_poll(Model_Load * load, double budget)
+{
+    double start;
+
+    if (load->state == MODEL_LOAD_IMPORTING){
+        if (!job_group_done(load->pool, &load->group)){
+            report(load);
+            return load->state;
+        }
+        if (load->result){
+            load->state = MODEL_LOAD_FAILED;
+            report(load);
+            return load->state;
+        }
+        start_uploading(load);
+    }
+    if (load->state == MODEL_LOAD_UPLOADING){
+        start = seconds_now();
+        do {
+            if (!upload_one(load)){
+                if (load->result){
+                    load->state = MODEL_LOAD_FAILED;
+                    break;
+                }
+                model_account_memory(load->model);
+                load->state = MODEL_LOAD_DONE;
+                break;
+            }
+        } while (seconds_now() - start < budget);
+    }
+    report(load);
+    return load->state;
+}
+
+
+float model_load_progress(const Model_Load * load)
+{
+    /* The first half is importing, the second uploading. */
+    unsigned int done, total;
+
+    switch (load->state){
+        case MODEL_LOAD_IMPORTING:
+            total = __atomic_load_n(&load->model->meshes_in_file,
+                                    __ATOMIC_RELAXED);
+            done = __atomic_load_n(&load->model->meshes_processed,
+                                   __ATOMIC_RELAXED);
+            return total ? .5f * done / total : 0.f;
+        case MODEL_LOAD_UPLOADING:
+            total = load->model->num_meshes + load->num_textures;
+            done = load->meshes_uploaded + load->textures_uploaded;
+            return total ? .5f + .5f * done / total : .5f;
+        case MODEL_LOAD_DONE:
+            return 1.f;
+        default:
+            return 0.f;
+    }
+}
+
+
+model_load_state_t model_load_finish(Model_Load * load)
+{
+    if (load->state == MODEL_LOAD_IMPORTING){
+        job_group_wait(load->pool, &load->group);
+    }
+    while (load->state == MODEL_LOAD_IMPORTING || \
+           load->state == MODEL_LOAD_UPLOADING)
+    {
+        model_load_poll(load, 1e9);
+    }
+    return load->state;
+}
@@ -0,0 +1,476 @@
+#include <occlusion.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define OCCLUSION_X86
+#endif
+
+
+/* Vertices closer to the eye plane than this are treated as crossing the
+ * near plane.
+ */
+#define OCCLUSION_MIN_W 1e-5f
+
+static int use_avx2 = 0;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+
+
+static void detect_cpu(void)
+{
+    #ifdef OCCLUSION_X86
+    __builtin_cpu_init();
+    use_avx2 = __builtin_cpu_supports("avx2");
+    #endif
+}
+
+
+static void account(Occlusion_Buffer * buffer)
+{
+    /* Everything the buffer holds, after any of it grows. */
+    long long total = 0;
+
+    for (int level = 0; level < OCCLUSION_LEVELS; level++){
+        total += (long long)(buffer->width >> level) * \
+                 (buffer->height >> level) * sizeof(float);
+    }
+    total += (long long)buffer->tiles_x * buffer->tiles_y * \
+             sizeof(Occlusion_Tile);
+    total += (long long)buffer->triangle_capacity * \
+             sizeof(Occlusion_Triangle);
+    total += (long long)buffer->bin_capacity * sizeof(unsigned int);
+    total += (long long)buffer->clip_capacity * sizeof(vec4);
+    memstat_set(&buffer->memory, MEMSTAT_CPU, MEMSTAT_CULLING, total);
+}
+
+
+occlusion_error_t occlusion_init(Occlusion_Buffer * buffer, int width,
+                                 int height)
+{
+    int size;
+
+    pthread_once(&cpu_once, detect_cpu);
+    memset(buffer, 0, sizeof(Occlusion_Buffer));
+    buffer->tiles_x = (width + OCCLUSION_TILE_WIDTH - 1) / \
+                      OCCLUSION_TILE_WIDTH;
+    buffer->tiles_y = (height + OCCLUSION_TILE_HEIGHT - 1) / \
+                      OCCLUSION_TILE_HEIGHT;
+    buffer->tiles_x = buffer->tiles_x ? buffer->tiles_x : 1;
+    buffer->tiles_y = buffer->tiles_y ? buffer->tiles_y : 1;
+    buffer->width = buffer->tiles_x * OCCLUSION_TILE_WIDTH;
+    buffer->height = buffer->tiles_y * OCCLUSION_TILE_HEIGHT;
+    for (int level = 0; level < OCCLUSION_LEVELS; level++){
+        size = (buffer->width >> level) * (buffer->height >> level);
+        buffer->levels[level] = malloc(size * sizeof(float));
+        if (!buffer->levels[level])
+            break;
+        /* Nothing drawn hides nothing. */
+        for (int i = 0; i < size; i++){
+            buffer->levels[level][i] = 1.f;
+        }
+    }
+    buffer->tiles = malloc(buffer->tiles_x * buffer->tiles_y * \
+                           sizeof(Occlusion_Tile));
+    if (!buffer->levels[OCCLUSION_LEVELS - 1] || !buffer->tiles){
+        occlusion_free(buffer);
+        err_print("Out of memory");
+        return OCCLUSION_NO_MEM;
+    }
+    for (int y = 0; y < buffer->tiles_y; y++){
+        for (int x = 0; x < buffer->tiles_x; x++){
+            buffer->tiles[y * buffer->tiles_x + x].buffer = buffer;
+            buffer->tiles[y * buffer->tiles_x + x].x = x;
+            buffer->tiles[y * buffer->tiles_x + x].y = y;
+        }
+    }
+    mat4x4_identity(buffer->view_projection);
+    memstat_register(&buffer->memory, "occlusion buffer");
+    account(buffer);
+    return OCCLUSION_SUCCESS;
+}
+
+
+void occlusion_free(Occlusion_Buffer * buffer)
+{
+    for (int level = 0; level < OCCLUSION_LEVELS; level++){
+        free(buffer->levels[level]);
+    }
+    free(buffer->triangles);
+    free(buffer->bins);
+    free(buffer->tiles);
+    free(buffer->clip);
+    memstat_unregister(&buffer->memory);
+    memset(buffer, 0, sizeof(Occlusion_Buffer));
+}
+
+
+void occlusion_begin(Occlusion_Buffer * buffer, mat4x4 view_projection)
+{
+    mat4x4_dup(buffer->view_projection, view_projection);
+    buffer->num_triangles = 0;
+}
+
+
+static int setup_triangle(const Occlusion_Buffer * buffer, const float * v0,
+                          const float * v1, const float * v2,
+                          Occlusion_Triangle * out)
+{
+    /* Edge i runs from vertex i to vertex i + 1 and is positive on the
+     * inside of a counter clockwise triangle. Vertex i's barycentric
+     * weight is edge i + 1 over the area, which gives the depth plane.
+     */
+    const float * v[3] = {v0, v1, v2};
+    float x[3], y[3], z[3], area, a, b, c;
+    int j;
+
+    for (int i = 0; i < 3; i++){
+        if (v[i][3] < OCCLUSION_MIN_W)
+            return 0;
+        x[i] = (v[i][0] / v[i][3] * .5f + .5f) * buffer->width;
+        y[i] = (v[i][1] / v[i][3] * .5f + .5f) * buffer->height;
+        z[i] = v[i][2] / v[i][3] * .5f + .5f;
+    }
+    if (z[0] > 1.f && z[1] > 1.f && z[2] > 1.f)
+        return 0;
+    area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area <= 0.f)
+        return 0;
+    out->min_x = (int)ceilf(fminf(x[0], fminf(x[1], x[2])) - .5f);
+    out->min_y = (int)ceilf(fminf(y[0], fminf(y[1], y[2])) - .5f);
+    out->max_x = (int)floorf(fmaxf(x[0], fmaxf(x[1], x[2])) - .5f);
+    out->max_y = (int)floorf(fmaxf(y[0], fmaxf(y[1], y[2])) - .5f);
+    out->min_x = out->min_x > 0 ? out->min_x : 0;
+    out->min_y = out->min_y > 0 ? out->min_y : 0;
+    out->max_x = out->max_x < buffer->width ? out->max_x : buffer->width - 1;
+    out->max_y = out->max_y < buffer->height ? out->max_y : \
+                 buffer->height - 1;
+    if (out->min_x > out->max_x || out->min_y > out->max_y)
+        return 0;
+    for (int k = 0; k < 3; k++){
+        out->depth[k] = 0.f;
+    }
+    for (int i = 0; i < 3; i++){
+        j = (i + 1) % 3;
+        a = y[i] - y[j];
+        b = x[j] - x[i];
+        c = -(a * x[i] + b * y[i]);
+        out->edge[i][0] = a;
+        out->edge[i][1] = b;
+        out->edge[i][2] = c;
+        /* Edge i is opposite vertex i + 2. */
+        j = (i + 2) % 3;
+        out->depth[0] += a * z[j] / area;
+        out->depth[1] += b * z[j] / area;
+        out->depth[2] += c * z[j] / area;
+    }
+    return 1;
+}
+
+
+occlusion_error_t occlusion_add_occluder(Occlusion_Buffer * buffer,
+                                         mat4x4 world,
+                                         const float * positions,
+                                         size_t stride,
+                                         unsigned int num_vertices,
+                                         const unsigned int * indices,
+                                         unsigned int count)
+{
+    mat4x4 clip;
+    unsigned int needed, capacity;
+    void * grown;
+
+    if (num_vertices > buffer->clip_capacity){
+        grown = realloc(buffer->clip, num_vertices * sizeof(vec4));
+        if (!grown){
+            err_print("Out of memory");
+            return OCCLUSION_NO_MEM;
+        }
+        buffer->clip = grown;
+        buffer->clip_capacity = num_vertices;
+        account(buffer);
+    }
+    needed = buffer->num_triangles + count / 3;
+    if (needed > buffer->triangle_capacity){
+        capacity = buffer->triangle_capacity ? buffer->triangle_capacity : 256;
+        while (capacity < needed){
+            capacity *= 2;
+        }
+        grown = realloc(buffer->triangles,
+                        capacity * sizeof(Occlusion_Triangle));
+        if (!grown){
+            err_print("Out of memory");
+            return OCCLUSION_NO_MEM;
+        }
+        buffer->triangles = grown;
+        buffer->triangle_capacity = capacity;
+        account(buffer);
+    }
+    mat4x4_mul_simd(clip, buffer->view_projection, world);
+    mat4x4_transform_points(buffer->clip, clip, positions, stride,
+                            num_vertices);
+    for (unsigned int i = 0; i + 2 < count; i += 3){
+        buffer->num_triangles += setup_triangle(
+            buffer, buffer->clip[indices[i]], buffer->clip[indices[i + 1]],
+            buffer->clip[indices[i + 2]],
+            buffer->triangles + buffer->num_triangles);
+    }
+    return OCCLUSION_SUCCESS;
+}
+
+
+#ifdef OCCLUSION_X86
+__attribute__((target("avx2")))
+static void rasterize_avx2(float * depth, int width,
+                           const Occlusion_Triangle * t, int x0, int y0,
+                           int x1, int y1)
+{
+    /* Eight pixels of a row at a time. Spans start on a multiple of 8,
+     * which tiles are too, so no lane leaves the tile. A lane is covered
+     * when no edge is negative, ie. none has its sign bit set.
+     */
+    const __m256 centres = _mm256_setr_ps(.5f, 1.5f, 2.5f, 3.5f,
+                                          4.5f, 5.5f, 6.5f, 7.5f);
+    const __m256 a0 = _mm256_set1_ps(t->edge[0][0]);
+    const __m256 a1 = _mm256_set1_ps(t->edge[1][0]);
+    const __m256 a2 = _mm256_set1_ps(t->edge[2][0]);
+    const __m256 dz = _mm256_set1_ps(t->depth[0]);
+    __m256 row0, row1, row2, row_z, px, outside, z, old;
+    float py;
+    float * row;
+
+    for (int y = y0; y <= y1; y++){
+        py = y + .5f;
+        row0 = _mm256_set1_ps(t->edge[0][1] * py + t->edge[0][2]);
+        row1 = _mm256_set1_ps(t->edge[1][1] * py + t->edge[1][2]);
+        row2 = _mm256_set1_ps(t->edge[2][1] * py + t->edge[2][2]);
+        row_z = _mm256_set1_ps(t->depth[1] * py + t->depth[2]);
+        row = depth + y * width;
+        for (int x = x0 & ~7; x <= x1; x += 8){
+            px = _mm256_add_ps(_mm256_set1_ps((float)x), centres);
+            outside = _mm256_or_ps(
+                _mm256_add_ps(_mm256_mul_ps(a0, px), row0),
+                _mm256_or_ps(_mm256_add_ps(_mm256_mul_ps(a1, px), row1),
+                             _mm256_add_ps(_mm256_mul_ps(a2, px), row2)));
+            z = _mm256_add_ps(_mm256_mul_ps(dz, px), row_z);
+            old = _mm256_loadu_ps(row + x);
+            _mm256_storeu_ps(row + x, _mm256_blendv_ps(_mm256_min_ps(old, z),
+                                                       old, outside));
+        }
+    }
+}
+#endif
+
+
+static void rasterize_scalar(float * depth, int width,
+                             const Occlusion_Triangle * t, int x0, int y0,
+                             int x1, int y1)
+{
+    float px, py, z;
+
+    for (int y = y0; y <= y1; y++){
+        py = y + .5f;
+        for (int x = x0; x <= x1; x++){
+            px = x + .5f;
+            if (t->edge[0][0] * px + t->edge[0][1] * py + t->edge[0][2] < 0.f ||
+                t->edge[1][0] * px + t->edge[1][1] * py + t->edge[1][2] < 0.f ||
+                t->edge[2][0] * px + t->edge[2][1] * py + t->edge[2][2] < 0.f)
+                continue;
+            z = t->depth[0] * px + t->depth[1] * py + t->depth[2];
+            if (z < depth[y * width + x]){
+                depth[y * width + x] = z;
+            }
+        }
+    }
+}
+
+
+static void reduce_tile(Occlusion_Buffer * buffer, int x0, int y0)
+{
+    /* Tiles divide evenly into every level, so each one can build its
+     * own corner of the hierarchy without waiting for its neighbours.
+     */
+    const float * below;
+    float * level;
+    int width, below_width, i;
+
+    for (int l = 1; l < OCCLUSION_LEVELS; l++){
+        below = buffer->levels[l - 1];
+        level = buffer->levels[l];
+        below_width = buffer->width >> (l - 1);
+        width = buffer->width >> l;
+        for (int y = y0 >> l; y < (y0 + OCCLUSION_TILE_HEIGHT) >> l; y++){
+            for (int x = x0 >> l; x < (x0 + OCCLUSION_TILE_WIDTH) >> l; x++){
+                i = 2 * y * below_width + 2 * x;
+                level[y * width + x] = fmaxf(
+                    fmaxf(below[i], below[i + 1]),
+                    fmaxf(below[i + below_width], below[i + below_width + 1]));
+            }
+        }
+    }
+}
+
+
+static void rasterize_tile(void * arg)
+{
+    Occlusion_Tile * tile = arg;
+    Occlusion_Buffer * buffer = tile->buffer;
+    const Occlusion_Triangle * t;
+    float * depth = buffer->levels[0];
+    int x0 = tile->x * OCCLUSION_TILE_WIDTH;
+    int y0 = tile->y * OCCLUSION_TILE_HEIGHT;
+    int x1 = x0 + OCCLUSION_TILE_WIDTH - 1;
+    int y1 = y0 + OCCLUSION_TILE_HEIGHT - 1;
+    int span_x0, span_y0, span_x1, span_y1;
+
+    for (int y = y0; y <= y1; y++){
+        for (int x = x0; x <= x1; x++){
+            depth[y * buffer->width + x] = 1.f;
+        }
+    }
+    for (unsigned int i = 0; i < tile->count; i++){
+        t = buffer->triangles + buffer->bins[tile->first + i];
+        span_x0 = t->min_x > x0 ? t->min_x : x0;
+        span_y0 = t->min_y > y0 ? t->min_y : y0;
+        span_x1 = t->max_x < x1 ? t->max_x : x1;
+        span_y1 = t->max_y < y1 ? t->max_y : y1;
+        #ifdef OCCLUSION_X86
+        if (use_avx2){
+            rasterize_avx2(depth, buffer->width, t, span_x0, span_y0,
+                           span_x1, span_y1);
+            continue;
+        }
+        #endif
+        rasterize_scalar(depth, buffer->width, t, span_x0, span_y0,
+                         span_x1, span_y1);
+    }
+    reduce_tile(buffer, x0, y0);
+}
+
+
+occlusion_error_t occlusion_rasterize(Occlusion_Buffer * buffer,
+                                      Job_Pool * pool)
+{
+    /* Triangles are binned to the tiles their bounds touch, counted
+     * first so every tile's list is one run of bins.
+     */
+    int num_tiles = buffer->tiles_x * buffer->tiles_y;
+    const Occlusion_Triangle * t;
+    Occlusion_Tile * tile;
+    unsigned int total = 0;
+    Job_Group group;
+    void * grown;
+
+    for (int i = 0; i < num_tiles; i++){
+        buffer->tiles[i].count = 0;
+    }
+    for (unsigned int i = 0; i < buffer->num_triangles; i++){
+        t = buffer->triangles + i;
+        for (int y = t->min_y / OCCLUSION_TILE_HEIGHT; \
+             y <= t->max_y / OCCLUSION_TILE_HEIGHT; y++)
+        {
+            for (int x = t->min_x / OCCLUSION_TILE_WIDTH; \
+                 x <= t->max_x / OCCLUSION_TILE_WIDTH; x++)
+            {
+                buffer->tiles[y * buffer->tiles_x + x].count++;
+                total++;
+            }
+        }
+    }
+    if (total > buffer->bin_capacity){
+        grown = realloc(buffer->bins, total * sizeof(unsigned int));
+        if (!grown){
+            err_print("Out of memory");
+            return OCCLUSION_NO_MEM;
+        }
+        buffer->bins = grown;
+        buffer->bin_capacity = total;
+        account(buffer);
+    }
+    total = 0;
+    for (int i = 0; i < num_tiles; i++){
+        buffer->tiles[i].first = total;
+        total += buffer->tiles[i].count;
+        buffer->tiles[i].count = 0;
+    }
+    for (unsigned int i = 0; i < buffer->num_triangles; i++){
+        t = buffer->triangles + i;
+        for (int y = t->min_y / OCCLUSION_TILE_HEIGHT; \
+             y <= t->max_y / OCCLUSION_TILE_HEIGHT; y++)
+        {
+            for (int x = t->min_x / OCCLUSION_TILE_WIDTH; \
+                 x <= t->max_x / OCCLUSION_TILE_WIDTH; x++)
+            {
+                tile = buffer->tiles + y * buffer->tiles_x + x;
+                buffer->bins[tile->first + tile->count++] = i;
+            }
+        }
+    }
+    job_group_init(&group);
+    for (int i = 0; i < num_tiles; i++){
+        if (job_pool_submit(pool, &group, rasterize_tile, buffer->tiles + i)){
+            rasterize_tile(buffer->tiles + i);
+        }
+    }
+    job_group_wait(pool, &group);
+    return OCCLUSION_SUCCESS;
+}
+
+
+int occlusion_test_aabb(const Occlusion_Buffer * buffer, mat4x4 world,
+                        const vec3 min, const vec3 max)
+{
+    /* The box's screen rectangle and nearest depth, against the furthest
+     * depth under that rectangle at the level where it spans at most four
+     * texels a side. Boxes reaching behind the eye always pass.
+     */
+    mat4x4 clip;
+    vec4 corner, p;
+    float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX;
+    float max_y = -FLT_MAX, nearest = FLT_MAX;
+    int x0, y0, x1, y1, level = 0, width;
+    const float * depth;
+
+    mat4x4_mul_simd(clip, (vec4 *)buffer->view_projection, world);
+    for (int i = 0; i < 8; i++){
+        corner[0] = i & 1 ? max[0] : min[0];
+        corner[1] = i & 2 ? max[1] : min[1];
+        corner[2] = i & 4 ? max[2] : min[2];
+        corner[3] = 1.f;
+        mat4x4_mul_vec4_simd(p, clip, corner);
+        if (p[3] < OCCLUSION_MIN_W)
+            return 1;
+        min_x = fminf(min_x, p[0] / p[3]);
+        max_x = fmaxf(max_x, p[0] / p[3]);
+        min_y = fminf(min_y, p[1] / p[3]);
+        max_y = fmaxf(max_y, p[1] / p[3]);
+        nearest = fminf(nearest, p[2] / p[3] * .5f + .5f);
+    }
+    /* Off screen is for frustum culling to decide. */
+    x0 = (int)floorf((min_x * .5f + .5f) * buffer->width);
+    x1 = (int)floorf((max_x * .5f + .5f) * buffer->width);
+    y0 = (int)floorf((min_y * .5f + .5f) * buffer->height);
+    y1 = (int)floorf((max_y * .5f + .5f) * buffer->height);
+    if (x1 < 0 || y1 < 0 || x0 >= buffer->width || y0 >= buffer->height)
+        return 1;
+    x0 = x0 > 0 ? x0 : 0;
+    y0 = y0 > 0 ? y0 : 0;
+    x1 = x1 < buffer->width ? x1 : buffer->width - 1;
+    y1 = y1 < buffer->height ? y1 : buffer->height - 1;
+    while (level < OCCLUSION_LEVELS - 1 && \
+           ((x1 >> level) - (x0 >> level) > 3 || \
+            (y1 >> level) - (y0 >> level) > 3))
+    {
+        level++;
+    }
+    depth = buffer->levels[level];
+    width = buffer->width >> level;
+    for (int y = y0 >> level; y <= y1 >> level; y++){
+        for (int x = x0 >> level; x <= x1 >> level; x++){
+            if (depth[y * width + x] >= nearest)
+                return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include <scene.h>
+#include <string.h>
+
+
+scene_error_t scene_graph_init(Scene_Graph * graph, unsigned int capacity)
+{
+    memset(graph, 0, sizeof(Scene_Graph));
+    if (!capacity){
+        capacity = 1;
+    }
+    graph->parent = malloc(capacity * sizeof(int));
+    graph->local = malloc(capacity * sizeof(mat4x4));
+    graph->world = malloc(capacity * sizeof(mat4x4));
+    graph->dirty = malloc(capacity);
+    graph->updated = malloc(capacity * sizeof(unsigned int));
+    if (!graph->parent || !graph->local || !graph->world || !graph->dirty || \
+        !graph->updated)
+    {
+        scene_graph_free(graph);
+        err_print("Out of memory");
+        return SCENE_NO_MEM;
+    }
+    graph->capacity = capacity;
+    return SCENE_SUCCESS;
+}
+
+
+void scene_graph_free(Scene_Graph * graph)
+{
+    free(graph->parent);
+    free(graph->local);
+    free(graph->world);
+    free(graph->dirty);
+    free(graph->updated);
+    memset(graph, 0, sizeof(Scene_Graph));
+}
+
+
+static scene_error_t scene_graph_grow(Scene_Graph * graph)
+{
+    unsigned int capacity = 2 * graph->capacity;
+    void * grown;
+
+    /* Each array is swapped in as soon as it has grown, so a failure
+     * part way leaves the graph consistent, just no bigger.
+     */
+    if (!(grown = realloc(graph->parent, capacity * sizeof(int))))
+        return SCENE_NO_MEM;
+    graph->parent = grown;
+    if (!(grown = realloc(graph->local, capacity * sizeof(mat4x4))))
+        return SCENE_NO_MEM;
+    graph->local = grown;
+    if (!(grown = realloc(graph->world, capacity * sizeof(mat4x4))))
+        return SCENE_NO_MEM;
+    graph->world = grown;
+    if (!(grown = realloc(graph->dirty, capacity)))
+        return SCENE_NO_MEM;
+    graph->dirty = grown;
+    if (!(grown = realloc(graph->updated, capacity * sizeof(unsigned int))))
+        return SCENE_NO_MEM;
+    graph->updated = grown;
+    graph->capacity = capacity;
+    return SCENE_SUCCESS;
+}
+
+
+int scene_graph_add(Scene_Graph * graph, int parent, mat4x4 local)
+{
+    unsigned int node = graph->num_nodes;
+
+    if (parent >= (int)graph->num_nodes){
+        err_print("Parent node does not exist");
+        return -1;
+    }
+    if (node == graph->capacity && scene_graph_grow(graph)){
+        err_print("Out of memory");
+        return -1;
+    }
+    graph->parent[node] = parent < 0 ? -1 : parent;
+    mat4x4_dup(graph->local[node], local);
+    mat4x4_identity(graph->world[node]);
+    graph->dirty[node] = 1;
+    graph->num_nodes++;
+    return node;
+}
+
+
+void scene_graph_set_local(Scene_Graph * graph, unsigned int node,
+                           mat4x4 local)
+{
+    mat4x4_dup(graph->local[node], local);
+    graph->dirty[node] = 1;
+}
+
+
+unsigned int scene_graph_update(Scene_Graph * graph)
+{
+    /* Flags are pushed down first, collecting the nodes to recompute in
+     * order, then the matrices are multiplied in one tight loop.
+     */
+    unsigned int count = 0, node;
+    int parent;
+
+    for (unsigned int i = 0; i < graph->num_nodes; i++){
+        parent = graph->parent[i];
+        if (parent >= 0 && graph->dirty[parent]){
+            graph->dirty[i] = 1;
+        }
+        if (graph->dirty[i]){
+            graph->updated[count++] = i;
+        }
+    }
+    for (unsigned int i = 0; i < count; i++){
+        node = graph->updated[i];
+        parent = graph->parent[node];
+        if (parent < 0){
+            mat4x4_dup(graph->world[node], graph->local[node]);
+        } else{
+            mat4x4_mul_simd(graph->world[node], graph->world[parent],
+                            graph->local[node]);
+        }
+        graph->dirty[node] = 0;
+    }
+    graph->num_updated = count;
+    return count;
+}
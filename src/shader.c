@@ -69,9 +69,69 @@ shader_err_t load(struct Shader * self, char * vertexPath, char * fragmentPath)
 }
 
 
+static void shaderSource(unsigned int shader, const char * source,
+                         const char * defines)
+{
+    /* Defines have to follow the #version line, so the source is handed
+     * to GL in three pieces with the defines spliced in between.
+     */
+    const char * strings[3];
+    GLint lengths[3];
+    const char * rest = source;
+
+    if (!defines){
+        glShaderSource(shader, 1, &source, NULL);
+        return;
+    }
+    while (*rest == ' ' || *rest == '\t' || *rest == '\n' || *rest == '\r')
+        rest++;
+    if (strncmp(rest, "#version", 8) == 0){
+        rest = strchr(rest, '\n');
+        rest = rest ? rest + 1 : source + strlen(source);
+    } else{
+        rest = source;
+    }
+    strings[0] = source;
+    lengths[0] = rest - source;
+    strings[1] = defines;
+    lengths[1] = strlen(defines);
+    strings[2] = rest;
+    lengths[2] = strlen(rest);
+    glShaderSource(shader, 3, strings, lengths);
+}
+
+
+static int positionsOnly(unsigned int program)
+{
+    /* True when the linked program reads a single vertex attribute, at
+     * location 0. Model drawing then uses the position only VAO.
+     */
+    GLint count = 0, size;
+    GLenum type;
+    char name[64];
+
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+    if (count != 1)
+        return 0;
+    glGetActiveAttrib(program, 0, sizeof(name), NULL, &size, &type, name);
+    return glGetAttribLocation(program, name) == 0;
+}
+
+
 shader_err_t shaderLoad(struct Shader * self, char * vertexPath,
                         char * fragmentPath, char * geomPath)
 {
+    return shaderLoadDefines(self, vertexPath, fragmentPath, geomPath, NULL);
+}
+
+
+shader_err_t shaderLoadDefines(struct Shader * self, char * vertexPath,
+                               char * fragmentPath, char * geomPath,
+                               const char * defines)
+{
+    /* defines is inserted after the #version line of every stage, eg.
+     * "#define PACKED_VERTICES\n". It may be NULL.
+     */
     char * vertexSource = NULL;
     char * fragmentSource = NULL;
     char * geomSource = NULL;
@@ -109,7 +169,7 @@ shader_err_t shaderLoad(struct Shader * self, char * vertexPath,
     // vertex shader
     vertex = glCreateShader(GL_VERTEX_SHADER);
     gl_err_check(free_3);
-    glShaderSource(vertex, 1, (const char **)(&vertexSource), NULL);
+    shaderSource(vertex, vertexSource, defines);
     gl_err_check(shader_1);
     glCompileShader(vertex);
     gl_err_check(shader_1);
@@ -118,7 +178,7 @@ shader_err_t shaderLoad(struct Shader * self, char * vertexPath,
     // fragment shader
     fragment = glCreateShader(GL_FRAGMENT_SHADER);
     gl_err_check(shader_1);
-    glShaderSource(fragment, 1, (const char **)(&fragmentSource), NULL);
+    shaderSource(fragment, fragmentSource, defines);
     gl_err_check(shader_2);
     glCompileShader(fragment);
     gl_err_check(shader_2);
@@ -128,7 +188,7 @@ shader_err_t shaderLoad(struct Shader * self, char * vertexPath,
     if (geomPath){
         geometry = glCreateShader(GL_GEOMETRY_SHADER);
         gl_err_check(shader_2);
-        glShaderSource(geometry, 1, (const char **)(&geomSource), NULL);
+        shaderSource(geometry, geomSource, defines);
         gl_err_check(shader_3);
         glCompileShader(geometry);
         gl_err_check(shader_3);
@@ -159,6 +219,7 @@ shader_err_t shaderLoad(struct Shader * self, char * vertexPath,
     #endif
     /* The penultimate assignment. If we got here, we succeeded. */
     self->ID = ID;
+    self->positionsOnly = positionsOnly(ID);
 
     /* Cleanup */
     shader_3:
@@ -179,6 +240,61 @@ shader_err_t shaderLoad(struct Shader * self, char * vertexPath,
 }
 
 
+shader_err_t shaderLoadCompute(struct Shader * self, char * computePath,
+                               const char * defines)
+{
+    /* A program with a single compute stage, run with glDispatchCompute
+     * after use(). defines works as in shaderLoadDefines.
+     */
+    char * computeSource = NULL;
+    unsigned int compute;
+    shader_err_t result = SHADER_NO_ERR;
+
+    result = readFile(computePath, &computeSource);
+    if (result != SHADER_NO_ERR)
+        return result;
+    if (!(computeSource)){
+        err_print("Compute shader file read failure\n");
+        return SHADER_NULL_PTR;
+    }
+
+    compute = glCreateShader(GL_COMPUTE_SHADER);
+    gl_err_check(free_1);
+    shaderSource(compute, computeSource, defines);
+    gl_err_check(shader_1);
+    glCompileShader(compute);
+    gl_err_check(shader_1);
+    checkCompileErrors(compute, "COMPUTE");
+
+    GLint ID = glCreateProgram();
+    #ifdef SHADER_DEBUG
+    if (glGetError() != GL_NO_ERROR){
+        err_print("Failed to create shader program\n");
+        result = SHADER_GL_ERR;
+        goto shader_1;
+    }
+    #endif
+    glAttachShader(ID, compute);
+    glLinkProgram(ID);
+    #ifdef SHADER_DEBUG
+    if (checkCompileErrors(ID, "PROGRAM") != SHADER_NO_ERR){
+        err_print("Shader compilation failed\n");
+        result = SHADER_GL_ERR;
+        glDeleteProgram(ID);
+        goto shader_1;
+    }
+    #endif
+    self->ID = ID;
+    self->positionsOnly = 0;
+
+    shader_1:
+        glDeleteShader(compute);
+    free_1:
+        free(computeSource);
+    return result;
+}
+
+
 shader_err_t use(struct Shader * self)
 {
     shader_err_t result = SHADER_NO_ERR;
@@ -0,0 +1,407 @@
+#include <simplify.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+
+/* Collapses run in passes. Each pass scores every edge, sorts them, and
+ * applies the cheapest ones that don't touch each other, so the rewritten
+ * index list never has to chase chains of collapses. Passes continue
+ * until the target is met, the error bound is hit or nothing is left to
+ * collapse.
+ */
+
+#define FLIP_THRESHOLD 0.25
+
+
+struct Quadric {
+    //Upper triangle of the symmetric 4x4 matrix, row by row
+    double xx, xy, xz, xw, yy, yz, yw, zz, zw, ww;
+    double weight;
+};
+typedef struct Quadric Quadric;
+
+struct Collapse {
+    unsigned int from;
+    unsigned int to;
+    double       cost;
+};
+typedef struct Collapse Collapse;
+
+
+static const float * position_of(const float * positions, size_t stride,
+                                 unsigned int index)
+{
+    return (const float *)((const char *)positions + index * stride);
+}
+
+
+static void quadric_add_plane(Quadric * q, double a, double b, double c,
+                              double d, double weight)
+{
+    q->xx += weight * a * a;
+    q->xy += weight * a * b;
+    q->xz += weight * a * c;
+    q->xw += weight * a * d;
+    q->yy += weight * b * b;
+    q->yz += weight * b * c;
+    q->yw += weight * b * d;
+    q->zz += weight * c * c;
+    q->zw += weight * c * d;
+    q->ww += weight * d * d;
+    q->weight += weight;
+}
+
+
+static void quadric_add(Quadric * q, const Quadric * r)
+{
+    q->xx += r->xx;
+    q->xy += r->xy;
+    q->xz += r->xz;
+    q->xw += r->xw;
+    q->yy += r->yy;
+    q->yz += r->yz;
+    q->yw += r->yw;
+    q->zz += r->zz;
+    q->zw += r->zw;
+    q->ww += r->ww;
+    q->weight += r->weight;
+}
+
+
+static double quadric_error(const Quadric * q, const Quadric * r,
+                            const float * p)
+{
+    /* Mean squared distance from p to the planes of q + r. */
+    double x = p[0], y = p[1], z = p[2], weight, error;
+
+    error = (q->xx + r->xx) * x * x + (q->yy + r->yy) * y * y + \
+            (q->zz + r->zz) * z * z + (q->ww + r->ww) + \
+            2.0 * ((q->xy + r->xy) * x * y + (q->xz + r->xz) * x * z + \
+                   (q->yz + r->yz) * y * z + (q->xw + r->xw) * x + \
+                   (q->yw + r->yw) * y + (q->zw + r->zw) * z);
+    weight = q->weight + r->weight;
+    error = weight > 0.0 ? error / weight : 0.0;
+    return error > 0.0 ? error : 0.0;
+}
+
+
+static void triangle_normal(const float * a, const float * b, const float * c,
+                            double * n)
+{
+    double e1[3], e2[3];
+
+    for (int k = 0; k < 3; k++){
+        e1[k] = (double)b[k] - a[k];
+        e2[k] = (double)c[k] - a[k];
+    }
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+
+static uint32_t hash_u32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+
+static int lock_seams_and_borders(unsigned char * locked,
+                                  const unsigned int * indices,
+                                  size_t num_indices,
+                                  const float * positions, size_t stride,
+                                  size_t num_vertices)
+{
+    /* Vertices sharing a position with another vertex sit on a UV or
+     * normal seam, and edges used by a single triangle are open borders.
+     * Moving either would tear the mesh, so both are locked.
+     */
+    const unsigned int empty = ~0u;
+    size_t table_size = 1, slot;
+    unsigned int * table, * position_id;
+    uint64_t * edges, key;
+    unsigned int * edge_count;
+    unsigned int a, b;
+    uint32_t bits[3];
+    const float * p;
+
+    while (table_size < 2 * (num_vertices > num_indices ? num_vertices \
+                                                        : num_indices))
+    {
+        table_size *= 2;
+    }
+    table = malloc(table_size * sizeof(unsigned int));
+    position_id = malloc(num_vertices * sizeof(unsigned int));
+    edges = malloc(table_size * sizeof(uint64_t));
+    edge_count = calloc(table_size, sizeof(unsigned int));
+    if (!table || !position_id || !edges || !edge_count){
+        free(table);
+        free(position_id);
+        free(edges);
+        free(edge_count);
+        return 0;
+    }
+
+    memset(table, 0xff, table_size * sizeof(unsigned int));
+    for (unsigned int v = 0; v < num_vertices; v++){
+        p = position_of(positions, stride, v);
+        memcpy(bits, p, sizeof(bits));
+        slot = hash_u32(bits[0] * 73856093u ^ bits[1] * 19349663u ^ \
+                        bits[2] * 83492791u) & (table_size - 1);
+        while (table[slot] != empty && \
+               memcmp(position_of(positions, stride, table[slot]), p,
+                      3 * sizeof(float)))
+        {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot] == empty){
+            table[slot] = v;
+        } else{
+            locked[v] = 1;
+            locked[table[slot]] = 1;
+        }
+        position_id[v] = table[slot];
+    }
+
+    for (size_t i = 0; i < num_indices; i++){
+        a = position_id[indices[i]];
+        b = position_id[indices[i - i % 3 + (i + 1) % 3]];
+        key = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+        slot = hash_u32((uint32_t)key ^ hash_u32((uint32_t)(key >> 32))) & \
+               (table_size - 1);
+        while (edge_count[slot] && edges[slot] != key){
+            slot = (slot + 1) & (table_size - 1);
+        }
+        edges[slot] = key;
+        edge_count[slot]++;
+    }
+    for (size_t i = 0; i < num_indices; i++){
+        a = position_id[indices[i]];
+        b = position_id[indices[i - i % 3 + (i + 1) % 3]];
+        key = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+        slot = hash_u32((uint32_t)key ^ hash_u32((uint32_t)(key >> 32))) & \
+               (table_size - 1);
+        while (edges[slot] != key){
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (edge_count[slot] == 1){
+            locked[indices[i]] = 1;
+            locked[indices[i - i % 3 + (i + 1) % 3]] = 1;
+        }
+    }
+    free(table);
+    free(position_id);
+    free(edges);
+    free(edge_count);
+    return 1;
+}
+
+
+static int compare_collapse(const void * a, const void * b)
+{
+    const Collapse * x = a;
+    const Collapse * y = b;
+
+    if (x->cost != y->cost)
+        return x->cost < y->cost ? -1 : 1;
+    return x->from < y->from ? -1 : (x->from > y->from);
+}
+
+
+static int collapse_flips(unsigned int from, unsigned int to,
+                          const unsigned int * indices,
+                          const unsigned int * offsets,
+                          const unsigned int * adjacency,
+                          const float * positions, size_t stride)
+{
+    /* True if moving from onto to turns any surviving triangle around
+     * from over (or close to it).
+     */
+    const unsigned int * triangle;
+    const float * p[3], * q[3];
+    double n0[3], n1[3], dot, length0, length1;
+
+    for (unsigned int j = offsets[from]; j < offsets[from + 1]; j++){
+        triangle = indices + 3 * adjacency[j];
+        if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+            continue;
+        for (int k = 0; k < 3; k++){
+            p[k] = position_of(positions, stride, triangle[k]);
+            q[k] = triangle[k] == from ? position_of(positions, stride, to)
+                                       : p[k];
+        }
+        triangle_normal(p[0], p[1], p[2], n0);
+        triangle_normal(q[0], q[1], q[2], n1);
+        dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+        length0 = sqrt(n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2]);
+        length1 = sqrt(n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2]);
+        if (dot <= FLIP_THRESHOLD * length0 * length1)
+            return 1;
+    }
+    return 0;
+}
+
+
+simplify_error_t simplify_mesh(unsigned int * out, size_t * out_count,
+                               const unsigned int * indices,
+                               size_t num_indices,
+                               const float * positions, size_t stride,
+                               size_t num_vertices,
+                               size_t target_index_count,
+                               float target_error, float * result_error)
+{
+    simplify_error_t result = SIMPLIFY_SUCCESS;
+    Quadric * quadrics;
+    Collapse * collapses;
+    unsigned char * locked, * touched;
+    unsigned int * offsets, * adjacency, * remap;
+    size_t count = num_indices, num_collapses, applied, budget, write;
+    double max_cost = (double)target_error * target_error, cost_ab, cost_ba;
+    double n[3], length, worst = 0.0;
+    const float * p[3];
+    unsigned int a, b, v, * triangle;
+
+    memcpy(out, indices, num_indices * sizeof(unsigned int));
+    *out_count = num_indices;
+    *result_error = 0.f;
+    quadrics = calloc(num_vertices, sizeof(Quadric));
+    collapses = malloc(num_indices * sizeof(Collapse));
+    locked = calloc(num_vertices, 1);
+    touched = malloc(num_vertices);
+    offsets = malloc((num_vertices + 1) * sizeof(unsigned int));
+    adjacency = malloc(num_indices * sizeof(unsigned int));
+    remap = malloc(num_vertices * sizeof(unsigned int));
+    if (!quadrics || !collapses || !locked || !touched || !offsets || \
+        !adjacency || !remap || \
+        !lock_seams_and_borders(locked, indices, num_indices, positions,
+                                stride, num_vertices))
+    {
+        err_print("Out of memory");
+        result = SIMPLIFY_NO_MEM;
+        goto cleanup;
+    }
+
+    /* Area weighted plane quadrics. */
+    for (size_t i = 0; i < num_indices; i += 3){
+        for (int k = 0; k < 3; k++){
+            p[k] = position_of(positions, stride, indices[i + k]);
+        }
+        triangle_normal(p[0], p[1], p[2], n);
+        length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0.0)
+            continue;
+        n[0] /= length;
+        n[1] /= length;
+        n[2] /= length;
+        for (int k = 0; k < 3; k++){
+            quadric_add_plane(quadrics + indices[i + k], n[0], n[1], n[2],
+                              -(n[0] * p[0][0] + n[1] * p[0][1] + \
+                                n[2] * p[0][2]),
+                              0.5 * length);
+        }
+    }
+
+    while (count > target_index_count){
+        /* Triangles around each vertex, for the flip test. */
+        memset(offsets, 0, (num_vertices + 1) * sizeof(unsigned int));
+        for (size_t i = 0; i < count; i++){
+            offsets[out[i] + 1]++;
+        }
+        for (size_t v = 0; v < num_vertices; v++){
+            offsets[v + 1] += offsets[v];
+        }
+        for (size_t i = 0; i < count; i++){
+            adjacency[offsets[out[i]]++] = i / 3;
+        }
+        for (size_t v = num_vertices; v > 0; v--){
+            offsets[v] = offsets[v - 1];
+        }
+        offsets[0] = 0;
+
+        /* The cheaper direction of every edge. */
+        num_collapses = 0;
+        for (size_t i = 0; i < count; i++){
+            a = out[i];
+            b = out[i - i % 3 + (i + 1) % 3];
+            if (locked[a] && locked[b])
+                continue;
+            cost_ab = locked[a] ? HUGE_VAL : \
+                      quadric_error(quadrics + a, quadrics + b,
+                                    position_of(positions, stride, b));
+            cost_ba = locked[b] ? HUGE_VAL : \
+                      quadric_error(quadrics + a, quadrics + b,
+                                    position_of(positions, stride, a));
+            collapses[num_collapses].from = cost_ab <= cost_ba ? a : b;
+            collapses[num_collapses].to = cost_ab <= cost_ba ? b : a;
+            collapses[num_collapses++].cost = cost_ab <= cost_ba ? cost_ab
+                                                                 : cost_ba;
+        }
+        qsort(collapses, num_collapses, sizeof(Collapse), compare_collapse);
+
+        /* Each collapse removes about two triangles. */
+        budget = (count - target_index_count) / 6 + 1;
+        applied = 0;
+        memset(touched, 0, num_vertices);
+        for (size_t v = 0; v < num_vertices; v++){
+            remap[v] = v;
+        }
+        for (size_t i = 0; i < num_collapses && applied < budget; i++){
+            a = collapses[i].from;
+            b = collapses[i].to;
+            if (collapses[i].cost > max_cost)
+                break;
+            if (touched[a] || touched[b])
+                continue;
+            if (collapse_flips(a, b, out, offsets, adjacency, positions,
+                               stride))
+                continue;
+            remap[a] = b;
+            quadric_add(quadrics + b, quadrics + a);
+            worst = collapses[i].cost > worst ? collapses[i].cost : worst;
+            applied++;
+            /* Freeze the neighbourhood for the rest of the pass, so the
+             * flip test above stays valid.
+             */
+            for (unsigned int j = offsets[a]; j < offsets[a + 1]; j++){
+                triangle = out + 3 * adjacency[j];
+                for (int k = 0; k < 3; k++){
+                    touched[triangle[k]] = 1;
+                }
+            }
+            touched[b] = 1;
+        }
+        if (!applied)
+            break;
+
+        write = 0;
+        for (size_t i = 0; i < count; i += 3){
+            a = remap[out[i]];
+            b = remap[out[i + 1]];
+            v = remap[out[i + 2]];
+            if (a == b || b == v || a == v)
+                continue;
+            out[write++] = a;
+            out[write++] = b;
+            out[write++] = v;
+        }
+        count = write;
+    }
+    *out_count = count;
+    *result_error = (float)sqrt(worst);
+
+    cleanup:
+        free(quadrics);
+        free(collapses);
+        free(locked);
+        free(touched);
+        free(offsets);
+        free(adjacency);
+        free(remap);
+    return result;
+}
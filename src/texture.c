@@ -0,0 +1,471 @@
+#include <texture.h>
+
+
+static const unsigned char ktx2_identifier[12] = {
+    0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+/* Byte offsets into the KTX2 header. Everything is little endian. */
+static const size_t ktx2_vk_format_offset   = 12;
+static const size_t ktx2_width_offset       = 20;
+static const size_t ktx2_height_offset      = 24;
+static const size_t ktx2_face_count_offset  = 36;
+static const size_t ktx2_level_count_offset = 40;
+static const size_t ktx2_supercompression   = 44;
+static const size_t ktx2_level_index_offset = 80;
+static const size_t ktx2_level_entry_size   = 24;
+
+
+static uint32_t read_u32(const unsigned char * p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) \
+           | ((uint32_t)p[3] << 24);
+}
+
+
+static uint64_t read_u64(const unsigned char * p)
+{
+    return (uint64_t)read_u32(p) | ((uint64_t)read_u32(p + 4) << 32);
+}
+
+
+size_t compressed_level_size(unsigned int block_size, unsigned int width,
+                             unsigned int height)
+{
+    /* Levels smaller than a block still occupy a whole block. */
+    size_t blocks_x = (width + 3) / 4;
+    size_t blocks_y = (height + 3) / 4;
+
+    if (blocks_x < 1)
+        blocks_x = 1;
+    if (blocks_y < 1)
+        blocks_y = 1;
+    return blocks_x * blocks_y * block_size;
+}
+
+
+static texture_error_t read_blob(const char * file_name,
+                                 unsigned char ** buffer, size_t * size)
+{
+    FILE * fp;
+    long file_size;
+
+    fp = fopen(file_name, "rb");
+    if (!fp){
+        fprintf(stderr, "%s %d: Failure opening %s\n", __FILE__, __LINE__,
+                file_name);
+        return TEXTURE_FS_ERR;
+    }
+    fseek(fp, 0L, SEEK_END);
+    file_size = ftell(fp);
+    rewind(fp);
+    if (file_size <= 0){
+        fclose(fp);
+        err_print("Empty texture file");
+        return TEXTURE_FS_ERR;
+    }
+    *buffer = malloc(file_size);
+    if (!*buffer){
+        fclose(fp);
+        err_print("Out of memory");
+        return TEXTURE_NO_MEM;
+    }
+    if (fread(*buffer, file_size, 1, fp) != 1){
+        fclose(fp);
+        free(*buffer);
+        *buffer = NULL;
+        err_print("File read failure");
+        return TEXTURE_FS_ERR;
+    }
+    fclose(fp);
+    *size = file_size;
+    return TEXTURE_SUCCESS;
+}
+
+
+static texture_error_t dxgi_to_gl(uint32_t dxgi_format, GLenum * format,
+                                  unsigned int * block_size)
+{
+    switch(dxgi_format){
+        case DXGI_BC1_UNORM:
+            *format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+            *block_size = 8;
+            break;
+        case DXGI_BC1_UNORM_SRGB:
+            *format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+            *block_size = 8;
+            break;
+        case DXGI_BC3_UNORM:
+            *format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            *block_size = 16;
+            break;
+        case DXGI_BC3_UNORM_SRGB:
+            *format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+            *block_size = 16;
+            break;
+        case DXGI_BC4_UNORM:
+            *format = GL_COMPRESSED_RED_RGTC1;
+            *block_size = 8;
+            break;
+        case DXGI_BC5_UNORM:
+            *format = GL_COMPRESSED_RG_RGTC2;
+            *block_size = 16;
+            break;
+        case DXGI_BC7_UNORM:
+            *format = GL_COMPRESSED_RGBA_BPTC_UNORM;
+            *block_size = 16;
+            break;
+        case DXGI_BC7_UNORM_SRGB:
+            *format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+            *block_size = 16;
+            break;
+        default:
+            fprintf(stderr, "%s %d: Unsupported DXGI format %u\n", __FILE__,
+                    __LINE__, dxgi_format);
+            return TEXTURE_FORMAT_ERR;
+    }
+    return TEXTURE_SUCCESS;
+}
+
+
+static texture_error_t vk_to_gl(uint32_t vk_format, GLenum * format,
+                                unsigned int * block_size)
+{
+    /* VkFormat enum values, see vulkan_core.h */
+    switch(vk_format){
+        case 131: //VK_FORMAT_BC1_RGB_UNORM_BLOCK
+        case 133: //VK_FORMAT_BC1_RGBA_UNORM_BLOCK
+            return dxgi_to_gl(DXGI_BC1_UNORM, format, block_size);
+        case 132: //VK_FORMAT_BC1_RGB_SRGB_BLOCK
+        case 134: //VK_FORMAT_BC1_RGBA_SRGB_BLOCK
+            return dxgi_to_gl(DXGI_BC1_UNORM_SRGB, format, block_size);
+        case 137: //VK_FORMAT_BC3_UNORM_BLOCK
+            return dxgi_to_gl(DXGI_BC3_UNORM, format, block_size);
+        case 138: //VK_FORMAT_BC3_SRGB_BLOCK
+            return dxgi_to_gl(DXGI_BC3_UNORM_SRGB, format, block_size);
+        case 139: //VK_FORMAT_BC4_UNORM_BLOCK
+            return dxgi_to_gl(DXGI_BC4_UNORM, format, block_size);
+        case 141: //VK_FORMAT_BC5_UNORM_BLOCK
+            return dxgi_to_gl(DXGI_BC5_UNORM, format, block_size);
+        case 145: //VK_FORMAT_BC7_UNORM_BLOCK
+            return dxgi_to_gl(DXGI_BC7_UNORM, format, block_size);
+        case 146: //VK_FORMAT_BC7_SRGB_BLOCK
+            return dxgi_to_gl(DXGI_BC7_UNORM_SRGB, format, block_size);
+        case 147: //VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK
+            *format = GL_COMPRESSED_RGB8_ETC2;
+            *block_size = 8;
+            return TEXTURE_SUCCESS;
+        case 148: //VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK
+            *format = GL_COMPRESSED_SRGB8_ETC2;
+            *block_size = 8;
+            return TEXTURE_SUCCESS;
+        case 151: //VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK
+            *format = GL_COMPRESSED_RGBA8_ETC2_EAC;
+            *block_size = 16;
+            return TEXTURE_SUCCESS;
+        case 152: //VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK
+            *format = GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC;
+            *block_size = 16;
+            return TEXTURE_SUCCESS;
+        default:
+            fprintf(stderr, "%s %d: Unsupported VkFormat %u\n", __FILE__,
+                    __LINE__, vk_format);
+            return TEXTURE_FORMAT_ERR;
+    }
+}
+
+
+static texture_error_t parse_dds(Compressed_Image * out)
+{
+    Dds_Header header;
+    Dds_Header_DX10 header_dx10;
+    size_t offset = sizeof(uint32_t) + sizeof(Dds_Header);
+    uint32_t dxgi_format;
+    unsigned int width, height;
+    texture_error_t result;
+
+    if (out->blob_size < offset){
+        err_print("DDS file truncated");
+        return TEXTURE_FORMAT_ERR;
+    }
+    memcpy(&header, out->blob + sizeof(uint32_t), sizeof(Dds_Header));
+    if (header.size != sizeof(Dds_Header) || \
+        !(header.pixel_format.flags & DDPF_FOURCC))
+    {
+        err_print("Only block compressed DDS files are supported");
+        return TEXTURE_FORMAT_ERR;
+    }
+    switch(header.pixel_format.four_cc){
+        case DDS_FOURCC('D', 'X', '1', '0'):
+            if (out->blob_size < offset + sizeof(Dds_Header_DX10)){
+                err_print("DDS file truncated");
+                return TEXTURE_FORMAT_ERR;
+            }
+            memcpy(&header_dx10, out->blob + offset, sizeof(Dds_Header_DX10));
+            offset += sizeof(Dds_Header_DX10);
+            if (header_dx10.resource_dimension != DDS_DIMENSION_TEXTURE2D || \
+                header_dx10.array_size > 1)
+            {
+                err_print("Only single 2D DDS textures are supported");
+                return TEXTURE_FORMAT_ERR;
+            }
+            dxgi_format = header_dx10.dxgi_format;
+            break;
+        case DDS_FOURCC('D', 'X', 'T', '1'):
+            dxgi_format = DXGI_BC1_UNORM;
+            break;
+        case DDS_FOURCC('D', 'X', 'T', '5'):
+            dxgi_format = DXGI_BC3_UNORM;
+            break;
+        case DDS_FOURCC('A', 'T', 'I', '1'):
+        case DDS_FOURCC('B', 'C', '4', 'U'):
+            dxgi_format = DXGI_BC4_UNORM;
+            break;
+        case DDS_FOURCC('A', 'T', 'I', '2'):
+        case DDS_FOURCC('B', 'C', '5', 'U'):
+            dxgi_format = DXGI_BC5_UNORM;
+            break;
+        default:
+            err_print("Unsupported DDS FourCC");
+            return TEXTURE_FORMAT_ERR;
+    }
+    result = dxgi_to_gl(dxgi_format, &out->internal_format, &out->block_size);
+    if (result){
+        return result;
+    }
+    out->width = header.width;
+    out->height = header.height;
+    out->num_levels = (header.flags & DDSD_MIPMAPCOUNT) ? \
+                      header.mip_map_count : 1;
+    if (out->num_levels < 1)
+        out->num_levels = 1;
+    if (out->num_levels > TEXTURE_MAX_LEVELS){
+        err_print("Too many mip levels in DDS file");
+        return TEXTURE_FORMAT_ERR;
+    }
+    /* Levels are stored back to back, largest first. */
+    width = out->width;
+    height = out->height;
+    for (unsigned int i = 0; i < out->num_levels; i++){
+        out->levels[i].width = width;
+        out->levels[i].height = height;
+        out->levels[i].size = compressed_level_size(out->block_size, width,
+                                                    height);
+        if (offset + out->levels[i].size > out->blob_size){
+            err_print("DDS file truncated");
+            return TEXTURE_FORMAT_ERR;
+        }
+        out->levels[i].data = out->blob + offset;
+        offset += out->levels[i].size;
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+    return TEXTURE_SUCCESS;
+}
+
+
+static texture_error_t parse_ktx2(Compressed_Image * out)
+{
+    const unsigned char * blob = out->blob;
+    const unsigned char * entry;
+    unsigned int width, height;
+    uint64_t level_offset, level_size;
+    texture_error_t result;
+
+    if (out->blob_size < ktx2_level_index_offset){
+        err_print("KTX2 file truncated");
+        return TEXTURE_FORMAT_ERR;
+    }
+    if (read_u32(blob + ktx2_supercompression) != 0){
+        err_print("Supercompressed KTX2 files are not supported");
+        return TEXTURE_FORMAT_ERR;
+    }
+    if (read_u32(blob + ktx2_face_count_offset) != 1){
+        err_print("Only single face KTX2 files are supported");
+        return TEXTURE_FORMAT_ERR;
+    }
+    result = vk_to_gl(read_u32(blob + ktx2_vk_format_offset),
+                      &out->internal_format, &out->block_size);
+    if (result){
+        return result;
+    }
+    out->width = read_u32(blob + ktx2_width_offset);
+    out->height = read_u32(blob + ktx2_height_offset);
+    out->num_levels = read_u32(blob + ktx2_level_count_offset);
+    if (out->num_levels < 1)
+        out->num_levels = 1;
+    if (out->num_levels > TEXTURE_MAX_LEVELS || \
+        out->blob_size < ktx2_level_index_offset + \
+                         out->num_levels * ktx2_level_entry_size)
+    {
+        err_print("Bad KTX2 level index");
+        return TEXTURE_FORMAT_ERR;
+    }
+    /* Unlike DDS the level index gives explicit offsets, base level first
+     * even though the data itself is stored smallest level first.
+     */
+    width = out->width;
+    height = out->height;
+    for (unsigned int i = 0; i < out->num_levels; i++){
+        entry = blob + ktx2_level_index_offset + i * ktx2_level_entry_size;
+        level_offset = read_u64(entry);
+        level_size = read_u64(entry + 8);
+        if (level_offset + level_size > out->blob_size || \
+            level_size != compressed_level_size(out->block_size, width,
+                                                height))
+        {
+            err_print("Bad KTX2 level");
+            return TEXTURE_FORMAT_ERR;
+        }
+        out->levels[i].width = width;
+        out->levels[i].height = height;
+        out->levels[i].size = level_size;
+        out->levels[i].data = out->blob + level_offset;
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+    return TEXTURE_SUCCESS;
+}
+
+
+texture_error_t compressed_image_load(const char * file_name,
+                                      Compressed_Image * out)
+{
+    texture_error_t result;
+
+    memset(out, 0, sizeof(Compressed_Image));
+    result = read_blob(file_name, &out->blob, &out->blob_size);
+    if (result){
+        return result;
+    }
+    if (out->blob_size >= sizeof(ktx2_identifier) && \
+        memcmp(out->blob, ktx2_identifier, sizeof(ktx2_identifier)) == 0)
+    {
+        result = parse_ktx2(out);
+    } else if (out->blob_size >= sizeof(uint32_t) && \
+               read_u32(out->blob) == DDS_MAGIC)
+    {
+        result = parse_dds(out);
+    } else{
+        fprintf(stderr, "%s %d: %s is neither DDS nor KTX2\n", __FILE__,
+                __LINE__, file_name);
+        result = TEXTURE_FORMAT_ERR;
+    }
+    if (result){
+        compressed_image_free(out);
+    }
+    return result;
+}
+
+
+texture_error_t compressed_image_upload(Compressed_Image * image,
+                                        unsigned int * texture_id)
+{
+    /* A texture name passed in is reused, otherwise one is generated. */
+    texture_error_t result = TEXTURE_SUCCESS;
+    Texture_Level * level;
+
+    if (!*texture_id){
+        glGenTextures(1, texture_id);
+    }
+    glBindTexture(GL_TEXTURE_2D, *texture_id);
+    for (unsigned int i = 0; i < image->num_levels; i++){
+        level = image->levels + i;
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, image->internal_format,
+                               level->width, level->height, 0, level->size,
+                               level->data);
+    }
+    /* Files need not carry the full chain down to 1x1. Clamping the max
+     * level keeps the texture complete with whatever levels we were given.
+     */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    image->num_levels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    image->num_levels > 1 ? GL_LINEAR_MIPMAP_LINEAR \
+                                          : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (glGetError() != GL_NO_ERROR){
+        err_print("GL error uploading compressed texture");
+        glDeleteTextures(1, texture_id);
+        *texture_id = 0;
+        result = TEXTURE_GL_ERR;
+    }
+    return result;
+}
+
+
+void compressed_image_free(Compressed_Image * image)
+{
+    if (image->blob){
+        free(image->blob);
+        image->blob = NULL;
+    }
+    image->blob_size = 0;
+    image->num_levels = 0;
+}
+
+
+texture_error_t compressed_texture_from_file(const char * file_name,
+                                             unsigned int * texture_id)
+{
+    Compressed_Image image;
+    texture_error_t result;
+
+    *texture_id = 0;
+    result = compressed_image_load(file_name, &image);
+    if (result){
+        return result;
+    }
+    result = compressed_image_upload(&image, texture_id);
+    compressed_image_free(&image);
+    return result;
+}
+
+
+int texture_is_compressed_file(const char * file_name)
+{
+    const char * extension = strrchr(file_name, '.');
+
+    if (!extension)
+        return 0;
+    return strcmp(extension, ".dds") == 0 || strcmp(extension, ".ktx2") == 0;
+}
+
+
+int compressed_texture_path(const char * file_name, char * out,
+                            int max_length)
+{
+    /* Looks for a pre-compressed sibling of an image file, ie.
+     * models/backpack/diffuse.jpg -> models/backpack/diffuse.ktx2 or
+     * models/backpack/diffuse.dds. Returns 1 and fills out if one exists.
+     */
+    const char * extensions[] = {".ktx2", ".dds"};
+    const char * dot = strrchr(file_name, '.');
+    const char * slash = strrchr(file_name, '/');
+    int stem_length;
+    int string_length;
+    FILE * fp;
+
+    if (!dot || (slash && dot < slash)){
+        stem_length = strlen(file_name);
+    } else{
+        stem_length = dot - file_name;
+    }
+    for (int i = 0; i < 2; i++){
+        string_length = snprintf(out, max_length, "%.*s%s", stem_length,
+                                 file_name, extensions[i]);
+        if (string_length >= max_length || string_length < 0){
+            err_print("snprintf error");
+            return 0;
+        }
+        fp = fopen(out, "rb");
+        if (fp){
+            fclose(fp);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,550 @@
+#include <texture_stream.h>
+#include <math.h>
+#include <string.h>
+
+
+/* Texture streaming for models loaded with load_model_deferred.
+ *
+ * Every texture starts out with only its tail resident (the levels no
+ * larger than TEXTURE_STREAM_TAIL_SIZE). Each frame the application
+ * reports how large a model is on screen, which sets the finest level its
+ * textures need. texture_stream_update then decodes finer levels on the
+ * job pool while they fit the budget, and when over it, drops levels from
+ * the textures used least recently. Uploads per update are capped so a
+ * burst of finished decodes can't stall a frame.
+ *
+ * Changing the resident range means building a new GL texture. Without
+ * sparse textures (GL 4.4) that is the only way storage is actually given
+ * back to the driver.
+ */
+
+#define DEFAULT_UPLOAD_LIMIT (8 << 20)
+
+
+static int tail_level(int width, int height, int num_levels)
+{
+    int level = 0;
+
+    while (level < num_levels - 1 && \
+           ((width >> level) > TEXTURE_STREAM_TAIL_SIZE || \
+            (height >> level) > TEXTURE_STREAM_TAIL_SIZE))
+    {
+        level++;
+    }
+    return level;
+}
+
+
+static size_t level_bytes(const Stream_Texture * texture, int level)
+{
+    unsigned int width = texture->width >> level;
+    unsigned int height = texture->height >> level;
+
+    width = width ? width : 1;
+    height = height ? height : 1;
+    if (texture->block_size){
+        return compressed_level_size(texture->block_size, width, height);
+    }
+    return (size_t)width * height * texture->texel_bytes;
+}
+
+
+static size_t range_bytes(const Stream_Texture * texture, int base)
+{
+    /* Bytes taken by levels base .. num_levels - 1. */
+    size_t total = 0;
+
+    for (int i = base; i < texture->num_levels; i++){
+        total += level_bytes(texture, i);
+    }
+    return total;
+}
+
+
+static void stream_decode(void * arg)
+{
+    /* Runs on the job pool. The main thread leaves the request and the
+     * source alone until the job is done, and only the request fields
+     * below base are written here.
+     */
+    Stream_Texture * texture = arg;
+    Stream_Request * request = &texture->request;
+    Texture_Image * source = &texture->source;
+
+    if (request->decode){
+        texture_image_decode(source);
+    }
+    request->image = *source;
+    /* id 0 has the upload create a fresh texture. */
+    request->image.id = 0;
+    if (source->result){
+        return;
+    }
+    if (source->compressed){
+        request->width = source->compressed_image.width;
+        request->height = source->compressed_image.height;
+        request->num_levels = source->compressed_image.num_levels;
+        request->block_size = source->compressed_image.block_size;
+        request->texel_bytes = 0;
+    } else{
+        request->width = source->width;
+        request->height = source->height;
+        request->num_levels = source->chain.num_levels;
+        request->block_size = 0;
+        /* Drivers pad RGB out to RGBA. */
+        request->texel_bytes = source->channels == 3 ? 4 : source->channels;
+    }
+    request->level = request->base;
+    if (request->level < 0){
+        request->level = tail_level(request->width, request->height,
+                                    request->num_levels);
+    }
+    if (request->level > request->num_levels - 1){
+        request->level = request->num_levels - 1;
+    }
+    texture_image_drop_levels(&request->image, request->level);
+}
+
+
+static void release_source(Stream_Texture * texture)
+{
+    if (!texture->source_ready)
+        return;
+    memstat_add(&texture->model->memory, MEMSTAT_CPU, MEMSTAT_TEXTURE,
+                -(long long)texture_image_bytes(&texture->source));
+    texture_image_free(&texture->source);
+    texture->source_ready = 0;
+}
+
+
+static texture_stream_error_t start_request(Texture_Streamer * streamer,
+                                            Stream_Texture * texture, int base)
+{
+    Stream_Request * request = &texture->request;
+
+    request->decode = !texture->source_ready;
+    if (request->decode){
+        memset(&texture->source, 0, sizeof(Texture_Image));
+        texture->source.path = texture->path;
+        texture->source.type = texture->type;
+    }
+    request->base = base;
+    request->active = 1;
+    job_group_init(&request->group);
+    streamer->in_flight++;
+    if (job_pool_submit(streamer->pool, &request->group, stream_decode,
+                        texture))
+    {
+        request->active = 0;
+        streamer->in_flight--;
+        return TEXTURE_STREAM_NO_MEM;
+    }
+    return TEXTURE_STREAM_SUCCESS;
+}
+
+
+static size_t finish_request(Texture_Streamer * streamer,
+                             Stream_Texture * texture)
+{
+    /* Uploads a finished decode and swaps it in. Returns the bytes
+     * uploaded.
+     */
+    Stream_Request * request = &texture->request;
+    size_t old_bytes, new_bytes = 0;
+    unsigned int old_id;
+
+    request->active = 0;
+    streamer->in_flight--;
+    if (request->image.result){
+        fprintf(stderr, "%s %d: Failed to stream %s\n", __FILE__, __LINE__,
+                texture->path);
+        if (request->decode){
+            texture_image_free(&texture->source);
+        }
+        return 0;
+    }
+    if (request->decode){
+        texture->source_ready = 1;
+        memstat_add(&texture->model->memory, MEMSTAT_CPU, MEMSTAT_TEXTURE,
+                    (long long)texture_image_bytes(&texture->source));
+    }
+    old_bytes = range_bytes(texture, texture->resident_base);
+    if (!texture->num_levels){
+        texture->width = request->width;
+        texture->height = request->height;
+        texture->num_levels = request->num_levels;
+        texture->block_size = request->block_size;
+        texture->texel_bytes = request->texel_bytes;
+        texture->wanted = request->level;
+        old_bytes = 0;
+    }
+    if (texture_image_upload(&request->image)){
+        fprintf(stderr, "%s %d: Failed to upload %s\n", __FILE__, __LINE__,
+                texture->path);
+        if (request->image.id){
+            glDeleteTextures(1, &request->image.id);
+        }
+        return 0;
+    }
+    new_bytes = range_bytes(texture, request->level);
+    old_id = texture->id;
+    texture->id = request->image.id;
+    for (int i = 0; i < texture->num_slots; i++){
+        *texture->slots[i] = texture->id;
+    }
+    if (old_id){
+        glDeleteTextures(1, &old_id);
+    }
+    streamer->resident += new_bytes;
+    streamer->resident -= old_bytes;
+    memstat_add(&texture->model->memory, MEMSTAT_GPU, MEMSTAT_TEXTURE,
+                (long long)new_bytes - (long long)old_bytes);
+    texture->resident_base = request->level;
+    if (texture->resident_base >= tail_level(texture->width, texture->height,
+                                             texture->num_levels))
+    {
+        release_source(texture);
+    }
+    return new_bytes;
+}
+
+
+texture_stream_error_t texture_stream_init(Texture_Streamer * streamer,
+                                           size_t budget)
+{
+    memset(streamer, 0, sizeof(Texture_Streamer));
+    streamer->pool = job_pool_default();
+    streamer->budget = budget;
+    streamer->upload_limit = DEFAULT_UPLOAD_LIMIT;
+    streamer->max_in_flight = streamer->pool ? \
+                              streamer->pool->num_threads + 1 : 1;
+    return TEXTURE_STREAM_SUCCESS;
+}
+
+
+void texture_stream_destroy(Texture_Streamer * streamer)
+{
+    /* Call this before free_model on any model that was added, the
+     * streamer holds pointers into the model's meshes.
+     */
+    Stream_Texture * texture;
+
+    for (int i = 0; i < streamer->num_textures; i++){
+        texture = streamer->textures[i];
+        if (texture->request.active){
+            job_group_wait(streamer->pool, &texture->request.group);
+            if (texture->request.decode){
+                texture_image_free(&texture->source);
+            }
+        }
+        release_source(texture);
+        for (int j = 0; j < texture->num_slots; j++){
+            *texture->slots[j] = 0;
+        }
+        if (texture->id){
+            glDeleteTextures(1, &texture->id);
+            memstat_add(&texture->model->memory, MEMSTAT_GPU,
+                        MEMSTAT_TEXTURE,
+                        -(long long)range_bytes(texture,
+                                                texture->resident_base));
+        }
+        free(texture->slots);
+        free(texture);
+    }
+    free(streamer->textures);
+    free(streamer->scratch);
+    memset(streamer, 0, sizeof(Texture_Streamer));
+}
+
+
+static texture_stream_error_t add_slot(Stream_Texture * texture,
+                                       unsigned int * slot)
+{
+    unsigned int ** slots;
+
+    slots = realloc(texture->slots,
+                    (texture->num_slots + 1) * sizeof(unsigned int *));
+    if (!slots){
+        err_print("Out of memory");
+        return TEXTURE_STREAM_NO_MEM;
+    }
+    texture->slots = slots;
+    texture->slots[texture->num_slots++] = slot;
+    return TEXTURE_STREAM_SUCCESS;
+}
+
+
+static texture_stream_error_t append_texture(Texture_Streamer * streamer,
+                                             Stream_Texture * texture)
+{
+    Stream_Texture ** textures;
+    Stream_Texture ** scratch;
+    int capacity;
+
+    if (streamer->num_textures == streamer->capacity){
+        capacity = streamer->capacity ? 2 * streamer->capacity : 16;
+        textures = realloc(streamer->textures,
+                           capacity * sizeof(Stream_Texture *));
+        if (!textures){
+            err_print("Out of memory");
+            return TEXTURE_STREAM_NO_MEM;
+        }
+        streamer->textures = textures;
+        scratch = realloc(streamer->scratch,
+                          capacity * sizeof(Stream_Texture *));
+        if (!scratch){
+            err_print("Out of memory");
+            return TEXTURE_STREAM_NO_MEM;
+        }
+        streamer->scratch = scratch;
+        streamer->capacity = capacity;
+    }
+    streamer->textures[streamer->num_textures++] = texture;
+    return TEXTURE_STREAM_SUCCESS;
+}
+
+
+texture_stream_error_t texture_stream_add_model(Texture_Streamer * streamer,
+                                                Model * model)
+{
+    /* The model must come from load_model_deferred. Its pending textures
+     * are taken over and their tails loaded before this returns, so the
+     * model can be drawn straight away.
+     */
+    texture_stream_error_t result = TEXTURE_STREAM_SUCCESS;
+    Stream_Texture * texture;
+    Texture_Node * node;
+    Mesh * mesh;
+    int first = streamer->num_textures;
+
+    for (node = model->loaded_textures; node; node = node->next){
+        if (!node->image)
+            continue;
+        texture = calloc(1, sizeof(Stream_Texture));
+        if (!texture){
+            err_print("Out of memory");
+            return TEXTURE_STREAM_NO_MEM;
+        }
+        texture->path = node->texture.path;
+        texture->type = node->texture.type;
+        texture->model = model;
+        texture->id = node->texture.id;
+        result = add_slot(texture, &node->texture.id);
+        for (unsigned int i = 0; i < model->num_meshes && !result; i++){
+            mesh = model->meshes + i;
+            for (unsigned int j = 0; j < mesh->num_textures && !result; j++){
+                if (mesh->textures[j].id == texture->id){
+                    result = add_slot(texture, &mesh->textures[j].id);
+                }
+            }
+        }
+        if (result || append_texture(streamer, texture)){
+            free(texture->slots);
+            free(texture);
+            return TEXTURE_STREAM_NO_MEM;
+        }
+        free(node->image);
+        node->image = NULL;
+        start_request(streamer, texture, -1);
+    }
+    for (int i = first; i < streamer->num_textures; i++){
+        texture = streamer->textures[i];
+        if (!texture->request.active)
+            continue;
+        job_group_wait(streamer->pool, &texture->request.group);
+        finish_request(streamer, texture);
+        if (!texture->num_levels){
+            result = TEXTURE_STREAM_ERR;
+        }
+    }
+    return result;
+}
+
+
+void texture_stream_request_model(Texture_Streamer * streamer,
+                                  const Model * model, float screen_size)
+{
+    /* screen_size is the model's extent on screen in pixels, see
+     * texture_stream_screen_size. A texture spread across that many
+     * pixels needs roughly the level whose size matches it.
+     */
+    Stream_Texture * texture;
+    int level, size, tail;
+
+    for (int i = 0; i < streamer->num_textures; i++){
+        texture = streamer->textures[i];
+        if (texture->model != model || !texture->num_levels)
+            continue;
+        tail = tail_level(texture->width, texture->height,
+                          texture->num_levels);
+        size = texture->width > texture->height ? texture->width \
+                                                : texture->height;
+        if (screen_size < 1.f){
+            level = tail;
+        } else{
+            level = (int)floorf(log2f(size / screen_size)) + \
+                    streamer->lod_bias;
+        }
+        if (level < 0)
+            level = 0;
+        if (level > tail)
+            level = tail;
+        if (level < texture->wanted)
+            texture->wanted = level;
+        texture->last_used = streamer->frame;
+    }
+}
+
+
+static int compare_least_recent(const void * a, const void * b)
+{
+    const Stream_Texture * x = *(Stream_Texture * const *)a;
+    const Stream_Texture * y = *(Stream_Texture * const *)b;
+
+    if (x->last_used != y->last_used)
+        return x->last_used < y->last_used ? -1 : 1;
+    return x->resident_base - y->resident_base;
+}
+
+
+static int compare_most_starved(const void * a, const void * b)
+{
+    const Stream_Texture * x = *(Stream_Texture * const *)a;
+    const Stream_Texture * y = *(Stream_Texture * const *)b;
+
+    return (y->resident_base - y->wanted) - (x->resident_base - x->wanted);
+}
+
+
+static size_t evict(Texture_Streamer * streamer, size_t committed)
+{
+    /* Drops levels, least recently used first, until the committed bytes
+     * fit the budget. Textures needing their current levels this frame
+     * are left alone, promotion never lets those exceed the budget.
+     */
+    Stream_Texture * texture;
+    int count = 0, tail, base;
+
+    for (int i = 0; i < streamer->num_textures; i++){
+        texture = streamer->textures[i];
+        if (texture->request.active || !texture->num_levels)
+            continue;
+        tail = tail_level(texture->width, texture->height,
+                          texture->num_levels);
+        if (texture->resident_base >= tail)
+            continue;
+        if (texture->last_used == streamer->frame && \
+            texture->wanted <= texture->resident_base)
+            continue;
+        streamer->scratch[count++] = texture;
+    }
+    qsort(streamer->scratch, count, sizeof(Stream_Texture *),
+          compare_least_recent);
+    for (int i = 0; i < count && committed > streamer->budget; i++){
+        if (streamer->in_flight >= streamer->max_in_flight)
+            break;
+        texture = streamer->scratch[i];
+        tail = tail_level(texture->width, texture->height,
+                          texture->num_levels);
+        base = texture->wanted > texture->resident_base ? texture->wanted \
+               : texture->resident_base + 1;
+        if (base > tail)
+            base = tail;
+        if (start_request(streamer, texture, base))
+            break;
+        committed -= range_bytes(texture, texture->resident_base) - \
+                     range_bytes(texture, base);
+    }
+    return committed;
+}
+
+
+static void promote(Texture_Streamer * streamer, size_t committed)
+{
+    Stream_Texture * texture;
+    size_t current, needed = 0;
+    int count = 0, base;
+
+    for (int i = 0; i < streamer->num_textures; i++){
+        texture = streamer->textures[i];
+        if (texture->request.active || !texture->num_levels)
+            continue;
+        if (texture->last_used != streamer->frame || \
+            texture->wanted >= texture->resident_base)
+            continue;
+        streamer->scratch[count++] = texture;
+    }
+    qsort(streamer->scratch, count, sizeof(Stream_Texture *),
+          compare_most_starved);
+    for (int i = 0; i < count; i++){
+        if (streamer->in_flight >= streamer->max_in_flight)
+            break;
+        texture = streamer->scratch[i];
+        current = range_bytes(texture, texture->resident_base);
+        /* Finest level between wanted and what we have that still fits. */
+        for (base = texture->wanted; base < texture->resident_base; base++){
+            needed = range_bytes(texture, base) - current;
+            if (committed + needed <= streamer->budget)
+                break;
+        }
+        if (base == texture->resident_base)
+            continue;
+        if (start_request(streamer, texture, base))
+            break;
+        committed += needed;
+    }
+}
+
+
+void texture_stream_update(Texture_Streamer * streamer)
+{
+    /* Call once per frame on the GL thread, after the frame's requests. */
+    Stream_Texture * texture;
+    Stream_Request * request;
+    size_t uploaded = 0, committed;
+
+    for (int i = 0; i < streamer->num_textures; i++){
+        texture = streamer->textures[i];
+        if (!texture->request.active)
+            continue;
+        if (uploaded >= streamer->upload_limit)
+            break;
+        if (job_group_done(streamer->pool, &texture->request.group)){
+            uploaded += finish_request(streamer, texture);
+        }
+    }
+
+    committed = streamer->resident;
+    for (int i = 0; i < streamer->num_textures; i++){
+        texture = streamer->textures[i];
+        request = &texture->request;
+        if (request->active && request->base >= 0){
+            committed += range_bytes(texture, request->base);
+            committed -= range_bytes(texture, texture->resident_base);
+        }
+    }
+    if (committed > streamer->budget){
+        committed = evict(streamer, committed);
+    }
+    promote(streamer, committed);
+
+    for (int i = 0; i < streamer->num_textures; i++){
+        texture = streamer->textures[i];
+        texture->wanted = tail_level(texture->width, texture->height,
+                                     texture->num_levels);
+    }
+    streamer->frame++;
+}
+
+
+float texture_stream_screen_size(float radius, float distance, float fov_y,
+                                 int viewport_height)
+{
+    /* Pixel diameter of a bounding sphere under a perspective projection
+     * with vertical field of view fov_y (radians).
+     */
+    if (distance <= radius){
+        return (float)viewport_height;
+    }
+    return viewport_height * radius / (distance * tanf(0.5f * fov_y));
+}
@@ -0,0 +1,562 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#include <texture.h>
+#include <mipmap.h>
+
+
+/* Offline block compressor for the jpg/png assets used by the chapters.
+ * Writes a DDS (DX10 header) with the full mip chain next to the source
+ * image, which texture_from_file in model.c then picks up instead of the
+ * original.
+ *
+ * Usage: texture_compress [-f bc1|bc3|bc5|bc7] [-l] input [output]
+ *   -f  block format. Defaults to bc5 for files named *normal* and bc7
+ *       for everything else.
+ *   -l  treat the input as linear data (specular, roughness, ...). By
+ *       default colour formats are tagged sRGB and mips are filtered in
+ *       linear light, as model.c does for diffuse maps. BC5 is always
+ *       linear.
+ */
+
+
+#define SUCCESS 0;
+#define FAILURE 1;
+
+
+typedef enum {
+    FORMAT_BC1,
+    FORMAT_BC3,
+    FORMAT_BC5,
+    FORMAT_BC7,
+} block_format_t;
+
+
+struct Image {
+    int             width;
+    int             height;
+    unsigned char * rgba;
+};
+typedef struct Image Image;
+
+
+static const int bc7_weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30,
+                                     34, 38, 43, 47, 51, 55, 60, 64};
+
+
+static void put_bits(unsigned char * block, int * position, uint32_t value,
+                     int count)
+{
+    /* Block formats are packed least significant bit first. */
+    for (int i = 0; i < count; i++){
+        if (value & (1u << i)){
+            block[*position / 8] |= 1u << (*position % 8);
+        }
+        (*position)++;
+    }
+}
+
+
+static int squared_distance(const int * a, const int * b, int channels)
+{
+    int sum = 0;
+    for (int i = 0; i < channels; i++){
+        sum += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return sum;
+}
+
+
+static void principal_extremes(int pixels[16][4], int channels,
+                               float low[4], float high[4])
+{
+    /* Endpoints are the extremes of the block projected onto its principal
+     * axis (a few rounds of power iteration on the covariance), inset
+     * slightly since the extremes are rarely hit exactly.
+     */
+    float mean[4] = {0.f, 0.f, 0.f, 0.f};
+    float covariance[4][4] = {{0.f}};
+    float axis[4] = {1.f, 1.f, 1.f, 1.f};
+    float next[4];
+    float t, t_min = 1e30f, t_max = -1e30f, length, inset;
+    int c, k;
+
+    for (int i = 0; i < 16; i++)
+        for (c = 0; c < channels; c++)
+            mean[c] += pixels[i][c] / 16.f;
+    for (int i = 0; i < 16; i++)
+        for (c = 0; c < channels; c++)
+            for (k = 0; k < channels; k++)
+                covariance[c][k] += (pixels[i][c] - mean[c]) * \
+                                    (pixels[i][k] - mean[k]);
+    for (int iteration = 0; iteration < 8; iteration++){
+        length = 0.f;
+        for (c = 0; c < channels; c++){
+            next[c] = 0.f;
+            for (k = 0; k < channels; k++)
+                next[c] += covariance[c][k] * axis[k];
+            length += next[c] * next[c];
+        }
+        if (length < 1e-12f)
+            break;
+        length = sqrtf(length);
+        for (c = 0; c < channels; c++)
+            axis[c] = next[c] / length;
+    }
+    for (int i = 0; i < 16; i++){
+        t = 0.f;
+        for (c = 0; c < channels; c++)
+            t += (pixels[i][c] - mean[c]) * axis[c];
+        t_min = t < t_min ? t : t_min;
+        t_max = t > t_max ? t : t_max;
+    }
+    inset = (t_max - t_min) / 32.f;
+    t_min += inset;
+    t_max -= inset;
+    for (c = 0; c < channels; c++){
+        low[c] = fminf(fmaxf(mean[c] + t_min * axis[c], 0.f), 255.f);
+        high[c] = fminf(fmaxf(mean[c] + t_max * axis[c], 0.f), 255.f);
+    }
+}
+
+
+static uint16_t pack_565(const float color[4])
+{
+    int r = (int)(color[0] * 31.f / 255.f + 0.5f);
+    int g = (int)(color[1] * 63.f / 255.f + 0.5f);
+    int b = (int)(color[2] * 31.f / 255.f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+
+static void unpack_565(uint16_t packed, int color[4])
+{
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+    color[3] = 255;
+}
+
+
+static void encode_bc1(int pixels[16][4], unsigned char * block)
+{
+    float low[4], high[4];
+    uint16_t color0, color1, swap;
+    int palette[4][4];
+    uint32_t indices = 0;
+    int best, distance, best_distance;
+
+    principal_extremes(pixels, 3, low, high);
+    color0 = pack_565(high);
+    color1 = pack_565(low);
+    if (color0 < color1){
+        swap = color0;
+        color0 = color1;
+        color1 = swap;
+    }
+    /* color0 > color1 selects the four colour (opaque) mode. */
+    unpack_565(color0, palette[0]);
+    unpack_565(color1, palette[1]);
+    for (int c = 0; c < 3; c++){
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    if (color0 != color1){
+        for (int i = 0; i < 16; i++){
+            best = 0;
+            best_distance = squared_distance(pixels[i], palette[0], 3);
+            for (int j = 1; j < 4; j++){
+                distance = squared_distance(pixels[i], palette[j], 3);
+                if (distance < best_distance){
+                    best_distance = distance;
+                    best = j;
+                }
+            }
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+    block[0] = color0 & 0xFF;
+    block[1] = color0 >> 8;
+    block[2] = color1 & 0xFF;
+    block[3] = color1 >> 8;
+    for (int i = 0; i < 4; i++){
+        block[4 + i] = (indices >> (8 * i)) & 0xFF;
+    }
+}
+
+
+static void encode_bc4(int pixels[16][4], int channel, unsigned char * block)
+{
+    int low = 255, high = 0;
+    int palette[8];
+    int best, distance, best_distance;
+    int position = 16;
+
+    for (int i = 0; i < 16; i++){
+        low = pixels[i][channel] < low ? pixels[i][channel] : low;
+        high = pixels[i][channel] > high ? pixels[i][channel] : high;
+    }
+    memset(block, 0, 8);
+    /* endpoint0 > endpoint1 selects the eight value mode. */
+    block[0] = high;
+    block[1] = low;
+    if (high == low){
+        return;
+    }
+    palette[0] = high;
+    palette[1] = low;
+    for (int i = 1; i < 7; i++){
+        palette[i + 1] = ((7 - i) * high + i * low + 3) / 7;
+    }
+    for (int i = 0; i < 16; i++){
+        best = 0;
+        best_distance = abs(pixels[i][channel] - palette[0]);
+        for (int j = 1; j < 8; j++){
+            distance = abs(pixels[i][channel] - palette[j]);
+            if (distance < best_distance){
+                best_distance = distance;
+                best = j;
+            }
+        }
+        put_bits(block, &position, best, 3);
+    }
+}
+
+
+static int bc7_quantize_endpoint(const float endpoint[4], int quantized[4])
+{
+    /* Mode 6 endpoints are 7 bits per channel plus a shared p-bit.
+     * Try both p-bits and keep whichever reconstructs closest.
+     */
+    int best_p = 0;
+    float best_error = 1e30f, error, value;
+    int candidate[4];
+
+    for (int p = 0; p < 2; p++){
+        error = 0.f;
+        for (int c = 0; c < 4; c++){
+            candidate[c] = (int)((endpoint[c] - p) / 2.f + 0.5f);
+            candidate[c] = candidate[c] < 0 ? 0 : \
+                           (candidate[c] > 127 ? 127 : candidate[c]);
+            value = (float)((candidate[c] << 1) | p) - endpoint[c];
+            error += value * value;
+        }
+        if (error < best_error){
+            best_error = error;
+            best_p = p;
+            memcpy(quantized, candidate, sizeof(candidate));
+        }
+    }
+    return best_p;
+}
+
+
+static void encode_bc7(int pixels[16][4], unsigned char * block)
+{
+    float low[4], high[4];
+    int e0[4], e1[4], full0[4], full1[4], swap[4];
+    int p0, p1, swap_p;
+    int palette[16][4];
+    int indices[16];
+    int best, distance, best_distance;
+    int position = 0;
+
+    principal_extremes(pixels, 4, low, high);
+    p0 = bc7_quantize_endpoint(low, e0);
+    p1 = bc7_quantize_endpoint(high, e1);
+    for (int pass = 0; pass < 2; pass++){
+        for (int c = 0; c < 4; c++){
+            full0[c] = (e0[c] << 1) | p0;
+            full1[c] = (e1[c] << 1) | p1;
+        }
+        for (int j = 0; j < 16; j++){
+            for (int c = 0; c < 4; c++){
+                palette[j][c] = ((64 - bc7_weights4[j]) * full0[c] + \
+                                 bc7_weights4[j] * full1[c] + 32) >> 6;
+            }
+        }
+        for (int i = 0; i < 16; i++){
+            best = 0;
+            best_distance = squared_distance(pixels[i], palette[0], 4);
+            for (int j = 1; j < 16; j++){
+                distance = squared_distance(pixels[i], palette[j], 4);
+                if (distance < best_distance){
+                    best_distance = distance;
+                    best = j;
+                }
+            }
+            indices[i] = best;
+        }
+        /* The anchor (first) index is stored with an implicit zero MSB. */
+        if (indices[0] < 8)
+            break;
+        memcpy(swap, e0, sizeof(swap));
+        memcpy(e0, e1, sizeof(swap));
+        memcpy(e1, swap, sizeof(swap));
+        swap_p = p0;
+        p0 = p1;
+        p1 = swap_p;
+    }
+    memset(block, 0, 16);
+    put_bits(block, &position, 1u << 6, 7);
+    for (int c = 0; c < 4; c++){
+        put_bits(block, &position, e0[c], 7);
+        put_bits(block, &position, e1[c], 7);
+    }
+    put_bits(block, &position, p0, 1);
+    put_bits(block, &position, p1, 1);
+    put_bits(block, &position, indices[0], 3);
+    for (int i = 1; i < 16; i++){
+        put_bits(block, &position, indices[i], 4);
+    }
+}
+
+
+static void fetch_block(Image * image, int block_x, int block_y,
+                        int pixels[16][4])
+{
+    /* Blocks hanging off the edge of small levels repeat the edge texels. */
+    int x, y;
+    unsigned char * texel;
+
+    for (int j = 0; j < 4; j++){
+        for (int i = 0; i < 4; i++){
+            x = block_x * 4 + i;
+            y = block_y * 4 + j;
+            x = x < image->width ? x : image->width - 1;
+            y = y < image->height ? y : image->height - 1;
+            texel = image->rgba + 4 * (y * image->width + x);
+            for (int c = 0; c < 4; c++){
+                pixels[j * 4 + i][c] = texel[c];
+            }
+        }
+    }
+}
+
+
+static size_t encode_level(Image * image, block_format_t format,
+                           unsigned char * out)
+{
+    int blocks_x = (image->width + 3) / 4;
+    int blocks_y = (image->height + 3) / 4;
+    int pixels[16][4];
+    unsigned char * block = out;
+
+    for (int by = 0; by < blocks_y; by++){
+        for (int bx = 0; bx < blocks_x; bx++){
+            fetch_block(image, bx, by, pixels);
+            switch(format){
+                case FORMAT_BC1:
+                    encode_bc1(pixels, block);
+                    block += 8;
+                    break;
+                case FORMAT_BC3:
+                    encode_bc4(pixels, 3, block);
+                    encode_bc1(pixels, block + 8);
+                    block += 16;
+                    break;
+                case FORMAT_BC5:
+                    encode_bc4(pixels, 0, block);
+                    encode_bc4(pixels, 1, block + 8);
+                    block += 16;
+                    break;
+                case FORMAT_BC7:
+                    encode_bc7(pixels, block);
+                    block += 16;
+                    break;
+            }
+        }
+    }
+    return block - out;
+}
+
+
+static dxgi_format_t dxgi_format(block_format_t format, int srgb)
+{
+    switch(format){
+        case FORMAT_BC1:
+            return srgb ? DXGI_BC1_UNORM_SRGB : DXGI_BC1_UNORM;
+        case FORMAT_BC3:
+            return srgb ? DXGI_BC3_UNORM_SRGB : DXGI_BC3_UNORM;
+        case FORMAT_BC5:
+            return DXGI_BC5_UNORM;
+        case FORMAT_BC7:
+        default:
+            return srgb ? DXGI_BC7_UNORM_SRGB : DXGI_BC7_UNORM;
+    }
+}
+
+
+static int write_dds(const char * file_name, Image * image,
+                     block_format_t format, int srgb)
+{
+    int status = SUCCESS;
+    unsigned int block_size = format == FORMAT_BC1 ? 8 : 16;
+    unsigned int num_levels;
+    uint32_t magic = DDS_MAGIC;
+    Dds_Header header;
+    Dds_Header_DX10 header_dx10;
+    Mip_Chain chain;
+    mip_content_t content;
+    Image level;
+    unsigned char * blocks;
+    size_t size;
+    FILE * fp;
+
+    /* Same filtering as the runtime path in model.c for the matching
+     * texture type, so a compressed asset and its source look alike at
+     * distance.
+     */
+    if (format == FORMAT_BC5){
+        content = MIP_CONTENT_NORMAL;
+    } else{
+        content = srgb ? MIP_CONTENT_SRGB : MIP_CONTENT_LINEAR;
+    }
+    if (mip_chain_build(&chain, image->rgba, image->width, image->height, 4,
+                        content, MIP_FILTER_KAISER))
+    {
+        return FAILURE;
+    }
+    num_levels = chain.num_levels;
+    memset(&header, 0, sizeof(header));
+    header.size = sizeof(Dds_Header);
+    header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT \
+                   | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+    header.width = image->width;
+    header.height = image->height;
+    header.pitch_or_linear_size = compressed_level_size(block_size,
+                                                        image->width,
+                                                        image->height);
+    header.mip_map_count = num_levels;
+    header.pixel_format.size = sizeof(struct Dds_Pixel_Format);
+    header.pixel_format.flags = DDPF_FOURCC;
+    header.pixel_format.four_cc = DDS_FOURCC('D', 'X', '1', '0');
+    header.caps = DDSCAPS_TEXTURE | DDSCAPS_MIPMAP | DDSCAPS_COMPLEX;
+    memset(&header_dx10, 0, sizeof(header_dx10));
+    header_dx10.dxgi_format = dxgi_format(format, srgb);
+    header_dx10.resource_dimension = DDS_DIMENSION_TEXTURE2D;
+    header_dx10.array_size = 1;
+
+    blocks = malloc(header.pitch_or_linear_size);
+    if (!blocks){
+        err_print("Out of memory");
+        mip_chain_free(&chain);
+        return FAILURE;
+    }
+    fp = fopen(file_name, "wb");
+    if (!fp){
+        fprintf(stderr, "%s %d: Could not open %s\n", __FILE__, __LINE__,
+                file_name);
+        free(blocks);
+        mip_chain_free(&chain);
+        return FAILURE;
+    }
+    fwrite(&magic, sizeof(magic), 1, fp);
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(&header_dx10, sizeof(header_dx10), 1, fp);
+    for (unsigned int i = 0; i < num_levels; i++){
+        level.width = chain.levels[i].width;
+        level.height = chain.levels[i].height;
+        level.rgba = chain.levels[i].data;
+        size = encode_level(&level, format, blocks);
+        if (fwrite(blocks, size, 1, fp) != 1){
+            err_print("Write failure");
+            status = FAILURE;
+            break;
+        }
+    }
+    mip_chain_free(&chain);
+    fclose(fp);
+    free(blocks);
+    return status;
+}
+
+
+static void default_output_name(const char * input, char * out, int max)
+{
+    const char * dot = strrchr(input, '.');
+    int stem_length = dot ? dot - input : (int)strlen(input);
+    snprintf(out, max, "%.*s.dds", stem_length, input);
+}
+
+
+static void usage(const char * program)
+{
+    fprintf(stderr, "Usage: %s [-f bc1|bc3|bc5|bc7] [-l] input [output]\n",
+            program);
+}
+
+
+int main(int argc, char ** argv)
+{
+    int status = SUCCESS;
+    block_format_t format = FORMAT_BC7;
+    int format_given = 0;
+    int srgb = 1;
+    const char * input = NULL;
+    const char * output = NULL;
+    const int max_file_name = 256;
+    char output_name[max_file_name];
+    int channels;
+    Image image;
+
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "-l") == 0){
+            srgb = 0;
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc){
+            i++;
+            format_given = 1;
+            if (strcmp(argv[i], "bc1") == 0){
+                format = FORMAT_BC1;
+            } else if (strcmp(argv[i], "bc3") == 0){
+                format = FORMAT_BC3;
+            } else if (strcmp(argv[i], "bc5") == 0){
+                format = FORMAT_BC5;
+            } else if (strcmp(argv[i], "bc7") == 0){
+                format = FORMAT_BC7;
+            } else{
+                usage(argv[0]);
+                return FAILURE;
+            }
+        } else if (!input){
+            input = argv[i];
+        } else if (!output){
+            output = argv[i];
+        } else{
+            usage(argv[0]);
+            return FAILURE;
+        }
+    }
+    if (!input){
+        usage(argv[0]);
+        return FAILURE;
+    }
+    if (!format_given && strstr(input, "normal")){
+        format = FORMAT_BC5;
+    }
+    if (format == FORMAT_BC5){
+        srgb = 0;
+    }
+    if (!output){
+        default_output_name(input, output_name, max_file_name);
+        output = output_name;
+    }
+
+    image.rgba = stbi_load(input, &image.width, &image.height, &channels, 4);
+    if (!image.rgba){
+        fprintf(stderr, "%s %d: Failed to load %s: %s\n", __FILE__, __LINE__,
+                input, stbi_failure_reason());
+        return FAILURE;
+    }
+    status = write_dds(output, &image, format, srgb);
+    if (!status){
+        printf("Wrote %s (%dx%d)\n", output, image.width, image.height);
+    }
+    stbi_image_free(image.rgba);
+    return status;
+}
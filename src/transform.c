@@ -0,0 +1,360 @@
+#include <transform.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define TRANSFORM_X86
+#endif
+
+
+/* Caps the jobs one update is split into, so their arguments fit on the
+ * stack. Large sets get proportionally larger jobs.
+ */
+#define TRANSFORM_MAX_JOBS 64
+#define TRANSFORM_COMPONENTS 10
+
+static int use_avx2 = 0;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+
+
+static void detect_cpu(void)
+{
+    #ifdef TRANSFORM_X86
+    __builtin_cpu_init();
+    use_avx2 = __builtin_cpu_supports("avx2");
+    #endif
+}
+
+
+static void components(Transform_Set * set,
+                       float ** arrays[TRANSFORM_COMPONENTS])
+{
+    for (int i = 0; i < 3; i++){
+        arrays[i] = set->position + i;
+        arrays[3 + i] = set->scale + i;
+    }
+    for (int i = 0; i < 4; i++){
+        arrays[6 + i] = set->rotation + i;
+    }
+}
+
+
+static transform_error_t reserve(Transform_Set * set, unsigned int capacity)
+{
+    /* Arrays already grown stay grown if a later one fails, which is
+     * harmless while capacity still holds the old figure.
+     */
+    float ** arrays[TRANSFORM_COMPONENTS];
+    float * grown;
+
+    components(set, arrays);
+    for (int i = 0; i < TRANSFORM_COMPONENTS; i++){
+        grown = realloc(*arrays[i], capacity * sizeof(float));
+        if (!grown){
+            err_print("Out of memory");
+            return TRANSFORM_NO_MEM;
+        }
+        *arrays[i] = grown;
+    }
+    set->capacity = capacity;
+    memstat_set(&set->memory, MEMSTAT_CPU, MEMSTAT_OTHER,
+                (long long)TRANSFORM_COMPONENTS * capacity * sizeof(float));
+    return TRANSFORM_SUCCESS;
+}
+
+
+transform_error_t transform_set_init(Transform_Set * set,
+                                     unsigned int capacity)
+{
+    memset(set, 0, sizeof(Transform_Set));
+    pthread_once(&cpu_once, detect_cpu);
+    memstat_register(&set->memory, "transforms");
+    if (reserve(set, capacity ? capacity : 1)){
+        transform_set_free(set);
+        return TRANSFORM_NO_MEM;
+    }
+    return TRANSFORM_SUCCESS;
+}
+
+
+void transform_set_free(Transform_Set * set)
+{
+    float ** arrays[TRANSFORM_COMPONENTS];
+
+    components(set, arrays);
+    for (int i = 0; i < TRANSFORM_COMPONENTS; i++){
+        free(*arrays[i]);
+        *arrays[i] = NULL;
+    }
+    set->count = set->capacity = 0;
+    memstat_unregister(&set->memory);
+}
+
+
+int transform_set_add(Transform_Set * set, const vec3 position,
+                      const quat rotation, const vec3 scale)
+{
+    if (set->count == set->capacity && reserve(set, 2 * set->capacity)){
+        return -1;
+    }
+    transform_set_position(set, set->count, position);
+    transform_set_rotation(set, set->count, rotation);
+    transform_set_scale(set, set->count, scale);
+    return set->count++;
+}
+
+
+void transform_set_position(Transform_Set * set, unsigned int index,
+                            const vec3 position)
+{
+    for (int i = 0; i < 3; i++){
+        set->position[i][index] = position[i];
+    }
+}
+
+
+void transform_set_rotation(Transform_Set * set, unsigned int index,
+                            const quat rotation)
+{
+    for (int i = 0; i < 4; i++){
+        set->rotation[i][index] = rotation[i];
+    }
+}
+
+
+void transform_set_axis_angle(Transform_Set * set, unsigned int index,
+                              const vec3 axis, float angle)
+{
+    float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + \
+                         axis[2] * axis[2]);
+    float s = length > 0.f ? sinf(angle * .5f) / length : 0.f;
+    quat rotation = {axis[0] * s, axis[1] * s, axis[2] * s,
+                     cosf(angle * .5f)};
+
+    transform_set_rotation(set, index, rotation);
+}
+
+
+void transform_set_scale(Transform_Set * set, unsigned int index,
+                         const vec3 scale)
+{
+    for (int i = 0; i < 3; i++){
+        set->scale[i][index] = scale[i];
+    }
+}
+
+
+static void compute_scalar(const Transform_Set * set,
+                           Transform_Instance * out, unsigned int index)
+{
+    /* The normal matrix of R * S is R * S^-1, as R is orthonormal, so
+     * both are R's columns scaled.
+     */
+    float x = set->rotation[0][index], y = set->rotation[1][index];
+    float z = set->rotation[2][index], w = set->rotation[3][index];
+    float r[3][3] = {
+        {1.f - 2.f * (y * y + z * z), 2.f * (x * y + w * z),
+         2.f * (x * z - w * y)},
+        {2.f * (x * y - w * z), 1.f - 2.f * (x * x + z * z),
+         2.f * (y * z + w * x)},
+        {2.f * (x * z + w * y), 2.f * (y * z - w * x),
+         1.f - 2.f * (x * x + y * y)},
+    };
+    float s;
+
+    for (int i = 0; i < 3; i++){
+        s = set->scale[i][index];
+        for (int j = 0; j < 3; j++){
+            out->model[i][j] = r[i][j] * s;
+            out->normal_matrix[i][j] = r[i][j] / s;
+        }
+        out->model[i][3] = out->normal_matrix[i][3] = 0.f;
+        out->model[3][i] = set->position[i][index];
+        out->normal_matrix[3][i] = 0.f;
+    }
+    out->model[3][3] = out->normal_matrix[3][3] = 1.f;
+}
+
+
+#ifdef TRANSFORM_X86
+__attribute__((target("avx2")))
+static void transpose_store(__m256 r[8], Transform_Instance * out,
+                            size_t offset)
+{
+    /* r[i] holds float offset + i of eight instances. Each comes out as
+     * eight consecutive floats of one instance.
+     */
+    __m256 t[8], u[8];
+
+    for (int i = 0; i < 8; i += 2){
+        t[i] = _mm256_unpacklo_ps(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_ps(r[i], r[i + 1]);
+    }
+    for (int i = 0; i < 8; i += 4){
+        u[i] = _mm256_shuffle_ps(t[i], t[i + 2], 0x44);
+        u[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], 0xee);
+        u[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0x44);
+        u[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0xee);
+    }
+    for (int i = 0; i < 4; i++){
+        _mm256_storeu_ps((float *)(out + i) + offset,
+                         _mm256_permute2f128_ps(u[i], u[i + 4], 0x20));
+        _mm256_storeu_ps((float *)(out + i + 4) + offset,
+                         _mm256_permute2f128_ps(u[i], u[i + 4], 0x31));
+    }
+}
+
+
+__attribute__((target("avx2")))
+static void compute_avx2(const Transform_Set * set, Transform_Instance * out,
+                         unsigned int index)
+{
+    /* Eight objects, each matrix element in its own register, turned
+     * into instances eight floats at a time.
+     */
+    __m256 x = _mm256_loadu_ps(set->rotation[0] + index);
+    __m256 y = _mm256_loadu_ps(set->rotation[1] + index);
+    __m256 z = _mm256_loadu_ps(set->rotation[2] + index);
+    __m256 w = _mm256_loadu_ps(set->rotation[3] + index);
+    __m256 one = _mm256_set1_ps(1.f), two = _mm256_set1_ps(2.f);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y);
+    __m256 zz = _mm256_mul_ps(z, z), xy = _mm256_mul_ps(x, y);
+    __m256 xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+    __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y);
+    __m256 wz = _mm256_mul_ps(w, z);
+    __m256 r[3][3], s, inverse, model[16], normal[16];
+
+    r[0][0] = _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz)));
+    r[0][1] = _mm256_mul_ps(two, _mm256_add_ps(xy, wz));
+    r[0][2] = _mm256_mul_ps(two, _mm256_sub_ps(xz, wy));
+    r[1][0] = _mm256_mul_ps(two, _mm256_sub_ps(xy, wz));
+    r[1][1] = _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz)));
+    r[1][2] = _mm256_mul_ps(two, _mm256_add_ps(yz, wx));
+    r[2][0] = _mm256_mul_ps(two, _mm256_add_ps(xz, wy));
+    r[2][1] = _mm256_mul_ps(two, _mm256_sub_ps(yz, wx));
+    r[2][2] = _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy)));
+    for (int i = 0; i < 3; i++){
+        s = _mm256_loadu_ps(set->scale[i] + index);
+        inverse = _mm256_div_ps(one, s);
+        for (int j = 0; j < 3; j++){
+            model[4 * i + j] = _mm256_mul_ps(r[i][j], s);
+            normal[4 * i + j] = _mm256_mul_ps(r[i][j], inverse);
+        }
+        model[4 * i + 3] = normal[4 * i + 3] = zero;
+        model[12 + i] = _mm256_loadu_ps(set->position[i] + index);
+        normal[12 + i] = zero;
+    }
+    model[15] = normal[15] = one;
+    transpose_store(model, out, 0);
+    transpose_store(model + 8, out, 8);
+    transpose_store(normal, out, 16);
+    transpose_store(normal + 8, out, 24);
+}
+#endif
+
+
+void transform_set_compute(const Transform_Set * set,
+                           Transform_Instance * out, unsigned int first,
+                           unsigned int count)
+{
+    unsigned int i = 0;
+
+    #ifdef TRANSFORM_X86
+    if (use_avx2){
+        for (; i + 8 <= count; i += 8){
+            compute_avx2(set, out + i, first + i);
+        }
+    }
+    #endif
+    for (; i < count; i++){
+        compute_scalar(set, out + i, first + i);
+    }
+}
+
+
+struct Transform_Job {
+    const Transform_Set * set;
+    Transform_Instance *  out;
+    unsigned int          first;
+    unsigned int          count;
+};
+typedef struct Transform_Job Transform_Job;
+
+
+static void compute_job(void * arg)
+{
+    Transform_Job * job = arg;
+
+    transform_set_compute(job->set, job->out + job->first, job->first,
+                          job->count);
+}
+
+
+void transform_set_update(const Transform_Set * set,
+                          Transform_Instance * out, Job_Pool * pool)
+{
+    Transform_Job jobs[TRANSFORM_MAX_JOBS];
+    Job_Group group;
+    unsigned int size = TRANSFORM_JOB_SIZE, num_jobs = 0;
+
+    if (set->count > size * TRANSFORM_MAX_JOBS){
+        size = (set->count + TRANSFORM_MAX_JOBS - 1) / TRANSFORM_MAX_JOBS;
+        size = (size + 7) & ~7u;
+    }
+    job_group_init(&group);
+    for (unsigned int first = 0; first < set->count; first += size){
+        jobs[num_jobs].set = set;
+        jobs[num_jobs].out = out;
+        jobs[num_jobs].first = first;
+        jobs[num_jobs].count = set->count - first < size ? \
+                               set->count - first : size;
+        if (job_pool_submit(pool, &group, compute_job, jobs + num_jobs)){
+            compute_job(jobs + num_jobs);
+        }
+        num_jobs++;
+    }
+    job_group_wait(pool, &group);
+}
+
+
+transform_error_t transform_set_upload(const Transform_Set * set,
+                                       GLuint buffer, Job_Pool * pool)
+{
+    /* Invalidating lets the driver hand back fresh memory rather than
+     * wait for draws still reading last frame's instances.
+     */
+    Transform_Instance * instances;
+
+    if (!set->count)
+        return TRANSFORM_SUCCESS;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    instances = glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                                 set->count * sizeof(Transform_Instance),
+                                 GL_MAP_WRITE_BIT | \
+                                 GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!instances){
+        err_print("Could not map instance buffer");
+        return TRANSFORM_GL_ERR;
+    }
+    transform_set_update(set, instances, pool);
+    if (!glUnmapBuffer(GL_ARRAY_BUFFER)){
+        err_print("Instance buffer lost while mapped");
+        return TRANSFORM_GL_ERR;
+    }
+    return TRANSFORM_SUCCESS;
+}
+
+
+void transform_instance_attributes(GLuint buffer, GLuint location)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (GLuint i = 0; i < 8; i++){
+        glVertexAttribPointer(location + i, 4, GL_FLOAT, GL_FALSE,
+                              sizeof(Transform_Instance),
+                              (void *)(i * sizeof(vec4)));
+        glEnableVertexAttribArray(location + i);
+        glVertexAttribDivisor(location + i, 1);
+    }
+}